@@ -22,17 +22,25 @@ endif()
 
 
 
+# The built-in page's script and style sheet, for custom pages that only change the HTML
+set(netlogging_www_dir ${this_cmp_root_dir}/src/builtin_sse_server/www)
+
+# Build the asset table of the built-in HTTP SSE server from the given files and add it to target.
+# Each file is served at /<file name>, index.html also at /.
 function(target_add_netlogging_asset target asset_src)
-    get_filename_component(asset_src "${asset_src}" ABSOLUTE)
-    set (asset_dst_dir "${CMAKE_BINARY_DIR}/www")
-    set (asset_dst "${asset_dst_dir}/index.html.gz")
+    set(asset_srcs)
+    foreach(src ${asset_src} ${ARGN})
+        get_filename_component(src "${src}" ABSOLUTE)
+        list(APPEND asset_srcs "${src}")
+    endforeach()
+    set (asset_dst "${CMAKE_BINARY_DIR}/www/netlogging_assets.c")
     add_custom_command(
         WORKING_DIRECTORY ${PROJECT_SOURCE_DIR}
         OUTPUT ${asset_dst}
         COMMAND ${CMAKE_COMMAND} -E echo "Compressing static assets for built-in HTTP SSE Logging Server..."
-        COMMAND ${python} ${this_cmp_root_dir}/tools/compress_assets.py --outdir=${asset_dst_dir} ${asset_src}
-        DEPENDS ${asset_src}
+        COMMAND ${python} ${this_cmp_root_dir}/tools/compress_assets.py --table=${asset_dst} ${asset_srcs}
+        DEPENDS ${asset_srcs} ${this_cmp_root_dir}/tools/compress_assets.py
     )
     add_custom_target(builtin_sse_assets DEPENDS "${asset_dst}")
-    target_add_binary_data(${target} "${asset_dst}" BINARY)
+    target_sources(${target} PRIVATE "${asset_dst}")
 endfunction()
@@ -1,27 +1,45 @@
 #!/usr/bin/env python3
 # -*- coding: utf-8 -*-
 
-# curl -X POST -H "Content-Type: application/json" -d '{"Name":"hogehoge1973", "Age":"100"}' http://192.168.10.46:8000/post
+# curl -X POST -H "Content-Type: application/x-ndjson" --data-binary $'{"seq":0,"level":3,"ts":10,"task":"main","tag":"main","msg":"hello"}\n' http://192.168.10.46:8000/post
 
 # https://qiita.com/tkj/items/210a66213667bc038110
 
-from http.server import HTTPServer
+from http.server import ThreadingHTTPServer
 from http.server import BaseHTTPRequestHandler
-from urllib.parse import urlparse
-from urllib.parse import parse_qs
 import argparse
+import gzip
+import json
+
+LEVEL_LETTERS = " EWIDV"
 
 class class1(BaseHTTPRequestHandler):
+	# HTTP/1.1 keeps the connection open, so the ESP32 doesn't have to reconnect for every batch
+	protocol_version = "HTTP/1.1"
+
 	def do_POST(self):
-		#parsed = urlparse(self.path)
-		#print("parsed={}".format(parsed))
-		#params = parse_qs(parsed.query)
-		#print("params={}".format(params))
 		content_len  = int(self.headers.get("content-length"))
-		#print("content_len={}".format(content_len))
-		req_body = self.rfile.read(content_len).decode("utf-8")
-		#print("req_body={}".format(req_body))
-		print("{}".format(req_body))
+		req_body = self.rfile.read(content_len)
+		if self.headers.get("content-encoding") == "gzip":
+			req_body = gzip.decompress(req_body)
+		req_body = req_body.decode("utf-8", errors="replace")
+		# NDJSON: one {"seq":..,"level":..,"ts":..,"task":..,"tag":..,"msg":".."} object per line
+		for line in req_body.splitlines():
+			if not line:
+				continue
+			try:
+				record = json.loads(line)
+			except ValueError:
+				print(line) # not from net_logging, print as is
+				continue
+			if record.get("dropped"):
+				print("--- {} lines dropped ---".format(record["dropped"]))
+			level = record.get("level", 0)
+			if level:
+				tag = record.get("tag")
+				print("{} ({}) {}{}".format(LEVEL_LETTERS[level], record.get("ts", ""), tag + ": " if tag else "", record.get("msg", "")))
+			else:
+				print(record.get("msg", ""))
 
 		body = "OK"
 		self.send_response(200)
@@ -30,6 +48,9 @@ class class1(BaseHTTPRequestHandler):
 		self.end_headers()
 		self.wfile.write(body.encode())
 
+	def log_message(self, format, *args):
+		pass # don't mix the access log into the device log
+
 if __name__=='__main__':
 	parser = argparse.ArgumentParser()
 	parser.add_argument('--port', type=int, help='tcp port', default=8000)
@@ -43,6 +64,6 @@ if __name__=='__main__':
 	print("| ESP32 HTTP Logging Server |")
 	print("+===========================+")
 	print("")
-	server = HTTPServer((ip, args.port), class1)
+	server = ThreadingHTTPServer((ip, args.port), class1)
 
 	server.serve_forever()
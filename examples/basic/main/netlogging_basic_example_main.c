@@ -71,15 +71,35 @@ void app_main()
 #endif // CONFIG_EXAMPLE_USE_NETLOGGING_UDP
 
 #if CONFIG_EXAMPLE_USE_NETLOGGING_TCP
-    tcp_logging_param_t tcp_logging_params = {};
+    tcp_logging_param_t tcp_logging_params = NETLOGGING_TCP_DEFAULT_CONFIG();
     tcp_logging_params.ipv4addr = CONFIG_EXAMPLE_NETLOGGING_TCP_IP;
     tcp_logging_params.port = CONFIG_EXAMPLE_NETLOGGING_TCP_PORT;
     ESP_ERROR_CHECK(netlogging_tcp_client_init(&tcp_logging_params));
     ESP_ERROR_CHECK(netlogging_tcp_client_run());
 #endif // CONFIG_EXAMPLE_USE_NETLOGGING_TCP
 
+#if CONFIG_EXAMPLE_USE_NETLOGGING_MQTT
+    mqtt_logging_param_t mqtt_logging_params = NETLOGGING_MQTT_DEFAULT_CONFIG();
+    mqtt_logging_params.url = CONFIG_EXAMPLE_NETLOGGING_MQTT_URL;
+    mqtt_logging_params.topic = CONFIG_EXAMPLE_NETLOGGING_MQTT_TOPIC;
+    ESP_ERROR_CHECK(netlogging_mqtt_client_init(&mqtt_logging_params));
+    ESP_ERROR_CHECK(netlogging_mqtt_client_run());
+#endif // CONFIG_EXAMPLE_USE_NETLOGGING_MQTT
+
+#if CONFIG_EXAMPLE_USE_NETLOGGING_SYSLOG
+    syslog_logging_param_t syslog_logging_params = NETLOGGING_SYSLOG_DEFAULT_CONFIG();
+    syslog_logging_params.host = CONFIG_EXAMPLE_NETLOGGING_SYSLOG_HOST;
+    syslog_logging_params.port = CONFIG_EXAMPLE_NETLOGGING_SYSLOG_PORT;
+#if CONFIG_EXAMPLE_NETLOGGING_SYSLOG_TCP
+    syslog_logging_params.transport = NETLOGGING_SYSLOG_TCP;
+#endif
+    syslog_logging_params.app_name = "basic_example";
+    ESP_ERROR_CHECK(netlogging_syslog_client_init(&syslog_logging_params));
+    ESP_ERROR_CHECK(netlogging_syslog_client_run());
+#endif // CONFIG_EXAMPLE_USE_NETLOGGING_SYSLOG
+
 #if CONFIG_EXAMPLE_USE_NETLOGGING_HTTP_CLIENT
-    http_logging_param_t http_logging_params = {};
+    http_logging_param_t http_logging_params = NETLOGGING_HTTP_DEFAULT_CONFIG();
     http_logging_params.url = CONFIG_EXAMPLE_NETLOGGING_HTTP_CLIENT_CONNECT_URL;
     ESP_ERROR_CHECK(netlogging_http_client_init(&http_logging_params));
     ESP_ERROR_CHECK(netlogging_http_client_run());
@@ -118,6 +138,16 @@ void app_main()
     ESP_ERROR_CHECK(netlogging_tcp_client_deinit());
 #endif // CONFIG_EXAMPLE_USE_NETLOGGING_TCP
 
+#if CONFIG_EXAMPLE_USE_NETLOGGING_MQTT
+    ESP_ERROR_CHECK(netlogging_mqtt_client_stop());
+    ESP_ERROR_CHECK(netlogging_mqtt_client_deinit());
+#endif // CONFIG_EXAMPLE_USE_NETLOGGING_MQTT
+
+#if CONFIG_EXAMPLE_USE_NETLOGGING_SYSLOG
+    ESP_ERROR_CHECK(netlogging_syslog_client_stop());
+    ESP_ERROR_CHECK(netlogging_syslog_client_deinit());
+#endif // CONFIG_EXAMPLE_USE_NETLOGGING_SYSLOG
+
 #if CONFIG_EXAMPLE_USE_NETLOGGING_HTTP_CLIENT
     ESP_ERROR_CHECK(netlogging_http_client_stop());
     ESP_ERROR_CHECK(netlogging_http_client_deinit());
@@ -4,21 +4,43 @@
 # Multicast Log Reciever
 # This program receives UDP multicast packets and logs them to a file.
 # Author: Paul Abbott
+#
+# Datagrams of a sender in reliable mode (resend_count > 0) are put back in order, duplicates are dropped,
+# and missing ones are asked for again with NACKs. See multicast_log_sender.c for the packet format.
+# --loss emulates a lossy link by dropping received datagrams and sent NACKs, in bursts of --burst on average.
+# Ctrl+C prints how many datagrams were dropped, recovered and lost.
 
 import socket
+import select
 import platform
 import struct
 import argparse
+import random
 import re
+import time
 import logging
 import logging.handlers
 
-ANY = "0.0.0.0" 
+ANY = "0.0.0.0"
 
 DEF_ADDR = "239.2.1.2"
 DEF_PORT = 2054
 DEF_IFACE = ANY
 
+MAGIC = b"\0NL"
+PKT_DATA = 1
+PKT_HEARTBEAT = 2
+PKT_NACK = 3
+PKT_GONE = 4
+HEADER = struct.Struct(">3sBII")
+NACK_MAX_RANGES = 16
+
+REORDER_WAIT = 0.02 # a gap may only be reordering, wait this long before the first NACK
+NACK_INTERVAL = 0.2 # wait this long for the resent datagram before asking again
+NACK_TRIES = 5      # then give the datagram up
+MAX_GAP = 4096      # a larger jump in seq starts over instead of asking for everything in between
+STARTUP_WINDOW = 16 # a new sender with a lower seq has just started
+
 def escape_ansi(line):
     ansi_escape = re.compile(r'(?:\x1B[@-_]|[\x80-\x9F])[0-?]*[ -/]*[@-~]')
     return ansi_escape.sub('', line)
@@ -33,7 +55,129 @@ def log_setup():
     log_handler.doRollover()
     logger.info("Logging started")
 
-def run_multicast(port, addr, iface):
+def seq_diff(a, b):
+	"""a - b for 32-bit sequence numbers that wrap, negative if a is before b"""
+	d = (a - b) & 0xFFFFFFFF
+	return d - 0x100000000 if d >= 0x80000000 else d
+
+def seq_add(a, n):
+	return (a + n) & 0xFFFFFFFF
+
+class Stats:
+	def __init__(self):
+		self.received = 0    # datagrams
+		self.emulated = 0    # dropped by --loss
+		self.duplicates = 0
+		self.recovered = 0   # arrived after a NACK
+		self.lost = 0        # given up, or gone from the sender's resend ring
+		self.nacks = 0
+
+	def report(self):
+		total = self.received - self.duplicates + self.lost
+		print("")
+		print("datagrams: {} received, {} duplicates, {} dropped by --loss".format(self.received, self.duplicates, self.emulated))
+		print("reliable mode: {} NACKs sent, {} datagrams recovered, {} lost ({:.2f}%)".format(
+			self.nacks, self.recovered, self.lost, 100.0 * self.lost / total if total else 0.0))
+
+class LossEmulator:
+	"""Gilbert-Elliott model: all packets are lost while in the bad state"""
+	def __init__(self, loss, burst):
+		self.loss = loss
+		self.leave_bad = 1.0 / max(burst, 1.0)
+		self.enter_bad = loss * self.leave_bad / (1.0 - loss) if loss < 1.0 else 1.0
+		self.bad = False
+
+	def drop(self):
+		if self.loss <= 0:
+			return False
+		self.bad = (random.random() >= self.leave_bad) if self.bad else (random.random() < self.enter_bad)
+		return self.bad
+
+class Stream:
+	"""Datagrams of one session of one sender"""
+	def __init__(self, session, next_seq):
+		self.session = session
+		self.next = next_seq   # next seq to deliver
+		self.high = seq_add(next_seq, -1) # highest seq known to be sent
+		self.pending = {}      # seq: lines, received ahead of self.next
+		self.missing = {}      # seq: [time of next NACK, NACKs sent]
+
+	def _note_sent(self, seq, now):
+		"""The sender has sent everything up to seq"""
+		if seq_diff(seq, self.high) <= 0:
+			return
+		s = seq_add(self.high, 1)
+		while seq_diff(s, seq) <= 0:
+			self.missing[s] = [now + REORDER_WAIT, 0]
+			s = seq_add(s, 1)
+		self.high = seq
+
+	def data(self, seq, lines, now, stats):
+		if seq_diff(seq, self.next) < 0 or seq in self.pending:
+			stats.duplicates += 1
+			return
+		if seq in self.missing:
+			if self.missing.pop(seq)[1] > 0:
+				stats.recovered += 1
+		self._note_sent(seq_add(seq, -1), now)
+		if seq_diff(seq, self.high) > 0:
+			self.high = seq
+		self.pending[seq] = lines
+
+	def gone(self, oldest, stats):
+		for seq in list(self.missing):
+			if seq_diff(seq, oldest) < 0:
+				self.give_up(seq, stats)
+
+	def give_up(self, seq, stats):
+		del self.missing[seq]
+		self.pending[seq] = None
+		stats.lost += 1
+
+	def due_nacks(self, now, nack, stats):
+		"""Missing seqs to ask for now, give up the ones asked for too often"""
+		due = []
+		for seq, state in sorted(self.missing.items(), key=lambda item: seq_diff(item[0], self.next)):
+			if state[0] > now:
+				continue
+			if not nack or state[1] >= NACK_TRIES:
+				self.give_up(seq, stats)
+				continue
+			state[0] = now + NACK_INTERVAL
+			state[1] += 1
+			due.append(seq)
+		return due
+
+	def deliver(self):
+		"""Datagrams that are now in order. None stands for a lost one."""
+		while self.next in self.pending:
+			yield self.pending.pop(self.next)
+			self.next = seq_add(self.next, 1)
+
+def nack_packets(session, seqs):
+	"""NACKs for the sorted seqs, as ranges"""
+	ranges = []
+	for seq in seqs:
+		if ranges and seq_add(ranges[-1][0], ranges[-1][1]) == seq and ranges[-1][1] < 0xFFFF:
+			ranges[-1][1] += 1
+		else:
+			ranges.append([seq, 1])
+	for i in range(0, len(ranges), NACK_MAX_RANGES):
+		packet = HEADER.pack(MAGIC, PKT_NACK, session, 0)
+		for first, count in ranges[i:i + NACK_MAX_RANGES]:
+			packet += struct.pack(">IH", first, count)
+		yield packet
+
+def print_lines(addr, data):
+	if (type(data) is bytes):
+		data = data.decode('utf-8', errors='replace')
+	# A datagram may hold several lines
+	for line in data.splitlines():
+		print("From:", addr, line)
+		line = escape_ansi(line) # remove ANSI color codes for the txt file
+		logging.info(line)
+
+def run_multicast(port, addr, iface, nack, emulator):
 
 	# Create a UDP socket
 	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
@@ -44,14 +188,14 @@ def run_multicast(port, addr, iface):
 	except AttributeError:
 		pass
 
-	sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 32) 
+	sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 32)
 	sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
 
 	# Bind to the port that we know will receive multicast data
  	# linux binds to multicast address, windows to interface address
 	ip_bind = iface if (platform.system() == "Windows") else addr
 	sock.bind((ip_bind, port))
- 
+
  	# IP_MULTICAST_IF: force sending network traffic over specific network adapter
 	if (iface != ANY):
 		sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(iface))
@@ -60,43 +204,84 @@ def run_multicast(port, addr, iface):
 		'4sl' if (iface == ANY) else '4s4s',
 		socket.inet_aton(addr),
 		socket.INADDR_ANY if (iface == ANY) else socket.inet_aton(iface))
- 
+
 	# Tell the kernel that we want to add ourselves to a multicast group
 	# The address for the multicast group is the third param
 	sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
- 
-	# setblocking(False) is equiv to settimeout(0.0) which means we poll the socket.
-	# But this will raise an error if recv() or send() can't immediately find or send data. 
-	sock.setblocking(False)
+
+	# NACKs are sent from their own socket, as the resent datagrams come back by unicast,
+	# which the socket bound to the multicast address doesn't get on Linux
+	nack_sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+	nack_sock.bind((iface, 0))
 
 	print("+============================+")
 	print("| Multicast Logging Receiver |")
 	print("+============================+")
 	print("")
 
-	while 1:
-		try:
-			data, addr = sock.recvfrom(1024)
-		except socket.error as e:
-			pass
-		else:
-			print("From:", addr, end=' ')
-			if (type(data) is bytes):
-				data = data.decode('utf-8')
-			data = data.rstrip() # remove trailing \r\n
-			print(data)
-			data = escape_ansi(data) # remove ANSI color codes for the txt file
-			logging.info(data)
-			
+	stats = Stats()
+	streams = {} # sender address: Stream
+	try:
+		while 1:
+			# Wake up now and then to send NACKs, instead of polling the sockets
+			ready = select.select([sock, nack_sock], [], [], REORDER_WAIT)[0]
+			data = None
+			if ready:
+				data, addr = ready[0].recvfrom(2048)
+			now = time.monotonic()
+
+			if data is not None and emulator.drop():
+				stats.emulated += 1
+			elif data is not None:
+				stats.received += 1
+				if not data.startswith(MAGIC):
+					print_lines(addr, data) # sender without reliable mode
+				elif len(data) >= HEADER.size:
+					_, kind, session, seq = HEADER.unpack_from(data)
+					stream = streams.get(addr)
+					if stream is None or stream.session != session:
+						# Ask for the first datagrams of a sender that restarted or just started,
+						# but not for the past of one that ran before we did
+						first = seq_add(seq, 1) if kind == PKT_HEARTBEAT else seq
+						if stream or first < STARTUP_WINDOW:
+							first = 0
+						streams[addr] = stream = Stream(session, first)
+					if seq_diff(seq, stream.high) > MAX_GAP:
+						print("From:", addr, "--- lost track, {} datagrams skipped ---".format(seq_diff(seq, stream.high)))
+						streams[addr] = stream = Stream(session, seq)
+					if kind == PKT_DATA:
+						stream.data(seq, data[HEADER.size:], now, stats)
+					elif kind == PKT_HEARTBEAT:
+						stream._note_sent(seq, now)
+					elif kind == PKT_GONE:
+						stream.gone(seq, stats)
+
+			for addr, stream in streams.items():
+				due = stream.due_nacks(now, nack, stats)
+				for packet in nack_packets(stream.session, due):
+					stats.nacks += 1
+					if not emulator.drop():
+						nack_sock.sendto(packet, addr)
+				for lines in stream.deliver():
+					if lines is None:
+						print("From:", addr, "--- datagram lost ---")
+						logging.info("--- datagram lost ---")
+					else:
+						print_lines(addr, lines)
+	except KeyboardInterrupt:
+		stats.report()
 
 if __name__ == "__main__":
 	parser = argparse.ArgumentParser()
 	parser.add_argument('--port', type=int, help='udp multicast port', default=DEF_PORT)
 	parser.add_argument('--addr', type=str, help='udp multicast address', default=DEF_ADDR)
 	parser.add_argument('--iface', type=str, help='host interface to bind to (default bind to all)', default=DEF_IFACE)
+	parser.add_argument('--no-nack', action='store_true', help="don't ask for missing datagrams, only count them")
+	parser.add_argument('--loss', type=float, help='emulated loss rate, e.g. 0.05', default=0.0)
+	parser.add_argument('--burst', type=float, help='average length of an emulated loss burst, in packets', default=3.0)
 	args = parser.parse_args()
 	print("args.port={}".format(args.port))
 	print("args.iface={}".format(args.iface))
 	print("args.addr={}".format(args.addr))
 	log_setup()
-	run_multicast(args.port, args.addr, args.iface)
\ No newline at end of file
+	run_multicast(args.port, args.addr, args.iface, not args.no_nack, LossEmulator(args.loss, args.burst))
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+
+import signal
+import socket
+import select
+import argparse
+
+def handler(signal, frame):
+	global running
+	#print('handler')
+	running = False
+
+def take_messages(data):
+	"""Split octet-counted messages (RFC 6587) off the received data. Returns (messages, rest)."""
+	messages = []
+	while b" " in data[:12]:
+		length, rest = data.split(b" ", 1)
+		if not length.isdigit():
+			raise ValueError("bad frame")
+		length = int(length)
+		if len(rest) < length:
+			break
+		messages.append(rest[:length])
+		data = rest[length:]
+	return messages, data
+
+if __name__ == "__main__":
+	signal.signal(signal.SIGINT, handler)
+	running = True
+
+	parser = argparse.ArgumentParser()
+	parser.add_argument('--port', type=int, help='syslog port', default=514)
+	parser.add_argument('--tcp', action='store_true', help='listen on TCP (octet counting) instead of UDP')
+	args = parser.parse_args()
+	print("args.port={}".format(args.port))
+
+	print("+=============================+")
+	print("| ESP32 Syslog Logging Server |")
+	print("+=============================+")
+	print("")
+
+	if not args.tcp:
+		udp_server = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		udp_server.bind(("0.0.0.0", args.port))
+		udp_server.settimeout(1)
+		while running:
+			try:
+				data = udp_server.recv(4096)
+			except socket.timeout:
+				continue
+			print(data.decode('utf-8', errors='replace'))
+	else:
+		tcp_server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		tcp_server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		tcp_server.bind(("0.0.0.0", args.port))
+		tcp_server.listen(5)
+		tcp_server.setblocking(0)
+
+		# The ESP32 reconnects after network problems. A new connection replaces the old one.
+		client = None
+		pending = b""
+		while running:
+			sockets = [tcp_server] + ([client] if client else [])
+			ready = select.select(sockets, [], [], 1)
+			if tcp_server in ready[0]:
+				if client:
+					client.close()
+				client, address = tcp_server.accept()
+				client.setblocking(0)
+				pending = b"" # an incomplete message of the old connection is sent again on the new one
+			elif client in ready[0]:
+				try:
+					data = client.recv(4096)
+				except OSError:
+					data = b""
+				if not data:
+					client.close()
+					client = None
+					pending = b""
+					continue
+				try:
+					messages, pending = take_messages(pending + data)
+				except ValueError:
+					print("bad frame, closing the connection")
+					client.close()
+					client = None
+					pending = b""
+					continue
+				for message in messages:
+					print(message.decode('utf-8', errors='replace'))
+
+		if client:
+			client.close()
@@ -4,18 +4,38 @@ import signal
 import socket
 import select
 import argparse
+import struct
+import zlib
 
 def handler(signal, frame):
 	global running
 	#print('handler')
 	running = False
 
+def take_frames(data, framing):
+	"""Split complete frames off the received data. Returns (lines, rest)."""
+	lines = []
+	if framing == "length":
+		while len(data) >= 4:
+			length = struct.unpack(">I", data[:4])[0]
+			if len(data) < 4 + length:
+				break
+			lines.append(data[4:4 + length])
+			data = data[4 + length:]
+	else:
+		while b"\n" in data:
+			line, data = data.split(b"\n", 1)
+			lines.append(line + b"\n")
+	return lines, data
+
 if __name__ == "__main__":
 	signal.signal(signal.SIGINT, handler)
 	running = True
 
 	parser = argparse.ArgumentParser()
 	parser.add_argument('--port', type=int, help='tcp port', default=8080)
+	parser.add_argument('--framing', choices=['newline', 'length'], help='framing of the lines, as set in tcp_logging_param_t', default='newline')
+	parser.add_argument('--gzip', action='store_true', help='the stream is gzip compressed (tcp_logging_param_t.gzip)')
 	args = parser.parse_args()
 	print("args.port={}".format(args.port))
 
@@ -32,18 +52,46 @@ if __name__ == "__main__":
 	tcp_server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
 	tcp_server.bind((server_ip, args.port))
 	tcp_server.listen(listen_num)
-	client,address = tcp_server.accept()
-	#print("Connected!! [ Source : {}]".format(address))
-	client.setblocking(0)
+	tcp_server.setblocking(0)
 
+	# The ESP32 reconnects after network problems. A new connection replaces the old one.
+	client = None
+	pending = b""
+	inflate = None
 	while running:
-		ready = select.select([client], [], [], 1)
+		sockets = [tcp_server] + ([client] if client else [])
+		ready = select.select(sockets, [], [], 1)
 		#print("ready={}".format(ready[0]))
-		if ready[0]:
-			data = client.recv(buffer_size)
-			if (type(data) is bytes):
-				data = data.decode('utf-8')
-				#print("[*] Received Data : {}".format(data))
-				print(data, end='')
-	
-	client.close()
+		if tcp_server in ready[0]:
+			if client:
+				client.close()
+			client, address = tcp_server.accept()
+			client.setblocking(0)
+			pending = b"" # an incomplete frame of the old connection is sent again on the new one
+			inflate = zlib.decompressobj(31) if args.gzip else None # each connection is a new gzip stream
+			#print("Connected!! [ Source : {}]".format(address))
+		elif client in ready[0]:
+			try:
+				data = client.recv(buffer_size)
+			except OSError:
+				data = b""
+			if not data:
+				client.close()
+				client = None
+				pending = b""
+				continue
+			if inflate:
+				try:
+					data = inflate.decompress(data)
+				except zlib.error as e:
+					print("bad gzip stream: {}".format(e))
+					client.close()
+					client = None
+					pending = b""
+					continue
+			lines, pending = take_frames(pending + data, args.framing)
+			for line in lines:
+				print(line.decode('utf-8', errors='replace'), end='')
+
+	if client:
+		client.close()
@@ -49,6 +49,8 @@ void app_main()
 #if CONFIG_EXAMPLE_USE_NETLOGGING_SSE_SERVER
 // Setup SSE logging
     sse_logging_param_t sse_logging_params = NETLOGGING_SSE_DEFAULT_CONFIG();
+    sse_logging_params.history_size = 8192; // lines logged before the page was opened
+    //sse_logging_params.control_token = "change-me"; // lets the page change the log levels
     netlogging_sse_server_init(&sse_logging_params);
     netlogging_sse_server_run();
 #endif // CONFIG_EXAMPLE_USE_NETLOGGING_SSE_SERVER
@@ -10,6 +10,7 @@
 import socket
 import argparse
 import re
+import json
 import logging
 import logging.handlers
 import time  # Add this import for retry delays
@@ -23,6 +24,17 @@ def escape_ansi(line):
 	ansi_escape = re.compile(r'(?:\x1B[@-_]|[\x80-\x9F])[0-?]*[ -/]*[@-~]')
 	return ansi_escape.sub('', line)
 
+LEVEL_LETTERS = " EWIDV"
+
+def format_record(record):
+	# A record of a log-records event (path with ?format=json): the device has parsed the line already
+	level = record.get("lvl", 0)
+	if not level:
+		return record["msg"]
+	tag = record.get("tag")
+	prefix = f"{LEVEL_LETTERS[level]} ({record['ts']}) " + (f"{tag}: " if tag else "")
+	return prefix + record["msg"]
+
 def log_setup():
 	logfile_handler = logging.handlers.RotatingFileHandler('my.log', maxBytes=1000000, backupCount=99)
 	logfile_formatter = logging.Formatter('%(asctime)s %(message)s')
@@ -36,53 +48,70 @@ def log_setup():
 	consoleHandler.setFormatter(logfile_formatter)
 	logger.addHandler(consoleHandler)
 
-def run_sse_client(host, port, path):
+def run_sse_client(host, port, path, state):
 	# Create a TCP socket
-	sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	sock = socket.create_connection((host, port), timeout=15)
 
-	# Connect to the server
-	sock.connect((host, port))
-
-	# Send the HTTP GET request
-	request = f"GET {path} HTTP/1.1\r\nHost: {host}:{port}\r\nAccept: text/event-stream\r\n\r\n"
+	# Send the HTTP GET request, with the id of the last event we got, so the server can tell what we missed
+	request = f"GET {path} HTTP/1.1\r\nHost: {host}:{port}\r\nAccept: text/event-stream\r\n"
+	if state['last_id'] is not None:
+		request += f"Last-Event-ID: {state['last_id']}\r\n"
+	request += "\r\n"
 	sock.sendall(request.encode('utf-8'))
 	logging.info("***************  Connected!  ***************")
 
+	# The stream comes in pieces of any size: keep the incomplete line until the rest arrives
+	pending = b''
+	in_headers = True
+	event_type = None
+	event_data = []
 	while True:
-		# Set a timeout for the socket, since server will send keepalive messages every 10 seconds.
-		sock.settimeout(15)
-		recvstr = sock.recv(1024)
+		# The socket times out after 15 s, the server sends keepalive messages every 10 seconds.
+		recvstr = sock.recv(4096)
 		if not recvstr:
-			break # timeout or connection closed
-		recvstr = recvstr.decode('utf-8')
-		event_type = None
-		event_data = None
-		for line in recvstr.splitlines():
-			# Lines starting with a separator are comments and are to be ignored.
-			if not line.strip() or line.startswith(SSE_FIELD_SEPARATOR):
+			break # connection closed
+		lines = (pending + recvstr).split(b'\n')
+		pending = lines.pop()
+		for line in lines:
+			line = line.rstrip(b'\r').decode('utf-8', errors='replace')
+			if in_headers:
+				in_headers = bool(line) # the headers end with a blank line
 				continue
-			parts = line.split(SSE_FIELD_SEPARATOR, 1)
-			field = parts[0].strip()
-			if len(parts) < 2:
+			if not line:
+				# A blank line ends the event
+				if "log-records" == event_type:
+					for data in event_data:
+						for record in json.loads(data):
+							if record.get("dropped"):
+								logging.info(f"W ({record['ts']}) net_logging: {record['dropped']} lines dropped")
+							logging.info(format_record(record))
+				elif (event_type or "message") in ("log-line", "message"):
+					for data in event_data:
+						data = escape_ansi(data).rstrip() # remove ANSI color codes and trailing whitespace
+						if data:
+							logging.info(data)
+				event_type = None
+				event_data = []
 				continue
+			# Lines starting with a separator are comments and are to be ignored.
+			if line.startswith(SSE_FIELD_SEPARATOR):
+				continue
+			field, _, value = line.partition(SSE_FIELD_SEPARATOR)
+			if value.startswith(' '):
+				value = value[1:]
 			if "event" == field:
-				event_type = parts[1].strip()
+				event_type = value
 			elif "data" == field:
-				event_data = parts[1].strip()
-
-		if "keepalive" == event_type:
-			continue
-		if "log-line" == event_type:
-			if event_data:
-				event_data = escape_ansi(event_data) # remove ANSI color codes
-				event_data = event_data.rstrip() # remove trailing whitespace and newlines
-				logging.info(event_data)
+				event_data.append(value)
+			elif "id" == field:
+				state['last_id'] = value
 
 
 def run_sse_client_with_retries(host, port, path, retry_delay=5):
+	state = {'last_id': None}
 	while True:
 		try:
-			run_sse_client(host, port, path)
+			run_sse_client(host, port, path, state)
 		except (socket.error, ConnectionError) as e:
 			logging.error(f"***************  Connection error: {e}. Retrying in {retry_delay} seconds...")
 			time.sleep(retry_delay)
@@ -95,8 +124,11 @@ if __name__ == "__main__":
 	parser.add_argument('addr', type=str, help='http server address')
 	parser.add_argument("-p", "--port", type=int, help='http server port', default=DEF_PORT)
 	parser.add_argument("--path", type=str, help='http server path', default=DEF_PATH)
+	parser.add_argument("--json", action='store_true', help='get the lines as JSON records, without color codes')
 
 	args = parser.parse_args()
+	if args.json:
+		args.path += ("&" if "?" in args.path else "?") + "format=json"
 	log_setup()
 	logging.debug("+==========================+")
 	logging.debug("| HTTP SSE Logging Client  |")
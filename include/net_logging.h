@@ -1,8 +1,12 @@
 #ifndef NET_LOGGING_H_
 #define NET_LOGGING_H_
 
+#include "sdkconfig.h"
 #include "esp_err.h"
+#include "esp_log.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 #define EXTERN_C_BEGIN  extern "C" {
@@ -22,6 +26,72 @@ EXTERN_C_BEGIN
 #define NETLOGGING_LOGD(fmt, args...) ESP_EARLY_LOGD(TAG, fmt, ##args)
 #define NETLOGGING_LOGV(fmt, args...) ESP_EARLY_LOGV(TAG, fmt, ##args)
 
+/**
+ * @brief What to do with a new log line when a sink's buffer is full.
+ */
+typedef enum {
+    NETLOGGING_OVERFLOW_DROP_NEWEST = 0,  /*!< Discard the new line (default) */
+    NETLOGGING_OVERFLOW_DROP_OLDEST,      /*!< Discard the oldest lines in the buffer to make room for the new one */
+    NETLOGGING_OVERFLOW_BLOCK,            /*!< Wait up to block_timeout_ms for the sink to make room, then discard the new line */
+} netlogging_overflow_t;
+
+/**
+ * @brief Log buffer settings of one sink (i.e. one built-in client or server connection).
+ */
+typedef struct {
+    size_t size;    /*!< Buffer size in bytes. 0 selects CONFIG_NETLOGGING_BUFFER_SIZE. */
+    uint32_t caps;  /*!< heap_caps flags for the buffer storage, e.g. MALLOC_CAP_SPIRAM. 0 selects the Kconfig default. */
+    netlogging_overflow_t overflow;  /*!< Overflow policy */
+    uint32_t block_timeout_ms;       /*!< Max time the logging task waits for room, for NETLOGGING_OVERFLOW_BLOCK */
+    bool required;                   /*!< In lossless mode, logging waits for room in this sink instead of dropping lines */
+    size_t priority_size;            /*!< Size of the separate buffer for error and warning lines, which the sink sends first. 0 disables it. */
+} netlogging_buffer_config_t;
+#define NETLOGGING_BUFFER_DEFAULT_CONFIG() {  \
+    .size = CONFIG_NETLOGGING_BUFFER_SIZE,\
+    .caps = 0,                            \
+    .overflow = NETLOGGING_OVERFLOW_DROP_NEWEST,\
+    .block_timeout_ms = 10,               \
+    .required = true,                     \
+    .priority_size = CONFIG_NETLOGGING_PRIORITY_LANE_SIZE,\
+}
+
+/**
+ * @brief Counters since netlogging_init(). Lines are counted once per sink that lost them.
+ */
+typedef struct {
+    uint32_t lines;     /*!< Log lines written */
+    uint32_t bytes;     /*!< Bytes of log text written */
+    uint32_t dropped;   /*!< New lines discarded because a sink's buffer was full */
+    uint32_t evicted;   /*!< Old lines discarded from a sink's buffer to make room (NETLOGGING_OVERFLOW_DROP_OLDEST) */
+    uint32_t blocked;   /*!< Times a logging task had to wait for room in a sink's buffer */
+    uint32_t timeouts;  /*!< Waits that ended without room, so the line was dropped anyway */
+    uint64_t blocked_us;/*!< Total time logging tasks spent waiting for room */
+    uint32_t isr_lines; /*!< Lines logged from an ISR, which are not sent to any sink */
+    uint32_t skipped;   /*!< Lines not given to a sink because of the sink's level, see netlogging_set_sink_level() */
+} netlogging_stats_t;
+esp_err_t netlogging_get_stats(netlogging_stats_t *stats);
+
+/**
+ * @brief Compression counters of one kind of sink since netlogging_init(), see netlogging_get_compression_stats()
+ */
+typedef struct {
+    uint32_t in;    /*!< Bytes given to the sink's compressors */
+    uint32_t out;   /*!< Bytes that came out of them. The ratio is out / in. */
+    uint64_t us;    /*!< Total time spent compressing */
+    uint32_t mem;   /*!< RAM used by the sink's compressors that exist now */
+} netlogging_compression_stats_t;
+esp_err_t netlogging_get_compression_stats(const char *sink, netlogging_compression_stats_t *stats);
+esp_err_t netlogging_set_lossless(bool enable, uint32_t timeout_ms);
+
+/**
+ * @brief Level of one kind of sink: "stdout", "multicast", "tcp", "http", "mqtt", "syslog", "sse" (all browsers),
+ * or "user" (the buffers of netlogging_register_recieveBuffer()). The sink gets the lines up to this level, and lines
+ * without a level. The default is ESP_LOG_VERBOSE, which lets esp_log_level_set() alone decide what is logged.
+ * @return ESP_ERR_NOT_FOUND for an unknown sink name
+ */
+esp_err_t netlogging_set_sink_level(const char *sink, esp_log_level_t level);
+esp_err_t netlogging_get_sink_level(const char *sink, esp_log_level_t *level);
+
 esp_err_t netlogging_init(bool enableStdout);
 esp_err_t netlogging_register_recieveBuffer(void *buffer);
 esp_err_t netlogging_unregister_recieveBuffer(void *buffer);
@@ -30,10 +100,12 @@ esp_err_t netlogging_deinit(void);
 typedef struct {
     const char *ipv4addr;
     unsigned long port;
+    netlogging_buffer_config_t buffer;
 } udp_logging_param_t;
 #define NETLOGGING_UDP_DEFAULT_CONFIG() {  \
     .ipv4addr = "255.255.255",\
     .port = 6789,             \
+    .buffer = NETLOGGING_BUFFER_DEFAULT_CONFIG(),\
 }
 esp_err_t netlogging_udp_client_init(const udp_logging_param_t *param);
 esp_err_t netlogging_udp_client_run(void);
@@ -43,38 +115,166 @@ esp_err_t netlogging_udp_client_deinit(void);
 typedef struct {
     const char *ipv4addr;
     unsigned long port;
+    netlogging_buffer_config_t buffer;
+    size_t datagram_size;   /*!< Lines are collected into datagrams of up to this many bytes, at most 1472 fit into one Ethernet frame */
+    bool raw_udp;           /*!< Send with lwIP's raw UDP API from the tcpip thread, instead of through a socket */
+    uint16_t resend_count;  /*!< Reliable mode: keep this many datagrams to resend on a receiver's NACK, 0=off. Takes resend_count * datagram_size bytes. */
 } multicast_logging_param_t;
 #define NETLOGGING_MULTICAST_DEFAULT_CONFIG() {  \
     .ipv4addr = "239.2.1.2",\
     .port = 2054,           \
+    .buffer = NETLOGGING_BUFFER_DEFAULT_CONFIG(),\
+    .datagram_size = 1024,  \
+    .raw_udp = false,       \
+    .resend_count = 0,      \
 }
 esp_err_t netlogging_multicast_sender_init(const multicast_logging_param_t *param);
 esp_err_t netlogging_multicast_sender_run(void);
 esp_err_t netlogging_multicast_sender_stop(void);
 esp_err_t netlogging_multicast_sender_deinit(void);
 
+/**
+ * @brief How the TCP client separates the lines in the stream.
+ */
+typedef enum {
+    NETLOGGING_TCP_FRAMING_NEWLINE = 0,   /*!< Each line ends with '\n' (one is added if missing) */
+    NETLOGGING_TCP_FRAMING_LENGTH_PREFIX, /*!< Each line is preceded by its length as a 32-bit big-endian integer */
+} netlogging_tcp_framing_t;
+
 typedef struct {
-    const char *ipv4addr;
+    const char *ipv4addr;           /*!< IPv4 address or host name of the server */
     unsigned long port;
+    netlogging_buffer_config_t buffer;
+    netlogging_tcp_framing_t framing;
+    size_t batch_size;              /*!< Write when this many bytes are collected */
+    uint32_t flush_interval_ms;     /*!< Write at the latest this long after the first line of a batch. 0 writes as soon as no more lines are waiting. */
+    bool nodelay;                   /*!< Set TCP_NODELAY: lower latency, more and smaller packets */
+    int sndbuf;                     /*!< SO_SNDBUF in bytes if lwIP supports it, 0 keeps the default */
+    uint32_t reconnect_min_ms;      /*!< First wait after a failed connection, doubled after each failure */
+    uint32_t reconnect_max_ms;      /*!< Longest wait between connection attempts */
+    bool gzip;                      /*!< Send each connection as one gzip stream, flushed after every batch */
 } tcp_logging_param_t;
+#define NETLOGGING_TCP_DEFAULT_CONFIG() {  \
+    .ipv4addr = "192.168.10.46",    \
+    .port = 8080,                   \
+    .buffer = NETLOGGING_BUFFER_DEFAULT_CONFIG(),\
+    .framing = NETLOGGING_TCP_FRAMING_NEWLINE,\
+    .batch_size = 1024,             \
+    .flush_interval_ms = 100,       \
+    .nodelay = false,               \
+    .sndbuf = 0,                    \
+    .reconnect_min_ms = 500,        \
+    .reconnect_max_ms = 30000,      \
+    .gzip = false,                  \
+}
 esp_err_t netlogging_tcp_client_init(const tcp_logging_param_t *param);
 esp_err_t netlogging_tcp_client_run(void);
 esp_err_t netlogging_tcp_client_stop(void);
 esp_err_t netlogging_tcp_client_deinit(void);
 
 typedef struct {
-    const char *url;
+    const char *url;                /*!< Lines are POSTed to this URL as NDJSON, one {"seq":..,"level":..,"tag":..,"msg":".."} object per line */
+    netlogging_buffer_config_t buffer;
+    size_t batch_size;              /*!< POST when this many bytes of NDJSON are collected */
+    uint32_t flush_interval_ms;     /*!< POST at the latest this long after the first line of a batch was collected */
+    uint32_t timeout_ms;            /*!< Network timeout of one POST */
+    bool gzip;                      /*!< Compress the batches, sent with Content-Encoding: gzip */
+    size_t gzip_min_size;           /*!< Batches smaller than this are sent uncompressed */
 } http_logging_param_t;
+#define NETLOGGING_HTTP_DEFAULT_CONFIG() {  \
+    .url = "http://myhttpserver.local:8000/post",\
+    .buffer = NETLOGGING_BUFFER_DEFAULT_CONFIG(),\
+    .batch_size = 2048,             \
+    .flush_interval_ms = 1000,      \
+    .timeout_ms = 5000,             \
+    .gzip = false,                  \
+    .gzip_min_size = 256,           \
+}
 esp_err_t netlogging_http_client_init(const http_logging_param_t *param);
 esp_err_t netlogging_http_client_run(void);
-esp_err_t netlogging_http_client_stop(void);
-esp_err_t netlogging_http_client_deinit(void);
+esp_err_t netlogging_http_client_stop(void);   // waits up to 8 s plus 2 * timeout_ms, ESP_ERR_TIMEOUT if the task is still in a POST
+esp_err_t netlogging_http_client_deinit(void); // ESP_ERR_INVALID_STATE while the task has not stopped
+
+typedef enum {
+    NETLOGGING_SYSLOG_UDP = 0,      /*!< One message per datagram (RFC 5426) */
+    NETLOGGING_SYSLOG_TCP,          /*!< Octet-counting framing (RFC 6587), several messages per segment */
+} netlogging_syslog_transport_t;
+
+typedef struct {
+    const char *host;               /*!< IPv4 address or host name of the syslog server */
+    unsigned long port;
+    netlogging_syslog_transport_t transport;
+    netlogging_buffer_config_t buffer;
+    const char *hostname;           /*!< HOSTNAME field, NULL uses "esp-" and the MAC address */
+    const char *app_name;           /*!< APP-NAME field, NULL leaves it empty ("-") */
+    uint8_t facility;               /*!< Syslog facility, 16 = local0 ... 23 = local7 */
+    size_t batch_size;              /*!< TCP: write when this many bytes are collected */
+    uint32_t flush_interval_ms;     /*!< TCP: write at the latest this long after the first message of a batch */
+    uint32_t reconnect_min_ms;      /*!< First wait after a failed connection, doubled after each failure */
+    uint32_t reconnect_max_ms;      /*!< Longest wait between connection attempts */
+} syslog_logging_param_t;
+#define NETLOGGING_SYSLOG_DEFAULT_CONFIG() {  \
+    .host = "192.168.10.46",        \
+    .port = 514,                    \
+    .transport = NETLOGGING_SYSLOG_UDP,\
+    .buffer = NETLOGGING_BUFFER_DEFAULT_CONFIG(),\
+    .hostname = NULL,               \
+    .app_name = NULL,               \
+    .facility = 16,                 \
+    .batch_size = 1024,             \
+    .flush_interval_ms = 100,       \
+    .reconnect_min_ms = 500,        \
+    .reconnect_max_ms = 30000,      \
+}
+esp_err_t netlogging_syslog_client_init(const syslog_logging_param_t *param);
+esp_err_t netlogging_syslog_client_run(void);
+esp_err_t netlogging_syslog_client_stop(void);
+esp_err_t netlogging_syslog_client_deinit(void);
+
+typedef struct {
+    const char *url;                /*!< Broker URI, e.g. "mqtt://broker.local:1883" */
+    const char *topic;              /*!< Lines are published to this topic */
+    netlogging_buffer_config_t buffer; /*!< Also holds the lines while the broker is not connected */
+    int qos;                        /*!< 0: cheapest, lines are lost if the connection breaks. 1 or 2: sent again until the broker has them */
+    bool topic_per_level;           /*!< Publish to <topic>/error, <topic>/warn, <topic>/info, ... (<topic>/other for lines without level) */
+    size_t batch_size;              /*!< Publish when this many bytes are collected, one line per row of the message */
+    uint32_t flush_interval_ms;     /*!< Publish at the latest this long after the first line of a batch */
+    size_t outbox_limit;            /*!< QoS 1/2: don't publish while more than this many bytes wait for the broker's acknowledgement */
+} mqtt_logging_param_t;
+#define NETLOGGING_MQTT_DEFAULT_CONFIG() {  \
+    .url = "mqtt://broker.emqx.io:1883",\
+    .topic = "/esp32/logging",      \
+    .buffer = NETLOGGING_BUFFER_DEFAULT_CONFIG(),\
+    .qos = 1,                       \
+    .topic_per_level = false,       \
+    .batch_size = 1024,             \
+    .flush_interval_ms = 500,       \
+    .outbox_limit = 8192,           \
+}
+esp_err_t netlogging_mqtt_client_init(const mqtt_logging_param_t *param);
+esp_err_t netlogging_mqtt_client_run(void);
+esp_err_t netlogging_mqtt_client_stop(void);
+esp_err_t netlogging_mqtt_client_deinit(void);
 
 typedef struct {
     unsigned long port;
+    netlogging_buffer_config_t buffer; /*!< Buffer settings, applied to each connected client */
+    bool gzip;                      /*!< Compress the event stream for browsers that accept gzip */
+    size_t history_size;            /*!< Bytes of recent lines kept for WebSocket clients that ask for them, 0 for none */
+    const char *control_token;      /*!< Enables /levels and /stats for requests with "Authorization: Bearer <token>".
+                                         Up to 48 characters, must stay valid while the server runs. NULL disables them. */
 } sse_logging_param_t;
 #define NETLOGGING_SSE_DEFAULT_CONFIG() {  \
     .port = 8080,                    \
+    .buffer = {                      \
+        .size = CONFIG_NETLOGGING_BUFFER_SIZE,\
+        .overflow = NETLOGGING_OVERFLOW_DROP_NEWEST,\
+        .required = false, /* browsers come and go, don't hold up logging for them */\
+        .priority_size = CONFIG_NETLOGGING_PRIORITY_LANE_SIZE,\
+    },                               \
+    .gzip = false,                   \
+    .history_size = 0,               \
+    .control_token = NULL,           \
 }
 esp_err_t netlogging_sse_server_init(const sse_logging_param_t *param);
 esp_err_t netlogging_sse_server_run(void);
@@ -1,254 +1,318 @@
 /*
-HTTP POST
+    HTTP Log Sender for ESP32 remote logging
 
-This example code is in the Public Domain (or CC0 licensed, at your option.)
-
-Unless required by applicable law or agreed to in writing, this
-software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
-CONDITIONS OF ANY KIND, either express or implied.
+    Collects the log lines into batches of NDJSON and POSTs them over one keep-alive connection.
 */
 
+#include "net_logging.h"
+#include "net_logging_priv.h"
+//#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE // set log level in this file only
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-#include "freertos/ringbuf.h"
-#else
-#include "freertos/message_buffer.h"
-#endif
-#include "esp_log.h"
-#include "esp_system.h"
-#include "esp_tls.h"
-#include "esp_http_client.h"
+#include "freertos/event_groups.h"
 
-#include "net_logging_priv.h"
+#define RETRY_TIMEOUT_MS (3000) // retry timeout in ms
+#define STOPPED_BIT (1UL << 0) // bit to signal that task has stopped
+#define STOP_WAITTIME (8000 / portTICK_PERIOD_MS) // wait this long for task to stop, plus two POSTs (see netlogging_http_client_stop())
+// Worst case: every char of the message, task and tag escaped as \u00XX
+#define LINE_JSON_MAX_LENGTH (96 + 6 * (CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH + configMAX_TASK_NAME_LEN + UINT8_MAX))
 
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-extern RingbufHandle_t xRingBufferHTTP;
-#else
-extern MessageBufferHandle_t xMessageBufferHTTP;
-#endif
+#define TAG "http_log_sender"
 
-esp_err_t _http_event_handler(esp_http_client_event_t *evt)
+struct server_handle_s
 {
-    static char *output_buffer;  // Buffer to store response of http request from event handler
-    static int output_len;		 // Stores number of bytes read
-    int mbedtls_err = 0;
-    esp_err_t err;
-    switch (evt->event_id) {
-    case HTTP_EVENT_ERROR:
-        //ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
-        break;
-    case HTTP_EVENT_ON_CONNECTED:
-        //ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
-        break;
-    case HTTP_EVENT_HEADER_SENT:
-        //ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
-        break;
-    case HTTP_EVENT_ON_HEADER:
-        //ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-        break;
-    case HTTP_EVENT_ON_DATA:
-        //ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-        /*
-        *	Check for chunked encoding is added as the URL for chunked encoding used in this example returns binary data.
-        *	However, event handler can also be used in case chunked encoding is used.
-        */
-        if (!esp_http_client_is_chunked_response(evt->client)) {
-            // If user_data buffer is configured, copy the response into the buffer
-            if (evt->user_data) {
-                memcpy(evt->user_data + output_len, evt->data, evt->data_len);
-            }
-            else {
-                if (output_buffer == NULL) {
-                    output_buffer = (char *)malloc(esp_http_client_get_content_length(evt->client));
-                    output_len = 0;
-                    if (output_buffer == NULL) {
-                        //ESP_LOGE(TAG, "Failed to allocate memory for output buffer");
-                        return ESP_FAIL;
-                    }
-                }
-                memcpy(output_buffer + output_len, evt->data, evt->data_len);
-            }
-            output_len += evt->data_len;
-        }
+    http_logging_param_t param;
+    volatile bool task_run;
+    netlogging_task_t task;
+    EventGroupHandle_t state_event;      /*!< Task's state event group */
+};
+static struct server_handle_s *server = NULL;
 
-        break;
-    case HTTP_EVENT_ON_FINISH:
-        //ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-        if (output_buffer != NULL) {
-            // Response is accumulated in output_buffer. Uncomment the below line to print the accumulated response
-            // ESP_LOG_BUFFER_HEX(TAG, output_buffer, output_len);
-            free(output_buffer);
-            output_buffer = NULL;
-        }
-        output_len = 0;
-        break;
-    case HTTP_EVENT_DISCONNECTED:
-        //ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
-        //int mbedtls_err = 0;
-        //esp_err_t err = esp_tls_get_and_clear_last_error(evt->data, &mbedtls_err, NULL);
-        err = esp_tls_get_and_clear_last_error(evt->data, &mbedtls_err, NULL);
-        if (err != 0) {
-            if (output_buffer != NULL) {
-                free(output_buffer);
-                output_buffer = NULL;
-            }
-            output_len = 0;
-            //ESP_LOGI(TAG, "Last esp error code: 0x%x", err);
-            //ESP_LOGI(TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
-        }
-        break;
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
-    case HTTP_EVENT_REDIRECT:
-        //ESP_LOGD(TAG, "HTTP_EVENT_REDIRECT");
-        break;
-#endif
+/**
+ * @brief Append one log line as a JSON object and a newline. out must have room for LINE_JSON_MAX_LENGTH bytes.
+ * @return Number of bytes written
+ */
+static size_t json_append_line(char *out, const netlogging_record_hdr_t *hdr, const char *text)
+{
+    char *p = out;
+    const char *end = out + LINE_JSON_MAX_LENGTH;
+    p += sprintf(p, "{\"seq\":%"PRIu32",\"level\":%u,\"ts\":%"PRIu32",", hdr->seq, hdr->level, hdr->timestamp);
+    if (hdr->dropped > 0) {
+        p += sprintf(p, "\"dropped\":%"PRIu32",", hdr->dropped);
     }
-    return ESP_OK;
+    p += sprintf(p, "\"task\":");
+    p += netlogging_json_string(p, end - p, hdr->task, strnlen(hdr->task, sizeof(hdr->task)), false);
+    if (hdr->tag_len > 0) {
+        p += sprintf(p, ",\"tag\":");
+        p += netlogging_json_string(p, end - p, text + hdr->tag_offset, hdr->tag_len, false);
+    }
+    p += sprintf(p, ",\"msg\":");
+    p += netlogging_json_string(p, end - p, text + hdr->msg_offset, hdr->msg_len, true);
+    *p++ = '}';
+    *p++ = '\n';
+    return p - out;
 }
 
-#define MAX_HTTP_OUTPUT_BUFFER 128
-
-static esp_err_t http_post_with_url(char *url, char *post_data, size_t post_len)
+/**
+ * @brief Gzip a batch if it is at least gzip_min_size bytes and gets smaller.
+ * @param[inout] len Length of the body, replaced by the length of the compressed body
+ * @return The compressed body, or body if it is not compressed
+ */
+static const char *http_compress_batch(netlogging_deflate_t *deflate, netlogging_buffer_t *gz, const char *body, size_t *len)
 {
-    //ESP_LOGI(TAG, "http_post_with_url url=[%s]", url);
-    char local_response_buffer[MAX_HTTP_OUTPUT_BUFFER] = {0};
-    /**
-     * NOTE: All the configuration parameters for http_client must be spefied either in URL or as host and path parameters.
-     * If host and path parameters are not set, query parameter will be ignored. In such cases,
-     * query parameter should be specified in URL.
-     *
-     * If URL as well as host and path parameters are specified, values of host and path will be considered.
-     */
-
-    esp_http_client_config_t config = {
-    .url = url,
-    .path = "/post",
-    .event_handler = _http_event_handler,
-    .user_data = local_response_buffer, // Pass address of local buffer to get response
-    .disable_auto_redirect = true,
-    };
+    if ((NULL == deflate) || (*len < server->param.gzip_min_size)) {
+        return body;
+    }
+    int64_t start = esp_timer_get_time();
+    gz->len = 0;
+    bool ok = netlogging_deflate_write(deflate, body, *len);
+    ok = netlogging_deflate_finish(deflate) && ok;
+    ok = ok && (gz->len < *len); // a full buffer fails the stream, the body is then sent as it is
+    netlogging_stats_add_compression(NETLOGGING_SINK_HTTP, *len, ok ? gz->len : *len, esp_timer_get_time() - start);
+    if (!ok) {
+        return body;
+    }
+    *len = gz->len;
+    return (const char *)gz->data;
+}
 
-#if 0
-    esp_http_client_config_t config = {
-    .url = "http://192.168.10.46:8000",
-    .path = "/post",
-    .event_handler = _http_event_handler,
-    .user_data = local_response_buffer, // Pass address of local buffer to get response
-    .disable_auto_redirect = true,
-    };
-#endif
+/**
+ * @brief POST one batch. The client reconnects by itself if the server closed the connection.
+ * @return ESP_OK if the batch is done with (sent, or refused by the server), an error if it should be sent again.
+ */
+static esp_err_t http_post_batch(esp_http_client_handle_t client, const char *body, size_t len, bool gzip)
+{
+    if (gzip) {
+        esp_http_client_set_header(client, "Content-Encoding", "gzip");
+    }
+    else {
+        esp_http_client_delete_header(client, "Content-Encoding");
+    }
+    esp_http_client_set_post_field(client, body, len);
+    esp_err_t err = esp_http_client_perform(client);
+    if (err != ESP_OK) {
+        NETLOGGING_LOGE("HTTP POST request failed: %s", esp_err_to_name(err));
+        esp_http_client_close(client);
+        return err;
+    }
+    int status = esp_http_client_get_status_code(client);
+    if ((status < 200) || (status >= 300)) {
+        // Sending the same batch again would most likely fail again
+        NETLOGGING_LOGW("HTTP POST status %d, %u bytes of log discarded", status, (unsigned)len);
+    }
+    return ESP_OK;
+}
 
+/**
+ * @brief POST a batch until it is done with, or until the task is to stop
+ * @return false if the batch was given up
+ */
+static bool http_post_batch_retry(esp_http_client_handle_t client, const char *body, size_t len, bool gzip)
+{
+    while (http_post_batch(client, body, len, gzip) != ESP_OK) {
+        if (!server->task_run) {
+            return false;
+        }
+        vTaskDelay(RETRY_TIMEOUT_MS / portTICK_PERIOD_MS);
+        if (!server->task_run) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+// HTTP Log Sender Task
+static void http_log_sender(void *pvParameters)
+{
+    NETLOGGING_LOGI("start http logging: url=[%s]", server->param.url);
 
-    // POST
-    esp_http_client_set_method(client, HTTP_METHOD_POST);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    //esp_http_client_set_post_field(client, post_data, strlen(post_data));
-    esp_http_client_set_post_field(client, post_data, post_len);
-    esp_err_t err = esp_http_client_perform(client);
-    //printf("esp_http_client_perform post_len=%d err=%d\n", post_len, err);
-    if (err == ESP_OK) {
-#if 0
-        ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %d",
-            esp_http_client_get_status_code(client),
-            esp_http_client_get_content_length(client));
-        ESP_LOGI(TAG, "local_response_buffer=[%s]", local_response_buffer);
-#endif
+    netlogging_ring_t *ring = NULL;
+    esp_http_client_handle_t client = NULL;
+    netlogging_deflate_t *deflate = NULL;
+    netlogging_buffer_t gz = { 0 };
+    size_t body_len = 0;
+    const size_t body_size = server->param.batch_size + LINE_JSON_MAX_LENGTH;
+    char *body = malloc(body_size);
+    if (NULL == body) {
+        NETLOGGING_LOGE("malloc fail");
+        goto _init_failed;
     }
-    else {
-        printf("HTTP POST request failed: %s\n", esp_err_to_name(err));
+    if (server->param.gzip) {
+        // Only compressed bodies smaller than the original are sent
+        gz.size = body_size;
+        gz.data = malloc(gz.size);
+        deflate = netlogging_compressor_create(NETLOGGING_SINK_HTTP, netlogging_buffer_append, &gz);
+        if ((NULL == gz.data) || (NULL == deflate)) {
+            NETLOGGING_LOGE("malloc fail");
+            goto _init_failed;
+        }
     }
 
-    esp_http_client_cleanup(client);
-    return err;
-}
+    // Create log ring
+    ring = netlogging_ring_create(&server->param.buffer);
+    if (NULL == ring) {
+        NETLOGGING_LOGE("netlogging_ring_create failed");
+        goto _init_failed;
+    }
+    esp_err_t err = netlogging_register_ring(ring, NETLOGGING_SINK_HTTP);
+    if (err != ESP_OK) {
+        NETLOGGING_LOGE("netlogging_register_ring failed");
+        goto _init_failed;
+    }
 
+    esp_http_client_config_t config = {
+        .url = server->param.url,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = server->param.timeout_ms,
+        .keep_alive_enable = true,
+        .disable_auto_redirect = true,
+    };
+    client = esp_http_client_init(&config);
+    if (NULL == client) {
+        NETLOGGING_LOGE("esp_http_client_init failed");
+        goto _init_failed;
+    }
+    esp_http_client_set_header(client, "Content-Type", "application/x-ndjson");
 
-void http_client(void *pvParameters)
-{
-    PARAMETER_t *task_parameter = pvParameters;
-    PARAMETER_t param;
-    memcpy((char *)&param, task_parameter, sizeof(PARAMETER_t));
-    printf("Start:param.url=[%s]\n", param.url);
-
-    // Try to connect to http server
-    esp_err_t err = http_post_with_url(param.url, "", 0);
-    printf("http_post_with_url err=%d\n", err);
-    if (err != ESP_OK) vTaskDelete(NULL);
-
-    // Send ready to receive notify
-    xTaskNotifyGive(param.taskHandle);
-
-    while (1) {
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-        size_t received;
-        char *buffer = (char *)xRingbufferReceive(xRingBufferHTTP, &received, portMAX_DELAY);
-        //printf("xRingBufferReceive received=%d\n", received);
-#else
+    bool reachable = true; // the last POST got an answer
+    int64_t flush_at = 0;
+    const int64_t flush_interval_us = (int64_t)server->param.flush_interval_ms * 1000;
+    while (server->task_run)
+    {
+        // Wait for the next line, but not past the flush time of the batch
+        TickType_t wait = pdMS_TO_TICKS(1000);
+        if (body_len > 0) {
+            int64_t left_us = flush_at - esp_timer_get_time();
+            wait = (left_us > 0) ? pdMS_TO_TICKS(left_us / 1000) : 0;
+        }
+        netlogging_record_hdr_t hdr;
         char buffer[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
-        size_t received = xMessageBufferReceive(xMessageBufferHTTP, buffer, sizeof(buffer), portMAX_DELAY);
-        //printf("xMessageBufferReceive received=%d\n", received);
-#endif
+        size_t received = netlogging_ring_receive(ring, &hdr, buffer, sizeof(buffer), wait);
         if (received > 0) {
-            //printf("xMessageBufferReceive buffer=[%.*s]\n",received, buffer);
-            // Remove trailing LF
-            if (buffer[received - 1] == 0x0a) received = received - 1;
-            if (received) {
-                http_post_with_url(param.url, buffer, received);
+            if (0 == body_len) {
+                flush_at = esp_timer_get_time() + flush_interval_us;
             }
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-            vRingbufferReturnItem(xRingBufferHTTP, (void *)buffer);
-#endif
+            body_len += json_append_line(body + body_len, &hdr, buffer);
         }
-        else {
-            printf("xMessageBufferReceive fail\n");
-            break;
+
+        if ((body_len >= server->param.batch_size) ||
+            ((body_len > 0) && (esp_timer_get_time() >= flush_at))) {
+            size_t len = body_len;
+            const char *payload = http_compress_batch(deflate, &gz, body, &len);
+            // Keep the batch until it is sent. Meanwhile the ring fills up and its overflow policy applies.
+            reachable = http_post_batch_retry(client, payload, len, payload != body);
+            body_len = 0;
         }
-    } // end while
+    }
+    // Last try for what was collected before the stop, one POST at most, and only if the server answered before
+    if ((body_len > 0) && reachable) {
+        size_t len = body_len;
+        const char *payload = http_compress_batch(deflate, &gz, body, &len);
+        http_post_batch(client, payload, len, payload != body);
+    }
 
-    // Stop connection
-    vTaskDelete(NULL);
+_init_failed:
+    // Cleanup. Task is only responsible for freeing memory that it allocated.
+    if (ring != NULL) {
+        netlogging_unregister_ring(ring);
+        netlogging_ring_delete(ring);
+        ring = NULL;
+    }
+    if (client != NULL) {
+        esp_http_client_cleanup(client);
+    }
+    netlogging_compressor_delete(NETLOGGING_SINK_HTTP, deflate);
+    free(gz.data);
+    free(body);
+    xEventGroupSetBits(server->state_event, STOPPED_BIT);
+    NETLOGGING_LOGI("http_log_sender task stopped");
+    netlogging_task_exit(&server->task);
 }
 
+esp_err_t netlogging_http_client_run(void)
+{
+    if (NULL == server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Start HTTP Sender task
+    server->task_run = true;
+    xEventGroupClearBits(server->state_event, STOPPED_BIT);
+    if (netlogging_task_create(&server->task, http_log_sender, "HTTP", 1024 * 6, NULL, 2) != ESP_OK) {
+        NETLOGGING_LOGE("xTaskCreate failed");
+        server->task_run = false;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
 
+esp_err_t netlogging_http_client_stop(void)
+{
+    if (NULL == server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* Tell task to stop and delete itself. It may be in a POST, and makes one more for the lines it has collected. */
+    server->task_run = false;
+    const TickType_t wait = STOP_WAITTIME + pdMS_TO_TICKS(2 * server->param.timeout_ms);
+    EventBits_t uxBits = xEventGroupWaitBits(server->state_event, STOPPED_BIT, false, true, wait);
+    if (0 == (uxBits & STOPPED_BIT)) {
+        return ESP_ERR_TIMEOUT;
+    }
+    netlogging_task_reap(&server->task);
+    return ESP_OK;
+}
 
-esp_err_t http_logging_init(const char *url, bool enableStdout) {
-
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-    printf("start http logging(xRingBuffer): url=[%s]\n", url);
-    // Create RineBuffer
-    xRingBufferHTTP = xRingbufferCreate(CONFIG_NETLOGGING_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
-    configASSERT(xRingBufferHTTP);
-#else
-    printf("start http logging(xMessageBuffer): url=[%s]\n", url);
-    // Create MessageBuffer
-    xMessageBufferHTTP = xMessageBufferCreate(CONFIG_NETLOGGING_BUFFER_SIZE);
-    configASSERT(xMessageBufferHTTP);
-#endif
-
-    // Start HTTP task
-    PARAMETER_t param;
-    strcpy(param.url, url);
-    param.taskHandle = xTaskGetCurrentTaskHandle();
-    xTaskCreate(http_client, "HTTP", 1024 * 4, (void *)&param, 2, NULL);
-
-    // Wait for ready to receive notify
-    uint32_t value = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
-    printf("http ulTaskNotifyTake=%"PRIi32"\n", value);
-    if (value == 0) {
-        printf("stop http logging\n");
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-        vRingbufferDelete(xRingBufferHTTP);
-        xRingBufferHTTP = NULL;
-#else
-        vMessageBufferDelete(xMessageBufferHTTP);
-        xMessageBufferHTTP = NULL;
-#endif
+esp_err_t netlogging_http_client_init(const http_logging_param_t *param)
+{
+    if ((NULL == param) || (NULL == param->url) || (0 == param->batch_size)) {
+        return ESP_ERR_INVALID_ARG;
     }
 
+    // Allocate memory for the handle
+    server = malloc(sizeof(struct server_handle_s));
+    if (server == NULL) {
+        NETLOGGING_LOGE("malloc fail");
+        return ESP_ERR_NO_MEM;
+    }
+    memset(server, 0, sizeof(struct server_handle_s));
+    server->param = *param;
+    server->state_event = xEventGroupCreate();
+    if (server->state_event == NULL) {
+        NETLOGGING_LOGE("xEventGroupCreate failed");
+        goto _init_failed;
+    }
     return ESP_OK;
+
+_init_failed:
+    netlogging_http_client_deinit();
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t netlogging_http_client_deinit(void)
+{
+    if (server)
+    {
+        // The task uses server until it has stopped, see netlogging_http_client_stop()
+        if ((NULL != server->task.handle) &&
+            (0 == (xEventGroupGetBits(server->state_event) & STOPPED_BIT))) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (server->state_event)
+        {
+            vEventGroupDelete(server->state_event);
+        }
+        netlogging_task_free(&server->task);
+
+        free(server);
+        server = NULL;
+        return ESP_OK;
+    }
+    return ESP_FAIL;
 }
@@ -0,0 +1,318 @@
+/*
+    MQTT Log Sender for ESP32 remote logging
+
+    Collects the log lines into batches and publishes each batch as one message, optionally to a topic per log level.
+    While the broker is not connected, the lines wait in the log buffer of this sink.
+*/
+
+#include "net_logging.h"
+#include "net_logging_priv.h"
+//#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE // set log level in this file only
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION > ESP_IDF_VERSION_VAL(4, 4, 0)
+#include "esp_mac.h" // esp_base_mac_addr_get
+#endif
+#include "mqtt_client.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+#define STOPPED_BIT (1UL << 0) // bit to signal that task has stopped
+#define CONNECTED_BIT (1UL << 1) // bit set while connected to the broker
+#define WAKEUP_BIT (1UL << 2) // bit to cut a wait for the broker short: connected, a message was acknowledged, or stop requested
+#define RETRY_WAIT_MS (1000) // wait this long for the broker before checking again
+#define STOP_WAITTIME (8000 / portTICK_PERIOD_MS) // wait this long for task to stop
+#define LINE_MAX_LENGTH (NETLOGGING_DROPPED_NOTICE_MAX_LENGTH + CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH) // a line and its drop notice
+#define TOPIC_MAX_LENGTH (128)
+
+#define TAG "mqtt_log_sender"
+
+struct server_handle_s
+{
+    mqtt_logging_param_t param;
+    volatile bool task_run;
+    netlogging_task_t task;
+    EventGroupHandle_t state_event;      /*!< Task's state event group */
+};
+static struct server_handle_s *server = NULL;
+
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    switch (event_id) {
+    case MQTT_EVENT_CONNECTED:
+        xEventGroupSetBits(server->state_event, CONNECTED_BIT | WAKEUP_BIT);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        xEventGroupClearBits(server->state_event, CONNECTED_BIT);
+        break;
+    case MQTT_EVENT_PUBLISHED:
+        // The outbox got smaller
+        xEventGroupSetBits(server->state_event, WAKEUP_BIT);
+        break;
+    default:
+        break;
+    }
+}
+
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
+{
+    mqtt_event_handler(NULL, NULL, event->event_id, event);
+    return ESP_OK;
+}
+#endif
+
+/**
+ * @brief Topic of a batch: the configured topic, with the level appended if topic_per_level is set
+ */
+static const char *mqtt_topic(char *topic, size_t size, uint8_t level)
+{
+    static const char *const level_names[] = { "other", "error", "warn", "info", "debug", "verbose" };
+    if (!server->param.topic_per_level) {
+        return server->param.topic;
+    }
+    const char *name = (level < sizeof(level_names) / sizeof(level_names[0])) ? level_names[level] : level_names[0];
+    snprintf(topic, size, "%s/%s", server->param.topic, name);
+    return topic;
+}
+
+/**
+ * @brief Publish one batch, if the broker is connected and the outbox has room for it.
+ * @return false if the batch has to wait
+ */
+static bool mqtt_publish_batch(esp_mqtt_client_handle_t client, const char *batch, size_t len, uint8_t level)
+{
+    if (0 == (xEventGroupGetBits(server->state_event) & CONNECTED_BIT)) {
+        return false;
+    }
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+    // QoS 1 and 2 messages stay in the outbox until the broker acknowledges them, don't let it grow without end
+    if ((server->param.qos > 0) && (esp_mqtt_client_get_outbox_size(client) > (int)server->param.outbox_limit)) {
+        return false;
+    }
+#endif
+    // Each line ends with a newline, the message doesn't need the last one
+    if ((len > 0) && (batch[len - 1] == '\n')) {
+        len--;
+    }
+    char topic[TOPIC_MAX_LENGTH];
+    int msg_id = esp_mqtt_client_publish(client, mqtt_topic(topic, sizeof(topic), level), batch, len, server->param.qos, 0);
+    if (msg_id < 0) {
+        NETLOGGING_LOGD("esp_mqtt_client_publish failed: %d", msg_id);
+        return false;
+    }
+    return true;
+}
+
+// MQTT Log Sender Task
+static void mqtt_log_sender(void *pvParameters)
+{
+    NETLOGGING_LOGI("start mqtt logging: url=[%s] topic=[%s]", server->param.url, server->param.topic);
+
+    const mqtt_logging_param_t *param = &server->param;
+    netlogging_ring_t *ring = NULL;
+    esp_mqtt_client_handle_t client = NULL;
+    size_t batch_len = 0;
+    uint8_t batch_level = 0;
+    char *batch = malloc(param->batch_size + LINE_MAX_LENGTH);
+    if (NULL == batch) {
+        NETLOGGING_LOGE("malloc fail");
+        goto _init_failed;
+    }
+
+    // Create log ring
+    ring = netlogging_ring_create(&param->buffer);
+    if (NULL == ring) {
+        NETLOGGING_LOGE("netlogging_ring_create failed");
+        goto _init_failed;
+    }
+    // The MQTT library connects and sends from its own task
+    netlogging_ring_set_helper(ring, "mqtt_task");
+    esp_err_t err = netlogging_register_ring(ring, NETLOGGING_SINK_MQTT);
+    if (err != ESP_OK) {
+        NETLOGGING_LOGE("netlogging_register_ring failed");
+        goto _init_failed;
+    }
+
+    // Set client id from mac
+    uint8_t mac[8];
+    esp_base_mac_addr_get(mac);
+    char client_id[32];
+    snprintf(client_id, sizeof(client_id), "log-%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = param->url,
+        .credentials.client_id = client_id,
+    };
+#else
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .uri = param->url,
+        .event_handle = mqtt_event_handler_cb,
+        .client_id = client_id,
+    };
+#endif
+    client = esp_mqtt_client_init(&mqtt_cfg);
+    if (NULL == client) {
+        NETLOGGING_LOGE("esp_mqtt_client_init failed");
+        goto _init_failed;
+    }
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+#endif
+    // The client connects, and reconnects, in its own task
+    esp_mqtt_client_start(client);
+
+    netlogging_record_hdr_t hdr;
+    char line[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
+    size_t line_len = 0; // a line that was received but not added to the batch yet
+    int64_t flush_at = 0;
+    const int64_t flush_interval_us = (int64_t)param->flush_interval_ms * 1000;
+    while (server->task_run)
+    {
+        // A full batch waits for the broker, meanwhile the lines wait in the ring
+        size_t received = 0;
+        if ((0 == line_len) && (batch_len < param->batch_size)) {
+            TickType_t wait = pdMS_TO_TICKS(1000);
+            if (batch_len > 0) {
+                int64_t left_us = flush_at - esp_timer_get_time();
+                wait = (left_us > 0) ? pdMS_TO_TICKS(left_us / 1000) : 0;
+            }
+            line_len = received = netlogging_ring_receive(ring, &hdr, line, sizeof(line), wait);
+        }
+
+        // With a topic per level, a batch only holds lines of one level
+        if ((line_len > 0) && ((0 == batch_len) || !param->topic_per_level || (hdr.level == batch_level))) {
+            if (0 == batch_len) {
+                batch_level = hdr.level;
+                flush_at = esp_timer_get_time() + flush_interval_us;
+            }
+            if (hdr.dropped > 0) {
+                // Tell the subscribers that lines are missing here
+                batch_len += netlogging_format_dropped(batch + batch_len, NETLOGGING_DROPPED_NOTICE_MAX_LENGTH, hdr.dropped);
+            }
+            memcpy(batch + batch_len, line, line_len);
+            batch_len += line_len;
+            if (line[line_len - 1] != '\n') {
+                batch[batch_len++] = '\n';
+            }
+            line_len = 0;
+        }
+
+        // Publish when the batch is full, when the next line needs another topic,
+        // or when it is due and no more lines are waiting
+        if ((batch_len >= param->batch_size) || ((batch_len > 0) && (line_len > 0)) ||
+            ((batch_len > 0) && (0 == received) && (esp_timer_get_time() >= flush_at))) {
+            if (mqtt_publish_batch(client, batch, batch_len, batch_level)) {
+                batch_len = 0;
+            }
+            else {
+                // Wait for the broker to connect, or for room in the outbox
+                xEventGroupWaitBits(server->state_event, WAKEUP_BIT, true, false, pdMS_TO_TICKS(RETRY_WAIT_MS));
+            }
+        }
+    }
+    // Last try for what was collected before the stop
+    if (batch_len > 0) {
+        mqtt_publish_batch(client, batch, batch_len, batch_level);
+    }
+
+_init_failed:
+    // Cleanup. Task is only responsible for freeing memory that it allocated.
+    if (ring != NULL) {
+        netlogging_unregister_ring(ring);
+        netlogging_ring_delete(ring);
+        ring = NULL;
+    }
+    if (client != NULL) {
+        esp_mqtt_client_stop(client);
+        esp_mqtt_client_destroy(client);
+    }
+    free(batch);
+    xEventGroupSetBits(server->state_event, STOPPED_BIT);
+    NETLOGGING_LOGI("mqtt_log_sender task stopped");
+    netlogging_task_exit(&server->task);
+}
+
+esp_err_t netlogging_mqtt_client_run(void)
+{
+    if (NULL == server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Start MQTT Sender task
+    server->task_run = true;
+    xEventGroupClearBits(server->state_event, STOPPED_BIT | CONNECTED_BIT | WAKEUP_BIT);
+    if (netlogging_task_create(&server->task, mqtt_log_sender, "MQTT", 1024 * 6, NULL, 2) != ESP_OK) {
+        NETLOGGING_LOGE("xTaskCreate failed");
+        server->task_run = false;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t netlogging_mqtt_client_stop(void)
+{
+    if (NULL == server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* Tell task to stop and delete itself */
+    server->task_run = false;
+    xEventGroupSetBits(server->state_event, WAKEUP_BIT);
+    EventBits_t uxBits = xEventGroupWaitBits(server->state_event, STOPPED_BIT, false, true, STOP_WAITTIME);
+    if (0 == (uxBits & STOPPED_BIT)) {
+        return ESP_ERR_TIMEOUT;
+    }
+    netlogging_task_reap(&server->task);
+    return ESP_OK;
+}
+
+esp_err_t netlogging_mqtt_client_init(const mqtt_logging_param_t *param)
+{
+    if ((NULL == param) || (NULL == param->url) || (NULL == param->topic) || (0 == param->batch_size) ||
+        (param->qos < 0) || (param->qos > 2) || (strlen(param->topic) + sizeof("/verbose") > TOPIC_MAX_LENGTH)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Allocate memory for the handle
+    server = malloc(sizeof(struct server_handle_s));
+    if (server == NULL) {
+        NETLOGGING_LOGE("malloc fail");
+        return ESP_ERR_NO_MEM;
+    }
+    memset(server, 0, sizeof(struct server_handle_s));
+    server->param = *param;
+    server->state_event = xEventGroupCreate();
+    if (server->state_event == NULL) {
+        NETLOGGING_LOGE("xEventGroupCreate failed");
+        goto _init_failed;
+    }
+    return ESP_OK;
+
+_init_failed:
+    netlogging_mqtt_client_deinit();
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t netlogging_mqtt_client_deinit(void)
+{
+    if (server)
+    {
+        if (server->state_event)
+        {
+            vEventGroupDelete(server->state_event);
+        }
+        netlogging_task_free(&server->task);
+
+        free(server);
+        server = NULL;
+        return ESP_OK;
+    }
+    return ESP_FAIL;
+}
@@ -1,44 +1,134 @@
 /*
     Multicast IP Log Sender for ESP32 remote logging
+
+    Lines are collected into datagrams of up to datagram_size bytes. They are sent through a socket, or with raw_udp
+    straight from the tcpip thread with lwIP's raw UDP API, which saves the socket layer's copy and message per packet.
+    The sender rebinds as soon as the network changes, and backs off only while setting up or sending fails.
+
+    Reliable mode (resend_count > 0): each datagram starts with a header holding a session id and a sequence number,
+    and the last resend_count datagrams are kept. A receiver that sees a gap sends a NACK to the sender's address and
+    port, and gets the missing datagrams resent by unicast. All numbers are big-endian:
+        header: "\0NL" type:u8 session:u32 seq:u32
+        DATA      header, then lines
+        HEARTBEAT header with the last seq sent, a few times after the sender went quiet, so a lost last datagram is noticed
+        NACK      header (seq unused), then up to NACK_MAX_RANGES of first_seq:u32 count:u16, from the receiver
+        GONE      header with the oldest seq still kept: everything before it can't be resent anymore
 */
 
 #include "net_logging.h"
+#include "net_logging_priv.h"
 //#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE // set log level in this file only
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "esp_system.h"
 #include "esp_event.h"
+#include "esp_wifi_types.h" // for WIFI_EVENT
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "lwip/sockets.h"
+#include "lwip/udp.h"
+#include "lwip/tcpip.h"
 #include "lwip/inet.h" // for inet_addr_from_ip4addr
 #include "lwip/netdb.h" // for getaddrinfo
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-#include "freertos/ringbuf.h"
-#else
-#include "freertos/message_buffer.h"
-#endif
 
 #define MULTICAST_TTL (1) // 1=don't leave the subnet
 #define USE_DEFAULT_IF (1) // 1=bind to default interface, 0=bind to specific interface
-#define RETRY_TIMEOUT_MS (3000) // retry timeout in ms
+#define RECONNECT_MIN_MS (500) // first wait after a failure, doubled after each further failure
+#define RECONNECT_MAX_MS (30000)
 #define STOPPED_BIT (1UL << 0) // bit to signal that task has stopped
+#define WAKEUP_BIT (1UL << 1) // bit to cut a backoff wait short: network changed, or stop requested
+#define NET_CHANGED_BIT (1UL << 2) // bit to signal that network configuration has changed
 #define STOP_WAITTIME (8000 / portTICK_PERIOD_MS) // wait this long for task to stop
 
+#define RELIABLE_HDR_LEN (12)
+#define RELIABLE_MAGIC "\0NL"
+#define PKT_DATA (1)
+#define PKT_HEARTBEAT (2)
+#define PKT_NACK (3)
+#define PKT_GONE (4)
+#define NACK_MAX_RANGES (16)
+#define NACK_MAX_LENGTH (RELIABLE_HDR_LEN + NACK_MAX_RANGES * 6)
+#define NACK_POLL_MS (50) // the socket is checked for NACKs this often. Raw UDP gets them without polling.
+#define HEARTBEAT_MS (1000)
+#define HEARTBEAT_COUNT (3)
+
 #define TAG "multicast_log_sender"
 
+// Raw UDP backend. Every call runs in the tcpip thread, the sender waits until it is done.
+typedef struct {
+    struct udp_pcb *pcb;
+    u16_t port;                 /*!< Local port */
+    bool receive;               /*!< Receive NACKs into nack[] */
+    ip_addr_t to;
+    u16_t to_port;
+    const void *data;
+    size_t len;
+    err_t err;
+    SemaphoreHandle_t done;
+    // Written by the tcpip thread while nack_pending is false, then read by the sender
+    volatile bool nack_pending;
+    uint8_t nack[NACK_MAX_LENGTH];
+    size_t nack_len;
+    struct sockaddr_in nack_from;
+} raw_udp_t;
+
+// Reliable mode: the sent datagrams, kept for resending. Datagram seq is in slot seq % count.
+typedef struct {
+    uint8_t *slots;             /*!< count slots of datagram_size bytes, the one being filled is the send buffer */
+    uint16_t *lens;
+    uint16_t count;
+    uint32_t session;
+    uint32_t next_seq;
+    TickType_t last_sent;
+    uint8_t heartbeats_left;
+} resend_ring_t;
+
 struct server_handle_s
 {
     multicast_logging_param_t param;
     volatile bool task_run;
+    netlogging_ring_t *volatile ring;    /*!< Set while the task has its ring, to wake it up */
+    netlogging_task_t task;
     EventGroupHandle_t state_event;      /*!< Task's state event group */
 };
 static struct server_handle_s *server = NULL;
 
+/**
+ * @brief Wake the task: it may be waiting for lines, or in a backoff
+ */
+static void multicast_wake(EventBits_t bits)
+{
+    xEventGroupSetBits(server->state_event, bits | WAKEUP_BIT);
+    netlogging_ring_t *ring = server->ring;
+    if (NULL != ring) {
+        netlogging_ring_wake(ring);
+    }
+}
+
+static void network_changed_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if ((IP_EVENT == event_base) && (IP_EVENT_AP_STAIPASSIGNED == event_id)) {
+        return; // a station got an address from our AP, nothing changed for us
+    }
+    // Got or lost an address, or the AP started: rebind right away instead of waiting for sendto to fail
+    multicast_wake(NET_CHANGED_BIT);
+}
+
+/**
+ * @brief Wait after a failure, or until the network changes or the task is stopped.
+ * @return The next backoff time
+ */
+static uint32_t multicast_backoff(uint32_t backoff_ms)
+{
+    xEventGroupWaitBits(server->state_event, WAKEUP_BIT, true, false, pdMS_TO_TICKS(backoff_ms));
+    return (backoff_ms * 2 < RECONNECT_MAX_MS) ? backoff_ms * 2 : RECONNECT_MAX_MS;
+}
+
 static int create_multicast_ipv4_socket(struct in_addr bind_iaddr, uint16_t port)
 {
     int sock = -1;
@@ -91,16 +181,12 @@ err:
     return -1;
 }
 
+/**
+ * @brief Resolve the multicast address and create the socket to send to it.
+ * @param[out] sock_out The socket, NULL to only resolve the address (for the raw UDP backend)
+ */
 static int multicast_setup(int *sock_out, struct addrinfo **res_out, struct in_addr src_addr, const char *mcast_addr, uint16_t port)
 {
-    int err = 0;
-    int sock = create_multicast_ipv4_socket(src_addr, port);
-    if (sock < 0)
-    {
-        NETLOGGING_LOGE("Failed to create socket. Error %d", errno);
-        return -1;
-    }
-
     struct addrinfo hints = {
         .ai_flags = AI_PASSIVE,
         .ai_socktype = SOCK_DGRAM,
@@ -108,16 +194,198 @@ static int multicast_setup(int *sock_out, struct addrinfo **res_out, struct in_a
     hints.ai_family = AF_INET; // For an IPv4 socket
     struct addrinfo *res;
 
-    err = getaddrinfo(mcast_addr, NULL, &hints, &res);
+    int err = getaddrinfo(mcast_addr, NULL, &hints, &res);
     if (0 != err) {
         NETLOGGING_LOGE("Failed getaddrinfo");
         return -1;
     }
-
     ((struct sockaddr_in *)res->ai_addr)->sin_port = htons(port);
+
+    if (NULL != sock_out) {
+        int sock = create_multicast_ipv4_socket(src_addr, port);
+        if (sock < 0)
+        {
+            NETLOGGING_LOGE("Failed to create socket. Error %d", errno);
+            freeaddrinfo(res);
+            return -1;
+        }
+        *sock_out = sock;
+    }
     *res_out = res;
-    *sock_out = sock;
-    return err;
+    return 0;
+}
+
+static void raw_udp_recv_cb(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    raw_udp_t *raw = arg;
+    // One NACK at a time, a receiver asks again if this one is dropped
+    if (!raw->nack_pending && IP_IS_V4(addr) && (p->tot_len <= sizeof(raw->nack))) {
+        raw->nack_len = pbuf_copy_partial(p, raw->nack, sizeof(raw->nack), 0);
+        raw->nack_from.sin_family = AF_INET;
+        raw->nack_from.sin_port = htons(port);
+        inet_addr_from_ip4addr(&raw->nack_from.sin_addr, ip_2_ip4(addr));
+        raw->nack_pending = true;
+        netlogging_ring_t *ring = server->ring;
+        if (NULL != ring) {
+            netlogging_ring_wake(ring); // answer it now, not when the next line comes
+        }
+    }
+    pbuf_free(p);
+}
+
+static void raw_udp_open_cb(void *ctx)
+{
+    raw_udp_t *raw = ctx;
+    raw->err = ERR_MEM;
+    raw->pcb = udp_new();
+    if (NULL != raw->pcb) {
+        raw->err = udp_bind(raw->pcb, IP_ANY_TYPE, raw->port);
+        if (raw->receive) {
+            udp_recv(raw->pcb, raw_udp_recv_cb, raw);
+        }
+#if LWIP_MULTICAST_TX_OPTIONS
+        udp_set_multicast_ttl(raw->pcb, MULTICAST_TTL);
+#endif
+    }
+    xSemaphoreGive(raw->done);
+}
+
+static void raw_udp_send_cb(void *ctx)
+{
+    raw_udp_t *raw = ctx;
+    // PBUF_REF: the stack uses the datagram buffer of the sender, which waits until the datagram is out
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, raw->len, PBUF_REF);
+    if (NULL == p) {
+        raw->err = ERR_MEM;
+    }
+    else {
+        p->payload = (void *)raw->data;
+        raw->err = udp_sendto(raw->pcb, p, &raw->to, raw->to_port);
+        pbuf_free(p);
+    }
+    xSemaphoreGive(raw->done);
+}
+
+static void raw_udp_close_cb(void *ctx)
+{
+    raw_udp_t *raw = ctx;
+    if (NULL != raw->pcb) {
+        udp_remove(raw->pcb);
+        raw->pcb = NULL;
+    }
+    xSemaphoreGive(raw->done);
+}
+
+/**
+ * @brief Run fn in the tcpip thread and wait for it.
+ * @return raw->err, or ERR_MEM if the tcpip thread's queue is full
+ */
+static err_t raw_udp_call(raw_udp_t *raw, tcpip_callback_fn fn)
+{
+    if (ERR_OK != tcpip_callback(fn, raw)) {
+        return ERR_MEM;
+    }
+    xSemaphoreTake(raw->done, portMAX_DELAY);
+    return raw->err;
+}
+
+static bool send_datagram(raw_udp_t *raw, int sock, const void *data, size_t len, const struct sockaddr_in *to)
+{
+    if (server->param.raw_udp) {
+        inet_addr_to_ip4addr(ip_2_ip4(&raw->to), &to->sin_addr);
+        IP_SET_TYPE_VAL(raw->to, IPADDR_TYPE_V4);
+        raw->to_port = ntohs(to->sin_port);
+        raw->data = data;
+        raw->len = len;
+        err_t raw_err = raw_udp_call(raw, raw_udp_send_cb);
+        if (ERR_OK != raw_err) {
+            NETLOGGING_LOGE("udp_sendto failed. err: %d", raw_err);
+            return false;
+        }
+        return true;
+    }
+    if (sendto(sock, data, len, 0, (const struct sockaddr *)to, sizeof(*to)) < 0) {
+        NETLOGGING_LOGE("sendto failed. errno: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void reliable_header(uint8_t *hdr, uint8_t type, uint32_t session, uint32_t seq)
+{
+    memcpy(hdr, RELIABLE_MAGIC, 3);
+    hdr[3] = type;
+    put_u32(hdr + 4, session);
+    put_u32(hdr + 8, seq);
+}
+
+/**
+ * @brief Resend the datagrams a NACK asks for to its sender, or tell it which ones are gone.
+ */
+static void reliable_handle_nack(resend_ring_t *resend, raw_udp_t *raw, int sock, const uint8_t *pkt, size_t len, const struct sockaddr_in *from)
+{
+    if ((len < RELIABLE_HDR_LEN) || (0 != memcmp(pkt, RELIABLE_MAGIC, 3)) || (PKT_NACK != pkt[3]) || (get_u32(pkt + 4) != resend->session)) {
+        return;
+    }
+    // The datagrams next_seq - held .. next_seq - 1 are kept
+    uint32_t held = (resend->next_seq < resend->count) ? resend->next_seq : resend->count;
+    bool gone = false;
+    unsigned resent = 0;
+    for (const uint8_t *range = pkt + RELIABLE_HDR_LEN; range + 6 <= pkt + len; range += 6) {
+        uint32_t seq = get_u32(range);
+        uint16_t n = (range[4] << 8) | range[5];
+        for (; (n > 0) && (resent < resend->count); seq++, n--) {
+            uint32_t age = resend->next_seq - seq; // 1 for the last datagram sent, huge for one not sent yet
+            if ((age == 0) || (age > 0x80000000UL)) {
+                break;
+            }
+            uint8_t *slot = resend->slots + (size_t)(seq % resend->count) * server->param.datagram_size;
+            if ((age > held) || (get_u32(slot + 8) != seq)) { // the slot may have been reused where seq wrapped
+                gone = true;
+                continue;
+            }
+            if (!send_datagram(raw, sock, slot, resend->lens[seq % resend->count], from)) {
+                return;
+            }
+            resent++;
+        }
+    }
+    if (gone) {
+        uint8_t hdr[RELIABLE_HDR_LEN];
+        reliable_header(hdr, PKT_GONE, resend->session, resend->next_seq - held);
+        send_datagram(raw, sock, hdr, sizeof(hdr), from);
+    }
+}
+
+static void reliable_poll_nacks(resend_ring_t *resend, raw_udp_t *raw, int sock)
+{
+    if (server->param.raw_udp) {
+        if (raw->nack_pending) {
+            reliable_handle_nack(resend, raw, sock, raw->nack, raw->nack_len, &raw->nack_from);
+            raw->nack_pending = false;
+        }
+        return;
+    }
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int len;
+    while ((len = recvfrom(sock, raw->nack, sizeof(raw->nack), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len)) > 0) {
+        reliable_handle_nack(resend, raw, sock, raw->nack, len, &from);
+        from_len = sizeof(from);
+    }
 }
 
 // UDP Multicast Log Sender Task
@@ -125,30 +393,47 @@ static void multicast_log_sender(void *pvParameters)
 {
     NETLOGGING_LOGI("start multicast logging: ipaddr=[%s] port=%ld", server->param.ipv4addr, server->param.port);
 
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-    // Create RingBuffer
-    RingbufHandle_t xRingBuffer = xRingbufferCreate(CONFIG_NETLOGGING_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
-    if (NULL == xRingBuffer) {
-        NETLOGGING_LOGE("xRingBufferCreate failed");
+    netlogging_ring_t *ring = NULL;
+    const bool reliable = (server->param.resend_count > 0);
+    raw_udp_t raw = { .port = server->param.port, .receive = reliable };
+    // Without reliable mode there is one slot, the send buffer
+    resend_ring_t resend = {
+        .count = reliable ? server->param.resend_count : 1,
+        .session = esp_random(),
+    };
+    const size_t hdr_len = reliable ? RELIABLE_HDR_LEN : 0;
+    resend.slots = malloc((size_t)resend.count * server->param.datagram_size);
+    resend.lens = calloc(resend.count, sizeof(uint16_t));
+    if ((NULL == resend.slots) || (NULL == resend.lens)) {
+        NETLOGGING_LOGE("malloc fail");
         goto _init_failed;
     }
-    esp_err_t err = netlogging_register_recieveBuffer(xRingBuffer);
-#else
-    // Create MessageBuffer
-    MessageBufferHandle_t xMessageBuffer = xMessageBufferCreate(CONFIG_NETLOGGING_BUFFER_SIZE);
-    if (NULL == xMessageBuffer) {
-        NETLOGGING_LOGE("xMessageBufferCreate failed");
+    if (server->param.raw_udp) {
+        raw.done = xSemaphoreCreateBinary();
+        if (NULL == raw.done) {
+            NETLOGGING_LOGE("xSemaphoreCreateBinary failed");
+            goto _init_failed;
+        }
+    }
+
+    // Create log ring
+    ring = netlogging_ring_create(&server->param.buffer);
+    if (NULL == ring) {
+        NETLOGGING_LOGE("netlogging_ring_create failed");
         goto _init_failed;
     }
-    esp_err_t err = netlogging_register_recieveBuffer(xMessageBuffer);
-#endif
+    esp_err_t err = netlogging_register_ring(ring, NETLOGGING_SINK_MULTICAST);
     if (err != ESP_OK) {
-        NETLOGGING_LOGE("netlogging_register_recieveBuffer failed");
+        NETLOGGING_LOGE("netlogging_register_ring failed");
         goto _init_failed;
     }
+    server->ring = ring;
 
+    uint32_t backoff_ms = RECONNECT_MIN_MS;
     while (server->task_run) // Outer while loop to create socket
     {
+        // This setup covers all network changes so far
+        xEventGroupClearBits(server->state_event, NET_CHANGED_BIT);
         // Configure source interface
         struct in_addr src_addr = {0};
 #if USE_DEFAULT_IF
@@ -162,70 +447,100 @@ static void multicast_log_sender(void *pvParameters)
         /* create the socket */
         int sock = -1;
         struct addrinfo *res_toFree = NULL;
-        if (0 != multicast_setup(&sock, &res_toFree, src_addr, server->param.ipv4addr, server->param.port))
+        if (0 != multicast_setup(server->param.raw_udp ? NULL : &sock, &res_toFree, src_addr, server->param.ipv4addr, server->param.port))
         {
             NETLOGGING_LOGE("Failed to setup");
-            // wait and then try again
-            vTaskDelay(RETRY_TIMEOUT_MS / portTICK_PERIOD_MS);
+            // wait and then try again, or sooner if the network changes
+            backoff_ms = multicast_backoff(backoff_ms);
             continue;
         }
+        struct sockaddr_in group = *(struct sockaddr_in *)res_toFree->ai_addr;
+        freeaddrinfo(res_toFree); // free the addrinfo struct
+        if (server->param.raw_udp) {
+            raw.nack_pending = false;
+            if (ERR_OK != raw_udp_call(&raw, raw_udp_open_cb)) {
+                NETLOGGING_LOGE("Failed to create udp pcb");
+                raw_udp_call(&raw, raw_udp_close_cb);
+                backoff_ms = multicast_backoff(backoff_ms);
+                continue;
+            }
+        }
 
+        bool failed = false;
         while (server->task_run)  // Inner while loop to send data
         {
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-            size_t received = 0;
-            char *buffer = (char *)xRingbufferReceive(xRingBuffer, &received, pdMS_TO_TICKS(1000));
-            //NETLOGGING_LOGI("xRingBufferReceive received=%d", received);
-#else
-            char buffer[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
-            size_t received = xMessageBufferReceive(xMessageBuffer, buffer, sizeof(buffer), pdMS_TO_TICKS(1000));
-            //NETLOGGING_LOGI("xMessageBufferReceive received=%d", received);
-#endif
-            if (received > 0) {
-                //NETLOGGING_LOGI("xMessageBufferReceive buffer=[%.*s]",received, buffer);
-                int sendto_ret = sendto(sock, buffer, received, 0, res_toFree->ai_addr, res_toFree->ai_addrlen);
-                if (sendto_ret < 0)
+            if (xEventGroupGetBits(server->state_event) & NET_CHANGED_BIT) {
+                NETLOGGING_LOGI("Network configuration changed");
+                break;
+            }
+            TickType_t wait = portMAX_DELAY;
+            if (reliable) {
+                reliable_poll_nacks(&resend, &raw, sock);
+                if ((resend.heartbeats_left > 0) && (xTaskGetTickCount() - resend.last_sent >= pdMS_TO_TICKS(HEARTBEAT_MS))) {
+                    uint8_t hdr[RELIABLE_HDR_LEN];
+                    reliable_header(hdr, PKT_HEARTBEAT, resend.session, resend.next_seq - 1);
+                    send_datagram(&raw, sock, hdr, sizeof(hdr), &group);
+                    resend.last_sent = xTaskGetTickCount();
+                    resend.heartbeats_left--;
+                }
+                wait = pdMS_TO_TICKS(server->param.raw_udp ? HEARTBEAT_MS : NACK_POLL_MS);
+            }
+            // As many lines as fit into one datagram, with notices where lines were lost.
+            // Waits until there are lines, or netlogging_ring_wake() is called.
+            uint16_t slot = resend.next_seq % resend.count;
+            uint8_t *datagram = resend.slots + (size_t)slot * server->param.datagram_size;
+            size_t len = netlogging_ring_receive_batch(ring, (char *)datagram + hdr_len, server->param.datagram_size - hdr_len, wait);
+            if (len > 0) {
+                if (reliable) {
+                    // Kept even if sending fails, a receiver can still ask for it
+                    reliable_header(datagram, PKT_DATA, resend.session, resend.next_seq);
+                    len += hdr_len;
+                    resend.lens[slot] = len;
+                    resend.next_seq++;
+                    resend.last_sent = xTaskGetTickCount();
+                    resend.heartbeats_left = HEARTBEAT_COUNT;
+                }
+                if (!send_datagram(&raw, sock, datagram, len, &group))
                 {
-                    NETLOGGING_LOGE("sendto failed. errno: %d", errno);
-                    // wait and then try again
-                    vTaskDelay(RETRY_TIMEOUT_MS / portTICK_PERIOD_MS);
+                    failed = true;
                     break; // break out of the inner while loop, back to the outer while loop to try to create the socket again
                 }
-
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-                vRingbufferReturnItem(xRingBuffer, (void *)buffer);
-#endif
+                backoff_ms = RECONNECT_MIN_MS;
             }
-            // Else timed out waiting for data from buffer, round the loop to check if task should keep running
+            // Else woken up or timed out, round the loop to check if task should keep running
 
         } // end inner while
 
         NETLOGGING_LOGI("close socket and restart...");
-        freeaddrinfo(res_toFree); // free the addrinfo struct
+        if (server->param.raw_udp) {
+            raw_udp_call(&raw, raw_udp_close_cb);
+        }
         if (sock != -1) {
             shutdown(sock, 0);
             close(sock);
         }
+        if (failed) {
+            // wait and then try again, or sooner if the network changes
+            backoff_ms = multicast_backoff(backoff_ms);
+        }
     } // end outer while
 
 _init_failed:
     // Cleanup. Task is only responsible for freeing memory that it allocated.
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-    netlogging_unregister_recieveBuffer(xRingBuffer);
-    if (xRingBuffer != NULL) {
-        vRingbufferDelete(xRingBuffer);
-        xRingBuffer = NULL;
+    server->ring = NULL;
+    if (ring != NULL) {
+        netlogging_unregister_ring(ring);
+        netlogging_ring_delete(ring);
+        ring = NULL;
     }
-#else
-    netlogging_unregister_recieveBuffer(xMessageBuffer);
-    if (xMessageBuffer != NULL) {
-        vMessageBufferDelete(xMessageBuffer);
-        xMessageBuffer = NULL;
+    if (raw.done != NULL) {
+        vSemaphoreDelete(raw.done);
     }
-#endif
+    free(resend.slots);
+    free(resend.lens);
     xEventGroupSetBits(server->state_event, STOPPED_BIT);
     NETLOGGING_LOGI("multicast_log_sender task stopped");
-    vTaskDelete(NULL);
+    netlogging_task_exit(&server->task);
 }
 
 esp_err_t netlogging_multicast_sender_run(void)
@@ -234,11 +549,18 @@ esp_err_t netlogging_multicast_sender_run(void)
         return ESP_ERR_INVALID_STATE;
     }
 
+    // Register for events that indicate a change in network configuration
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_START, network_changed_handler, NULL);
+    esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, network_changed_handler, NULL);
+
     // Start Multicast Sender task
     server->task_run = true;
-    if(xTaskCreate(multicast_log_sender, "MCAST", 1024 * 6, NULL, 2, NULL)!= pdPASS) {
+    xEventGroupClearBits(server->state_event, STOPPED_BIT | WAKEUP_BIT | NET_CHANGED_BIT);
+    if (netlogging_task_create(&server->task, multicast_log_sender, "MCAST", 1024 * 6, NULL, 2) != ESP_OK) {
         NETLOGGING_LOGE("xTaskCreate failed");
         server->task_run = false;
+        esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_AP_START, network_changed_handler);
+        esp_event_handler_unregister(IP_EVENT, ESP_EVENT_ANY_ID, network_changed_handler);
         return ESP_FAIL;
     }
     return ESP_OK;
@@ -263,9 +585,15 @@ esp_err_t netlogging_multicast_sender_stop(void)
     if (NULL == server) {
         return ESP_ERR_INVALID_STATE;
     }
-    /* Tell task to stop and delete itself */
+    esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_AP_START, network_changed_handler);
+    esp_event_handler_unregister(IP_EVENT, ESP_EVENT_ANY_ID, network_changed_handler);
+    /* Tell task to stop and delete itself, it wakes up at once */
     server->task_run = false;
+    multicast_wake(0);
     esp_err_t ret = netlogging_multicast_sender_wait_for_stop();
+    if (ret == ESP_OK) {
+        netlogging_task_reap(&server->task);
+    }
     return ret;
 }
 
@@ -281,6 +609,11 @@ esp_err_t netlogging_multicast_sender_init(const multicast_logging_param_t *para
     }
     memset(server, 0, sizeof(struct server_handle_s));
     server->param = *param;
+    const size_t min_datagram_size = CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH + NETLOGGING_DROPPED_NOTICE_MAX_LENGTH +
+                                     ((server->param.resend_count > 0) ? RELIABLE_HDR_LEN : 0);
+    if (server->param.datagram_size < min_datagram_size) {
+        server->param.datagram_size = min_datagram_size; // the longest line and its notice
+    }
     server->state_event = xEventGroupCreate();
     if (server->state_event == NULL) {
         NETLOGGING_LOGE("xEventGroupCreate failed");
@@ -301,6 +634,7 @@ esp_err_t netlogging_multicast_sender_deinit(void)
         {
             vEventGroupDelete(server->state_event);
         }
+        netlogging_task_free(&server->task);
 
         free(server);
         server = NULL;
@@ -0,0 +1,360 @@
+/*
+    Syslog Log Sender for ESP32 remote logging
+
+    Sends each log line as an RFC 5424 message: the esp_log level becomes the severity, the task the PROCID and the
+    tag the MSGID. Over UDP each message is one datagram, over TCP the messages are collected into batches with
+    RFC 6587 octet-counting framing.
+*/
+
+#include "net_logging.h"
+#include "net_logging_priv.h"
+//#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE // set log level in this file only
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION > ESP_IDF_VERSION_VAL(4, 4, 0)
+#include "esp_mac.h" // esp_base_mac_addr_get
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "lwip/sockets.h"
+
+#define STOPPED_BIT (1UL << 0) // bit to signal that task has stopped
+#define WAKEUP_BIT (1UL << 1) // bit to cut a reconnect wait short on stop
+#define STOP_WAITTIME (8000 / portTICK_PERIOD_MS) // wait this long for task to stop
+#define HOSTNAME_MAX_LENGTH (64)
+#define APP_NAME_MAX_LENGTH (48) // limit of RFC 5424
+#define PROCID_MAX_LENGTH (128) // limit of RFC 5424, task names may be longer
+#define MSGID_MAX_LENGTH (32) // limit of RFC 5424
+// "<191>1 " and "2024-05-01T12:00:00.123Z ", then the fields, each but the last followed by a space
+#define HEADER_MAX_LENGTH (7 + 25 + (HOSTNAME_MAX_LENGTH + 1) + (APP_NAME_MAX_LENGTH + 1) + (PROCID_MAX_LENGTH + 1) + MSGID_MAX_LENGTH)
+#define SD_MAX_LENGTH (56) // " [meta sequenceId=\"2147483647\" sysUpTime=\"4294967295\"]" and the space before the line
+#define SYSLOG_MSG_MAX_LENGTH (HEADER_MAX_LENGTH + SD_MAX_LENGTH + CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH)
+#define FRAME_MAX_LENGTH (6 + SYSLOG_MSG_MAX_LENGTH) // "MSG-LEN SP" in front of a message
+#define VALID_TIME (1600000000) // the wall clock is set if it is later than this (2020)
+
+#define TAG "syslog_log_sender"
+
+struct server_handle_s
+{
+    syslog_logging_param_t param;
+    char hostname[HOSTNAME_MAX_LENGTH + 1];
+    volatile bool task_run;
+    netlogging_task_t task;
+    EventGroupHandle_t state_event;      /*!< Task's state event group */
+};
+static struct server_handle_s *server = NULL;
+
+/**
+ * @brief Copy a header field. Characters that syslog doesn't allow in it, like spaces, become '_'.
+ * @return Pointer behind the field, which is "-" if nothing is left
+ */
+static char *syslog_field(char *out, const char *s, size_t len, size_t max_len)
+{
+    char *p = out;
+    for (size_t i = 0; (i < len) && (s[i] != '\0') && ((size_t)(p - out) < max_len); i++) {
+        *p++ = ((s[i] > ' ') && (s[i] <= '~')) ? s[i] : '_';
+    }
+    if (p == out) {
+        *p++ = '-';
+    }
+    return p;
+}
+
+/**
+ * @brief Format one line as an RFC 5424 message, e.g.
+ *        <14>1 2024-05-01T12:00:00.123Z esp-a0b1c2d3e4f5 app main wifi [meta sequenceId="42" sysUpTime="123"] connected
+ * @return Length of the message, at most SYSLOG_MSG_MAX_LENGTH
+ */
+static size_t syslog_format(char *out, const netlogging_record_hdr_t *hdr, const char *text, size_t len)
+{
+    // Severities of ESP_LOG_NONE (line without level), ERROR, WARN, INFO, DEBUG, VERBOSE
+    static const uint8_t severity[] = { 5, 3, 4, 6, 7, 7 };
+
+    // The tag and the message without the prefix, color codes and newline were found when the line was logged
+    const char *tag = text + hdr->tag_offset;
+    const char *message = text + hdr->msg_offset;
+    size_t msg_len = (hdr->msg_offset + hdr->msg_len <= len) ? hdr->msg_len : 0;
+
+    char *p = out;
+    uint8_t level = (hdr->level < sizeof(severity)) ? hdr->level : ESP_LOG_NONE;
+    p += sprintf(p, "<%u>1 ", server->param.facility * 8 + severity[level]);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec > VALID_TIME) {
+        struct tm tm;
+        gmtime_r(&tv.tv_sec, &tm);
+        p += strftime(p, 24, "%Y-%m-%dT%H:%M:%S", &tm);
+        p += sprintf(p, ".%03dZ ", (int)(tv.tv_usec / 1000));
+    }
+    else {
+        p += sprintf(p, "- ");
+    }
+    p = syslog_field(p, server->hostname, strlen(server->hostname), HOSTNAME_MAX_LENGTH);
+    *p++ = ' ';
+    const char *app_name = server->param.app_name ? server->param.app_name : "";
+    p = syslog_field(p, app_name, strlen(app_name), APP_NAME_MAX_LENGTH);
+    *p++ = ' ';
+    p = syslog_field(p, hdr->task, sizeof(hdr->task), PROCID_MAX_LENGTH);
+    *p++ = ' ';
+    p = syslog_field(p, tag, hdr->tag_len, MSGID_MAX_LENGTH);
+    // sequenceId runs from 1 to 2147483647
+    p += sprintf(p, " [meta sequenceId=\"%"PRIu32"\"", (hdr->seq % 2147483647) + 1);
+    p += sprintf(p, " sysUpTime=\"%"PRIu32"\"", hdr->timestamp / 10); // in hundredths of a second
+    *p++ = ']';
+    if (msg_len > 0) {
+        *p++ = ' ';
+        memcpy(p, message, msg_len);
+        p += msg_len;
+    }
+    return p - out;
+}
+
+/**
+ * @brief Find how much of a batch was written in complete frames.
+ * @return Length of the complete "MSG-LEN SP MSG" frames at the start of the batch
+ */
+static size_t syslog_frames_written(const char *batch, size_t written)
+{
+    size_t done = 0;
+    while (done < written) {
+        size_t i = done;
+        size_t msg_len = 0;
+        while ((i < written) && (batch[i] >= '0') && (batch[i] <= '9')) {
+            msg_len = msg_len * 10 + (batch[i++] - '0');
+        }
+        if ((i >= written) || (batch[i] != ' ') || (i + 1 + msg_len > written)) {
+            break;
+        }
+        done = i + 1 + msg_len;
+    }
+    return done;
+}
+
+// Syslog Log Sender Task
+static void syslog_log_sender(void *pvParameters)
+{
+    const syslog_logging_param_t *param = &server->param;
+    const bool tcp = (NETLOGGING_SYSLOG_TCP == param->transport);
+    NETLOGGING_LOGI("start syslog logging: host=[%s] port=%lu %s", param->host, param->port, tcp ? "tcp" : "udp");
+
+    netlogging_ring_t *ring = NULL;
+    size_t batch_len = 0;
+    char *batch = NULL;
+    char *msg = malloc(SYSLOG_MSG_MAX_LENGTH);
+    if (tcp) {
+        batch = malloc(param->batch_size + 2 * FRAME_MAX_LENGTH); // a line and its drop notice
+    }
+    if ((NULL == msg) || (tcp && (NULL == batch))) {
+        NETLOGGING_LOGE("malloc fail");
+        goto _init_failed;
+    }
+
+    // Create log ring
+    ring = netlogging_ring_create(&param->buffer);
+    if (NULL == ring) {
+        NETLOGGING_LOGE("netlogging_ring_create failed");
+        goto _init_failed;
+    }
+    esp_err_t err = netlogging_register_ring(ring, NETLOGGING_SINK_SYSLOG);
+    if (err != ESP_OK) {
+        NETLOGGING_LOGE("netlogging_register_ring failed");
+        goto _init_failed;
+    }
+
+    uint32_t backoff_ms = param->reconnect_min_ms;
+    while (server->task_run) // Outer while loop to connect
+    {
+        int sock = tcp ? netlogging_tcp_connect(param->host, param->port, false, 0) : netlogging_udp_connect(param->host, param->port);
+        if (sock < 0) {
+            // Wait and then try again
+            xEventGroupWaitBits(server->state_event, WAKEUP_BIT, true, false, pdMS_TO_TICKS(backoff_ms));
+            backoff_ms = (backoff_ms * 2 < param->reconnect_max_ms) ? backoff_ms * 2 : param->reconnect_max_ms;
+            continue;
+        }
+        backoff_ms = param->reconnect_min_ms;
+
+        int64_t flush_at = 0;
+        const int64_t flush_interval_us = (int64_t)param->flush_interval_ms * 1000;
+        bool failed = false;
+        while (server->task_run && !failed)  // Inner while loop to send data
+        {
+            // What is left of a TCP batch from a broken connection is sent first
+            size_t received = 0;
+            if (batch_len < param->batch_size) {
+                TickType_t wait = pdMS_TO_TICKS(1000);
+                if (batch_len > 0) {
+                    int64_t left_us = flush_at - esp_timer_get_time();
+                    wait = (left_us > 0) ? pdMS_TO_TICKS(left_us / 1000) : 0;
+                }
+                netlogging_record_hdr_t hdr;
+                char buffer[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
+                received = netlogging_ring_receive(ring, &hdr, buffer, sizeof(buffer), wait);
+                if (received > 0) {
+                    if ((0 == batch_len) && tcp) {
+                        flush_at = esp_timer_get_time() + flush_interval_us;
+                    }
+                    for (int i = (hdr.dropped > 0) ? 0 : 1; i < 2; i++) {
+                        size_t msg_len;
+                        if (0 == i) {
+                            // Tell the server that lines are missing here, as a warning of its own
+                            netlogging_record_hdr_t notice_hdr = { .seq = hdr.seq, .timestamp = esp_log_timestamp() };
+                            char notice[NETLOGGING_DROPPED_NOTICE_MAX_LENGTH];
+                            int notice_len = netlogging_format_dropped(notice, sizeof(notice), hdr.dropped);
+                            netlogging_record_parse(&notice_hdr, notice, notice_len);
+                            msg_len = syslog_format(msg, &notice_hdr, notice, notice_len);
+                        }
+                        else {
+                            msg_len = syslog_format(msg, &hdr, buffer, received);
+                        }
+                        if (tcp) {
+                            batch_len += sprintf(batch + batch_len, "%u ", (unsigned)msg_len);
+                            memcpy(batch + batch_len, msg, msg_len);
+                            batch_len += msg_len;
+                        }
+                        else if (send(sock, msg, msg_len, 0) < 0) {
+                            // The datagram is lost
+                            NETLOGGING_LOGE("send failed. errno: %d", errno);
+                            failed = true;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // Write when the batch is full, or when it is due and no more lines are waiting
+            if ((batch_len >= param->batch_size) ||
+                ((batch_len > 0) && (0 == received) && (esp_timer_get_time() >= flush_at))) {
+                size_t sent_len;
+                if (!netlogging_send_all(sock, batch, batch_len, &sent_len)) {
+                    // Keep the messages that were not written completely. The server discards the incomplete message
+                    // at the end of the broken connection, and gets it again on the next one.
+                    size_t done = syslog_frames_written(batch, sent_len);
+                    memmove(batch, batch + done, batch_len - done);
+                    batch_len -= done;
+                    break;
+                }
+                batch_len = 0;
+            }
+        } // end inner while
+
+        if (failed) {
+            // Don't spin if the network is gone
+            xEventGroupWaitBits(server->state_event, WAKEUP_BIT, true, false, pdMS_TO_TICKS(param->reconnect_min_ms));
+        }
+        NETLOGGING_LOGI("close socket and restart...");
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
+    } // end outer while
+
+_init_failed:
+    // Cleanup. Task is only responsible for freeing memory that it allocated.
+    if (ring != NULL) {
+        netlogging_unregister_ring(ring);
+        netlogging_ring_delete(ring);
+        ring = NULL;
+    }
+    free(batch);
+    free(msg);
+    xEventGroupSetBits(server->state_event, STOPPED_BIT);
+    NETLOGGING_LOGI("syslog_log_sender task stopped");
+    netlogging_task_exit(&server->task);
+}
+
+esp_err_t netlogging_syslog_client_run(void)
+{
+    if (NULL == server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Start Syslog Sender task
+    server->task_run = true;
+    xEventGroupClearBits(server->state_event, STOPPED_BIT | WAKEUP_BIT);
+    if (netlogging_task_create(&server->task, syslog_log_sender, "SYSLOG", 1024 * 4, NULL, 2) != ESP_OK) {
+        NETLOGGING_LOGE("xTaskCreate failed");
+        server->task_run = false;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t netlogging_syslog_client_stop(void)
+{
+    if (NULL == server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* Tell task to stop and delete itself */
+    server->task_run = false;
+    xEventGroupSetBits(server->state_event, WAKEUP_BIT);
+    EventBits_t uxBits = xEventGroupWaitBits(server->state_event, STOPPED_BIT, false, true, STOP_WAITTIME);
+    if (0 == (uxBits & STOPPED_BIT)) {
+        return ESP_ERR_TIMEOUT;
+    }
+    netlogging_task_reap(&server->task);
+    return ESP_OK;
+}
+
+esp_err_t netlogging_syslog_client_init(const syslog_logging_param_t *param)
+{
+    if ((NULL == param) || (NULL == param->host) || (param->facility > 23) ||
+        ((NETLOGGING_SYSLOG_TCP == param->transport) && (0 == param->batch_size))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Allocate memory for the handle
+    server = malloc(sizeof(struct server_handle_s));
+    if (server == NULL) {
+        NETLOGGING_LOGE("malloc fail");
+        return ESP_ERR_NO_MEM;
+    }
+    memset(server, 0, sizeof(struct server_handle_s));
+    server->param = *param;
+    if (0 == server->param.reconnect_min_ms) {
+        server->param.reconnect_min_ms = 500;
+    }
+    if (server->param.reconnect_max_ms < server->param.reconnect_min_ms) {
+        server->param.reconnect_max_ms = server->param.reconnect_min_ms;
+    }
+    if (param->hostname) {
+        snprintf(server->hostname, sizeof(server->hostname), "%s", param->hostname);
+    }
+    else {
+        uint8_t mac[8];
+        esp_base_mac_addr_get(mac);
+        snprintf(server->hostname, sizeof(server->hostname), "esp-%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+    server->state_event = xEventGroupCreate();
+    if (server->state_event == NULL) {
+        NETLOGGING_LOGE("xEventGroupCreate failed");
+        goto _init_failed;
+    }
+    return ESP_OK;
+
+_init_failed:
+    netlogging_syslog_client_deinit();
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t netlogging_syslog_client_deinit(void)
+{
+    if (server)
+    {
+        if (server->state_event)
+        {
+            vEventGroupDelete(server->state_event);
+        }
+        netlogging_task_free(&server->task);
+
+        free(server);
+        server = NULL;
+        return ESP_OK;
+    }
+    return ESP_FAIL;
+}
@@ -1,150 +1,322 @@
 /*
-	TCP Client
+    TCP Log Sender for ESP32 remote logging
 
-	This example code is in the Public Domain (or CC0 licensed, at your option.)
-
-	Unless required by applicable law or agreed to in writing, this
-	software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
-	CONDITIONS OF ANY KIND, either express or implied.
+    Keeps a connection to a TCP server, and reconnects with backoff when it is lost.
+    The lines are collected into batches and written with newline or length-prefix framing.
+    With gzip, each connection is one gzip stream that is flushed after every batch.
 */
 
+#include "net_logging.h"
+#include "net_logging_priv.h"
+//#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE // set log level in this file only
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_system.h"
+#include "esp_event.h"
+#include "esp_timer.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-#include "freertos/ringbuf.h"
-#else
-#include "freertos/message_buffer.h"
-#endif
-#include "esp_system.h"
-#include "esp_log.h"
+#include "freertos/event_groups.h"
 #include "lwip/sockets.h"
-#include "netdb.h" // gethostbyname
 
-#include "net_logging_priv.h"
+#define STOPPED_BIT (1UL << 0) // bit to signal that task has stopped
+#define WAKEUP_BIT (1UL << 1) // bit to cut a reconnect wait short: got an IP address, or stop requested
+#define STOP_WAITTIME (8000 / portTICK_PERIOD_MS) // wait this long for task to stop
+#define FRAME_MAX_LENGTH (4 + NETLOGGING_DROPPED_NOTICE_MAX_LENGTH + CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH) // a line and its drop notice
+
+#define TAG "tcp_log_sender"
+
+struct server_handle_s
+{
+    tcp_logging_param_t param;
+    volatile bool task_run;
+    netlogging_task_t task;
+    EventGroupHandle_t state_event;      /*!< Task's state event group */
+};
+static struct server_handle_s *server = NULL;
+
+static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if ((IP_EVENT_STA_GOT_IP == event_id) || (IP_EVENT_ETH_GOT_IP == event_id) || (IP_EVENT_GOT_IP6 == event_id)) {
+        // Don't wait for the backoff to run out, the network is back
+        xEventGroupSetBits(server->state_event, WAKEUP_BIT);
+    }
+}
+
+/**
+ * @brief Write a batch, through the compressor if there is one.
+ * @param[out] written Bytes of the batch that the network stack took. Always 0 if compressed,
+ *             the compressed stream of a broken connection can't be continued.
+ * @return false if the connection or the compressor failed
+ */
+static bool tcp_write_batch(int sock, netlogging_deflate_t *deflate, netlogging_buffer_t *zbuf, const char *batch, size_t len, size_t *written)
+{
+    *written = 0;
+    if (NULL == deflate) {
+        return netlogging_send_all(sock, batch, len, written);
+    }
+    // Sync flush, so that the server can decompress the batch right away
+    int64_t start = esp_timer_get_time();
+    zbuf->len = 0;
+    bool ok = netlogging_deflate_write(deflate, batch, len) && netlogging_deflate_flush(deflate);
+    netlogging_stats_add_compression(NETLOGGING_SINK_TCP, len, zbuf->len, esp_timer_get_time() - start);
+    if (!ok) {
+        NETLOGGING_LOGE("compression failed");
+        return false;
+    }
+    return netlogging_send_all(sock, zbuf->data, zbuf->len, NULL);
+}
+
+/**
+ * @brief Find where the first frame starts that was not written completely
+ * @param written Bytes written from the start of the batch
+ */
+static size_t tcp_frames_written(const char *batch, size_t written, netlogging_tcp_framing_t framing)
+{
+    size_t done = 0;
+    if (NETLOGGING_TCP_FRAMING_LENGTH_PREFIX == framing) {
+        while (done + 4 <= written) {
+            const uint8_t *p = (const uint8_t *)batch + done;
+            size_t frame = 4 + (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]);
+            if (done + frame > written) {
+                break;
+            }
+            done += frame;
+        }
+        return done;
+    }
+    for (size_t i = 0; i < written; i++) {
+        if ('\n' == batch[i]) {
+            done = i + 1;
+        }
+    }
+    return done;
+}
+
+/**
+ * @brief Append one frame to the batch.
+ * @return Number of bytes written, at most FRAME_MAX_LENGTH
+ */
+static size_t tcp_append_frame(char *out, netlogging_tcp_framing_t framing, const char *text, size_t len)
+{
+    if (NETLOGGING_TCP_FRAMING_LENGTH_PREFIX == framing) {
+        out[0] = (len >> 24) & 0xFF;
+        out[1] = (len >> 16) & 0xFF;
+        out[2] = (len >> 8) & 0xFF;
+        out[3] = len & 0xFF;
+        memcpy(out + 4, text, len);
+        return 4 + len;
+    }
+    memcpy(out, text, len);
+    if ((0 == len) || (text[len - 1] != '\n')) {
+        out[len++] = '\n';
+    }
+    return len;
+}
+
+// TCP Log Sender Task
+static void tcp_log_sender(void *pvParameters)
+{
+    NETLOGGING_LOGI("start tcp logging: ipaddr=[%s] port=%ld", server->param.ipv4addr, server->param.port);
+
+    const tcp_logging_param_t *param = &server->param;
+    netlogging_ring_t *ring = NULL;
+    netlogging_deflate_t *deflate = NULL;
+    netlogging_buffer_t zbuf = { 0 };
+    size_t batch_len = 0;
+    char *batch = malloc(param->batch_size + FRAME_MAX_LENGTH);
+    if (NULL == batch) {
+        NETLOGGING_LOGE("malloc fail");
+        goto _init_failed;
+    }
+    if (param->gzip) {
+        // Room for a batch that doesn't compress at all, plus block headers and the flush marker
+        zbuf.size = (param->batch_size + FRAME_MAX_LENGTH) * 9 / 8 + 64;
+        zbuf.data = malloc(zbuf.size);
+        deflate = netlogging_compressor_create(NETLOGGING_SINK_TCP, netlogging_buffer_append, &zbuf);
+        if ((NULL == zbuf.data) || (NULL == deflate)) {
+            NETLOGGING_LOGE("malloc fail");
+            goto _init_failed;
+        }
+    }
+
+    // Create log ring
+    ring = netlogging_ring_create(&param->buffer);
+    if (NULL == ring) {
+        NETLOGGING_LOGE("netlogging_ring_create failed");
+        goto _init_failed;
+    }
+    esp_err_t err = netlogging_register_ring(ring, NETLOGGING_SINK_TCP);
+    if (err != ESP_OK) {
+        NETLOGGING_LOGE("netlogging_register_ring failed");
+        goto _init_failed;
+    }
+
+    uint32_t backoff_ms = param->reconnect_min_ms;
+    while (server->task_run) // Outer while loop to connect
+    {
+        int sock = netlogging_tcp_connect(param->ipv4addr, param->port, param->nodelay, param->sndbuf);
+        if (sock < 0) {
+            // Wait and then try again, or sooner if the network comes back
+            xEventGroupWaitBits(server->state_event, WAKEUP_BIT, true, false, pdMS_TO_TICKS(backoff_ms));
+            backoff_ms = (backoff_ms * 2 < param->reconnect_max_ms) ? backoff_ms * 2 : param->reconnect_max_ms;
+            continue;
+        }
+        NETLOGGING_LOGI("connected to %s:%lu", param->ipv4addr, param->port);
+        backoff_ms = param->reconnect_min_ms;
+        if (deflate != NULL) {
+            netlogging_deflate_reset(deflate); // new gzip stream for the new connection
+        }
+
+        int64_t flush_at = 0;
+        const int64_t flush_interval_us = (int64_t)param->flush_interval_ms * 1000;
+        while (server->task_run)  // Inner while loop to send data
+        {
+            // What is left of a batch from a broken connection is sent first
+            size_t received = 0;
+            if (batch_len < param->batch_size) {
+                TickType_t wait = pdMS_TO_TICKS(1000);
+                if (batch_len > 0) {
+                    int64_t left_us = flush_at - esp_timer_get_time();
+                    wait = (left_us > 0) ? pdMS_TO_TICKS(left_us / 1000) : 0;
+                }
+                netlogging_record_hdr_t hdr;
+                char buffer[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
+                received = netlogging_ring_receive(ring, &hdr, buffer, sizeof(buffer), wait);
+                if (received > 0) {
+                    if (0 == batch_len) {
+                        flush_at = esp_timer_get_time() + flush_interval_us;
+                    }
+                    if (hdr.dropped > 0) {
+                        // Tell the server that lines are missing here
+                        char notice[NETLOGGING_DROPPED_NOTICE_MAX_LENGTH];
+                        int notice_len = netlogging_format_dropped(notice, sizeof(notice), hdr.dropped);
+                        batch_len += tcp_append_frame(batch + batch_len, param->framing, notice, notice_len);
+                    }
+                    batch_len += tcp_append_frame(batch + batch_len, param->framing, buffer, received);
+                }
+            }
+
+            // Write when the batch is full, or when it is due and no more lines are waiting
+            if ((batch_len >= param->batch_size) ||
+                ((batch_len > 0) && (0 == received) && (esp_timer_get_time() >= flush_at))) {
+                size_t written;
+                if (!tcp_write_batch(sock, deflate, &zbuf, batch, batch_len, &written)) {
+                    // Keep the frames that were not written completely. The server drops the incomplete frame at the
+                    // end of the broken connection, and gets it again on the next one.
+                    size_t done = tcp_frames_written(batch, written, param->framing);
+                    memmove(batch, batch + done, batch_len - done);
+                    batch_len -= done;
+                    break;
+                }
+                batch_len = 0;
+            }
+        } // end inner while
+
+        NETLOGGING_LOGI("close socket and restart...");
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
+    } // end outer while
+
+_init_failed:
+    // Cleanup. Task is only responsible for freeing memory that it allocated.
+    if (ring != NULL) {
+        netlogging_unregister_ring(ring);
+        netlogging_ring_delete(ring);
+        ring = NULL;
+    }
+    netlogging_compressor_delete(NETLOGGING_SINK_TCP, deflate);
+    free(zbuf.data);
+    free(batch);
+    xEventGroupSetBits(server->state_event, STOPPED_BIT);
+    NETLOGGING_LOGI("tcp_log_sender task stopped");
+    netlogging_task_exit(&server->task);
+}
+
+esp_err_t netlogging_tcp_client_run(void)
+{
+    if (NULL == server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, ip_event_handler, NULL);
 
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-extern RingbufHandle_t xRingBufferTCP;
-#else
-extern MessageBufferHandle_t xMessageBufferTCP;
-#endif
+    // Start TCP Sender task
+    server->task_run = true;
+    xEventGroupClearBits(server->state_event, STOPPED_BIT | WAKEUP_BIT);
+    if (netlogging_task_create(&server->task, tcp_log_sender, "TCP", 1024 * 4, NULL, 2) != ESP_OK) {
+        NETLOGGING_LOGE("xTaskCreate failed");
+        server->task_run = false;
+        esp_event_handler_unregister(IP_EVENT, ESP_EVENT_ANY_ID, ip_event_handler);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
 
-void tcp_client(void *pvParameters)
+esp_err_t netlogging_tcp_client_stop(void)
 {
-	PARAMETER_t *task_parameter = pvParameters;
-	PARAMETER_t param;
-	memcpy((char *)&param, task_parameter, sizeof(PARAMETER_t));
-	printf("Start:param.port=%d param.ipv4=[%s]\n", param.port, param.ipv4);
-
-	int addr_family = 0;
-	int ip_protocol = 0;
-
-	struct sockaddr_in dest_addr;
-	dest_addr.sin_addr.s_addr = inet_addr(param.ipv4);
-	dest_addr.sin_family = AF_INET;
-	dest_addr.sin_port = htons(param.port);
-	addr_family = AF_INET;
-	ip_protocol = IPPROTO_IP;
-
-	printf("dest_addr.sin_addr.s_addr=0x%"PRIx32"\n", dest_addr.sin_addr.s_addr);
-	if (dest_addr.sin_addr.s_addr == 0xffffffff) {
-		struct hostent *hp;
-		hp = gethostbyname(param.ipv4);
-		if (hp == NULL) {
-			printf("FTP Client Error: Connect, gethostbyname\n");
-			vTaskDelete(NULL);
-		}
-		struct ip4_addr *ip4_addr;
-		ip4_addr = (struct ip4_addr *)hp->h_addr;
-		dest_addr.sin_addr.s_addr = ip4_addr->addr;
-		printf("dest_addr.sin_addr.s_addr=0x%"PRIx32"\n", dest_addr.sin_addr.s_addr);
-	}
-
-
-	int sock = socket(addr_family, SOCK_STREAM, ip_protocol);
-	if (sock < 0) {
-		//ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-		vTaskDelete(NULL);
-	}
-	printf("Socket created, connecting to %s:%d\n", param.ipv4, param.port);
-
-	int err = connect(sock, (struct sockaddr *)&dest_addr, sizeof(struct sockaddr_in));
-	if (err == 0) {
-		printf("Successfully connected\n");
-	} else {
-		printf("Socket unable to connect: errno %d\n", errno);
-		vTaskDelete(NULL);
-	}
-
-	// Send ready to receive notify
-	xTaskNotifyGive(param.taskHandle);
-
-	while (1) {
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-        size_t received;
-        char *buffer = (char *)xRingbufferReceive(xRingBufferTCP, &received, portMAX_DELAY);
-        //printf("xRingBufferReceive received=%d\n", received);
-#else
-		char buffer[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
-		size_t received = xMessageBufferReceive(xMessageBufferTCP, buffer, sizeof(buffer), portMAX_DELAY);
-		//printf("xMessageBufferReceive received=%d\n", received);
-#endif
-		if (received > 0) {
-			//printf("xMessageBufferReceive buffer=[%.*s]\n",received, buffer);
-			int ret = send(sock, buffer, received, 0);
-			LWIP_ASSERT("ret == received", ret == received);
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-            vRingbufferReturnItem(xRingBufferTCP, (void *)buffer);
-#endif
-		} else {
-			//printf("xMessageBufferReceive fail\n");
-			break;
-		} // end if
-	} // end while
-
-	if (sock != -1) {
-		//ESP_LOGE(TAG, "Shutting down socket and restarting...");
-		shutdown(sock, 0);
-		close(sock);
-	}
-	vTaskDelete(NULL);
+    if (NULL == server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_event_handler_unregister(IP_EVENT, ESP_EVENT_ANY_ID, ip_event_handler);
+    /* Tell task to stop and delete itself */
+    server->task_run = false;
+    xEventGroupSetBits(server->state_event, WAKEUP_BIT);
+    EventBits_t uxBits = xEventGroupWaitBits(server->state_event, STOPPED_BIT, false, true, STOP_WAITTIME);
+    if (0 == (uxBits & STOPPED_BIT)) {
+        return ESP_ERR_TIMEOUT;
+    }
+    netlogging_task_reap(&server->task);
+    return ESP_OK;
 }
 
-esp_err_t tcp_logging_init(const char *ipaddr, unsigned long port) {
-
-    #if CONFIG_NETLOGGING_USE_RINGBUFFER
-        printf("start tcp logging(xRingBuffer): ipaddr=[%s] port=%ld\n", ipaddr, port);
-        // Create RineBuffer
-        xRingBufferTCP = xRingbufferCreate(CONFIG_NETLOGGING_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
-        configASSERT( xRingBufferTCP );
-    #else
-        printf("start tcp logging(xMessageBuffer): ipaddr=[%s] port=%ld\n", ipaddr, port);
-        // Create MessageBuffer
-        xMessageBufferTCP = xMessageBufferCreate(CONFIG_NETLOGGING_BUFFER_SIZE);
-        configASSERT( xMessageBufferTCP );
-    #endif
-
-        // Start TCP task
-        PARAMETER_t param;
-        param.port = port;
-        strcpy(param.ipv4, ipaddr);
-        param.taskHandle = xTaskGetCurrentTaskHandle();
-        xTaskCreate(tcp_client, "TCP", 1024*6, (void *)&param, 2, NULL);
-
-        // Wait for ready to receive notify
-        uint32_t value = ulTaskNotifyTake( pdTRUE, pdMS_TO_TICKS(1000) );
-        printf("tcp ulTaskNotifyTake=%"PRIi32"\n", value);
-        if (value == 0) {
-            printf("stop tcp logging\n");
-    #if CONFIG_NETLOGGING_USE_RINGBUFFER
-            vRingbufferDelete(xRingBufferTCP);
-            xRingBufferTCP = NULL;
-    #else
-            vMessageBufferDelete(xMessageBufferTCP);
-            xMessageBufferTCP = NULL;
-    #endif
+esp_err_t netlogging_tcp_client_init(const tcp_logging_param_t *param)
+{
+    if ((NULL == param) || (NULL == param->ipv4addr) || (0 == param->batch_size)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Allocate memory for the handle
+    server = malloc(sizeof(struct server_handle_s));
+    if (server == NULL) {
+        NETLOGGING_LOGE("malloc fail");
+        return ESP_ERR_NO_MEM;
+    }
+    memset(server, 0, sizeof(struct server_handle_s));
+    server->param = *param;
+    if (0 == server->param.reconnect_min_ms) {
+        server->param.reconnect_min_ms = 500;
+    }
+    if (server->param.reconnect_max_ms < server->param.reconnect_min_ms) {
+        server->param.reconnect_max_ms = server->param.reconnect_min_ms;
+    }
+    server->state_event = xEventGroupCreate();
+    if (server->state_event == NULL) {
+        NETLOGGING_LOGE("xEventGroupCreate failed");
+        goto _init_failed;
+    }
+    return ESP_OK;
+
+_init_failed:
+    netlogging_tcp_client_deinit();
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t netlogging_tcp_client_deinit(void)
+{
+    if (server)
+    {
+        if (server->state_event)
+        {
+            vEventGroupDelete(server->state_event);
         }
+        netlogging_task_free(&server->task);
 
+        free(server);
+        server = NULL;
         return ESP_OK;
     }
+    return ESP_FAIL;
+}
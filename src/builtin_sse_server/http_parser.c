@@ -0,0 +1,364 @@
+/*
+    Incremental HTTP/1.1 request parser (RFC 9112 request line and header fields)
+
+    A state machine that takes one byte at a time, so a request may be split anywhere. Bare LF line ends are
+    accepted, CR is ignored at the end of a line. Header fields folded over several lines are rejected.
+*/
+
+#include "http_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    ST_METHOD,
+    ST_TARGET,
+    ST_VERSION,
+    ST_NAME,
+    ST_VALUE_START,
+    ST_VALUE,
+    ST_BODY,
+    ST_DONE,
+};
+
+// Headers the server uses, all others are skipped
+enum {
+    HDR_NONE,
+    HDR_CONNECTION,
+    HDR_ACCEPT_ENCODING,
+    HDR_LAST_EVENT_ID,
+    HDR_IF_NONE_MATCH,
+    HDR_CONTENT_LENGTH,
+    HDR_TRANSFER_ENCODING,
+    HDR_UPGRADE,
+    HDR_WS_KEY,
+    HDR_WS_VERSION,
+    HDR_WS_PROTOCOL,
+    HDR_AUTHORIZATION,
+};
+
+static const char *const header_names[] = {
+    [HDR_CONNECTION] = "connection",
+    [HDR_ACCEPT_ENCODING] = "accept-encoding",
+    [HDR_LAST_EVENT_ID] = "last-event-id",
+    [HDR_IF_NONE_MATCH] = "if-none-match",
+    [HDR_CONTENT_LENGTH] = "content-length",
+    [HDR_TRANSFER_ENCODING] = "transfer-encoding",
+    [HDR_UPGRADE] = "upgrade",
+    [HDR_WS_KEY] = "sec-websocket-key",
+    [HDR_WS_VERSION] = "sec-websocket-version",
+    [HDR_WS_PROTOCOL] = "sec-websocket-protocol",
+    [HDR_AUTHORIZATION] = "authorization",
+};
+#define HEADER_COUNT (sizeof(header_names) / sizeof(header_names[0]))
+
+static inline char to_lower(char c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? (char)(c - 'A' + 'a') : c;
+}
+
+static bool parse_uint32(const char *s, uint32_t *value)
+{
+    if ('\0' == *s) {
+        return false;
+    }
+    uint64_t v = 0;
+    for (; *s != '\0'; s++) {
+        if ((*s < '0') || (*s > '9')) {
+            return false;
+        }
+        v = v * 10 + (uint64_t)(*s - '0');
+        if (v > UINT32_MAX) {
+            return false;
+        }
+    }
+    *value = (uint32_t)v;
+    return true;
+}
+
+bool netlogging_http_has_token(const char *list, const char *token)
+{
+    size_t len = strlen(token);
+    while (*list != '\0') {
+        list += strspn(list, " \t,");
+        size_t n = strcspn(list, " \t,;");
+        bool found = (n == len) && (0 == memcmp(list, token, len));
+        list += n;
+        size_t params = strcspn(list, ",");
+        if (found) {
+            const char *q = strstr(list, "q=");
+            bool refused = (q != NULL) && (q < list + params) && (strspn(q + 2, "0.") == strcspn(q + 2, " \t,;"));
+            return !refused;
+        }
+        list += params;
+    }
+    return false;
+}
+
+static netlogging_http_result_t end_header(netlogging_http_request_t *req)
+{
+    while ((req->len > 0) && ((' ' == req->token[req->len - 1]) || ('\t' == req->token[req->len - 1]))) {
+        req->len--;
+    }
+    req->token[req->len] = '\0';
+    uint32_t version;
+    switch (req->header) {
+    case HDR_CONNECTION:
+        if (netlogging_http_has_token(req->token, "close")) {
+            req->keep_alive = false;
+        } else if (netlogging_http_has_token(req->token, "keep-alive")) {
+            req->keep_alive = true;
+        }
+        req->connection_upgrade = netlogging_http_has_token(req->token, "upgrade");
+        break;
+    case HDR_ACCEPT_ENCODING:
+        req->accept_gzip = netlogging_http_has_token(req->token, "gzip");
+        break;
+    case HDR_LAST_EVENT_ID:
+        // An id the server didn't send is ignored, the client gets the stream as a new one
+        req->has_last_event_id = parse_uint32(req->token, &req->last_event_id);
+        break;
+    case HDR_IF_NONE_MATCH:
+        if (req->len < sizeof(req->if_none_match)) {
+            memcpy(req->if_none_match, req->token, req->len + 1);
+        }
+        break;
+    case HDR_CONTENT_LENGTH:
+        if (!parse_uint32(req->token, &req->content_length)) {
+            return NETLOGGING_HTTP_BAD_REQUEST;
+        }
+        break;
+    case HDR_TRANSFER_ENCODING:
+        // Request bodies are not used, a chunked one can't be skipped
+        return NETLOGGING_HTTP_BAD_REQUEST;
+    case HDR_UPGRADE:
+        req->upgrade_websocket = netlogging_http_has_token(req->token, "websocket");
+        break;
+    case HDR_WS_KEY:
+        if (req->len < sizeof(req->websocket_key)) {
+            memcpy(req->websocket_key, req->token, req->len + 1);
+        }
+        break;
+    case HDR_WS_VERSION:
+        req->websocket_version = (parse_uint32(req->token, &version) && (version < 256)) ? version : 0;
+        break;
+    case HDR_WS_PROTOCOL:
+        if (req->len < sizeof(req->websocket_protocol)) {
+            memcpy(req->websocket_protocol, req->token, req->len + 1);
+        }
+        break;
+    case HDR_AUTHORIZATION:
+        // A value that was cut to the token's length could match a shorter one
+        if (req->len < sizeof(req->authorization)) {
+            memcpy(req->authorization, req->token, req->len + 1);
+        }
+        break;
+    }
+    return NETLOGGING_HTTP_INCOMPLETE;
+}
+
+static netlogging_http_result_t parse_byte(netlogging_http_request_t *req, char c)
+{
+    switch (req->state) {
+    case ST_METHOD:
+        if ((0 == req->len) && (('\r' == c) || ('\n' == c))) {
+            return NETLOGGING_HTTP_INCOMPLETE; // empty lines before a request are allowed
+        }
+        if (' ' == c) {
+            if (0 == req->len) {
+                return NETLOGGING_HTTP_BAD_REQUEST;
+            }
+            memcpy(req->method, req->token, req->len);
+            req->method[req->len] = '\0';
+            req->len = 0;
+            req->state = ST_TARGET;
+        } else if ((c < 'A') || (c > 'Z') || (req->len >= NETLOGGING_HTTP_METHOD_MAX - 1)) {
+            return NETLOGGING_HTTP_BAD_REQUEST;
+        } else {
+            req->token[req->len++] = c;
+        }
+        break;
+
+    case ST_TARGET:
+        if (' ' == c) {
+            if (0 == req->len) {
+                return NETLOGGING_HTTP_BAD_REQUEST;
+            }
+            req->path[req->len] = '\0';
+            req->len = 0;
+            req->state = ST_VERSION;
+        } else if (((unsigned char)c <= ' ') || (0x7F == c) || ((0 == req->len) && (c != '/'))) {
+            return NETLOGGING_HTTP_BAD_REQUEST; // only origin-form, e.g. "/log-events?x=1"
+        } else if (req->len >= NETLOGGING_HTTP_TARGET_MAX - 1) {
+            return NETLOGGING_HTTP_URI_TOO_LONG;
+        } else if (('?' == c) && (0 == req->query)) {
+            req->path[req->len++] = '\0';
+            req->query = req->len;
+        } else {
+            req->path[req->len++] = c;
+        }
+        break;
+
+    case ST_VERSION:
+        if ('\n' == c) {
+            if ((8 != req->len) || (0 != memcmp(req->token, "HTTP/1.", 7)) || ((req->token[7] != '0') && (req->token[7] != '1'))) {
+                return NETLOGGING_HTTP_BAD_REQUEST;
+            }
+            req->minor_version = req->token[7] - '0';
+            req->keep_alive = (req->minor_version > 0);
+            req->len = 0;
+            req->state = ST_NAME;
+        } else if (c != '\r') {
+            if (req->len >= 8) {
+                return NETLOGGING_HTTP_BAD_REQUEST;
+            }
+            req->token[req->len++] = c;
+        }
+        break;
+
+    case ST_NAME:
+        if ('\r' == c) {
+            break;
+        }
+        if ('\n' == c) {
+            if (req->len != 0) {
+                return NETLOGGING_HTTP_BAD_REQUEST; // a line without a colon
+            }
+            req->body_left = req->content_length;
+            req->state = ST_BODY;
+            break;
+        }
+        if (':' == c) {
+            if (0 == req->len) {
+                return NETLOGGING_HTTP_BAD_REQUEST;
+            }
+            req->header = HDR_NONE;
+            if (req->len < sizeof(req->token)) {
+                for (size_t i = 1; i < HEADER_COUNT; i++) {
+                    if ((strlen(header_names[i]) == req->len) && (0 == memcmp(header_names[i], req->token, req->len))) {
+                        req->header = i;
+                        break;
+                    }
+                }
+            }
+            req->len = 0;
+            req->state = ST_VALUE_START;
+        } else if ((' ' == c) || ('\t' == c)) {
+            return NETLOGGING_HTTP_BAD_REQUEST; // folded line, or white space before the colon
+        } else if (req->len < sizeof(req->token)) {
+            // A longer name isn't one of ours, len stays at the size to tell
+            req->token[req->len++] = to_lower(c);
+        }
+        break;
+
+    case ST_VALUE_START:
+        if ((' ' == c) || ('\t' == c)) {
+            break;
+        }
+        req->state = ST_VALUE;
+        // fall through
+    case ST_VALUE:
+        if ('\n' == c) {
+            netlogging_http_result_t result = end_header(req);
+            req->len = 0;
+            req->state = ST_NAME;
+            return result;
+        }
+        if (('\r' == c) || (HDR_NONE == req->header)) {
+            break;
+        }
+        if (req->len < sizeof(req->token) - 1) {
+            // Token lists are compared in lower case, ids and entity tags as they are
+            bool lower = (HDR_CONNECTION == req->header) || (HDR_ACCEPT_ENCODING == req->header) || (HDR_UPGRADE == req->header);
+            req->token[req->len++] = lower ? to_lower(c) : c;
+        }
+        break;
+    }
+    return NETLOGGING_HTTP_INCOMPLETE;
+}
+
+void netlogging_http_request_reset(netlogging_http_request_t *req)
+{
+    memset(req, 0, sizeof(*req));
+    req->state = ST_METHOD;
+}
+
+size_t netlogging_http_parse(netlogging_http_request_t *req, const char *data, size_t len, netlogging_http_result_t *result)
+{
+    size_t pos = 0;
+    *result = NETLOGGING_HTTP_INCOMPLETE;
+    while ((pos < len) && (req->state < ST_BODY)) {
+        if (++req->header_bytes > NETLOGGING_HTTP_HEADERS_MAX) {
+            *result = NETLOGGING_HTTP_HEADERS_TOO_LARGE;
+            req->state = ST_DONE;
+            return pos;
+        }
+        *result = parse_byte(req, data[pos++]);
+        if (*result != NETLOGGING_HTTP_INCOMPLETE) {
+            req->state = ST_DONE;
+            return pos;
+        }
+    }
+    if (ST_BODY == req->state) {
+        size_t n = (len - pos < req->body_left) ? len - pos : req->body_left;
+        pos += n;
+        req->body_left -= n;
+        if (0 == req->body_left) {
+            req->state = ST_DONE;
+        }
+    }
+    if (ST_DONE == req->state) {
+        *result = NETLOGGING_HTTP_COMPLETE;
+    }
+    return pos;
+}
+
+const char *netlogging_http_query(const netlogging_http_request_t *req)
+{
+    return (req->query > 0) ? req->path + req->query : "";
+}
+
+static int hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    c = to_lower(c);
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+bool netlogging_http_query_param(const char *query, const char *name, char *value, size_t size)
+{
+    size_t name_len = strlen(name);
+    for (const char *p = query; *p != '\0'; ) {
+        size_t n = strcspn(p, "&");
+        size_t key_len = strcspn(p, "=&");
+        if ((key_len == name_len) && (0 == memcmp(p, name, name_len))) {
+            size_t out = 0;
+            const char *v = p + key_len + ((p[key_len] == '=') ? 1 : 0);
+            const char *end = p + n;
+            while ((v < end) && (out + 1 < size)) {
+                char c = *v++;
+                if ('+' == c) {
+                    c = ' ';
+                } else if (('%' == c) && (end - v >= 2) && (hex_value(v[0]) >= 0) && (hex_value(v[1]) >= 0)) {
+                    c = (char)(hex_value(v[0]) * 16 + hex_value(v[1]));
+                    v += 2;
+                }
+                value[out++] = c;
+            }
+            if (size > 0) {
+                value[out] = '\0';
+            }
+            return true;
+        }
+        p += n;
+        if ('&' == *p) {
+            p++;
+        }
+    }
+    return false;
+}
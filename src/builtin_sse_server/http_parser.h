@@ -0,0 +1,96 @@
+#ifndef NET_LOGGING_HTTP_PARSER_H_
+#define NET_LOGGING_HTTP_PARSER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Incremental HTTP/1.1 request parser for the built-in SSE server.
+ * No dependencies on ESP-IDF, so it can be built and checked on the host.
+ *
+ * The request is fed in pieces of any size, e.g. as it comes from recv(). Memory is the struct only: the request
+ * line is kept, of the headers only the values the server uses. Other headers are skipped, however long they are.
+ * A request body (Content-Length) is skipped too, so the next request on a keep-alive connection is found.
+ */
+
+#define NETLOGGING_HTTP_METHOD_MAX (8)      // including the terminating null
+#define NETLOGGING_HTTP_TARGET_MAX (96)     // path and query string, longer targets are 414 URI Too Long
+#define NETLOGGING_HTTP_VALUE_MAX (64)      // header values the server uses are cut to this length
+#define NETLOGGING_HTTP_ETAG_MAX (40)
+#define NETLOGGING_HTTP_WS_KEY_MAX (32)      // also of the WebSocket subprotocol list
+#define NETLOGGING_HTTP_AUTH_MAX (56)       // longer Authorization values are left empty
+#define NETLOGGING_HTTP_HEADERS_MAX (8192)  // request line and all headers, more are 431
+
+typedef enum {
+    NETLOGGING_HTTP_INCOMPLETE = 0,     /*!< All data consumed, the request needs more */
+    NETLOGGING_HTTP_COMPLETE,           /*!< The request is complete, data after it belongs to the next request */
+    NETLOGGING_HTTP_BAD_REQUEST,        /*!< 400 */
+    NETLOGGING_HTTP_URI_TOO_LONG,       /*!< 414 */
+    NETLOGGING_HTTP_HEADERS_TOO_LARGE,  /*!< 431 */
+} netlogging_http_result_t;
+
+typedef struct {
+    char method[NETLOGGING_HTTP_METHOD_MAX];
+    char path[NETLOGGING_HTTP_TARGET_MAX];  /*!< Request target, the '?' before the query string is replaced by a null */
+    uint8_t query;                          /*!< Offset of the query string in path, 0 if there is none */
+    uint8_t minor_version;                  /*!< HTTP/1.x */
+    bool keep_alive;                        /*!< The client keeps the connection: HTTP/1.1 without Connection: close */
+    bool accept_gzip;                       /*!< Accept-Encoding lists gzip */
+    bool has_last_event_id;
+    uint32_t last_event_id;                 /*!< Last-Event-ID of a reconnecting EventSource */
+    char if_none_match[NETLOGGING_HTTP_ETAG_MAX];
+    uint32_t content_length;
+    bool connection_upgrade;                /*!< Connection lists upgrade */
+    bool upgrade_websocket;                 /*!< Upgrade: websocket */
+    uint8_t websocket_version;              /*!< Sec-WebSocket-Version */
+    char websocket_key[NETLOGGING_HTTP_WS_KEY_MAX];
+    char websocket_protocol[NETLOGGING_HTTP_WS_KEY_MAX]; /*!< Sec-WebSocket-Protocol, the subprotocols the client offers */
+    char authorization[NETLOGGING_HTTP_AUTH_MAX];        /*!< Authorization, e.g. "Bearer <token>" */
+
+    // Parser state
+    uint8_t state;
+    uint8_t header;                         /*!< The header whose value is being received */
+    uint8_t len;                            /*!< Bytes in token */
+    char token[NETLOGGING_HTTP_VALUE_MAX];  /*!< Method, version, header name or value being received */
+    uint16_t header_bytes;
+    uint32_t body_left;
+} netlogging_http_request_t;
+
+/**
+ * @brief Prepares for a new request. Required before the first netlogging_http_parse() and after each result.
+ */
+void netlogging_http_request_reset(netlogging_http_request_t *req);
+
+/**
+ * @brief Parses the next piece of a request
+ * @param[out] result NETLOGGING_HTTP_INCOMPLETE until the request is complete or found to be bad
+ * @return Bytes consumed. Less than len only if the request is complete or bad.
+ */
+size_t netlogging_http_parse(netlogging_http_request_t *req, const char *data, size_t len, netlogging_http_result_t *result);
+
+/**
+ * @brief Checks a comma separated list, e.g. "gzip, deflate;q=0.5", for a token. A token with q=0 doesn't count.
+ */
+bool netlogging_http_has_token(const char *list, const char *token);
+
+/**
+ * @brief The query string of a complete request, without the '?'. Empty if there is none.
+ */
+const char *netlogging_http_query(const netlogging_http_request_t *req);
+
+/**
+ * @brief Finds a parameter in a query string ("a=1&b=x+y") and decodes its value (%XX and '+')
+ * @param[out] value Null-terminated, cut to size - 1 bytes. A parameter without '=' has an empty value.
+ * @return false if the query string doesn't have the parameter
+ */
+bool netlogging_http_query_param(const char *query, const char *name, char *value, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* NET_LOGGING_HTTP_PARSER_H_ */
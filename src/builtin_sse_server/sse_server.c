@@ -3,12 +3,17 @@
 */
 
 #include "net_logging.h"
+#include "net_logging_priv.h"
+#include "http_parser.h"
+#include "websocket.h"
 //#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE // set log level in this file only
 #include "esp_log.h"
 #include "esp_netif_types.h" // for IP_EVENT
 #include "esp_wifi_types.h" // for WIFI_EVENT
 #include "esp_system.h"
 #include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_idf_version.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -18,45 +23,99 @@
 #include "lwip/sockets.h"
 #include "lwip/inet.h" // for inet_addr_from_ip4addr
 #include "lwip/netdb.h" // for getaddrinfo
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-#include "freertos/ringbuf.h"
-#else
-#include "freertos/message_buffer.h"
-#endif
 
 #define RETRY_TIMEOUT_MS (3000) // retry timeout in ms
 #define KEEPALIVE_TIMEOUT_MS (10000) // keepalive timeout in ms
+#define REQUEST_TIMEOUT_MS (5000) // close connections that don't send a request this long
 
 #define STOP_WAITTIME (8000 / portTICK_PERIOD_MS) // wait this long for task to stop
 #define MAX_CLIENTS (CONFIG_LWIP_MAX_SOCKETS - 3)
 #define INVALID_SOCK (-1) // Indicates that the file descriptor represents an invalid (uninitialized or closed) socket
 #define YIELD_TO_ALL_MS (50) // Time in ms to yield to all tasks when a non-blocking socket would block
-#define USE_GZIP_ASSETS (1) // Use gzip compression for index.html
+#define SSE_BATCH_SIZE (1024) // collect events up to this size before sending them to a client
+#define SSE_EVENT_MAX_LENGTH (CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH + 160) // a line and its drop notice
+#define JSON_EVENT_END_MAX_LENGTH (20) // "]\nid: 4294967295\n\n"
+#define JSON_EVENT_START_LENGTH (26) // "event: log-records\ndata: ["
+// A JSON record with empty strings and the longest numbers, and the null of snprintf
+#define JSON_RECORD_MIN_LENGTH (94) // {"seq":4294967295,"ts":4294967295,"lvl":255,"dropped":4294967295,"tag":"","task":"","msg":""}
+// A record is started while the batch is shorter than SSE_BATCH_SIZE, the rest of the buffer must hold it
+_Static_assert(SSE_EVENT_MAX_LENGTH - JSON_EVENT_START_LENGTH - JSON_EVENT_END_MAX_LENGTH >= JSON_RECORD_MIN_LENGTH,
+    "SSE_EVENT_MAX_LENGTH too small for a JSON record");
+
+// WebSocket clients get binary messages of log records, each (little endian):
+//   u8 flags: level (esp_log_level_t) in bits 0-2 and the RECORD_ bits
+//   u32 sequence number
+//   u32 lines dropped before this one, if RECORD_DROPPED
+//   u32 timestamp, ms (esp_log_timestamp())
+//   u8 CPU core
+//   u8 length of the task name, task name
+//   u8 length of the tag, tag (none for lines without the esp_log prefix)
+//   u16 length of the message, message (without the esp_log prefix, color codes and line end)
+#define RECORD_DROPPED (1 << 3)
+#define RECORD_HISTORY (1 << 4) // sent for a history request
+#define RECORD_HISTORY_END (1 << 5) // no text, ends the answer to a history request
+#define RECORD_LEVEL_MASK (0x07)
+
+#define TAG_LEVELS_MAX (8) // tags whose level was set through /levels
+#define CONTROL_TOKEN_MAX (NETLOGGING_HTTP_AUTH_MAX - sizeof("Bearer "))
 
 
 #define TAG "sse_log_sender"
 
-// File content buffer for index.html
-#if USE_GZIP_ASSETS
-extern const char sse_html_start[] asm("_binary_index_html_gz_start");
-extern const char sse_html_end[] asm("_binary_index_html_gz_end");
-#else
-extern const char sse_html_start[] asm("_binary_index_html_start");
-extern const char sse_html_end[] asm("_binary_index_html_end");
-#endif // USE_GZIP_ASSETS
+// Static files of the web page, generated at build time by tools/compress_assets.py (see cmake/include.cmake)
+struct netlogging_asset_s {
+    const char *path;           /*!< e.g. "/index.html" */
+    const char *content_type;
+    const char *etag;           /*!< Quoted hash of the content */
+    const uint8_t *data;
+    size_t size;
+    bool gzip;                  /*!< data is gzip compressed */
+};
+extern const struct netlogging_asset_s netlogging_assets[];
+extern const size_t netlogging_assets_count;
 
 struct client_handle_s
 {
     int sock;
-    void *buffer;
+    netlogging_ring_t *ring;
+    netlogging_deflate_t *deflate;   /*!< Set if the event stream is gzip compressed */
     TickType_t last_activity;
+    bool resumed;                    /*!< The client reconnected, resume_seq is the id of the last event it got */
+    uint32_t resume_seq;
+    bool websocket;                  /*!< The stream is a WebSocket, else an event stream */
+    bool json;                       /*!< Event stream: log-records events with JSON records, else log-line events */
+    bool paused;                     /*!< WebSocket: the client asked for no lines for now */
+    uint8_t max_level;               /*!< WebSocket: lines up to this level, and lines without a level */
+    char tag[24];                    /*!< WebSocket: only lines of this tag, if not empty */
+    uint32_t filtered_dropped;       /*!< WebSocket: lines dropped before lines that were filtered out */
+    bool history_requested;          /*!< WebSocket: history_lines of the history are to be sent */
+    size_t history_lines;
+    union {
+        netlogging_http_request_t request; /*!< The request being received, until the connection is a stream */
+        netlogging_ws_reader_t ws;         /*!< Control messages of a WebSocket client */
+    };
 };
 struct server_handle_s
 {
     sse_logging_param_t param;
     struct client_handle_s client[MAX_CLIENTS];
+    char batch[SSE_BATCH_SIZE + SSE_EVENT_MAX_LENGTH]; // clients are served one after the other, they share these buffers,
+                                                       // batch also receives the requests
+    netlogging_buffer_t zbuf;
+    netlogging_ring_t *history_ring; /*!< Gets the lines for the history, if param.history_size is set */
+    uint8_t *history;                /*!< The newest records, each after its u16 length, the oldest at history_tail */
+    size_t history_head;
+    size_t history_tail;
+    size_t history_used;
+    size_t history_count;
+    uint8_t global_level;            /*!< Last set through /levels, for ESP-IDF versions without esp_log_level_get() */
+    struct {
+        char tag[24];
+        uint8_t level;
+    } tag_levels[TAG_LEVELS_MAX];    /*!< The tags set through /levels, esp_log can't list them */
     volatile bool task_run;
     int start_count;
+    netlogging_task_t task;
     EventGroupHandle_t state_event;      /*!< Task's state event group */
 };
 static struct server_handle_s *server = NULL;
@@ -79,6 +138,10 @@ static struct server_handle_s *server = NULL;
 static int try_receive(const int sock, char *data, size_t max_len)
 {
     int len = recv(sock, data, max_len, 0);
+    if (0 == len) {
+        NETLOGGING_LOGD("[sock=%d]: Connection closed by the client", sock);
+        return -2;
+    }
     if (len < 0) {
         if (errno == EINPROGRESS || errno == EAGAIN || errno == EWOULDBLOCK) {
             return 0;   // Not an error
@@ -113,7 +176,10 @@ static int socket_send(const int sock, const char *data, const size_t len)
             NETLOGGING_LOGD("Error occurred during sending. errno: %d", errno);
             return -1;
         }
-        to_write -= written;
+        if (written > 0) {
+            to_write -= written;
+        }
+        // On EAGAIN nothing was taken, the same data is sent again
         if (to_write > 0) {
             // If not all data has been sent, yield to other tasks before continuing
             vTaskDelay(pdMS_TO_TICKS(YIELD_TO_ALL_MS));
@@ -144,7 +210,116 @@ static inline char *get_clients_address(struct sockaddr_storage *source_addr)
     return address_str;
 }
 
+/**
+ * @brief The static file for a request path, "/" is index.html
+ * @return NULL if there is none
+ */
+static const struct netlogging_asset_s *find_asset(const char *path)
+{
+    if (0 == strcmp(path, "/")) {
+        path = "/index.html";
+    }
+    for (size_t i = 0; i < netlogging_assets_count; i++) {
+        if (0 == strcmp(netlogging_assets[i].path, path)) {
+            return &netlogging_assets[i];
+        }
+    }
+    return NULL;
+}
 
+/**
+ * @brief Sends a short plain text response, e.g. "404 Not Found"
+ * @param req NULL for a request that couldn't be parsed, the connection is closed then
+ * @return 0 to keep the connection, 1 when it is to be closed, -1 on error
+ */
+static int send_status(struct client_handle_s *client, const netlogging_http_request_t *req, const char *status)
+{
+    bool keep_alive = (req != NULL) && req->keep_alive;
+    bool head = (req != NULL) && (0 == strcmp(req->method, "HEAD"));
+    const char *text = status + 4; // after the code
+    char response[192];
+    int len = snprintf(response, sizeof(response),
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: %u\r\n"
+        "%s"
+        "Connection: %s\r\n"
+        "\r\n"
+        "%s",
+        status, (unsigned)strlen(text), (0 == strncmp(status, "401", 3)) ? "WWW-Authenticate: Bearer\r\n" : "",
+        keep_alive ? "keep-alive" : "close", head ? "" : text);
+    if (socket_send(client->sock, response, len) < 0) {
+        NETLOGGING_LOGD("Error sending %s: errno %d", status, errno);
+        return -1;
+    }
+    return keep_alive ? 0 : 1;
+}
+
+/**
+ * @brief Sends a static file, or only 304 Not Modified if the browser has it already
+ * @return 0 to keep the connection, 1 when it is to be closed, -1 on error
+ */
+static int serve_asset(struct client_handle_s *client, const struct netlogging_asset_s *asset, const netlogging_http_request_t *req)
+{
+    // The ETag is a hash of the content, a browser that sends it back has the same file.
+    // Browsers revalidate on each load (no-cache), which costs a few bytes instead of the file.
+    bool not_modified = (NULL != strstr(req->if_none_match, asset->etag));
+    bool head = (0 == strcmp(req->method, "HEAD"));
+    const char *connection = req->keep_alive ? "keep-alive" : "close";
+
+    char headers[256];
+    if (not_modified) {
+        snprintf(headers, sizeof(headers),
+            "HTTP/1.1 304 Not Modified\r\n"
+            "ETag: %s\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: %s\r\n"
+            "\r\n",
+            asset->etag, connection);
+    } else {
+        // Every browser accepts gzip, so the compressed file is all there is
+        snprintf(headers, sizeof(headers),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %u\r\n"
+            "%s"
+            "ETag: %s\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: %s\r\n"
+            "\r\n",
+            asset->content_type, (unsigned)asset->size, asset->gzip ? "Content-Encoding: gzip\r\n" : "", asset->etag, connection);
+    }
+    if (socket_send(client->sock, headers, strlen(headers)) < 0) {
+        NETLOGGING_LOGD("Error sending header: errno %d", errno);
+        return -1;
+    }
+    if (!not_modified && !head && (socket_send(client->sock, (const char *)asset->data, asset->size) < 0)) {
+        NETLOGGING_LOGD("Error sending file content: errno %d", errno);
+        return -1;
+    }
+    NETLOGGING_LOGD("%s: %s", asset->path, not_modified ? "not modified" : "sent");
+    return req->keep_alive ? 0 : 1;
+}
+
+/**
+ * @brief Sends events to a client, through its compressor if it has one. Each send is sync-flushed,
+ *        so that the browser can show the events right away.
+ */
+static int client_send(struct client_handle_s *client, const char *data, size_t len)
+{
+    if (NULL == client->deflate) {
+        return socket_send(client->sock, data, len);
+    }
+    int64_t start = esp_timer_get_time();
+    server->zbuf.len = 0;
+    bool ok = netlogging_deflate_write(client->deflate, data, len) && netlogging_deflate_flush(client->deflate);
+    netlogging_stats_add_compression(NETLOGGING_SINK_SSE, len, server->zbuf.len, esp_timer_get_time() - start);
+    if (!ok) {
+        NETLOGGING_LOGE("compression failed");
+        return -1;
+    }
+    return socket_send(client->sock, (const char *)server->zbuf.data, server->zbuf.len);
+}
 
 static void cleanup_client(struct client_handle_s *client)
 {
@@ -153,169 +328,876 @@ static void cleanup_client(struct client_handle_s *client)
         close(client->sock);
         client->sock = INVALID_SOCK;
     }
-    if (NULL != client->buffer) {
-        netlogging_unregister_recieveBuffer(client->buffer);
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-        vRingbufferDelete(client->buffer);
-#else
-        vMessageBufferDelete(client->buffer);
-#endif
-        client->buffer = NULL;
+    if (NULL != client->ring) {
+        netlogging_unregister_ring(client->ring);
+        netlogging_ring_delete(client->ring);
+        client->ring = NULL;
     }
+    netlogging_compressor_delete(NETLOGGING_SINK_SSE, client->deflate);
+    client->deflate = NULL;
+    client->websocket = false;
 }
 
-static int serve_client(struct client_handle_s *client)
+/**
+ * @brief Creates and registers the client's log ring, the lines go to it from now on
+ */
+static int start_stream(struct client_handle_s *client)
 {
-    assert(client != NULL);
-    TickType_t now = xTaskGetTickCount();
-    // first time serving this client?
-    if (NULL == client->buffer)
-    {
-        // Receive HTTP request
-        char request[1024];
-        int req_len = try_receive(client->sock, request, sizeof(request) - 1);
-        if (0 == req_len) {
-            // No data available -> yield to other tasks
-            return 0;
+    // Errors of the priority lane come before older lines, only clients that get the sequence numbers can sort them
+    netlogging_buffer_config_t buffer = server->param.buffer;
+    if (!client->websocket && !client->json) {
+        buffer.priority_size = 0;
+    }
+    client->ring = netlogging_ring_create(&buffer);
+    if (NULL == client->ring) {
+        NETLOGGING_LOGE("netlogging_ring_create failed");
+        return -1;
+    }
+    esp_err_t err = netlogging_register_ring(client->ring, NETLOGGING_SINK_SSE);
+    if (err != ESP_OK) {
+        NETLOGGING_LOGE("netlogging_register_ring failed");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Turns the connection into an event stream, the lines are sent by serve_client() from now on
+ */
+static int serve_event_stream(struct client_handle_s *client, const netlogging_http_request_t *req)
+{
+    NETLOGGING_LOGD("client connected");
+    if ((server->zbuf.data != NULL) && req->accept_gzip) {
+        // Without memory for a compressor the client gets the plain stream
+        client->deflate = netlogging_compressor_create(NETLOGGING_SINK_SSE, netlogging_buffer_append, &server->zbuf);
+    }
+    // A client that reconnects sends the id of the last event it got, the lines in between are counted below.
+    // A page that opens a new stream can pass it as ?last-event-id=N.
+    const char *query = netlogging_http_query(req);
+    char id[12];
+    client->resumed = req->has_last_event_id;
+    client->resume_seq = req->last_event_id;
+    if (!client->resumed && netlogging_http_query_param(query, "last-event-id", id, sizeof(id)) && (id[0] != '\0')) {
+        char *end;
+        client->resume_seq = strtoul(id, &end, 10);
+        client->resumed = ('\0' == *end);
+    }
+    char format[8];
+    client->json = netlogging_http_query_param(query, "format", format, sizeof(format)) && (0 == strcmp(format, "json"));
+    // Send SSE headers
+    char headers[256];
+    snprintf(headers, sizeof(headers),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "%s"
+        "Connection: keep-alive\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "\r\n",
+        client->deflate ? "Content-Encoding: gzip\r\n" : "");
+
+    if (socket_send(client->sock, headers, strlen(headers)) < 0) {
+        return -1;
+    }
+    // The reconnection time is a field of the stream, not a header
+    if (client_send(client, "retry: 1000\n\n", 13) < 0) {
+        return -1;
+    }
+
+    client->last_activity = 0; // force a keep-alive event on first run
+    return start_stream(client);
+}
+
+static size_t put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return 4;
+}
+
+/**
+ * @brief Encodes a line as a WebSocket log record, of the fields found when it was logged
+ * @param out At least 17 + configMAX_TASK_NAME_LEN + the length of the text
+ * @return Length of the record
+ */
+static size_t ws_record(uint8_t *out, const netlogging_record_hdr_t *hdr, const char *text, uint8_t flags)
+{
+    uint8_t *p = out;
+    *p++ = (hdr->level & RECORD_LEVEL_MASK) | flags | ((hdr->dropped > 0) ? RECORD_DROPPED : 0);
+    p += put_u32(p, hdr->seq);
+    if (hdr->dropped > 0) {
+        p += put_u32(p, hdr->dropped);
+    }
+    p += put_u32(p, hdr->timestamp);
+    *p++ = hdr->core;
+    size_t task_len = strnlen(hdr->task, sizeof(hdr->task));
+    *p++ = (uint8_t)task_len;
+    memcpy(p, hdr->task, task_len);
+    p += task_len;
+    *p++ = hdr->tag_len;
+    memcpy(p, text + hdr->tag_offset, hdr->tag_len);
+    p += hdr->tag_len;
+    *p++ = (uint8_t)hdr->msg_len;
+    *p++ = (uint8_t)(hdr->msg_len >> 8);
+    memcpy(p, text + hdr->msg_offset, hdr->msg_len);
+    return p + hdr->msg_len - out;
+}
+
+static bool ws_line_passes(const struct client_handle_s *client, uint8_t level, const char *tag, size_t tag_len)
+{
+    if ((level != ESP_LOG_NONE) && (level > client->max_level)) {
+        return false;
+    }
+    return ('\0' == client->tag[0]) || ((strlen(client->tag) == tag_len) && (0 == memcmp(client->tag, tag, tag_len)));
+}
+
+static bool ws_record_passes(const struct client_handle_s *client, const uint8_t *record)
+{
+    const uint8_t *p = record + 1 + 4 + ((record[0] & RECORD_DROPPED) ? 4 : 0) + 4 + 1;
+    p += 1 + p[0]; // task
+    return ws_line_passes(client, record[0] & RECORD_LEVEL_MASK, (const char *)p + 1, p[0]);
+}
+
+/**
+ * @brief Sends the records in server->batch, after NETLOGGING_WS_HEADER_MAX bytes of room for the frame header,
+ *        as one binary message. A client with a compressor gets them as the next piece of its gzip stream.
+ */
+static int ws_send_records(struct client_handle_s *client, size_t len)
+{
+    uint8_t *payload = (uint8_t *)server->batch + NETLOGGING_WS_HEADER_MAX;
+    if (client->deflate != NULL) {
+        int64_t start = esp_timer_get_time();
+        server->zbuf.len = NETLOGGING_WS_HEADER_MAX;
+        bool ok = netlogging_deflate_write(client->deflate, payload, len) && netlogging_deflate_flush(client->deflate);
+        netlogging_stats_add_compression(NETLOGGING_SINK_SSE, len, server->zbuf.len - NETLOGGING_WS_HEADER_MAX,
+            esp_timer_get_time() - start);
+        if (!ok) {
+            NETLOGGING_LOGE("compression failed");
+            return -1;
         }
-        if (req_len < 0) {
-            // Error occurred within this client's socket -> close and mark invalid
-            return req_len;
-        }
-
-        // Else got HTTP request
-        const size_t sse_html_size = sse_html_end - sse_html_start;
-        // first time serving this client
-        NETLOGGING_LOGD("serve new client");
-
-        // Null-terminate received data
-        request[req_len] = 0;
-
-        // Check if the request is for the root path (/)
-        if (strstr(request, "GET / HTTP") != NULL) {
-            // Prepare HTTP response
-            char headers[256];
-            snprintf(headers, sizeof(headers),
-                "HTTP/1.1 200 OK\r\n"
-                "Content-Type: text/html\r\n"
-                "Content-Length: %d\r\n"
-#if USE_GZIP_ASSETS
-                "Content-Encoding: gzip\r\n"
-#endif // USE_GZIP_ASSETS
-                "Connection: close\r\n"
-                "\r\n",
-                sse_html_size);
-
-            // Send header
-            int sent_len = socket_send(client->sock, headers, strlen(headers));
-            if (sent_len < 0) {
-                NETLOGGING_LOGD("Error sending header: errno %d", errno);
-                return -1;
-            }
+        payload = server->zbuf.data + NETLOGGING_WS_HEADER_MAX;
+        len = server->zbuf.len - NETLOGGING_WS_HEADER_MAX;
+    }
+    uint8_t header[NETLOGGING_WS_HEADER_MAX];
+    size_t header_len = netlogging_ws_frame_header(header, NETLOGGING_WS_BINARY, len);
+    memcpy(payload - header_len, header, header_len);
+    return socket_send(client->sock, (const char *)payload - header_len, header_len + len);
+}
 
-            // Send file content
-            sent_len = socket_send(client->sock, sse_html_start, sse_html_size);
-            if (sent_len < 0) {
-                NETLOGGING_LOGD("Error sending file content: errno %d", errno);
-                return -1;
+/**
+ * @brief Sends a short frame that doesn't go through the compressor: control frames and the empty keep-alive
+ */
+static int ws_send_control(struct client_handle_s *client, uint8_t opcode, const uint8_t *payload, size_t len)
+{
+    uint8_t frame[2 + NETLOGGING_WS_PAYLOAD_MAX];
+    size_t header_len = netlogging_ws_frame_header(frame, opcode, len);
+    if (len > 0) {
+        memcpy(frame + header_len, payload, len);
+    }
+    return socket_send(client->sock, (const char *)frame, header_len + len);
+}
+
+/**
+ * @brief Sends a close frame
+ * @return 1, the connection is to be closed
+ */
+static int ws_close(struct client_handle_s *client, uint16_t code)
+{
+    uint8_t payload[2] = { code >> 8, code & 0xFF };
+    ws_send_control(client, NETLOGGING_WS_CLOSE, payload, sizeof(payload));
+    return 1;
+}
+
+static void history_copy_in(size_t pos, const uint8_t *data, size_t len)
+{
+    size_t n = server->param.history_size - pos;
+    if (n > len) {
+        n = len;
+    }
+    memcpy(server->history + pos, data, n);
+    memcpy(server->history, data + n, len - n);
+}
+
+static void history_copy_out(size_t pos, uint8_t *data, size_t len)
+{
+    size_t n = server->param.history_size - pos;
+    if (n > len) {
+        n = len;
+    }
+    memcpy(data, server->history + pos, n);
+    memcpy(data + n, server->history, len - n);
+}
+
+static size_t history_record_length(size_t pos)
+{
+    uint8_t len[2];
+    history_copy_out(pos, len, sizeof(len));
+    return len[0] | (len[1] << 8);
+}
+
+/**
+ * @brief Moves the lines from the history ring to the history, the oldest records make room
+ */
+static void history_update(void)
+{
+    if (NULL == server->history_ring) {
+        return;
+    }
+    size_t size = server->param.history_size;
+    uint8_t *record = (uint8_t *)server->batch; // not in use between clients
+    netlogging_record_hdr_t hdr;
+    char text[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
+    size_t received;
+    while ((received = netlogging_ring_receive(server->history_ring, &hdr, text, sizeof(text), 0)) > 0) {
+        uint8_t len[2];
+        size_t record_len = ws_record(record, &hdr, text, 0);
+        if (sizeof(len) + record_len > size) {
+            continue;
+        }
+        while (size - server->history_used < sizeof(len) + record_len) {
+            size_t old = sizeof(len) + history_record_length(server->history_tail);
+            server->history_tail = (server->history_tail + old) % size;
+            server->history_used -= old;
+            server->history_count--;
+        }
+        len[0] = (uint8_t)record_len;
+        len[1] = (uint8_t)(record_len >> 8);
+        history_copy_in(server->history_head, len, sizeof(len));
+        history_copy_in((server->history_head + sizeof(len)) % size, record, record_len);
+        server->history_head = (server->history_head + sizeof(len) + record_len) % size;
+        server->history_used += sizeof(len) + record_len;
+        server->history_count++;
+    }
+}
+
+/**
+ * @brief Sends the newest count lines of the history that pass the client's filters, then RECORD_HISTORY_END.
+ *        The lines the client's ring has too are left out, they come next. Lines that were sent to the client
+ *        already may be sent again, it tells by the sequence numbers.
+ * @param before Sequence number of the next line in the client's ring, if has_next
+ */
+static int history_send(struct client_handle_s *client, size_t count, bool has_next, uint32_t before)
+{
+    uint8_t *batch = (uint8_t *)server->batch + NETLOGGING_WS_HEADER_MAX;
+    size_t batch_len = 0;
+    size_t skip = (server->history_count > count) ? server->history_count - count : 0;
+    size_t pos = server->history_tail;
+    for (size_t i = 0; i < server->history_count; i++) {
+        size_t len = history_record_length(pos);
+        pos = (pos + 2) % server->param.history_size;
+        if (i >= skip) {
+            history_copy_out(pos, batch + batch_len, len);
+            uint32_t seq = batch[batch_len + 1] | (batch[batch_len + 2] << 8) | (batch[batch_len + 3] << 16) | ((uint32_t)batch[batch_len + 4] << 24);
+            if ((!has_next || ((int32_t)(seq - before) < 0)) && ws_record_passes(client, batch + batch_len)) {
+                batch[batch_len] |= RECORD_HISTORY;
+                batch_len += len;
             }
+            if (batch_len >= SSE_BATCH_SIZE) {
+                if (ws_send_records(client, batch_len) < 0) {
+                    return -1;
+                }
+                batch_len = 0;
+            }
+        }
+        pos = (pos + len) % server->param.history_size;
+    }
+    netlogging_record_hdr_t end = { 0 };
+    batch_len += ws_record(batch + batch_len, &end, "", RECORD_HISTORY_END);
+    return ws_send_records(client, batch_len);
+}
+
+/**
+ * @brief Handles a control message from a WebSocket client:
+ *        "level N" (esp_log_level_t), "tag NAME", "tag" (all tags), "pause", "resume" or "history [N]"
+ */
+static int ws_command(struct client_handle_s *client, const uint8_t *payload, size_t len)
+{
+    char command[NETLOGGING_WS_PAYLOAD_MAX + 1];
+    memcpy(command, payload, len);
+    command[len] = '\0';
+    size_t word_len = strcspn(command, " ");
+    const char *arg = command + word_len + strspn(command + word_len, " ");
+    NETLOGGING_LOGD("[sock=%d]: %s", client->sock, command);
+    if ((5 == word_len) && (0 == strncmp(command, "level", 5))) {
+        int level = atoi(arg);
+        client->max_level = (level < ESP_LOG_NONE) ? ESP_LOG_NONE : (level > ESP_LOG_VERBOSE) ? ESP_LOG_VERBOSE : level;
+    } else if ((3 == word_len) && (0 == strncmp(command, "tag", 3))) {
+        snprintf(client->tag, sizeof(client->tag), "%s", arg);
+    } else if ((5 == word_len) && (0 == strncmp(command, "pause", 5))) {
+        client->paused = true;
+    } else if ((6 == word_len) && (0 == strncmp(command, "resume", 6))) {
+        client->paused = false;
+    } else if ((7 == word_len) && (0 == strncmp(command, "history", 7))) {
+        // Sent by serve_websocket(), which knows the next line of the client's ring
+        client->history_requested = true;
+        client->history_lines = ('\0' == *arg) ? SIZE_MAX : strtoul(arg, NULL, 10);
+    }
+    return 0;
+}
 
+/**
+ * @brief Answers the WebSocket client's frames in data
+ * @return 0 to keep the connection, 1 when it is to be closed, <0 on error
+ */
+static int ws_handle_frames(struct client_handle_s *client, const uint8_t *data, size_t len)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        netlogging_ws_frame_t frame;
+        netlogging_ws_result_t result;
+        pos += netlogging_ws_read(&client->ws, data + pos, len - pos, &frame, &result);
+        if (NETLOGGING_WS_INCOMPLETE == result) {
+            break;
+        }
+        if (result != NETLOGGING_WS_FRAME) {
+            return ws_close(client, (NETLOGGING_WS_TOO_BIG == result) ? NETLOGGING_WS_MESSAGE_TOO_BIG : NETLOGGING_WS_PROTOCOL_ERROR);
+        }
+        int ret = 0;
+        switch (frame.opcode) {
+        case NETLOGGING_WS_TEXT:
+            ret = ws_command(client, frame.payload, frame.len);
+            break;
+        case NETLOGGING_WS_PING:
+            ret = ws_send_control(client, NETLOGGING_WS_PONG, frame.payload, frame.len);
+            break;
+        case NETLOGGING_WS_CLOSE:
+            NETLOGGING_LOGD("[sock=%d]: WebSocket closed by the client", client->sock);
+            return ws_close(client, NETLOGGING_WS_NORMAL_CLOSURE);
+        default:
+            break; // pongs, and binary messages, which mean nothing here
         }
-        // Check if the request is for the SSE endpoint
-        else if (strstr(request, "GET /log-events HTTP") != NULL) {
-            NETLOGGING_LOGD("client connected");
-            // Send SSE headers
-            const char *headers = "HTTP/1.1 200 OK\r\n"
-                "Content-Type: text/event-stream\r\n"
-                "retry: 1000\r\n"
-                "Cache-Control: no-cache\r\n"
-                "Connection: keep-alive\r\n"
-                "Access-Control-Allow-Origin: *\r\n"
-                "\r\n";
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Receives the WebSocket client's frames and answers them
+ * @return 0 to keep the connection, 1 when it is to be closed, <0 on error
+ */
+static int ws_receive(struct client_handle_s *client)
+{
+    uint8_t data[64];
+    int len = try_receive(client->sock, (char *)data, sizeof(data));
+    if (len <= 0) {
+        return len;
+    }
+    return ws_handle_frames(client, data, len);
+}
 
-            socket_send(client->sock, headers, strlen(headers));
+/**
+ * @brief Accepts a WebSocket handshake. The client asks for the compressed stream with the subprotocol
+ *        "netlog-gzip", and gets it if there is memory for a compressor. Otherwise it gets "netlog".
+ */
+static int serve_websocket_upgrade(struct client_handle_s *client, const netlogging_http_request_t *req)
+{
+    if (!req->upgrade_websocket || !req->connection_upgrade || ('\0' == req->websocket_key[0])) {
+        return send_status(client, req, "400 Bad Request");
+    }
+    if (req->websocket_version != 13) {
+        return send_status(client, req, "426 Upgrade Required");
+    }
+    const char *protocol = NULL;
+    if ((server->zbuf.data != NULL) && netlogging_http_has_token(req->websocket_protocol, "netlog-gzip")) {
+        client->deflate = netlogging_compressor_create(NETLOGGING_SINK_SSE, netlogging_buffer_append, &server->zbuf);
+        protocol = client->deflate ? "netlog-gzip" : NULL;
+    }
+    if ((NULL == protocol) && netlogging_http_has_token(req->websocket_protocol, "netlog")) {
+        protocol = "netlog";
+    }
+    char accept[NETLOGGING_WS_ACCEPT_LENGTH + 1];
+    netlogging_ws_accept_key(req->websocket_key, accept);
+    char headers[192];
+    snprintf(headers, sizeof(headers),
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n"
+        "%s%s%s"
+        "\r\n",
+        accept, protocol ? "Sec-WebSocket-Protocol: " : "", protocol ? protocol : "", protocol ? "\r\n" : "");
+    if (socket_send(client->sock, headers, strlen(headers)) < 0) {
+        return -1;
+    }
+    NETLOGGING_LOGD("WebSocket client connected");
+    // The reader takes the place of the request, req is gone from here on
+    netlogging_ws_reader_reset(&client->ws);
+    client->websocket = true;
+    client->paused = false;
+    client->max_level = ESP_LOG_VERBOSE;
+    client->tag[0] = '\0';
+    client->filtered_dropped = 0;
+    client->history_requested = false;
+    client->last_activity = xTaskGetTickCount();
+    return start_stream(client);
+}
 
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-            // Create RingBuffer
-            client->buffer = xRingbufferCreate(CONFIG_NETLOGGING_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+/**
+ * @brief Checks the token of a /levels or /stats request
+ * @return 0 if the request may go on, else the result of the error response
+ */
+static int check_token(struct client_handle_s *client, const netlogging_http_request_t *req, bool *ok)
+{
+    *ok = false;
+    const char *token = server->param.control_token;
+    if (NULL == token) {
+        return send_status(client, req, "404 Not Found");
+    }
+    const char *auth = req->authorization;
+    size_t len = strlen(token);
+    if ((0 != strncmp(auth, "Bearer ", 7)) || (strlen(auth + 7) != len)) {
+        return send_status(client, req, "401 Unauthorized");
+    }
+    // The time a wrong token takes doesn't tell how much of it was right
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) {
+        diff |= (uint8_t)(auth[7 + i] ^ token[i]);
+    }
+    if (diff != 0) {
+        return send_status(client, req, "401 Unauthorized");
+    }
+    *ok = true;
+    return 0;
+}
+
+static int send_json(struct client_handle_s *client, const netlogging_http_request_t *req, const char *body, size_t len)
+{
+    char headers[160];
+    int headers_len = snprintf(headers, sizeof(headers),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %u\r\n"
+        "Cache-Control: no-store\r\n"
+        "Connection: %s\r\n"
+        "\r\n",
+        (unsigned)len, req->keep_alive ? "keep-alive" : "close");
+    if ((socket_send(client->sock, headers, headers_len) < 0) ||
+        ((0 != strcmp(req->method, "HEAD")) && (socket_send(client->sock, body, len) < 0))) {
+        NETLOGGING_LOGD("Error sending JSON: errno %d", errno);
+        return -1;
+    }
+    return req->keep_alive ? 0 : 1;
+}
+
+static uint8_t tag_level(const char *tag, uint8_t level_set)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    return esp_log_level_get(tag); // it may have been changed by the application since
 #else
-            // Create MessageBuffer
-            client->buffer = xMessageBufferCreate(CONFIG_NETLOGGING_BUFFER_SIZE);
+    return level_set;
 #endif
-            if (NULL == client->buffer) {
-                NETLOGGING_LOGE("bufferCreate failed");
-                return -1;
+}
+
+/**
+ * @brief GET /levels: {"global":3,"tags":{"wifi":2},"sinks":{"stdout":5,"sse":5}}
+ *        The tags are those set through POST /levels, the sinks those that run or have a level set.
+ */
+static int serve_levels(struct client_handle_s *client, const netlogging_http_request_t *req)
+{
+    bool ok;
+    int ret = check_token(client, req, &ok);
+    if (!ok) {
+        return ret;
+    }
+    char body[512];
+    size_t len = snprintf(body, sizeof(body), "{\"global\":%u,\"tags\":{", tag_level("*", server->global_level));
+    const char *separator = "";
+    for (size_t i = 0; i < TAG_LEVELS_MAX; i++) {
+        if (server->tag_levels[i].tag[0] != '\0') {
+            len += snprintf(body + len, sizeof(body) - len, "%s\"%s\":%u", separator,
+                server->tag_levels[i].tag, tag_level(server->tag_levels[i].tag, server->tag_levels[i].level));
+            separator = ",";
+        }
+    }
+    len += snprintf(body + len, sizeof(body) - len, "},\"sinks\":{");
+    separator = "";
+    for (netlogging_sink_t sink = 0; sink < NETLOGGING_SINK_COUNT; sink++) {
+        esp_log_level_t level = ESP_LOG_VERBOSE;
+        netlogging_get_sink_level(netlogging_sink_name(sink), &level);
+        if (netlogging_sink_registered(sink) || (level != ESP_LOG_VERBOSE)) {
+            len += snprintf(body + len, sizeof(body) - len, "%s\"%s\":%u", separator, netlogging_sink_name(sink), level);
+            separator = ",";
+        }
+    }
+    len += snprintf(body + len, sizeof(body) - len, "}}");
+    return send_json(client, req, body, len);
+}
+
+/**
+ * @brief POST /levels?tag=wifi&level=2 sets esp_log's level of a tag, tag=* the global level.
+ *        POST /levels?sink=mqtt&level=2 sets a sink's level, see netlogging_set_sink_level().
+ *        The answer is the levels as for GET.
+ */
+static int set_levels(struct client_handle_s *client, const netlogging_http_request_t *req)
+{
+    bool ok;
+    int ret = check_token(client, req, &ok);
+    if (!ok) {
+        return ret;
+    }
+    const char *query = netlogging_http_query(req);
+    char value[24];
+    if (!netlogging_http_query_param(query, "level", value, sizeof(value)) ||
+        (strlen(value) != 1) || (value[0] < '0' + ESP_LOG_NONE) || (value[0] > '0' + ESP_LOG_VERBOSE)) {
+        return send_status(client, req, "400 Bad Request");
+    }
+    esp_log_level_t level = value[0] - '0';
+    if (netlogging_http_query_param(query, "sink", value, sizeof(value))) {
+        if (netlogging_set_sink_level(value, level) != ESP_OK) {
+            return send_status(client, req, "404 Not Found");
+        }
+    } else if (netlogging_http_query_param(query, "tag", value, sizeof(value)) && ('\0' != value[0])) {
+        if (0 == strcmp(value, "*")) {
+            // esp_log sets all tags to the global level too
+            memset(server->tag_levels, 0, sizeof(server->tag_levels));
+            server->global_level = level;
+        } else {
+            // The tag goes into JSON as it is
+            for (const char *c = value; *c != '\0'; c++) {
+                if (((unsigned char)*c < ' ') || ('"' == *c) || ('\\' == *c)) {
+                    return send_status(client, req, "400 Bad Request");
+                }
             }
-            esp_err_t err = netlogging_register_recieveBuffer(client->buffer);
-            if (err != ESP_OK) {
-                NETLOGGING_LOGE("netlogging_register_recieveBuffer failed");
-                return -1;
+            size_t slot = TAG_LEVELS_MAX;
+            for (size_t i = 0; i < TAG_LEVELS_MAX; i++) {
+                if (0 == strcmp(server->tag_levels[i].tag, value)) {
+                    slot = i;
+                    break;
+                }
+                if ((slot == TAG_LEVELS_MAX) && ('\0' == server->tag_levels[i].tag[0])) {
+                    slot = i;
+                }
             }
-            client->last_activity = 0; // force a keep-alive event on first run
-        }
-        else {
-            // Not found response for other paths
-            const char *not_found = "HTTP/1.1 404 Not Found\r\n"
-                "Content-Type: text/plain\r\n"
-                "Content-Length: 9\r\n"
-                "Connection: close\r\n"
-                "\r\n"
-                "Not Found";
-            int sent_len = socket_send(client->sock, not_found, strlen(not_found));
-            if (sent_len < 0) {
-                NETLOGGING_LOGD("Error sending 404: errno %d", errno);
-                return -1;
+            // A tag at the global level is like one that wasn't set, it frees its slot
+            if (level == tag_level("*", server->global_level)) {
+                if (slot < TAG_LEVELS_MAX) {
+                    server->tag_levels[slot].tag[0] = '\0';
+                }
+            } else if (slot == TAG_LEVELS_MAX) {
+                return send_status(client, req, "507 Insufficient Storage");
+            } else {
+                snprintf(server->tag_levels[slot].tag, sizeof(server->tag_levels[slot].tag), "%s", value);
+                server->tag_levels[slot].level = level;
             }
         }
+        esp_log_level_set(value, level);
+    } else {
+        return send_status(client, req, "400 Bad Request");
+    }
+    NETLOGGING_LOGI("%s: level %d", query, level);
+    return serve_levels(client, req);
+}
+
+/**
+ * @brief GET /stats: the counters of netlogging_get_stats() and the time in us, the page makes rates of them
+ */
+static int serve_stats(struct client_handle_s *client, const netlogging_http_request_t *req)
+{
+    bool ok;
+    int ret = check_token(client, req, &ok);
+    if (!ok) {
+        return ret;
+    }
+    netlogging_stats_t stats;
+    if (netlogging_get_stats(&stats) != ESP_OK) {
+        return send_status(client, req, "503 Service Unavailable");
+    }
+    int streams = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        streams += (NULL != server->client[i].ring) ? 1 : 0;
     }
-    else {
-        // Keep connection open and send SSE events
+    char body[512];
+    int len = snprintf(body, sizeof(body),
+        "{\"us\":%" PRId64 ",\"lines\":%" PRIu32 ",\"bytes\":%" PRIu32 ",\"dropped\":%" PRIu32 ",\"evicted\":%" PRIu32
+        ",\"skipped\":%" PRIu32 ",\"isr_lines\":%" PRIu32 ",\"streams\":%d,\"compression\":{",
+        esp_timer_get_time(), stats.lines, stats.bytes, stats.dropped, stats.evicted,
+        stats.skipped, stats.isr_lines, streams);
+    // The sinks that can compress
+    static const char *const compressing[] = { "tcp", "http", "sse" };
+    for (size_t i = 0; i < sizeof(compressing) / sizeof(compressing[0]); i++) {
+        netlogging_compression_stats_t c;
+        netlogging_get_compression_stats(compressing[i], &c);
+        len += snprintf(body + len, sizeof(body) - len,
+            "%s\"%s\":{\"in\":%" PRIu32 ",\"out\":%" PRIu32 ",\"us\":%" PRIu64 ",\"mem\":%" PRIu32 "}",
+            (i > 0) ? "," : "", compressing[i], c.in, c.out, c.us, c.mem);
+    }
+    len += snprintf(body + len, sizeof(body) - len, "}}");
+    return send_json(client, req, body, len);
+}
+
+typedef int (*route_handler_t)(struct client_handle_s *client, const netlogging_http_request_t *req);
+
+// Paths other than these are the static files
+static const struct {
+    const char *method;
+    const char *path;
+    route_handler_t handler;
+} routes[] = {
+    { "GET", "/log-events", serve_event_stream },
+    { "GET", "/ws", serve_websocket_upgrade },
+    { "GET", "/levels", serve_levels },
+    { "POST", "/levels", set_levels },
+    { "GET", "/stats", serve_stats },
+};
 
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-        size_t received;
-        char *buffer = (char *)xRingbufferReceive(client->buffer, &received, 0); // don't wait
-        if (NULL == buffer) {
-            received = 0; // no data available
+/**
+ * @brief Answers a complete request
+ * @return 0 to keep the connection, 1 when it is to be closed, <0 on error
+ */
+static int handle_request(struct client_handle_s *client, const netlogging_http_request_t *req)
+{
+    NETLOGGING_LOGD("[sock=%d]: %s %s", client->sock, req->method, req->path);
+    bool path_found = false;
+    for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]); i++) {
+        if (0 == strcmp(routes[i].path, req->path)) {
+            if (0 == strcmp(routes[i].method, req->method)) {
+                return routes[i].handler(client, req);
+            }
+            path_found = true;
         }
-#else
-        char buffer[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
-        size_t received = xMessageBufferReceive(client->buffer, buffer, sizeof(buffer), 0); // don't wait
-#endif
+    }
+    const struct netlogging_asset_s *asset = find_asset(req->path);
+    if (asset != NULL) {
+        path_found = true;
+        if ((0 == strcmp(req->method, "GET")) || (0 == strcmp(req->method, "HEAD"))) {
+            return serve_asset(client, asset, req);
+        }
+    }
+    return send_status(client, req, path_found ? "405 Method Not Allowed" : "404 Not Found");
+}
+
+/**
+ * @brief Receives what the client sent and answers the requests that are complete.
+ *        The request may come in several pieces, several requests may come in one (keep-alive, pipelining).
+ * @return 0 to keep the connection, 1 when it is to be closed, <0 on error
+ */
+static int receive_requests(struct client_handle_s *client, TickType_t now)
+{
+    int len = try_receive(client->sock, server->batch, sizeof(server->batch));
+    if (0 == len) {
+        // Idle connections take up one of the few sockets
+        if ((now - client->last_activity) > pdMS_TO_TICKS(REQUEST_TIMEOUT_MS)) {
+            NETLOGGING_LOGD("[sock=%d]: No request, closing", client->sock);
+            return 1;
+        }
+        return 0;
+    }
+    if (len < 0) {
+        return len;
+    }
+    client->last_activity = now;
+    size_t pos = 0;
+    while (pos < (size_t)len) {
+        netlogging_http_result_t result;
+        pos += netlogging_http_parse(&client->request, server->batch + pos, len - pos, &result);
+        switch (result) {
+        case NETLOGGING_HTTP_INCOMPLETE:
+            return 0;
+        case NETLOGGING_HTTP_COMPLETE:
+            break;
+        case NETLOGGING_HTTP_URI_TOO_LONG:
+            return send_status(client, NULL, "414 URI Too Long");
+        case NETLOGGING_HTTP_HEADERS_TOO_LARGE:
+            return send_status(client, NULL, "431 Request Header Fields Too Large");
+        default:
+            return send_status(client, NULL, "400 Bad Request");
+        }
+        int ret = handle_request(client, &client->request);
+        if ((0 == ret) && client->websocket && (pos < (size_t)len)) {
+            // Frames that the client sent right behind the handshake
+            return ws_handle_frames(client, (const uint8_t *)server->batch + pos, len - pos);
+        }
+        if ((ret != 0) || (client->ring != NULL)) {
+            return ret; // closing, or the connection is an event stream now
+        }
+        netlogging_http_request_reset(&client->request);
+    }
+    return 0;
+}
 
-        if ((NULL != buffer) && (received > 0)) {
-            // Format the buffer content as an SSE event
-            char sse_event[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH + 64];
-            snprintf(sse_event, sizeof(sse_event), "event: log-line\ndata: %.*s\n\n", (int)received, buffer);
+/**
+ * @brief Sends the waiting lines to a WebSocket client, after answering its control messages
+ * @return 0 to keep the connection, 1 when it is to be closed, <0 on error
+ */
+static int serve_websocket(struct client_handle_s *client, TickType_t now)
+{
+    int ret = ws_receive(client);
+    if (ret != 0) {
+        return ret;
+    }
+    netlogging_record_hdr_t hdr;
+    char buffer[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
+    size_t received = 0;
+    if (client->history_requested) {
+        // The history ends before the next line of the ring, the lines logged since the client connected are in both
+        received = netlogging_ring_receive(client->ring, &hdr, buffer, sizeof(buffer), 0);
+        if (history_send(client, client->history_lines, received > 0, hdr.seq) < 0) {
+            return -1;
+        }
+        client->history_requested = false;
+    }
+    // A paused client's ring fills up, it's told how many lines it missed when it resumes
+    uint8_t *batch = (uint8_t *)server->batch + NETLOGGING_WS_HEADER_MAX;
+    size_t batch_len = 0;
+    while ((received > 0) || (!client->paused && (batch_len < SSE_BATCH_SIZE))) {
+        if (0 == received) {
+            received = netlogging_ring_receive(client->ring, &hdr, buffer, sizeof(buffer), 0); // don't wait
+            if (0 == received) {
+                break;
+            }
+        }
+        received = 0;
+        if (!ws_line_passes(client, hdr.level, buffer + hdr.tag_offset, hdr.tag_len)) {
+            client->filtered_dropped += hdr.dropped;
+            continue;
+        }
+        hdr.dropped += client->filtered_dropped;
+        client->filtered_dropped = 0;
+        batch_len += ws_record(batch + batch_len, &hdr, buffer, 0);
+    }
 
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-            vRingbufferReturnItem(client->buffer, (void *)buffer);
-#endif
+    if (batch_len > 0) {
+        if (ws_send_records(client, batch_len) < 0) {
+            NETLOGGING_LOGD("Error sending WebSocket message: errno %d", errno);
+            return -1;
+        }
+        client->last_activity = now;
+    }
+    else if ((now - client->last_activity) > pdMS_TO_TICKS(KEEPALIVE_TIMEOUT_MS)) {
+        // An empty message as keep-alive, a page sees it, unlike a ping
+        if (ws_send_control(client, NETLOGGING_WS_BINARY, NULL, 0) < 0) {
+            NETLOGGING_LOGD("Error sending keep-alive: errno %d", errno);
+            return -1;
+        }
+        client->last_activity = now;
+    }
+    return 0;
+}
 
-            // Send the event
-            int ret = socket_send(client->sock, sse_event, strlen(sse_event));
-            if (ret < 0) {
-                NETLOGGING_LOGD("Error sending SSE event: errno %d", errno);
-                return -1;
+/**
+ * @brief Writes a line as a JSON object of its fields, the message cut if it does not fit into size bytes
+ * @return Length of the object, 0 if size is less than JSON_RECORD_MIN_LENGTH
+ */
+static size_t json_record(char *out, size_t size, const netlogging_record_hdr_t *hdr, const char *text)
+{
+    if (size < JSON_RECORD_MIN_LENGTH) {
+        return 0;
+    }
+    // The numbers fit in any case, the strings are cut so that the fields after them still fit
+    size_t len = snprintf(out, size, "{\"seq\":%"PRIu32",\"ts\":%"PRIu32",\"lvl\":%u,", hdr->seq, hdr->timestamp, hdr->level);
+    if (hdr->dropped > 0) {
+        len += snprintf(out + len, size - len, "\"dropped\":%"PRIu32",", hdr->dropped);
+    }
+    len += snprintf(out + len, size - len, "\"tag\":");
+    len += netlogging_json_string(out + len, size - len - strlen(",\"task\":\"\",\"msg\":\"\"}"),
+        text + hdr->tag_offset, hdr->tag_len, false);
+    len += snprintf(out + len, size - len, ",\"task\":");
+    len += netlogging_json_string(out + len, size - len - strlen(",\"msg\":\"\"}"),
+        hdr->task, strnlen(hdr->task, sizeof(hdr->task)), false);
+    len += snprintf(out + len, size - len, ",\"msg\":");
+    len += netlogging_json_string(out + len, size - len - 1, text + hdr->msg_offset, hdr->msg_len, true);
+    out[len++] = '}';
+    return len;
+}
+
+/**
+ * @brief Sends the waiting lines to an event stream client
+ * @return 0 to keep the connection, <0 on error
+ */
+static int serve_event_stream_lines(struct client_handle_s *client, TickType_t now)
+{
+    // Send the waiting lines as SSE events, several per send
+    char *batch = server->batch;
+    size_t batch_len = 0;
+    uint32_t last_seq = 0;
+    while (batch_len < SSE_BATCH_SIZE) {
+        netlogging_record_hdr_t hdr;
+        char buffer[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH];
+        size_t received = netlogging_ring_receive(client->ring, &hdr, buffer, sizeof(buffer), 0); // don't wait
+        if (0 == received) {
+            break;
+        }
+        // Lines logged while a resuming client was away are gone, they weren't in its ring
+        if (client->resumed) {
+            int32_t missed = (int32_t)(hdr.seq - client->resume_seq - 1);
+            if (missed > 0) {
+                hdr.dropped += missed;
+            }
+            client->resumed = false;
+        }
+        if (client->json) {
+            // One event for all lines of the batch, its id is the sequence number of the last one
+            if (0 == batch_len) {
+                batch_len += sprintf(batch, "event: log-records\ndata: [");
             }
-            client->last_activity = now;
-        }
-        else if (now > (client->last_activity + pdMS_TO_TICKS(KEEPALIVE_TIMEOUT_MS))) {
-            // No data available, send keep-alive event
-            NETLOGGING_LOGD("sending keep-alive");
-            char sse_event[CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH + 64];
-            snprintf(sse_event, sizeof(sse_event), "event: keepalive\ndata: %"PRIu32"\n\n", now);
-
-            int ret = socket_send(client->sock, sse_event, strlen(sse_event));
-            if (ret < 0) {
-                NETLOGGING_LOGD("Error sending keep-alive: errno %d", errno);
-                return -1;
+            else {
+                batch[batch_len++] = ',';
             }
-            client->last_activity = now;
+            batch_len += json_record(batch + batch_len, sizeof(server->batch) - JSON_EVENT_END_MAX_LENGTH - batch_len, &hdr, buffer);
+            last_seq = hdr.seq;
+            continue;
         }
+        // Format the buffer content as an SSE event, with the line's sequence number as its id, so a client
+        // can tell where it left off. A notice goes first if lines were lost before this one.
+        batch_len += snprintf(batch + batch_len, sizeof(server->batch) - batch_len, "id: %"PRIu32"\n", hdr.seq);
+        if (hdr.dropped > 0) {
+            char notice[NETLOGGING_DROPPED_NOTICE_MAX_LENGTH];
+            netlogging_format_dropped(notice, sizeof(notice), hdr.dropped);
+            batch_len += snprintf(batch + batch_len, sizeof(server->batch) - batch_len, "event: log-line\ndata: %s\n", notice);
+        }
+        batch_len += snprintf(batch + batch_len, sizeof(server->batch) - batch_len,
+            "event: log-line\ndata: %.*s\n\n", (int)received, buffer);
+    }
+    if (client->json && (batch_len > 0)) {
+        batch_len += sprintf(batch + batch_len, "]\nid: %"PRIu32"\n\n", last_seq);
+    }
+
+    if (batch_len > 0) {
+        int ret = client_send(client, batch, batch_len);
+        if (ret < 0) {
+            NETLOGGING_LOGD("Error sending SSE event: errno %d", errno);
+            return -1;
+        }
+        client->last_activity = now;
+    }
+    else if (now > (client->last_activity + pdMS_TO_TICKS(KEEPALIVE_TIMEOUT_MS))) {
+        // No data available, send keep-alive event
+        NETLOGGING_LOGD("sending keep-alive");
+        char sse_event[64];
+        snprintf(sse_event, sizeof(sse_event), "event: keepalive\ndata: %"PRIu32"\n\n", now);
+
+        int ret = client_send(client, sse_event, strlen(sse_event));
+        if (ret < 0) {
+            NETLOGGING_LOGD("Error sending keep-alive: errno %d", errno);
+            return -1;
+        }
+        client->last_activity = now;
     }
     return 0;
 }
 
+
+/**
+ * @brief Answers a client's requests, or sends the waiting lines to a stream client
+ * @return 0 to keep the connection, 1 when it is to be closed, <0 on error
+ */
+static int serve_client(struct client_handle_s *client)
+{
+    assert(client != NULL);
+    TickType_t now = xTaskGetTickCount();
+    if (NULL == client->ring) {
+        return receive_requests(client, now);
+    }
+    if (client->websocket) {
+        return serve_websocket(client, now);
+    }
+    return serve_event_stream_lines(client, now);
+}
+
 static void network_changed_handler(void *arg, esp_event_base_t event_base,
     const int32_t event_id, void *event_data)
 {
@@ -329,6 +1211,27 @@ static void server_task(void *pvParameters)
 {
     NETLOGGING_LOGD("Starting HTTP Logging Server");
 
+    if (server->param.gzip) {
+        // Output of one flushed batch that doesn't compress at all, plus block headers and a WebSocket frame header
+        server->zbuf.size = sizeof(server->batch) * 9 / 8 + 64 + NETLOGGING_WS_HEADER_MAX;
+        server->zbuf.data = malloc(server->zbuf.size);
+        if (NULL == server->zbuf.data) {
+            NETLOGGING_LOGW("malloc fail, event streams are not compressed");
+        }
+    }
+    if (server->param.history_size > 0) {
+        // The history keeps the lines from before a WebSocket client connected, it has a ring of its own
+        server->history = malloc(server->param.history_size);
+        server->history_ring = server->history ? netlogging_ring_create(&server->param.buffer) : NULL;
+        if ((NULL == server->history_ring) || (netlogging_register_ring(server->history_ring, NETLOGGING_SINK_SSE) != ESP_OK)) {
+            NETLOGGING_LOGW("no memory for the history");
+            netlogging_ring_delete(server->history_ring);
+            server->history_ring = NULL;
+            free(server->history);
+            server->history = NULL;
+        }
+    }
+
     while (server->task_run) // Outer while loop to (re)start server
     {
         if (server->start_count > 0) {
@@ -340,7 +1243,8 @@ static void server_task(void *pvParameters)
         // Prepare a list to hold client's connection state, mark all of them as invalid, i.e. available
         for (int i = 0; i < MAX_CLIENTS; ++i) {
             server->client[i].sock = INVALID_SOCK;
-            server->client[i].buffer = NULL;
+            server->client[i].ring = NULL;
+            server->client[i].deflate = NULL;
         }
 
         // Creating a listener socket for incoming connections
@@ -447,17 +1351,25 @@ static void server_task(void *pvParameters)
                         break; // break out of the inner while loop, back to the outer while loop to try to create the socket again
                     }
                     NETLOGGING_LOGV("[sock=%d]: Socket marked as non blocking", client->sock);
+                    client->last_activity = xTaskGetTickCount();
+                    client->websocket = false;
+                    netlogging_http_request_reset(&client->request);
                 }
             }
 
+            history_update();
+
             // We serve all the connected clients in this loop
             for (int i = 0; i < MAX_CLIENTS; ++i) {
                 struct client_handle_s *client = &server->client[i];
                 if (client->sock != INVALID_SOCK) {
-                    if (serve_client(client) != 0)
+                    int ret = serve_client(client);
+                    if (ret != 0)
                     {
-                        // Error occurred while serving this client -> close and mark invalid
-                        NETLOGGING_LOGD("[sock=%d]: Error occurred while serving client -> closing the socket", client->sock);
+                        // Response complete, or error occurred while serving this client -> close and mark invalid
+                        if (ret < 0) {
+                            NETLOGGING_LOGD("[sock=%d]: Error occurred while serving client -> closing the socket", client->sock);
+                        }
                         cleanup_client(client);
                         continue; // continue to the next socket
                     }
@@ -487,9 +1399,20 @@ static void server_task(void *pvParameters)
     } // end outer while
 
     // Cleanup. Task is only responsible for freeing memory that it allocated.
+    if (server->history_ring != NULL) {
+        netlogging_unregister_ring(server->history_ring);
+        netlogging_ring_delete(server->history_ring);
+        server->history_ring = NULL;
+    }
+    free(server->history);
+    server->history = NULL;
+    server->history_head = server->history_tail = server->history_used = server->history_count = 0;
+    free(server->zbuf.data);
+    server->zbuf.data = NULL;
+    NETLOGGING_LOGD("stack never used: %u bytes", (unsigned)uxTaskGetStackHighWaterMark(NULL) * sizeof(StackType_t));
     xEventGroupSetBits(server->state_event, STOPPED_BIT);
     NETLOGGING_LOGI("task stopped");
-    vTaskDelete(NULL);
+    netlogging_task_exit(&server->task);
 }
 
 esp_err_t netlogging_sse_server_run(void)
@@ -501,7 +1424,9 @@ esp_err_t netlogging_sse_server_run(void)
     // Start Multicast Sender task
     server->task_run = true;
     server->start_count = 0;
-    if( xTaskCreate(server_task, "HTTP SSE", 1024 * 6, NULL, 2, NULL) != pdPASS) {
+    xEventGroupClearBits(server->state_event, STOPPED_BIT);
+    // WebSocket clients, the history and /levels have deep call paths on this task, see the stack left at "task stopped"
+    if (netlogging_task_create(&server->task, server_task, "HTTP SSE", 1024 * 6, NULL, 2) != ESP_OK) {
         NETLOGGING_LOGE("xTaskCreate failed");
         server->task_run = false;
         return ESP_FAIL;
@@ -531,11 +1456,17 @@ esp_err_t netlogging_sse_server_stop(void)
     /* Tell task to stop and delete itself */
     server->task_run = false;
     esp_err_t ret = netlogging_sse_server_wait_for_stop();
+    if (ret == ESP_OK) {
+        netlogging_task_reap(&server->task);
+    }
     return ret;
 }
 
 esp_err_t netlogging_sse_server_init(const sse_logging_param_t *param)
 {
+    if ((NULL == param) || ((NULL != param->control_token) && (strlen(param->control_token) > CONTROL_TOKEN_MAX))) {
+        return ESP_ERR_INVALID_ARG;
+    }
     NETLOGGING_LOGD("start see logging: port=%ld", param->port);
 
     // Allocate memory for the handle
@@ -546,6 +1477,7 @@ esp_err_t netlogging_sse_server_init(const sse_logging_param_t *param)
     }
     memset(server, 0, sizeof(struct server_handle_s));
     server->param = *param;
+    server->global_level = CONFIG_LOG_DEFAULT_LEVEL;
     server->state_event = xEventGroupCreate();
     if (server->state_event == NULL) {
         NETLOGGING_LOGE("xEventGroupCreate failed");
@@ -573,6 +1505,7 @@ esp_err_t netlogging_sse_server_deinit(void)
         {
             vEventGroupDelete(server->state_event);
         }
+        netlogging_task_free(&server->task);
         free(server);
         server = NULL;
         return ESP_OK;
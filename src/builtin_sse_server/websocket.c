@@ -0,0 +1,181 @@
+/*
+    WebSocket handshake key and framing (RFC 6455)
+
+    SHA-1 is only used for the handshake key, as the protocol requires. It is implemented here rather than taken
+    from mbedtls, whose SHA-1 functions changed names between the ESP-IDF versions this component supports.
+*/
+
+#include "websocket.h"
+
+#include <string.h>
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static inline uint32_t rol(uint32_t x, unsigned n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t h[5], const uint8_t *p)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)p[4 * i] << 24) | ((uint32_t)p[4 * i + 1] << 16) | ((uint32_t)p[4 * i + 2] << 8) | p[4 * i + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+// For short messages only, as the handshake key is
+static void sha1(const uint8_t *data, size_t len, uint8_t digest[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    uint8_t block[64];
+    size_t pos = 0;
+    for (; len - pos >= 64; pos += 64) {
+        sha1_block(h, data + pos);
+    }
+    // The rest, 0x80, zeros and the length in bits, in one or two blocks
+    size_t rest = len - pos;
+    memset(block, 0, sizeof(block));
+    memcpy(block, data + pos, rest);
+    block[rest] = 0x80;
+    if (rest >= 56) {
+        sha1_block(h, block);
+        memset(block, 0, sizeof(block));
+    }
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) {
+        block[63 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    sha1_block(h, block);
+    for (int i = 0; i < 20; i++) {
+        digest[i] = (uint8_t)(h[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+void netlogging_ws_accept_key(const char *key, char accept[NETLOGGING_WS_ACCEPT_LENGTH + 1])
+{
+    static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t input[64 + sizeof(WS_GUID)];
+    size_t key_len = strnlen(key, 64);
+    memcpy(input, key, key_len);
+    memcpy(input + key_len, WS_GUID, sizeof(WS_GUID) - 1);
+    uint8_t digest[21] = { 0 }; // a zero byte after the digest, for the last group of 3
+    sha1(input, key_len + sizeof(WS_GUID) - 1, digest);
+    char *out = accept;
+    for (int i = 0; i < 20; i += 3) {
+        uint32_t v = ((uint32_t)digest[i] << 16) | ((uint32_t)digest[i + 1] << 8) | ((i + 2 < 20) ? digest[i + 2] : 0);
+        *out++ = base64[(v >> 18) & 0x3F];
+        *out++ = base64[(v >> 12) & 0x3F];
+        *out++ = base64[(v >> 6) & 0x3F];
+        *out++ = (i + 2 < 20) ? base64[v & 0x3F] : '=';
+    }
+    *out = '\0';
+}
+
+size_t netlogging_ws_frame_header(uint8_t *header, uint8_t opcode, size_t payload_len)
+{
+    header[0] = 0x80 | opcode; // FIN
+    if (payload_len < 126) {
+        header[1] = (uint8_t)payload_len;
+        return 2;
+    }
+    if (payload_len <= 0xFFFF) {
+        header[1] = 126;
+        header[2] = (uint8_t)(payload_len >> 8);
+        header[3] = (uint8_t)payload_len;
+        return 4;
+    }
+    header[1] = 127;
+    for (int i = 0; i < 8; i++) {
+        header[9 - i] = (uint8_t)((uint64_t)payload_len >> (8 * i));
+    }
+    return 10;
+}
+
+void netlogging_ws_reader_reset(netlogging_ws_reader_t *reader)
+{
+    reader->len = 0;
+    reader->complete = false;
+}
+
+size_t netlogging_ws_read(netlogging_ws_reader_t *reader, const uint8_t *data, size_t len,
+    netlogging_ws_frame_t *frame, netlogging_ws_result_t *result)
+{
+    if (reader->complete) {
+        netlogging_ws_reader_reset(reader);
+    }
+    *result = NETLOGGING_WS_INCOMPLETE;
+    size_t pos = 0;
+    while (pos < len) {
+        // The first two bytes tell how long the frame is
+        size_t need = 2;
+        if (reader->len >= 2) {
+            uint8_t b0 = reader->buf[0];
+            uint8_t b1 = reader->buf[1];
+            if ((b0 & 0x70) || !(b1 & 0x80)) {
+                *result = NETLOGGING_WS_ERROR; // extension bits without an extension, or not masked
+                return pos;
+            }
+            if (!(b0 & 0x80) || ((b0 & 0x0F) == 0)) {
+                *result = NETLOGGING_WS_TOO_BIG; // fragmented, only long messages would be
+                return pos;
+            }
+            if ((b1 & 0x7F) > NETLOGGING_WS_PAYLOAD_MAX) {
+                *result = NETLOGGING_WS_TOO_BIG;
+                return pos;
+            }
+            need = 2 + 4 + (b1 & 0x7F);
+        }
+        size_t n = need - reader->len;
+        if (n > len - pos) {
+            n = len - pos;
+        }
+        memcpy(reader->buf + reader->len, data + pos, n);
+        reader->len += n;
+        pos += n;
+        if ((reader->len == need) && (need > 2)) {
+            const uint8_t *mask = reader->buf + 2;
+            frame->opcode = reader->buf[0] & 0x0F;
+            frame->payload = reader->buf + 6;
+            frame->len = need - 6;
+            for (size_t i = 0; i < frame->len; i++) {
+                frame->payload[i] ^= mask[i & 3];
+            }
+            reader->complete = true;
+            *result = NETLOGGING_WS_FRAME;
+            return pos;
+        }
+    }
+    return pos;
+}
@@ -0,0 +1,81 @@
+#ifndef NET_LOGGING_WEBSOCKET_H_
+#define NET_LOGGING_WEBSOCKET_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * WebSocket (RFC 6455) pieces for the built-in server: the handshake key, frame headers and an incremental
+ * reader for the client's frames. No dependencies on ESP-IDF, so it can be built and checked on the host.
+ *
+ * The server only takes short messages from the client (up to NETLOGGING_WS_PAYLOAD_MAX bytes, unfragmented),
+ * so a reader is a small fixed buffer.
+ */
+
+#define NETLOGGING_WS_ACCEPT_LENGTH (28)  // base64 of a SHA-1 digest
+#define NETLOGGING_WS_HEADER_MAX (10)     // of a frame from the server, which is not masked
+#define NETLOGGING_WS_PAYLOAD_MAX (125)   // longest frame accepted from the client, the limit of control frames
+
+enum {
+    NETLOGGING_WS_TEXT = 0x1,
+    NETLOGGING_WS_BINARY = 0x2,
+    NETLOGGING_WS_CLOSE = 0x8,
+    NETLOGGING_WS_PING = 0x9,
+    NETLOGGING_WS_PONG = 0xA,
+};
+
+// Close codes
+#define NETLOGGING_WS_NORMAL_CLOSURE (1000)
+#define NETLOGGING_WS_PROTOCOL_ERROR (1002)
+#define NETLOGGING_WS_MESSAGE_TOO_BIG (1009)
+
+typedef enum {
+    NETLOGGING_WS_INCOMPLETE = 0,   /*!< All data consumed, the frame needs more */
+    NETLOGGING_WS_FRAME,            /*!< A frame is complete */
+    NETLOGGING_WS_ERROR,            /*!< Not a valid frame from a client, close with NETLOGGING_WS_PROTOCOL_ERROR */
+    NETLOGGING_WS_TOO_BIG,          /*!< Close with NETLOGGING_WS_MESSAGE_TOO_BIG */
+} netlogging_ws_result_t;
+
+typedef struct {
+    uint8_t buf[2 + 4 + NETLOGGING_WS_PAYLOAD_MAX]; /*!< Header, mask and payload of the frame being received */
+    uint8_t len;
+    bool complete;                  /*!< buf holds a complete frame, the next byte starts a new one */
+} netlogging_ws_reader_t;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t *payload;               /*!< Unmasked, in the reader's buffer until the next netlogging_ws_read() */
+    size_t len;
+} netlogging_ws_frame_t;
+
+/**
+ * @brief The Sec-WebSocket-Accept value for a client's Sec-WebSocket-Key
+ */
+void netlogging_ws_accept_key(const char *key, char accept[NETLOGGING_WS_ACCEPT_LENGTH + 1]);
+
+/**
+ * @brief Writes the header of an unfragmented frame from the server
+ * @param[out] header At least NETLOGGING_WS_HEADER_MAX bytes
+ * @return Length of the header
+ */
+size_t netlogging_ws_frame_header(uint8_t *header, uint8_t opcode, size_t payload_len);
+
+void netlogging_ws_reader_reset(netlogging_ws_reader_t *reader);
+
+/**
+ * @brief Takes the next piece of the client's data
+ * @param[out] frame Set when the result is NETLOGGING_WS_FRAME
+ * @return Bytes consumed. Less than len only if a frame is complete or bad.
+ */
+size_t netlogging_ws_read(netlogging_ws_reader_t *reader, const uint8_t *data, size_t len,
+    netlogging_ws_frame_t *frame, netlogging_ws_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* NET_LOGGING_WEBSOCKET_H_ */
@@ -0,0 +1,808 @@
+//@ts-check
+// Lines kept in the page. Older lines are dropped, so memory and DOM size stay the same however long it runs.
+const CAPACITY = 50000;
+const OVERSCAN = 20; // rows rendered above and below the visible ones
+
+// Elements
+const logsContainer = document.getElementById('logs');
+const spacer = document.getElementById('spacer');
+const rowsContainer = document.getElementById('rows');
+const clearBtn = document.getElementById('clearBtn');
+const pauseBtn = document.getElementById('pauseBtn');
+const scrollBtn = document.getElementById('scrollBtn');
+const exportBtn = document.getElementById('exportBtn');
+const levelSelect = /** @type {HTMLSelectElement} */ (document.getElementById('levelSelect'));
+const tagSelect = /** @type {HTMLSelectElement} */ (document.getElementById('tagSelect'));
+const filterInput = /** @type {HTMLInputElement} */ (document.getElementById('filterInput'));
+const regexCheck = /** @type {HTMLInputElement} */ (document.getElementById('regexCheck'));
+const deviceFilterCheck = /** @type {HTMLInputElement} */ (document.getElementById('deviceFilterCheck'));
+const findInput = /** @type {HTMLInputElement} */ (document.getElementById('findInput'));
+const prevBtn = document.getElementById('prevBtn');
+const nextBtn = document.getElementById('nextBtn');
+const findStatus = document.getElementById('findStatus');
+const deviceBtn = document.getElementById('deviceBtn');
+const devicePanel = document.getElementById('devicePanel');
+const tokenInput = /** @type {HTMLInputElement} */ (document.getElementById('tokenInput'));
+const globalLevelSelect = /** @type {HTMLSelectElement} */ (document.getElementById('globalLevelSelect'));
+const levelTagInput = /** @type {HTMLInputElement} */ (document.getElementById('levelTagInput'));
+const tagLevelSelect = /** @type {HTMLSelectElement} */ (document.getElementById('tagLevelSelect'));
+const setTagLevelBtn = document.getElementById('setTagLevelBtn');
+const tagLevels = document.getElementById('tagLevels');
+const sinkLevels = document.getElementById('sinkLevels');
+const deviceStats = document.getElementById('deviceStats');
+const connectionStatus = document.getElementById('connection');
+const counts = document.getElementById('counts');
+
+// Level and tag of a line, parsed once when it arrives. LEVEL_NONE for lines without an esp_log prefix.
+const LEVEL_ERROR = 1, LEVEL_WARNING = 2, LEVEL_INFO = 3, LEVEL_DEBUG = 4, LEVEL_VERBOSE = 5, LEVEL_NONE = 6;
+const LEVEL_CLASSES = ['', 'log-line error', 'log-line warning', 'log-line info', 'log-line debug', 'log-line verbose', 'log-line'];
+const LEVEL_CHARS = { E: LEVEL_ERROR, W: LEVEL_WARNING, I: LEVEL_INFO, D: LEVEL_DEBUG, V: LEVEL_VERBOSE };
+const ESP_LOG = /^([EWIDV]) \([^)]*\) ([^:]*): /;
+const LEVEL_LETTERS = ' EWIDV';
+
+// Log records of the WebSocket stream (see sse_server.c): u8 flags, u32 seq, [u32 dropped], u32 timestamp, u8 core,
+// u8 task name length, task name, u8 tag length, tag, u16 message length, message. All little endian.
+// The device has found level, tag and message already, they are shown without parsing the line again.
+const RECORD_LEVEL_MASK = 0x07;
+const RECORD_DROPPED = 1 << 3;
+const RECORD_HISTORY = 1 << 4;
+const RECORD_HISTORY_END = 1 << 5;
+
+// Device control through /levels and /stats (see sse_server.c), levels are esp_log_level_t
+const LEVEL_NAMES = ['None', 'Error', 'Warning', 'Info', 'Debug', 'Verbose'];
+const STATS_INTERVAL_MS = 2000;
+
+// Column store: line n (counting all lines ever added) is in slot n % CAPACITY of each column.
+// The lines kept are first .. total - 1.
+const texts = new Array(CAPACITY);
+const levels = new Uint8Array(CAPACITY);
+const tags = new Uint16Array(CAPACITY);     // index into tagNames, 0 for none
+const times = new Float64Array(CAPACITY);   // when it arrived, ms since the epoch
+let total = 0;
+let first = 0;
+
+// Index, updated as lines come and go: lines per tag, for the tag list
+const tagNames = [''];
+const tagIds = new Map();
+const tagCounts = [0];
+let tagsChanged = false;
+
+// The lines that pass the filters, in order. view[viewStart] is the first, older entries are dropped lazily.
+let view = [];
+let viewStart = 0;
+let viewDropped = 0;    // entries that went off the top since the last frame
+
+// Filters
+let maxLevel = LEVEL_NONE;
+let tagFilter = 0;      // 0 for all
+let textFilter = null;  // RegExp, or null for all
+let findRegex = null;
+let findPos = -1;       // line number of the current match, -1 for none
+let findCount = 0;
+
+// State
+let isPaused = false;
+let autoScroll = true;
+let events = null;
+let socket = null;
+let useWebSocket = !!window.WebSocket; // until the server turns out not to have one
+let inflater = null;    // writer of the DecompressionStream of a compressed WebSocket stream
+let partial = new Uint8Array(0); // start of a record that continues in the next message
+const decoder = new TextDecoder();
+let lastSeq = -1;       // of the newest line from the device
+let history = null;     // while waiting for the history: {lines: [[seq, dropped, record]], live: [...]}
+let pending = [];       // lines received since the last frame, or while paused
+let frameRequested = false;
+let rowHeight = 20;
+let received = 0;       // for the lines/s in the status
+let rate = 0;
+let statsTimer = null;  // while the device panel is open
+let lastStats = null;   // the previous /stats, the rates are the difference
+
+// Initialize UI state
+updateButtons();
+measureRowHeight();
+fillLevelSelect(globalLevelSelect);
+fillLevelSelect(tagLevelSelect);
+tokenInput.value = localStorage.getItem('netlogToken') || '';
+
+// Set up event handlers
+clearBtn.addEventListener('click', clearLogs);
+pauseBtn.addEventListener('click', togglePause);
+scrollBtn.addEventListener('click', toggleScroll);
+exportBtn.addEventListener('click', exportLines);
+levelSelect.addEventListener('change', applyFilters);
+tagSelect.addEventListener('change', applyFilters);
+filterInput.addEventListener('input', applyFilters);
+regexCheck.addEventListener('change', () => { applyFilters(); applyFind(); });
+deviceFilterCheck.addEventListener('change', sendDeviceFilters);
+findInput.addEventListener('input', applyFind);
+findInput.addEventListener('keydown', (e) => {
+  if (e.key === 'Enter') {
+    findNext(e.shiftKey ? -1 : 1);
+  }
+});
+prevBtn.addEventListener('click', () => findNext(-1));
+nextBtn.addEventListener('click', () => findNext(1));
+logsContainer.addEventListener('scroll', onScroll, { passive: true });
+window.addEventListener('resize', requestFrame);
+deviceBtn.addEventListener('click', toggleDevicePanel);
+tokenInput.addEventListener('change', () => {
+  localStorage.setItem('netlogToken', tokenInput.value);
+  lastStats = null;
+  loadLevels();
+});
+globalLevelSelect.addEventListener('change', () => setLevel('tag=*', globalLevelSelect.value));
+setTagLevelBtn.addEventListener('click', () => {
+  if (levelTagInput.value) {
+    setLevel(`tag=${encodeURIComponent(levelTagInput.value)}`, tagLevelSelect.value);
+  }
+});
+
+// Functions
+function measureRowHeight() {
+  const probe = document.createElement('div');
+  probe.className = 'log-line';
+  probe.textContent = 'X';
+  rowsContainer.appendChild(probe);
+  rowHeight = probe.getBoundingClientRect().height || 20;
+  rowsContainer.removeChild(probe);
+}
+
+function clearLogs() {
+  total = 0;
+  first = 0;
+  texts.fill(undefined);
+  tagCounts.fill(0);
+  tagsChanged = true;
+  pending = [];
+  view = [];
+  viewStart = 0;
+  viewDropped = 0;
+  findPos = -1;
+  findCount = 0;
+  requestFrame();
+}
+
+function togglePause() {
+  isPaused = !isPaused;
+  // Over a WebSocket the device stops sending, and tells how many lines were dropped when it resumes
+  sendCommand(isPaused ? 'pause' : 'resume');
+  updateButtons();
+  requestFrame();
+}
+
+function toggleScroll() {
+  autoScroll = !autoScroll;
+  updateButtons();
+  requestFrame();
+}
+
+function updateButtons() {
+  pauseBtn.textContent = isPaused ? 'Resume' : 'Pause';
+  pauseBtn.style.backgroundColor = isPaused ? '#e74c3c' : '';
+
+  scrollBtn.textContent = `Auto-scroll: ${autoScroll ? 'ON' : 'OFF'}`;
+  scrollBtn.style.backgroundColor = autoScroll ? '#2ecc71' : '';
+}
+
+function onScroll() {
+  // Scrolling up stops following the end, scrolling back to the end follows it again
+  const atEnd = logsContainer.scrollTop + logsContainer.clientHeight >= logsContainer.scrollHeight - rowHeight;
+  if (atEnd !== autoScroll) {
+    autoScroll = atEnd;
+    updateButtons();
+  }
+  requestFrame();
+}
+
+function requestFrame() {
+  if (!frameRequested) {
+    frameRequested = true;
+    requestAnimationFrame(onFrame);
+  }
+}
+
+/**
+ * @param {string} text
+ * @param {boolean} regex
+ * @param {HTMLInputElement} input marked invalid if the expression doesn't compile
+ */
+function makeRegex(text, regex, input) {
+  input.classList.remove('invalid');
+  if (!text) {
+    return null;
+  }
+  try {
+    return new RegExp(regex ? text : text.replace(/[.*+?^${}()|[\]\\]/g, '\\$&'), 'i');
+  } catch (e) {
+    input.classList.add('invalid');
+    return null;
+  }
+}
+
+function matches(n) {
+  const slot = n % CAPACITY;
+  return (levels[slot] <= maxLevel) && (!tagFilter || (tags[slot] === tagFilter)) &&
+    (!textFilter || textFilter.test(texts[slot]));
+}
+
+// Filters go over all kept lines at once, the view is built again
+function applyFilters() {
+  maxLevel = Number(levelSelect.value);
+  tagFilter = tagSelect.value ? (tagIds.get(tagSelect.value) || -1) : 0;
+  textFilter = makeRegex(filterInput.value, regexCheck.checked, filterInput);
+  sendDeviceFilters();
+  view = [];
+  viewStart = 0;
+  viewDropped = 0;
+  for (let n = first; n < total; n++) {
+    if (matches(n)) {
+      view.push(n);
+    }
+  }
+  applyFind();
+}
+
+function applyFind() {
+  findRegex = makeRegex(findInput.value, regexCheck.checked, findInput);
+  findPos = -1;
+  findCount = 0;
+  if (findRegex) {
+    for (let i = viewStart; i < view.length; i++) {
+      if (findRegex.test(texts[view[i] % CAPACITY])) {
+        findCount++;
+      }
+    }
+  }
+  requestFrame();
+}
+
+// Jumps to the next match in the shown lines, dir 1 down, -1 up
+function findNext(dir) {
+  if (!findRegex || (view.length === viewStart)) {
+    return;
+  }
+  const length = view.length - viewStart;
+  let at = (findPos >= 0) ? viewIndexOf(findPos) : (dir > 0 ? -1 : length);
+  for (let step = 0; step < length; step++) {
+    at = (at + dir + length) % length;
+    const n = view[viewStart + at];
+    if (findRegex.test(texts[n % CAPACITY])) {
+      findPos = n;
+      autoScroll = false;
+      updateButtons();
+      logsContainer.scrollTop = Math.max(0, (at + 0.5) * rowHeight - logsContainer.clientHeight / 2);
+      requestFrame();
+      return;
+    }
+  }
+}
+
+// Position of line n in the view, or of the line before it
+function viewIndexOf(n) {
+  let lo = viewStart, hi = view.length;
+  while (lo < hi) {
+    const mid = (lo + hi) >> 1;
+    if (view[mid] < n) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo - viewStart;
+}
+
+function tagOf(name) {
+  let id = tagIds.get(name);
+  if (id === undefined) {
+    id = tagNames.length;
+    if (id > 0xFFFF) {
+      return 0; // there are not that many tags, unless something logs made up ones
+    }
+    tagNames.push(name);
+    tagCounts.push(0);
+    tagIds.set(name, id);
+  }
+  return id;
+}
+
+// tag undefined: level and tag are parsed from the line
+function addLogLine(logLine, level = 0, tag = undefined) {
+  if (total - first === CAPACITY) {
+    // Full, the oldest line goes
+    const old = first % CAPACITY;
+    tagCounts[tags[old]]--;
+    if (tagCounts[tags[old]] === 0) {
+      tagsChanged = true;
+    }
+    first++;
+    while ((viewStart < view.length) && (view[viewStart] < first)) {
+      viewStart++;
+      viewDropped++;
+    }
+  }
+  const slot = total % CAPACITY;
+  if (tag === undefined) {
+    const m = ESP_LOG.exec(logLine);
+    level = level || (m ? LEVEL_CHARS[m[1]] : LEVEL_NONE);
+    tag = m ? m[2] : '';
+  }
+  texts[slot] = logLine;
+  levels[slot] = level || LEVEL_NONE;
+  tags[slot] = tag ? tagOf(tag) : 0;
+  times[slot] = Date.now();
+  if (tagCounts[tags[slot]]++ === 0) {
+    tagsChanged = true;
+  }
+  if (matches(total)) {
+    view.push(total);
+    if (findRegex && findRegex.test(logLine)) {
+      findCount++;
+    }
+  }
+  total++;
+  if (viewStart > CAPACITY) {
+    view = view.slice(viewStart);
+    viewStart = 0;
+  }
+  requestFrame();
+}
+
+// All lines that came in since the last frame are added at once, then the visible rows are drawn once
+function onFrame() {
+  frameRequested = false;
+  if (!isPaused) {
+    for (const line of pending) {
+      addLogLine(...line);
+    }
+    pending = [];
+  }
+  if (tagsChanged) {
+    updateTags();
+  }
+  render();
+}
+
+function updateTags() {
+  tagsChanged = false;
+  const selected = tagSelect.value;
+  const names = [];
+  for (let id = 1; id < tagNames.length; id++) {
+    if ((tagCounts[id] > 0) || (tagNames[id] === selected)) {
+      names.push(tagNames[id]);
+    }
+  }
+  names.sort();
+  tagSelect.length = 1;
+  for (const name of names) {
+    tagSelect.add(new Option(name, name));
+  }
+  tagSelect.value = selected;
+}
+
+function render() {
+  const shown = view.length - viewStart;
+  spacer.style.height = (shown * rowHeight) + 'px';
+  if (autoScroll) {
+    logsContainer.scrollTop = logsContainer.scrollHeight;
+  } else if (viewDropped > 0) {
+    // Lines went off the top: keep the lines being read in place
+    logsContainer.scrollTop = Math.max(0, logsContainer.scrollTop - viewDropped * rowHeight);
+  }
+  viewDropped = 0;
+  const top = Math.max(0, Math.floor(logsContainer.scrollTop / rowHeight) - OVERSCAN);
+  const bottom = Math.min(shown, Math.ceil((logsContainer.scrollTop + logsContainer.clientHeight) / rowHeight) + OVERSCAN);
+  rowsContainer.style.transform = `translateY(${top * rowHeight}px)`;
+  // Reuse the row elements, only their text and class change
+  const rows = rowsContainer.children;
+  const needed = Math.max(0, bottom - top);
+  while (rows.length < needed) {
+    rowsContainer.appendChild(document.createElement('div'));
+  }
+  while (rows.length > needed) {
+    rowsContainer.removeChild(rowsContainer.lastChild);
+  }
+  for (let i = 0; i < needed; i++) {
+    const n = view[viewStart + top + i];
+    const slot = n % CAPACITY;
+    const row = /** @type {HTMLElement} */ (rows[i]);
+    if (row.textContent !== texts[slot]) {
+      row.textContent = texts[slot];
+    }
+    let cls = LEVEL_CLASSES[levels[slot]];
+    if (n === findPos) {
+      cls += ' current';
+    } else if (findRegex && findRegex.test(texts[slot])) {
+      cls += ' match';
+    }
+    if (row.className !== cls) {
+      row.className = cls;
+    }
+  }
+  const kept = total - first;
+  counts.textContent = ((shown < kept) ? `${shown} shown, ` : '') + `${kept} of ${CAPACITY} lines, ${rate} lines/s` +
+    (isPaused ? `, ${pending.length} waiting` : '');
+  findStatus.textContent = findRegex ? `${findCount} found` : '';
+}
+
+// Saves the shown lines, each with the time it arrived
+function exportLines() {
+  const out = [];
+  for (let i = viewStart; i < view.length; i++) {
+    const slot = view[i] % CAPACITY;
+    const t = new Date(times[slot]);
+    out.push(`${t.toISOString()} ${texts[slot]}\n`);
+  }
+  const a = document.createElement('a');
+  a.href = URL.createObjectURL(new Blob(out, { type: 'text/plain' }));
+  a.download = `${document.title.replace(/\s+/g, '-')}-${new Date().toISOString().replace(/[:.]/g, '-')}.log`;
+  a.click();
+  setTimeout(() => URL.revokeObjectURL(a.href), 1000);
+}
+
+function stripColors(text) {
+  return text.replace(/\u001b[^m]*?m/g, ''); // Remove ANSI escape codes
+}
+
+function queueLine(logLine, level = 0, tag = undefined) {
+  if (logLine) {
+    pending.push([logLine, level, tag]);
+    received++;
+  }
+  if (pending.length > CAPACITY) {
+    pending.splice(0, pending.length - CAPACITY); // paused for long, keep the newest
+  }
+  requestFrame();
+}
+
+function onLogLineReceived(event) {
+  feedWatchdog();
+  // One event may hold a drop notice and a line
+  for (const line of event.data.split('\n')) {
+    queueLine(stripColors(line).trimEnd());
+  }
+}
+
+// The event stream with ?format=json: an array of {seq, ts, lvl, [dropped], tag, task, msg} per event
+function onLogRecordsReceived(event) {
+  feedWatchdog();
+  for (const r of JSON.parse(event.data)) {
+    onRecord(0, r.seq, r.dropped || 0, { level: r.lvl, ts: r.ts, task: r.task, tag: r.tag, msg: r.msg });
+  }
+}
+
+function sendCommand(command) {
+  if (socket && (socket.readyState === WebSocket.OPEN)) {
+    socket.send(command);
+  }
+}
+
+// With "On device" checked, the device sends only the lines of the level and tag filters, the others never arrive
+function sendDeviceFilters() {
+  const onDevice = deviceFilterCheck.checked;
+  sendCommand(`level ${onDevice ? Math.min(maxLevel, LEVEL_VERBOSE) : LEVEL_VERBOSE}`);
+  sendCommand((onDevice && tagSelect.value) ? `tag ${tagSelect.value}` : 'tag');
+}
+
+// Records may be split between messages when the stream is compressed, the rest waits for the next piece
+function onRecords(chunk) {
+  let data = chunk;
+  if (partial.length > 0) {
+    data = new Uint8Array(partial.length + chunk.length);
+    data.set(partial);
+    data.set(chunk, partial.length);
+  }
+  const dv = new DataView(data.buffer, data.byteOffset, data.byteLength);
+  let pos = 0;
+  for (;;) {
+    let p = pos + 5;
+    if (p > data.length) {
+      break;
+    }
+    const flags = data[pos];
+    const seq = dv.getUint32(pos + 1, true);
+    let dropped = 0;
+    if (flags & RECORD_DROPPED) {
+      if (p + 4 > data.length) {
+        break;
+      }
+      dropped = dv.getUint32(p, true);
+      p += 4;
+    }
+    if (p + 6 > data.length) {
+      break;
+    }
+    const ts = dv.getUint32(p, true);
+    p += 5; // and the core
+    const task = p + 1;
+    p = task + data[p];
+    if (p >= data.length) {
+      break;
+    }
+    const tag = p + 1;
+    p = tag + data[p];
+    if (p + 2 > data.length) {
+      break;
+    }
+    const length = dv.getUint16(p, true);
+    p += 2;
+    if (p + length > data.length) {
+      break;
+    }
+    onRecord(flags, seq, dropped, {
+      level: flags & RECORD_LEVEL_MASK,
+      ts,
+      task: decoder.decode(data.subarray(task, tag - 1)),
+      tag: decoder.decode(data.subarray(tag, p - 2)),
+      msg: decoder.decode(data.subarray(p, p + length)),
+    });
+    pos = p + length;
+  }
+  partial = data.slice(pos);
+}
+
+function onRecord(flags, seq, dropped, record) {
+  if (flags & RECORD_HISTORY_END) {
+    endHistory();
+    return;
+  }
+  if (history) {
+    (flags & RECORD_HISTORY ? history.lines : history.live).push([seq, dropped, record]);
+    return;
+  }
+  lastSeq = seq;
+  if (dropped > 0) {
+    queueLine(`W (-) net_logging: ${dropped} lines dropped`, LEVEL_WARNING, 'net_logging');
+  }
+  const { level, ts, tag } = record;
+  // Lines of a message after the first one have no level of their own
+  const [first, ...more] = stripColors(record.msg).split('\n');
+  if (level > 0) {
+    queueLine(tag ? `${LEVEL_LETTERS[level]} (${ts}) ${tag}: ${first}` : `${LEVEL_LETTERS[level]} (${ts}) ${first}`, level, tag);
+  } else {
+    queueLine(first.trimEnd(), LEVEL_NONE, '');
+  }
+  for (const line of more) {
+    queueLine(line.trimEnd(), LEVEL_NONE, '');
+  }
+}
+
+// The history goes before the lines that came meanwhile. Lines that were shown before a reconnect are skipped,
+// unless the device restarted and counts from 0 again.
+function endHistory() {
+  if (!history) {
+    return;
+  }
+  const { lines, live } = history;
+  history = null;
+  const firstLive = live.length ? live[0][0] : Infinity;
+  const after = (firstLive < lastSeq) ? -1 : lastSeq;
+  for (const [seq, dropped, record] of lines) {
+    if ((seq > after) && (seq < firstLive)) {
+      onRecord(0, seq, dropped, record);
+    }
+  }
+  for (const [seq, dropped, record] of live) {
+    onRecord(0, seq, dropped, record);
+  }
+}
+
+function onSocketMessage(event) {
+  feedWatchdog();
+  const data = new Uint8Array(event.data);
+  if (data.length === 0) {
+    return; // keep-alive
+  }
+  if (inflater) {
+    inflater.write(data).catch(() => {});
+  } else {
+    onRecords(data);
+  }
+}
+
+// The compressed stream is one gzip stream over all messages, flushed at the end of each
+function startInflater() {
+  const stream = new DecompressionStream('gzip');
+  const reader = stream.readable.getReader();
+  (async () => {
+    try {
+      for (;;) {
+        const { value, done } = await reader.read();
+        if (done) {
+          break;
+        }
+        onRecords(value);
+      }
+    } catch (e) {
+      console.warn('Decompression failed', e);
+    }
+  })();
+  return stream.writable.getWriter();
+}
+
+function openWebSocket() {
+  const url = `${location.protocol === 'https:' ? 'wss' : 'ws'}://${location.host}/ws`;
+  const protocols = window.DecompressionStream ? ['netlog-gzip', 'netlog'] : ['netlog'];
+  const ws = new WebSocket(url, protocols);
+  let opened = false;
+  ws.binaryType = 'arraybuffer';
+  ws.onopen = () => {
+    opened = true;
+    inflater = (ws.protocol === 'netlog-gzip') ? startInflater() : null;
+    partial = new Uint8Array(0);
+    history = { lines: [], live: [] };
+    ws.send('history');
+    sendDeviceFilters();
+    if (isPaused) {
+      ws.send('pause');
+    }
+    deviceFilterCheck.parentElement.hidden = false;
+    onConnected();
+  };
+  ws.onmessage = onSocketMessage;
+  ws.onclose = () => {
+    if (!opened) {
+      useWebSocket = false; // e.g. a custom server without /ws, the event stream will do
+    }
+    onDisconnected();
+    setTimeout(connect, 1000);
+  };
+  socket = ws;
+  feedWatchdog();
+}
+
+function connect() {
+  if (useWebSocket) {
+    openWebSocket();
+  } else {
+    subscribeToSSE();
+  }
+}
+
+setInterval(() => {
+  rate = received;
+  received = 0;
+  requestFrame();
+}, 1000);
+
+function onKeepAlive(event) {
+  console.debug('Keep-alive event received: ', event.data);
+  feedWatchdog();
+}
+
+function onConnected() {
+  connectionStatus.textContent = socket ? 'Connected (WebSocket)' : 'Connected';
+  connectionStatus.style.color = '#2ecc71';
+  addLogLine('Connected!', LEVEL_ERROR);
+}
+
+function onDisconnected() {
+  connectionStatus.textContent = 'Trying to connect...';
+  connectionStatus.style.color = '#e74c3c';
+  if (events) {
+    events.close();
+    events = null;
+  }
+  if (socket) {
+    socket.onclose = null;
+    socket.close();
+    socket = null;
+  }
+  if (inflater) {
+    inflater.close().catch(() => {});
+    inflater = null;
+  }
+  history = null;
+  deviceFilterCheck.parentElement.hidden = true;
+}
+
+function subscribeToSSE() {
+  events = new EventSource('/log-events?format=json');
+  events.onopen = onConnected;
+  events.onerror = onDisconnected;
+  events.addEventListener('log-records', onLogRecordsReceived, false);
+  events.addEventListener('log-line', onLogLineReceived, false);
+  events.addEventListener('keepalive', onKeepAlive, false);
+  feedWatchdog();
+}
+
+// Start a watchdog timer to check connection status
+let watchdogTimer = null;
+function feedWatchdog() {
+  if (watchdogTimer) {
+    clearTimeout(watchdogTimer);
+  }
+  watchdogTimer = setTimeout(() => {
+    addLogLine('Connection Timeout!', LEVEL_ERROR);
+    onDisconnected();
+    connect();
+  }, 15000);
+}
+
+function fillLevelSelect(select) {
+  LEVEL_NAMES.forEach((name, level) => select.add(new Option(name, String(level))));
+}
+
+async function deviceRequest(method, path) {
+  const response = await fetch(path, { method, headers: { Authorization: `Bearer ${tokenInput.value}` }, cache: 'no-store' });
+  if (response.status === 401) {
+    throw new Error('Wrong token');
+  }
+  if (response.status === 404) {
+    throw new Error('No control token set on the device');
+  }
+  if (!response.ok) {
+    throw new Error(`${response.status} ${response.statusText}`);
+  }
+  return response.json();
+}
+
+function showDeviceError(error) {
+  deviceStats.textContent = error.message;
+}
+
+function toggleDevicePanel() {
+  devicePanel.hidden = !devicePanel.hidden;
+  clearInterval(statsTimer);
+  statsTimer = null;
+  lastStats = null;
+  if (!devicePanel.hidden) {
+    loadLevels();
+    pollStats();
+    statsTimer = setInterval(pollStats, STATS_INTERVAL_MS);
+  }
+}
+
+function showLevels(levels) {
+  globalLevelSelect.value = String(levels.global);
+  tagLevels.textContent = '';
+  for (const [tag, level] of Object.entries(levels.tags)) {
+    const button = document.createElement('button');
+    button.textContent = `${tag}: ${LEVEL_NAMES[level]}`;
+    button.title = 'Change';
+    button.addEventListener('click', () => {
+      levelTagInput.value = tag;
+      tagLevelSelect.value = String(level);
+    });
+    tagLevels.appendChild(button);
+  }
+  sinkLevels.textContent = '';
+  for (const [sink, level] of Object.entries(levels.sinks)) {
+    const label = document.createElement('label');
+    const select = document.createElement('select');
+    fillLevelSelect(select);
+    select.value = String(level);
+    select.addEventListener('change', () => setLevel(`sink=${encodeURIComponent(sink)}`, select.value));
+    label.append(`${sink} `, select);
+    sinkLevels.appendChild(label);
+  }
+}
+
+function loadLevels() {
+  deviceRequest('GET', '/levels').then(showLevels, showDeviceError);
+}
+
+function setLevel(what, level) {
+  deviceRequest('POST', `/levels?${what}&level=${level}`).then(showLevels, showDeviceError);
+}
+
+// Rates over the last interval, so a change of level shows within a few seconds
+function pollStats() {
+  deviceRequest('GET', '/stats').then((stats) => {
+    const seconds = lastStats ? (stats.us - lastStats.us) / 1e6 : 0;
+    if (seconds > 0) { // not after a restart of the device
+      const perSecond = (key) => ((stats[key] - lastStats[key]) >>> 0) / seconds;
+      deviceStats.textContent = `${perSecond('lines').toFixed(1)} lines/s, ${(perSecond('bytes') / 1024).toFixed(1)} KB/s, ` +
+        `${perSecond('skipped').toFixed(1)} skipped/s, ${perSecond('dropped').toFixed(1)} dropped/s`;
+    }
+    lastStats = stats;
+  }, showDeviceError);
+}
+
+// Prefer the WebSocket, fall back to Server-Sent Events
+if (useWebSocket || !!window.EventSource) {
+  connect();
+} else {
+  addLogLine('Your browser does not support WebSockets or Server-Sent Events.');
+}
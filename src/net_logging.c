@@ -1,60 +1,230 @@
 #include "net_logging.h" // public header file should stand on its own, so include it first
+#include "net_logging_priv.h"
 
+#include <inttypes.h>
+#include <string.h>
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/semphr.h"
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-#include "freertos/ringbuf.h"
-#else
-#include "freertos/message_buffer.h"
+
+#ifndef CONFIG_NETLOGGING_LOSSLESS
+#define CONFIG_NETLOGGING_LOSSLESS 0
+#endif
+#ifndef CONFIG_NETLOGGING_LOSSLESS_TIMEOUT_MS
+#define CONFIG_NETLOGGING_LOSSLESS_TIMEOUT_MS 100
 #endif
 
 #define TAG "net_logging: "
 
 SemaphoreHandle_t logBuffersMutex;
-void *logBuffers[6] = {};
+netlogging_ring_t *logBuffers[6] = {};
+static uint8_t logSinks[6];  // netlogging_sink_t of each ring in logBuffers
 bool writeToStdout;
+static bool stdoutAsync; // stdout is written by the stdout sink's task, see net_logging_stdout.c
 vprintf_like_t old_vprintf = NULL;
+static netlogging_stats_t stats; // protected by stats_lock, so a sink can count without waiting for logBuffersMutex
+static netlogging_compression_stats_t compression[NETLOGGING_SINK_COUNT]; // protected by stats_lock
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t next_seq; // protected by logBuffersMutex, so the lines go to the rings in the order of their numbers
+static volatile bool lossless = CONFIG_NETLOGGING_LOSSLESS;
+static volatile TickType_t lossless_ticks = pdMS_TO_TICKS(CONFIG_NETLOGGING_LOSSLESS_TIMEOUT_MS);
+static portMUX_TYPE isr_lines_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t isr_lines;
+
+// Level of each kind of sink, read without the mutex by logging_vprintf
+static const char *const sink_names[NETLOGGING_SINK_COUNT] = {
+    [NETLOGGING_SINK_STDOUT] = "stdout",
+    [NETLOGGING_SINK_MULTICAST] = "multicast",
+    [NETLOGGING_SINK_TCP] = "tcp",
+    [NETLOGGING_SINK_HTTP] = "http",
+    [NETLOGGING_SINK_MQTT] = "mqtt",
+    [NETLOGGING_SINK_SYSLOG] = "syslog",
+    [NETLOGGING_SINK_SSE] = "sse",
+    [NETLOGGING_SINK_USER] = "user",
+};
+static volatile uint8_t sink_levels[NETLOGGING_SINK_COUNT] = { [0 ... NETLOGGING_SINK_COUNT - 1] = ESP_LOG_VERBOSE };
+
+// Tasks that all network sinks depend on. If they waited for a sink, the sink could be waiting for them.
+// A sink that depends on a task of its own, e.g. of a client library, names it with netlogging_ring_set_helper().
+static const char *const never_block_tasks[] = { "tiT", "wifi", "sys_evt" };
+
+/**
+ * @brief Check if the calling task may wait for room in a log ring. Must be called with logBuffersMutex held.
+ */
+static bool logging_may_block(void)
+{
+    if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) {
+        return false;
+    }
+    const char *name = pcTaskGetName(NULL);
+    for (size_t i = 0; i < sizeof(never_block_tasks) / sizeof(never_block_tasks[0]); i++) {
+        if (strcmp(name, never_block_tasks[i]) == 0) {
+            return false;
+        }
+    }
+    // A sink, or a task that a sink depends on, must never wait for a sink
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < 6; i++) {
+        if (logBuffers[i] == NULL) {
+            continue;
+        }
+        const char *helper = netlogging_ring_get_helper(logBuffers[i]);
+        if ((netlogging_ring_get_reader(logBuffers[i]) == self) || ((helper != NULL) && (strcmp(name, helper) == 0))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Find level, tag and message of a line from its esp_log prefix, e.g. "E (1234) tag: ..." or
+ *        "\033[0;31mE (1234) tag: ...\033[0m\n". A line that doesn't start with a level letter, e.g. plain printf
+ *        output, gets ESP_LOG_NONE and no tag.
+ */
+void netlogging_record_parse(netlogging_record_hdr_t *record, const char *text, size_t len)
+{
+    // The message ends before the line end and the color reset of CONFIG_LOG_COLORS
+    size_t end = len;
+    while ((end > 0) && ((text[end - 1] == '\n') || (text[end - 1] == '\r'))) {
+        end--;
+    }
+    if ((end >= 4) && (0 == memcmp(text + end - 4, "\033[0m", 4))) {
+        end -= 4;
+    }
+    record->level = ESP_LOG_NONE;
+    record->tag_offset = 0;
+    record->tag_len = 0;
+    record->msg_offset = 0;
+    record->msg_len = end;
+
+    size_t start = 0;
+    if ((end > 0) && (text[0] == '\033')) {
+        // Skip the color sequence
+        const char *m = memchr(text, 'm', end);
+        if (NULL == m) {
+            return;
+        }
+        start = m + 1 - text;
+    }
+    const char *line = text + start;
+    if ((end - start < 3) || (line[1] != ' ') || (line[2] != '(')) {
+        return;
+    }
+    switch (line[0]) {
+    case 'E': record->level = ESP_LOG_ERROR; break;
+    case 'W': record->level = ESP_LOG_WARN; break;
+    case 'I': record->level = ESP_LOG_INFO; break;
+    case 'D': record->level = ESP_LOG_DEBUG; break;
+    case 'V': record->level = ESP_LOG_VERBOSE; break;
+    default: return;
+    }
+    // "E (1234) tag: message", the timestamp may also be the time of day
+    const char *close = memchr(line, ')', end - start);
+    if ((NULL == close) || (close + 1 >= text + end) || (close[1] != ' ')) {
+        return;
+    }
+    record->msg_offset = close + 2 - text;
+    record->msg_len = end - record->msg_offset;
+    const char *colon = memchr(close, ':', text + end - close);
+    if ((NULL != colon) && (colon - text <= UINT8_MAX)) {
+        record->tag_offset = close + 2 - text;
+        record->tag_len = colon - (close + 2);
+        size_t msg = colon + 1 - text;
+        if ((msg < end) && (text[msg] == ' ')) {
+            msg++;
+        }
+        record->msg_offset = msg;
+        record->msg_len = end - msg;
+    }
+}
 
 // Please note that function callback here must be re-entrant as it can be invoked in parallel from multiple thread context.
 static int logging_vprintf(const char *fmt, va_list l) {
-    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    char *buffer = malloc(CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH);
-    if (buffer == NULL) {
+    if (xPortInIsrContext()) {
+        // Neither the mutex nor malloc may be used in an ISR. Just count the line.
+        portENTER_CRITICAL_ISR(&isr_lines_lock);
+        isr_lines++;
+        portEXIT_CRITICAL_ISR(&isr_lines_lock);
+        return 0;
+    }
+    // The record header goes in front of the text, so a record can be stored in a ring in one piece
+    netlogging_record_hdr_t *record = malloc(sizeof(netlogging_record_hdr_t) + CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH);
+    if (record == NULL) {
         // Don't use ESP_LOGE here, as it will call logging_vprintf again, causing a infinite recursion and stack overflow.
         NETLOGGING_LOGE(TAG, "logging_vprintf malloc fail");
         return 0;
     }
+    char *buffer = (char *)(record + 1);
     int len = vsnprintf(buffer, CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH, fmt, l);
+    if (len >= CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH) {
+        len = CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH - 1; // truncated
+    }
     if (len > 0) {
         const int cstr_len = len + 1;
+        netlogging_record_parse(record, buffer, len);
+        record->timestamp = esp_log_timestamp();
+        record->core = xPortGetCoreID();
+        strncpy(record->task, pcTaskGetName(NULL), sizeof(record->task) - 1);
+        record->task[sizeof(record->task) - 1] = '\0';
 
+        // Rings that may wait for room are sent to after the mutex is released, so a slow sink doesn't stall
+        // the other tasks that log. The line goes to them right away if there is room, to keep the order.
+        netlogging_ring_t *waiting[6];
+        int waiting_count = 0;
+        bool may_block = false;
+        netlogging_stats_t counts = { .lines = 1, .bytes = len };
         if (xSemaphoreTake(logBuffersMutex, portMAX_DELAY) == pdTRUE) {
-#if CONFIG_NETLOGGING_USE_RINGBUFFER
-            // Send to RingBuffers
+            record->seq = next_seq++;
+            may_block = logging_may_block();
+            // Send to all registered log rings whose level takes the line
             for (int i = 0; i < 6; i++) {
-                if (logBuffers[i] != NULL) {
-                    BaseType_t sent = xRingbufferSendFromISR(logBuffers[i], buffer, cstr_len, &xHigherPriorityTaskWoken);
-                    //assert(sended == pdTRUE); -- don't die if buffer overflows
-                    (void)sent;
+                if ((logBuffers[i] != NULL) && (record->level > sink_levels[logSinks[i]])) {
+                    counts.skipped++;
+                } else if ((logBuffers[i] != NULL) && may_block && netlogging_ring_may_wait(logBuffers[i], lossless)) {
+                    if (!netlogging_ring_try_send(logBuffers[i], record, len)) {
+                        netlogging_ring_hold(logBuffers[i]);
+                        waiting[waiting_count++] = logBuffers[i];
+                    }
+                } else if (logBuffers[i] != NULL) {
+                    bool sent = netlogging_ring_send(logBuffers[i], record, len, 0, false, &counts);
+                    //assert(sent); -- don't die if buffer overflows
+                    if (!sent) {
+                        counts.dropped++;
+                    }
                 }
             }
-#else
-            // Send to MessageBuffers
-            for (int i = 0; i < 6; i++) {
-                if (logBuffers[i] != NULL) {
-                    BaseType_t sent = xMessageBufferSendFromISR(logBuffers[i], buffer, cstr_len, &xHigherPriorityTaskWoken);
-                    //assert(sended == pdTRUE); -- don't die if buffer overflows
-                    (void)sent;
+            xSemaphoreGive(logBuffersMutex);
+        }
+
+        if (waiting_count > 0) {
+            // In lossless mode, the whole call waits at most lossless_ticks, however many sinks are slow
+            const TickType_t start = xTaskGetTickCount();
+            const TickType_t timeout = lossless ? lossless_ticks : 0;
+            for (int i = 0; i < waiting_count; i++) {
+                TickType_t waited = xTaskGetTickCount() - start;
+                TickType_t lossless_wait = (waited < timeout) ? (timeout - waited) : 0;
+                if (!netlogging_ring_send(waiting[i], record, len, lossless_wait, may_block, &counts)) {
+                    counts.dropped++;
                 }
+                netlogging_ring_release(waiting[i]);
             }
-#endif
-            xSemaphoreGive(logBuffersMutex);
         }
+        portENTER_CRITICAL(&stats_lock);
+        stats.lines += counts.lines;
+        stats.bytes += counts.bytes;
+        stats.skipped += counts.skipped;
+        stats.dropped += counts.dropped;
+        stats.evicted += counts.evicted;
+        stats.blocked += counts.blocked;
+        stats.blocked_us += counts.blocked_us;
+        stats.timeouts += counts.timeouts;
+        portEXIT_CRITICAL(&stats_lock);
 
         // Write to stdout
-        if (writeToStdout) {
+        if (writeToStdout && !stdoutAsync && (record->level <= sink_levels[NETLOGGING_SINK_STDOUT])) {
             //return vprintf( fmt, l );
             //printf( "%s", buffer ); // we already formatted the string, so just print it
             fwrite(buffer, sizeof(char), cstr_len, stdout);
@@ -62,20 +232,237 @@ static int logging_vprintf(const char *fmt, va_list l) {
         }
     }
 
-    free(buffer);
-    (void)xHigherPriorityTaskWoken;  // unused
+    free(record);
     return 0;
 }
 
 /**
- * @brief Register a buffer to be used for logging.
+ * @brief Get the line and drop counters.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if stats is NULL, ESP_ERR_INVALID_STATE if not initialized.
+ */
+esp_err_t netlogging_get_stats(netlogging_stats_t *stats_out)
+{
+    if (stats_out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (logBuffersMutex == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&stats_lock);
+    *stats_out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+    portENTER_CRITICAL(&isr_lines_lock);
+    stats_out->isr_lines = isr_lines;
+    portEXIT_CRITICAL(&isr_lines_lock);
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the compression counters of a kind of sink, see netlogging_set_sink_level() for the names.
+ * Only "tcp", "http" and "sse" compress.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if an argument is NULL, ESP_ERR_NOT_FOUND if there is no sink of this name.
+ */
+esp_err_t netlogging_get_compression_stats(const char *sink, netlogging_compression_stats_t *stats_out)
+{
+    if ((sink == NULL) || (stats_out == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < NETLOGGING_SINK_COUNT; i++) {
+        if (strcmp(sink_names[i], sink) == 0) {
+            portENTER_CRITICAL(&stats_lock);
+            *stats_out = compression[i];
+            portEXIT_CRITICAL(&stats_lock);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * @brief Count the work of a sink's compressor.
+ */
+void netlogging_stats_add_compression(netlogging_sink_t sink, size_t in, size_t out, int64_t us)
+{
+    portENTER_CRITICAL(&stats_lock);
+    compression[sink].in += in;
+    compression[sink].out += out;
+    compression[sink].us += us;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+/**
+ * @brief Create a compressor for a sink.
+ * @return NULL if out of memory
+ */
+netlogging_deflate_t *netlogging_compressor_create(netlogging_sink_t sink, netlogging_deflate_out_t out, void *ctx)
+{
+    netlogging_deflate_t *d = netlogging_deflate_create(CONFIG_NETLOGGING_DEFLATE_WINDOW_BITS, out, ctx);
+    if (NULL != d) {
+        portENTER_CRITICAL(&stats_lock);
+        compression[sink].mem += netlogging_deflate_memory(CONFIG_NETLOGGING_DEFLATE_WINDOW_BITS);
+        portEXIT_CRITICAL(&stats_lock);
+    }
+    return d;
+}
+
+void netlogging_compressor_delete(netlogging_sink_t sink, netlogging_deflate_t *d)
+{
+    if (NULL == d) {
+        return;
+    }
+    netlogging_deflate_delete(d);
+    portENTER_CRITICAL(&stats_lock);
+    compression[sink].mem -= netlogging_deflate_memory(CONFIG_NETLOGGING_DEFLATE_WINDOW_BITS);
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+bool netlogging_buffer_append(void *ctx, const uint8_t *data, size_t len)
+{
+    netlogging_buffer_t *buf = ctx;
+    if (buf->len + len > buf->size) {
+        return false;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return true;
+}
+
+/**
+ * @brief Enable or disable lossless mode.
+ * In lossless mode a log call waits for room in every sink that is marked as required, instead of dropping the line.
+ * The call waits at most timeout_ms in total. It never waits if called from a sink's own task, from the network stack's
+ * tasks, from an ISR or before the scheduler runs. The time spent waiting is counted in netlogging_stats_t.
+ * @return ESP_OK
+ */
+esp_err_t netlogging_set_lossless(bool enable, uint32_t timeout_ms)
+{
+    lossless_ticks = pdMS_TO_TICKS(timeout_ms);
+    lossless = enable;
+    return ESP_OK;
+}
+
+/**
+ * @brief Format the notice that a sink sends in place of lines that it lost.
+ * It looks like a warning from esp_log, so viewers show it like any other line.
+ * @return Length of the notice
+ */
+int netlogging_format_dropped(char *buf, size_t size, uint32_t dropped)
+{
+    int len = snprintf(buf, size, "W (%"PRIu32") net_logging: %"PRIu32" lines dropped\n", esp_log_timestamp(), dropped);
+    return (len < (int)size) ? len : (int)size - 1;
+}
+
+/**
+ * @brief Write text as a JSON string, with the quotes. The text is cut if it does not fit into size bytes.
+ * @param strip_colors Leave out the ANSI color codes of CONFIG_LOG_COLORS
+ * @return Length of the string, at most size (at least 2)
+ */
+size_t netlogging_json_string(char *out, size_t size, const char *text, size_t len, bool strip_colors)
+{
+    char *p = out;
+    const char *end = out + size - 1; // room for the closing quote
+    *p++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        if (strip_colors && (c == '\033')) {
+            while ((i < len) && (text[i] != 'm')) {
+                i++;
+            }
+            continue;
+        }
+        char escape = 0;
+        switch (c) {
+        case '"':  escape = '"'; break;
+        case '\\': escape = '\\'; break;
+        case '\n': escape = 'n'; break;
+        case '\r': escape = 'r'; break;
+        case '\t': escape = 't'; break;
+        default: break;
+        }
+        size_t need = escape ? 2 : ((c < 0x20) ? 6 : 1);
+        if ((size_t)(end - p) < need) {
+            break;
+        }
+        if (escape) {
+            *p++ = '\\';
+            *p++ = escape;
+        }
+        else if (c < 0x20) {
+            p += sprintf(p, "\\u%04x", c); // e.g. the ESC of color codes
+        }
+        else {
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+    return p - out;
+}
+
+/**
+ * @brief Set the level of a kind of sink, for all its rings, also the ones registered later.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if sink is NULL or level is not an esp_log_level_t,
+ *         ESP_ERR_NOT_FOUND if there is no sink of this name.
+ */
+esp_err_t netlogging_set_sink_level(const char *sink, esp_log_level_t level)
+{
+    if ((sink == NULL) || (level > ESP_LOG_VERBOSE)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < NETLOGGING_SINK_COUNT; i++) {
+        if (strcmp(sink_names[i], sink) == 0) {
+            sink_levels[i] = level;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * @brief Get the level of a kind of sink.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if an argument is NULL, ESP_ERR_NOT_FOUND if there is no sink of this name.
+ */
+esp_err_t netlogging_get_sink_level(const char *sink, esp_log_level_t *level)
+{
+    if ((sink == NULL) || (level == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < NETLOGGING_SINK_COUNT; i++) {
+        if (strcmp(sink_names[i], sink) == 0) {
+            *level = (esp_log_level_t)sink_levels[i];
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+const char *netlogging_sink_name(netlogging_sink_t sink)
+{
+    return (sink < NETLOGGING_SINK_COUNT) ? sink_names[sink] : "";
+}
+
+bool netlogging_sink_registered(netlogging_sink_t sink)
+{
+    if (sink == NETLOGGING_SINK_STDOUT) {
+        return writeToStdout; // written by logging_vprintf itself unless it is async
+    }
+    bool found = false;
+    if ((logBuffersMutex != NULL) && (xSemaphoreTake(logBuffersMutex, portMAX_DELAY) == pdTRUE)) {
+        for (int i = 0; i < 6; i++) {
+            found = found || ((logBuffers[i] != NULL) && (logSinks[i] == sink));
+        }
+        xSemaphoreGive(logBuffersMutex);
+    }
+    return found;
+}
+
+/**
+ * @brief Register a log ring of a built-in sink.
  *
- * @param buffer The buffer to register. It must be a valid pointer to a MessageBufferHandle_t or RingbufHandle_t.
- * @return ESP_OK on success, ESP_ERR_INVALID_ARG if buffer is NULL, ESP_ERR_NO_MEM if no empty slot found.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if ring is NULL, ESP_ERR_NO_MEM if no empty slot found.
  */
-esp_err_t netlogging_register_recieveBuffer(void *buffer)
+esp_err_t netlogging_register_ring(netlogging_ring_t *ring, netlogging_sink_t sink)
 {
-    if (buffer == NULL) {
+    if ((ring == NULL) || (sink >= NETLOGGING_SINK_COUNT)) {
         return ESP_ERR_INVALID_ARG;
     }
     assert(NULL != logBuffersMutex); // You probably forgot to call netlogging_init() first!
@@ -85,13 +472,65 @@ esp_err_t netlogging_register_recieveBuffer(void *buffer)
         // search for empty slot
         for (int i = 0; i < 6; i++) {
             if (logBuffers[i] == NULL) {
-                logBuffers[i] = buffer;
+                logBuffers[i] = ring;
+                logSinks[i] = sink;
+                ret = ESP_OK;
+                break;
+            }
+        }
+        xSemaphoreGive(logBuffersMutex);
+    }
+    return ret;
+}
+
+/**
+ * @brief Unregister a log ring of a built-in sink. The ring itself is not deleted.
+ * Returns when no task is waiting for room in the ring anymore, so it may be deleted then.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if ring is NULL, ESP_ERR_NOT_FOUND if ring was not found.
+ */
+esp_err_t netlogging_unregister_ring(netlogging_ring_t *ring)
+{
+    if (ring == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    if (xSemaphoreTake(logBuffersMutex, portMAX_DELAY) == pdTRUE) {
+        // search for ring by pointer
+        for (int i = 0; i < 6; i++) {
+            if (logBuffers[i] == ring) {
+                logBuffers[i] = NULL;
                 ret = ESP_OK;
                 break;
             }
         }
         xSemaphoreGive(logBuffersMutex);
     }
+    if (ESP_OK == ret) {
+        netlogging_ring_close(ring); // a line may still be waiting for room in it
+    }
+    return ret;
+}
+
+/**
+ * @brief Register a buffer to be used for logging.
+ *
+ * @param buffer The buffer to register. It must be a valid pointer to a MessageBufferHandle_t or RingbufHandle_t.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if buffer is NULL, ESP_ERR_NO_MEM if no empty slot found.
+ */
+esp_err_t netlogging_register_recieveBuffer(void *buffer)
+{
+    if (buffer == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    netlogging_ring_t *ring = netlogging_ring_wrap(buffer);
+    if (ring == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t ret = netlogging_register_ring(ring, NETLOGGING_SINK_USER);
+    if (ret != ESP_OK) {
+        netlogging_ring_delete(ring);
+    }
     return ret;
 }
 
@@ -108,10 +547,12 @@ esp_err_t netlogging_unregister_recieveBuffer(void *buffer)
         return ESP_ERR_INVALID_ARG;
     }
     esp_err_t ret = ESP_ERR_NOT_FOUND;
+    netlogging_ring_t *ring = NULL;
     if (xSemaphoreTake(logBuffersMutex, portMAX_DELAY) == pdTRUE) {
-        // search for buffer by pointer
+        // search for the ring that wraps this buffer
         for (int i = 0; i < 6; i++) {
-            if (logBuffers[i] == buffer) {
+            if ((logBuffers[i] != NULL) && (netlogging_ring_get_handle(logBuffers[i]) == buffer)) {
+                ring = logBuffers[i];
                 logBuffers[i] = NULL;
                 ret = ESP_OK;
                 break;
@@ -119,6 +560,7 @@ esp_err_t netlogging_unregister_recieveBuffer(void *buffer)
         }
         xSemaphoreGive(logBuffersMutex);
     }
+    netlogging_ring_delete(ring); // only deletes the wrapper, not the user's buffer
     return ret;
 }
 
@@ -138,6 +580,16 @@ esp_err_t netlogging_init(bool enableStdout) {
     for (int i = 0; i < 6; i++) {
         logBuffers[i] = NULL;
     }
+    memset(&stats, 0, sizeof(stats));
+    next_seq = 0;
+    isr_lines = 0;
+    stdoutAsync = false;
+#if CONFIG_NETLOGGING_STDOUT_ASYNC
+    if (writeToStdout) {
+        // If the task can't be started, write to stdout from the logging task as before
+        stdoutAsync = (netlogging_stdout_sink_start() == ESP_OK);
+    }
+#endif
     // Set function used to output log entries to our custom one.
     old_vprintf = esp_log_set_vprintf(logging_vprintf);
     return ESP_OK;
@@ -153,6 +605,11 @@ esp_err_t netlogging_deinit() {
     // Restore previous function used to output log entries.
     esp_log_set_vprintf(old_vprintf);
 
+    if (stdoutAsync) {
+        netlogging_stdout_sink_stop();
+        stdoutAsync = false;
+    }
+
     // We assume that all buffers are unregistered at this point.
 
     // Delete the mutex
@@ -163,3 +620,80 @@ esp_err_t netlogging_deinit() {
     return ESP_OK;
 }
 
+/**
+ * @brief Start a sender or server task.
+ * With CONFIG_NETLOGGING_STATIC_ALLOCATION the task is created with xTaskCreateStatic() from memory that is
+ * allocated on the first call and reused for every restart, until netlogging_task_free().
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the task could not be created.
+ */
+esp_err_t netlogging_task_create(netlogging_task_t *task, TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg, UBaseType_t priority)
+{
+#if CONFIG_NETLOGGING_STATIC_ALLOCATION
+    if ((NULL != task->stack) && (task->stack_size != stack_size)) {
+        netlogging_task_free(task);
+    }
+    if (NULL == task->tcb) {
+        // The TCB and stack must be in internal RAM
+        task->tcb = heap_caps_calloc(1, sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        task->stack = heap_caps_malloc(stack_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        task->stack_size = stack_size;
+        if ((NULL == task->tcb) || (NULL == task->stack)) {
+            netlogging_task_free(task);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    task->handle = xTaskCreateStatic(fn, name, stack_size, arg, priority, task->stack, task->tcb);
+    return (NULL != task->handle) ? ESP_OK : ESP_ERR_NO_MEM;
+#else
+    if (xTaskCreate(fn, name, stack_size, arg, priority, &task->handle) != pdPASS) {
+        task->handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+#endif
+}
+
+/**
+ * @brief Last call of a task started with netlogging_task_create().
+ * A static task must not delete itself, because its memory could be freed before the idle task has cleaned it up.
+ * It suspends instead and is deleted by netlogging_task_reap().
+ */
+void netlogging_task_exit(netlogging_task_t *task)
+{
+#if CONFIG_NETLOGGING_STATIC_ALLOCATION
+    (void)task;
+    vTaskSuspend(NULL);
+#else
+    task->handle = NULL;
+    vTaskDelete(NULL);
+#endif
+}
+
+/**
+ * @brief Delete a task that has signalled that it is done (i.e. is in netlogging_task_exit()).
+ */
+void netlogging_task_reap(netlogging_task_t *task)
+{
+#if CONFIG_NETLOGGING_STATIC_ALLOCATION
+    if (NULL != task->handle) {
+        vTaskDelete(task->handle);
+    }
+#endif
+    task->handle = NULL;
+}
+
+/**
+ * @brief Free the memory of a static task. The task must have been reaped.
+ */
+void netlogging_task_free(netlogging_task_t *task)
+{
+    netlogging_task_reap(task);
+    if (NULL != task->tcb) {
+        heap_caps_free(task->tcb);
+        task->tcb = NULL;
+    }
+    if (NULL != task->stack) {
+        heap_caps_free(task->stack);
+        task->stack = NULL;
+    }
+}
@@ -0,0 +1,405 @@
+/*
+    Small gzip compressor for log text (RFC 1951 fixed Huffman blocks in a RFC 1952 gzip member)
+
+    Greedy LZ77 with hash chains over a window of 2^window_bits bytes. Memory is 2 windows of input, one chain
+    entry per window byte and a hash table, e.g. about 5 KB for a 1 KB window. Log text compresses well with fixed
+    Huffman codes because most of the gain comes from the repeated tags and format strings.
+*/
+
+#include "net_logging_deflate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_MATCH (3)
+#define MAX_MATCH (258)
+#define MIN_LOOKAHEAD (MAX_MATCH + MIN_MATCH + 1)
+#define MAX_CHAIN (16) // candidates tried per position, more gives slightly better compression for more CPU
+#define OUT_SIZE (128)
+
+struct netlogging_deflate_s
+{
+    netlogging_deflate_out_t out;
+    void *ctx;
+    size_t wsize;       /*!< Window size */
+    unsigned hash_bits;
+    uint8_t *buf;       /*!< 2 * wsize: history, then input that is not compressed yet */
+    size_t pos;         /*!< Next byte of buf to compress */
+    size_t end;         /*!< End of the input in buf */
+    uint16_t *head;     /*!< Per hash: last position + 1 with this hash, 0 if none */
+    uint16_t *prev;     /*!< Per position & (wsize - 1): previous position + 1 with the same hash */
+
+    uint32_t crc;
+    uint32_t total_in;
+    uint32_t bitbuf;
+    unsigned bitcount;
+    bool started;       /*!< gzip header written */
+    bool block_open;    /*!< Inside a fixed Huffman block */
+    bool failed;
+    size_t out_len;
+    uint8_t out_buf[OUT_SIZE];
+};
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// CRC-32 (gzip), 4 bits at a time
+static const uint32_t crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crc_table[crc & 15];
+        crc = (crc >> 4) ^ crc_table[crc & 15];
+    }
+    return ~crc;
+}
+
+static size_t hash_size(unsigned window_bits)
+{
+    return (size_t)1 << (window_bits - 1);
+}
+
+size_t netlogging_deflate_memory(unsigned window_bits)
+{
+    size_t wsize = (size_t)1 << window_bits;
+    return sizeof(netlogging_deflate_t) + 2 * wsize + (hash_size(window_bits) + wsize) * sizeof(uint16_t);
+}
+
+/**
+ * @brief Create a compressor.
+ * @param window_bits log2 of the window size, NETLOGGING_DEFLATE_MIN_WINDOW_BITS to NETLOGGING_DEFLATE_MAX_WINDOW_BITS
+ * @return NULL if window_bits is out of range or memory allocation failed
+ */
+netlogging_deflate_t *netlogging_deflate_create(unsigned window_bits, netlogging_deflate_out_t out, void *ctx)
+{
+    if ((window_bits < NETLOGGING_DEFLATE_MIN_WINDOW_BITS) || (window_bits > NETLOGGING_DEFLATE_MAX_WINDOW_BITS) || (NULL == out)) {
+        return NULL;
+    }
+    netlogging_deflate_t *d = calloc(1, sizeof(netlogging_deflate_t));
+    if (NULL == d) {
+        return NULL;
+    }
+    d->out = out;
+    d->ctx = ctx;
+    d->wsize = (size_t)1 << window_bits;
+    d->hash_bits = window_bits - 1;
+    d->buf = malloc(2 * d->wsize);
+    d->head = calloc(hash_size(window_bits), sizeof(uint16_t));
+    d->prev = calloc(d->wsize, sizeof(uint16_t));
+    if ((NULL == d->buf) || (NULL == d->head) || (NULL == d->prev)) {
+        netlogging_deflate_delete(d);
+        return NULL;
+    }
+    return d;
+}
+
+void netlogging_deflate_delete(netlogging_deflate_t *d)
+{
+    if (NULL == d) {
+        return;
+    }
+    free(d->buf);
+    free(d->head);
+    free(d->prev);
+    free(d);
+}
+
+static void flush_out(netlogging_deflate_t *d)
+{
+    if ((d->out_len > 0) && !d->failed) {
+        d->failed = !d->out(d->ctx, d->out_buf, d->out_len);
+    }
+    d->out_len = 0;
+}
+
+static void put_byte(netlogging_deflate_t *d, uint8_t b)
+{
+    d->out_buf[d->out_len++] = b;
+    if (d->out_len == OUT_SIZE) {
+        flush_out(d);
+    }
+}
+
+static void put_bits(netlogging_deflate_t *d, uint32_t value, unsigned nbits)
+{
+    d->bitbuf |= value << d->bitcount;
+    d->bitcount += nbits;
+    while (d->bitcount >= 8) {
+        put_byte(d, d->bitbuf & 0xFF);
+        d->bitbuf >>= 8;
+        d->bitcount -= 8;
+    }
+}
+
+static void align_byte(netlogging_deflate_t *d)
+{
+    if (d->bitcount > 0) {
+        put_bits(d, 0, 8 - d->bitcount);
+    }
+}
+
+// Huffman codes are sent starting with the most significant bit
+static void put_code(netlogging_deflate_t *d, uint32_t code, unsigned nbits)
+{
+    uint32_t rev = 0;
+    for (unsigned i = 0; i < nbits; i++) {
+        rev = (rev << 1) | (code & 1);
+        code >>= 1;
+    }
+    put_bits(d, rev, nbits);
+}
+
+// Fixed literal/length code, RFC 1951 3.2.6
+static void put_litlen(netlogging_deflate_t *d, unsigned sym)
+{
+    if (sym < 144) {
+        put_code(d, 0x30 + sym, 8);
+    }
+    else if (sym < 256) {
+        put_code(d, 0x190 + sym - 144, 9);
+    }
+    else if (sym < 280) {
+        put_code(d, sym - 256, 7);
+    }
+    else {
+        put_code(d, 0xC0 + sym - 280, 8);
+    }
+}
+
+static void put_header(netlogging_deflate_t *d)
+{
+    if (!d->started) {
+        // gzip header: deflate, no flags, no mtime, unknown OS
+        static const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+        for (size_t i = 0; i < sizeof(header); i++) {
+            put_byte(d, header[i]);
+        }
+        d->started = true;
+    }
+}
+
+static void open_block(netlogging_deflate_t *d)
+{
+    put_header(d);
+    if (!d->block_open) {
+        put_bits(d, 0x2, 3); // BFINAL=0, BTYPE=01 (fixed Huffman)
+        d->block_open = true;
+    }
+}
+
+static void close_block(netlogging_deflate_t *d)
+{
+    if (d->block_open) {
+        put_litlen(d, 256); // end of block
+        d->block_open = false;
+    }
+}
+
+static void put_match(netlogging_deflate_t *d, unsigned len, unsigned dist)
+{
+    unsigned i = 28;
+    while (len_base[i] > len) {
+        i--;
+    }
+    put_litlen(d, 257 + i);
+    put_bits(d, len - len_base[i], len_extra[i]);
+    unsigned j = 29;
+    while (dist_base[j] > dist) {
+        j--;
+    }
+    put_code(d, j, 5);
+    put_bits(d, dist - dist_base[j], dist_extra[j]);
+}
+
+static unsigned hash3(const netlogging_deflate_t *d, const uint8_t *p)
+{
+    uint32_t h = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (h * 2654435761u) >> (32 - d->hash_bits);
+}
+
+static void insert(netlogging_deflate_t *d, size_t pos)
+{
+    unsigned h = hash3(d, d->buf + pos);
+    d->prev[pos & (d->wsize - 1)] = d->head[h];
+    d->head[h] = (uint16_t)(pos + 1);
+}
+
+/**
+ * @brief Compress the input in buf. Without flush, MIN_LOOKAHEAD bytes are left for the next write,
+ * so that matches can be as long as possible.
+ */
+static void compress(netlogging_deflate_t *d, bool flush)
+{
+    const size_t max_dist = d->wsize - MIN_LOOKAHEAD;
+    while ((d->pos < d->end) && (flush || (d->end - d->pos > MIN_LOOKAHEAD))) {
+        open_block(d);
+        const size_t pos = d->pos;
+        const size_t avail = d->end - pos;
+        unsigned best_len = 0;
+        size_t best_dist = 0;
+        if (avail >= MIN_MATCH) {
+            const unsigned limit = (avail < MAX_MATCH) ? avail : MAX_MATCH;
+            const uint8_t *cur = d->buf + pos;
+            unsigned h = hash3(d, cur);
+            uint16_t next = d->head[h];
+            int chain = MAX_CHAIN;
+            while ((next != 0) && (chain-- > 0)) {
+                size_t cand = next - 1;
+                if ((cand >= pos) || (pos - cand > max_dist)) {
+                    break; // stale entry from before the window moved
+                }
+                const uint8_t *m = d->buf + cand;
+                if (m[best_len] == cur[best_len]) {
+                    unsigned len = 0;
+                    while ((len < limit) && (m[len] == cur[len])) {
+                        len++;
+                    }
+                    if (len > best_len) {
+                        best_len = len;
+                        best_dist = pos - cand;
+                        if (len == limit) {
+                            break;
+                        }
+                    }
+                }
+                uint16_t older = d->prev[cand & (d->wsize - 1)];
+                if (older >= next) {
+                    break;
+                }
+                next = older;
+            }
+            insert(d, pos);
+        }
+        if (best_len >= MIN_MATCH) {
+            put_match(d, best_len, best_dist);
+            for (size_t p = pos + 1; (p < pos + best_len) && (d->end - p >= MIN_MATCH); p++) {
+                insert(d, p);
+            }
+            d->pos += best_len;
+        }
+        else {
+            put_litlen(d, d->buf[pos]);
+            d->pos++;
+        }
+    }
+}
+
+// Drop the older half of buf when it is full
+static void slide(netlogging_deflate_t *d)
+{
+    const size_t wsize = d->wsize;
+    memmove(d->buf, d->buf + wsize, d->end - wsize);
+    d->pos -= wsize;
+    d->end -= wsize;
+    const size_t hsize = (size_t)1 << d->hash_bits;
+    for (size_t i = 0; i < hsize; i++) {
+        d->head[i] = (d->head[i] > wsize) ? (uint16_t)(d->head[i] - wsize) : 0;
+    }
+    for (size_t i = 0; i < wsize; i++) {
+        d->prev[i] = (d->prev[i] > wsize) ? (uint16_t)(d->prev[i] - wsize) : 0;
+    }
+}
+
+/**
+ * @brief Add data to the stream. Compressed output is produced as the input fills the window.
+ * @return false if the output function failed
+ */
+bool netlogging_deflate_write(netlogging_deflate_t *d, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    d->crc = crc32_update(d->crc, p, len);
+    d->total_in += len;
+    while ((len > 0) && !d->failed) {
+        if (d->end == 2 * d->wsize) {
+            slide(d);
+        }
+        size_t n = 2 * d->wsize - d->end;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(d->buf + d->end, p, n);
+        d->end += n;
+        p += n;
+        len -= n;
+        compress(d, false);
+    }
+    return !d->failed;
+}
+
+/**
+ * @brief Compress all input so far and hand it to the output function, ending on a byte boundary (like zlib's
+ * Z_SYNC_FLUSH). The receiver can then decompress everything written so far. The stream stays open and the
+ * following data can still refer back to the data before the flush.
+ * @return false if the output function failed
+ */
+bool netlogging_deflate_flush(netlogging_deflate_t *d)
+{
+    compress(d, true);
+    put_header(d);
+    close_block(d);
+    // Empty stored block: BFINAL=0, BTYPE=00, aligned LEN=0 NLEN=0xFFFF
+    put_bits(d, 0, 3);
+    align_byte(d);
+    put_byte(d, 0x00);
+    put_byte(d, 0x00);
+    put_byte(d, 0xFF);
+    put_byte(d, 0xFF);
+    flush_out(d);
+    return !d->failed;
+}
+
+/**
+ * @brief Compress the rest of the input, end the gzip member and reset for the next one.
+ * @return false if the output function failed anywhere in this stream
+ */
+bool netlogging_deflate_finish(netlogging_deflate_t *d)
+{
+    compress(d, true);
+    put_header(d);
+    close_block(d);
+    put_bits(d, 0x3, 3);         // BFINAL=1, BTYPE=01, empty
+    put_litlen(d, 256);
+    align_byte(d);
+    for (int i = 0; i < 4; i++) {
+        put_byte(d, (d->crc >> (8 * i)) & 0xFF);
+    }
+    for (int i = 0; i < 4; i++) {
+        put_byte(d, (d->total_in >> (8 * i)) & 0xFF);
+    }
+    flush_out(d);
+    bool ok = !d->failed;
+    netlogging_deflate_reset(d);
+    return ok;
+}
+
+/**
+ * @brief Abandon the current stream, e.g. because the connection it was sent over is gone.
+ * The next write starts a new gzip member.
+ */
+void netlogging_deflate_reset(netlogging_deflate_t *d)
+{
+    d->pos = 0;
+    d->end = 0;
+    memset(d->head, 0, ((size_t)1 << d->hash_bits) * sizeof(uint16_t));
+    memset(d->prev, 0, d->wsize * sizeof(uint16_t));
+    d->crc = 0;
+    d->total_in = 0;
+    d->bitbuf = 0;
+    d->bitcount = 0;
+    d->started = false;
+    d->block_open = false;
+    d->failed = false;
+    d->out_len = 0;
+}
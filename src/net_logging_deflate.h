@@ -0,0 +1,42 @@
+#ifndef NET_LOGGING_DEFLATE_H_
+#define NET_LOGGING_DEFLATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Small gzip compressor for log text: LZ77 over a small window and fixed Huffman codes.
+ * No dependencies on ESP-IDF, so it can be built and checked on the host.
+ *
+ * The compressed bytes are handed to the output function in chunks. A stream is started by the first
+ * netlogging_deflate_write() and ended by netlogging_deflate_finish(), after which the compressor can be reused.
+ * Long-lived streams call netlogging_deflate_flush() at the end of each batch, so the receiver can show it.
+ */
+typedef struct netlogging_deflate_s netlogging_deflate_t;
+
+/**
+ * @brief Receives compressed output.
+ * @return false to abort the stream, the compressor then fails until the next netlogging_deflate_finish() or reset.
+ */
+typedef bool (*netlogging_deflate_out_t)(void *ctx, const uint8_t *data, size_t len);
+
+#define NETLOGGING_DEFLATE_MIN_WINDOW_BITS (9)
+#define NETLOGGING_DEFLATE_MAX_WINDOW_BITS (13)
+
+netlogging_deflate_t *netlogging_deflate_create(unsigned window_bits, netlogging_deflate_out_t out, void *ctx);
+void netlogging_deflate_delete(netlogging_deflate_t *d);
+size_t netlogging_deflate_memory(unsigned window_bits); // bytes allocated by netlogging_deflate_create()
+bool netlogging_deflate_write(netlogging_deflate_t *d, const void *data, size_t len);
+bool netlogging_deflate_flush(netlogging_deflate_t *d);
+bool netlogging_deflate_finish(netlogging_deflate_t *d);
+void netlogging_deflate_reset(netlogging_deflate_t *d);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* NET_LOGGING_DEFLATE_H_ */
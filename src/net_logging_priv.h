@@ -0,0 +1,119 @@
+#ifndef NET_LOGGING_PRIV_H_
+#define NET_LOGGING_PRIV_H_
+
+#include "net_logging.h"
+#include "net_logging_deflate.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+EXTERN_C_BEGIN
+
+/*
+ * Log ring: the buffer between logging_vprintf and one sink.
+ * Wraps an xMessageBuffer (or xRingbuffer if CONFIG_NETLOGGING_USE_RINGBUFFER) and owns its storage.
+ * Each item is a record: a netlogging_record_hdr_t followed by the text of the line (not null-terminated).
+ * Error and warning records go to a second, smaller buffer (the priority lane) if there is one, which is read first.
+ * So records may come out of order, use seq to restore the order.
+ */
+typedef struct netlogging_ring_s netlogging_ring_t;
+
+/*
+ * The fields of a line are found once, when it is logged, so the sinks can filter and encode without parsing the text.
+ * An esp_log line "\033[0;31mE (1234) wifi: message\033[0m\n" has the tag "wifi" and the message "message".
+ * A line without the esp_log prefix, e.g. from printf, has no tag, and the message is the line without its line end.
+ */
+typedef struct {
+    uint32_t seq;       /*!< Sequence number of the line, counts all lines since netlogging_init() */
+    uint32_t dropped;   /*!< Number of lines this sink lost just before this one */
+    uint32_t timestamp; /*!< esp_log_timestamp() when the line was logged, ms */
+    uint8_t level;      /*!< esp_log_level_t of the line, ESP_LOG_NONE if the line has no level prefix */
+    uint8_t core;       /*!< CPU core the line was logged on */
+    uint8_t tag_offset; /*!< The tag is tag_len bytes at this offset in the text */
+    uint8_t tag_len;
+    uint16_t msg_offset;/*!< The message is msg_len bytes at this offset, without color codes and line end */
+    uint16_t msg_len;
+    char task[configMAX_TASK_NAME_LEN]; /*!< Name of the task that logged the line, null-terminated */
+} netlogging_record_hdr_t;
+
+// Sets level, tag and message of a record from its text, e.g. of a line a sink made up itself
+void netlogging_record_parse(netlogging_record_hdr_t *record, const char *text, size_t len);
+
+netlogging_ring_t *netlogging_ring_create(const netlogging_buffer_config_t *config);
+netlogging_ring_t *netlogging_ring_wrap(void *handle); // wrap a buffer created by the user, see netlogging_register_recieveBuffer()
+void netlogging_ring_delete(netlogging_ring_t *ring);
+void *netlogging_ring_get_handle(const netlogging_ring_t *ring);
+TaskHandle_t netlogging_ring_get_reader(const netlogging_ring_t *ring);
+void netlogging_ring_set_helper(netlogging_ring_t *ring, const char *task_name);
+const char *netlogging_ring_get_helper(const netlogging_ring_t *ring);
+bool netlogging_ring_send(netlogging_ring_t *ring, netlogging_record_hdr_t *record, size_t text_len,
+    TickType_t lossless_wait, bool may_block, netlogging_stats_t *stats);
+bool netlogging_ring_may_wait(const netlogging_ring_t *ring, bool lossless);
+bool netlogging_ring_try_send(netlogging_ring_t *ring, netlogging_record_hdr_t *record, size_t text_len);
+void netlogging_ring_hold(netlogging_ring_t *ring);
+void netlogging_ring_release(netlogging_ring_t *ring);
+void netlogging_ring_close(netlogging_ring_t *ring); // after unregistering, before deleting
+size_t netlogging_ring_receive(netlogging_ring_t *ring, netlogging_record_hdr_t *hdr, char *text, size_t max_len, TickType_t wait);
+size_t netlogging_ring_receive_batch(netlogging_ring_t *ring, char *buf, size_t size, TickType_t wait);
+void netlogging_ring_wake(netlogging_ring_t *ring);
+
+// Kinds of sink. Each kind has its own level, see netlogging_set_sink_level(), which applies to all its rings.
+typedef enum {
+    NETLOGGING_SINK_STDOUT = 0,
+    NETLOGGING_SINK_MULTICAST,
+    NETLOGGING_SINK_TCP,
+    NETLOGGING_SINK_HTTP,
+    NETLOGGING_SINK_MQTT,
+    NETLOGGING_SINK_SYSLOG,
+    NETLOGGING_SINK_SSE,
+    NETLOGGING_SINK_USER,   /*!< Buffers registered with netlogging_register_recieveBuffer() */
+    NETLOGGING_SINK_COUNT,
+} netlogging_sink_t;
+
+esp_err_t netlogging_register_ring(netlogging_ring_t *ring, netlogging_sink_t sink);
+esp_err_t netlogging_unregister_ring(netlogging_ring_t *ring);
+const char *netlogging_sink_name(netlogging_sink_t sink);
+bool netlogging_sink_registered(netlogging_sink_t sink); // has a ring now
+#define NETLOGGING_DROPPED_NOTICE_MAX_LENGTH (64) // longest output of netlogging_format_dropped()
+int netlogging_format_dropped(char *buf, size_t size, uint32_t dropped);
+size_t netlogging_json_string(char *out, size_t size, const char *text, size_t len, bool strip_colors);
+void netlogging_stats_add_compression(netlogging_sink_t sink, size_t in, size_t out, int64_t us);
+
+// Compressor with the window size from Kconfig, its memory is counted in the sink's netlogging_compression_stats_t
+netlogging_deflate_t *netlogging_compressor_create(netlogging_sink_t sink, netlogging_deflate_out_t out, void *ctx);
+void netlogging_compressor_delete(netlogging_sink_t sink, netlogging_deflate_t *d);
+
+// Output buffer for a compressor, fails when full
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+} netlogging_buffer_t;
+bool netlogging_buffer_append(void *ctx, const uint8_t *data, size_t len); // netlogging_deflate_out_t
+
+// Socket helpers for the built-in clients
+int netlogging_tcp_connect(const char *host, unsigned long port, bool nodelay, int sndbuf);
+int netlogging_udp_connect(const char *host, unsigned long port);
+bool netlogging_send_all(int sock, const void *data, size_t len, size_t *sent_len);
+
+// Stdout (UART) sink, started by netlogging_init() with CONFIG_NETLOGGING_STDOUT_ASYNC
+esp_err_t netlogging_stdout_sink_start(void);
+void netlogging_stdout_sink_stop(void);
+
+/*
+ * Sender/server task. With CONFIG_NETLOGGING_STATIC_ALLOCATION the TCB and stack are allocated on the first
+ * netlogging_task_create() and kept until netlogging_task_free(), so restarting a sink does not fragment the heap.
+ */
+typedef struct {
+    TaskHandle_t handle;
+    StaticTask_t *tcb;
+    StackType_t *stack;
+    uint32_t stack_size;
+} netlogging_task_t;
+
+esp_err_t netlogging_task_create(netlogging_task_t *task, TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg, UBaseType_t priority);
+void netlogging_task_exit(netlogging_task_t *task); // must be the last call of the task function
+void netlogging_task_reap(netlogging_task_t *task); // call after the task has signalled that it stopped
+void netlogging_task_free(netlogging_task_t *task);
+
+EXTERN_C_END
+#endif /* NET_LOGGING_PRIV_H_ */
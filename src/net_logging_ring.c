@@ -0,0 +1,550 @@
+/*
+    Log rings: per-sink buffers between logging_vprintf and the sender tasks
+*/
+
+#include "net_logging_priv.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+#include "freertos/ringbuf.h"
+#else
+#include "freertos/message_buffer.h"
+#endif
+
+#define TAG "net_logging_ring"
+
+#define RECORD_MAX_LENGTH (sizeof(netlogging_record_hdr_t) + CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH)
+#define RECORD_OVERHEAD (8) // Bytes that the message buffer or ring buffer uses per item, at most
+
+enum {
+    LANE_BULK = 0,
+    LANE_PRIORITY,
+    LANE_COUNT
+};
+
+typedef struct {
+    void *handle;       /*!< MessageBufferHandle_t or RingbufHandle_t, NULL if the lane is disabled */
+    uint8_t *storage;   /*!< Buffer storage, only if statically created */
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+    StaticRingbuffer_t static_buffer;
+#else
+    StaticMessageBuffer_t static_buffer;
+#endif
+    size_t size;
+} ring_lane_t;
+
+struct netlogging_ring_s
+{
+    ring_lane_t lanes[LANE_COUNT];
+    bool external;      /*!< Handle was created by the user, don't delete it. Lines are stored without header. */
+    netlogging_overflow_t overflow;
+    TickType_t block_ticks;
+    bool required;      /*!< Lossless mode waits for this ring */
+
+    SemaphoreHandle_t lock;         /*!< Serializes the reader against producers that evict the oldest lines */
+    SemaphoreHandle_t data_ready;   /*!< Given by producers after a line was stored */
+    SemaphoreHandle_t space_ready;  /*!< Given by the reader after a line was taken */
+    StaticSemaphore_t lock_buffer;
+    StaticSemaphore_t data_ready_buffer;
+    StaticSemaphore_t space_ready_buffer;
+    TaskHandle_t reader;            /*!< Task that receives from this ring */
+    const char *helper;             /*!< Name of a task that the reader depends on, e.g. of a client library, or NULL */
+    uint32_t users;                 /*!< Producers that wait for room outside the log buffers mutex, see netlogging_ring_hold() */
+    volatile bool closing;          /*!< Unregistered, waiting producers give up */
+    volatile bool wake;             /*!< Set by netlogging_ring_wake(), makes the reader's next empty receive return at once */
+
+    uint32_t dropped;   /*!< Lines rejected since the last stored line. Reported in the header of the next stored line. */
+    uint32_t evicted;   /*!< Lines evicted from the head, or lost before an empty record. Reported with the next received line. */
+#if !CONFIG_NETLOGGING_USE_RINGBUFFER
+    uint8_t scratch[];  /*!< One record, for reading out of the message buffer */
+#endif
+};
+
+static uint32_t ring_storage_caps(uint32_t caps)
+{
+    if (0 != caps) {
+        return caps;
+    }
+#if CONFIG_NETLOGGING_BUFFER_IN_SPIRAM
+    return MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+#else
+    return 0; // default heap
+#endif
+}
+
+static bool lane_create(ring_lane_t *lane, size_t size, uint32_t caps)
+{
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+    size = (size + 3) & ~3; // No-split ring buffers must be 32-bit aligned
+#endif
+    lane->size = size;
+
+    // Buffers outside the default heap can only be placed there with the static API
+    bool use_static = (0 != caps);
+#if CONFIG_NETLOGGING_STATIC_ALLOCATION
+    use_static = true;
+#endif
+    if (use_static) {
+        if (0 == caps) {
+            caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+        }
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+        lane->storage = heap_caps_malloc(size, caps);
+        if (NULL != lane->storage) {
+            lane->handle = xRingbufferCreateStatic(size, RINGBUF_TYPE_NOSPLIT, lane->storage, &lane->static_buffer);
+        }
+#else
+        // The storage area of a static message buffer must be one byte larger than the buffer
+        lane->storage = heap_caps_malloc(size + 1, caps);
+        if (NULL != lane->storage) {
+            lane->handle = xMessageBufferCreateStatic(size, lane->storage, &lane->static_buffer);
+        }
+#endif
+    }
+    else {
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+        lane->handle = xRingbufferCreate(size, RINGBUF_TYPE_NOSPLIT);
+#else
+        lane->handle = xMessageBufferCreate(size);
+#endif
+    }
+
+    if (NULL == lane->handle) {
+        NETLOGGING_LOGE("bufferCreate failed: size=%u caps=0x%"PRIx32, (unsigned)size, caps);
+        return false;
+    }
+    return true;
+}
+
+static void lane_delete(ring_lane_t *lane)
+{
+    if (NULL != lane->handle) {
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+        vRingbufferDelete(lane->handle);
+#else
+        vMessageBufferDelete(lane->handle);
+#endif
+    }
+    if (NULL != lane->storage) {
+        heap_caps_free(lane->storage);
+    }
+}
+
+netlogging_ring_t *netlogging_ring_create(const netlogging_buffer_config_t *config)
+{
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+    netlogging_ring_t *ring = calloc(1, sizeof(netlogging_ring_t));
+#else
+    netlogging_ring_t *ring = calloc(1, sizeof(netlogging_ring_t) + RECORD_MAX_LENGTH);
+#endif
+    if (NULL == ring) {
+        NETLOGGING_LOGE("malloc fail");
+        return NULL;
+    }
+    size_t size = (config && config->size) ? config->size : CONFIG_NETLOGGING_BUFFER_SIZE;
+    size_t priority_size = config ? config->priority_size : 0;
+    ring->overflow = config ? config->overflow : NETLOGGING_OVERFLOW_DROP_NEWEST;
+    ring->block_ticks = config ? pdMS_TO_TICKS(config->block_timeout_ms) : 0;
+    ring->required = config ? config->required : false;
+    uint32_t caps = ring_storage_caps(config ? config->caps : 0);
+
+    ring->lock = xSemaphoreCreateMutexStatic(&ring->lock_buffer);
+    ring->data_ready = xSemaphoreCreateBinaryStatic(&ring->data_ready_buffer);
+    ring->space_ready = xSemaphoreCreateBinaryStatic(&ring->space_ready_buffer);
+
+    if (!lane_create(&ring->lanes[LANE_BULK], size, caps) ||
+        ((priority_size > 0) && !lane_create(&ring->lanes[LANE_PRIORITY], priority_size, caps))) {
+        netlogging_ring_delete(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+netlogging_ring_t *netlogging_ring_wrap(void *handle)
+{
+    netlogging_ring_t *ring = calloc(1, sizeof(netlogging_ring_t));
+    if (NULL == ring) {
+        return NULL;
+    }
+    ring->lanes[LANE_BULK].handle = handle;
+    ring->external = true;
+    return ring;
+}
+
+void netlogging_ring_delete(netlogging_ring_t *ring)
+{
+    if (NULL == ring) {
+        return;
+    }
+    if (!ring->external) {
+        for (int i = 0; i < LANE_COUNT; i++) {
+            lane_delete(&ring->lanes[i]);
+        }
+    }
+    if (NULL != ring->lock) {
+        vSemaphoreDelete(ring->lock);
+        vSemaphoreDelete(ring->data_ready);
+        vSemaphoreDelete(ring->space_ready);
+    }
+    free(ring);
+}
+
+void *netlogging_ring_get_handle(const netlogging_ring_t *ring)
+{
+    return ring->lanes[LANE_BULK].handle;
+}
+
+TaskHandle_t netlogging_ring_get_reader(const netlogging_ring_t *ring)
+{
+    return ring->reader;
+}
+
+/**
+ * @brief Name a task that the reader depends on, so it never waits for room in a ring. Call before registering the ring.
+ * @param task_name Must stay valid as long as the ring
+ */
+void netlogging_ring_set_helper(netlogging_ring_t *ring, const char *task_name)
+{
+    ring->helper = task_name;
+}
+
+const char *netlogging_ring_get_helper(const netlogging_ring_t *ring)
+{
+    return ring->helper;
+}
+
+static bool lane_try_send(ring_lane_t *lane, const void *data, size_t len)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+    BaseType_t sent = xRingbufferSendFromISR(lane->handle, data, len, &xHigherPriorityTaskWoken);
+    return (pdTRUE == sent);
+#else
+    size_t sent = xMessageBufferSendFromISR(lane->handle, data, len, &xHigherPriorityTaskWoken);
+    return (sent == len);
+#endif
+}
+
+/**
+ * @brief Take the oldest record out of a lane. Must be called with ring->lock held.
+ *
+ * @param[out] hdr Header of the record
+ * @param[out] text Destination for the text, may be NULL to discard it
+ * @return Length of the text in the lane, -1 if the lane was empty.
+ */
+static int lane_take(netlogging_ring_t *ring, ring_lane_t *lane, netlogging_record_hdr_t *hdr, char *text, size_t max_len)
+{
+    if (NULL == lane->handle) {
+        return -1;
+    }
+    int text_len = -1;
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+    size_t received = 0;
+    uint8_t *record = xRingbufferReceive(lane->handle, &received, 0);
+#else
+    uint8_t *record = ring->scratch;
+    size_t received = xMessageBufferReceive(lane->handle, record, RECORD_MAX_LENGTH, 0);
+#endif
+    if ((NULL != record) && (received >= sizeof(*hdr))) {
+        memcpy(hdr, record, sizeof(*hdr));
+        text_len = received - sizeof(*hdr);
+        if (NULL != text) {
+            if ((size_t)text_len > max_len - 1) {
+                text_len = max_len - 1;
+            }
+            memcpy(text, record + sizeof(*hdr), text_len);
+            text[text_len] = 0;
+        }
+    }
+#if CONFIG_NETLOGGING_USE_RINGBUFFER
+    if (NULL != record) {
+        vRingbufferReturnItem(lane->handle, record);
+    }
+#endif
+    return text_len;
+}
+
+/**
+ * @brief Discard the oldest record of a lane. Must be called with ring->lock held.
+ * @return false if the lane was empty.
+ */
+static bool lane_evict_oldest(netlogging_ring_t *ring, ring_lane_t *lane)
+{
+    netlogging_record_hdr_t hdr;
+    if (lane_take(ring, lane, &hdr, NULL, 0) < 0) {
+        return false;
+    }
+    // The lines that were dropped before the evicted one are lost as well
+    ring->evicted += hdr.dropped + 1;
+    return true;
+}
+
+static bool is_priority_level(uint8_t level)
+{
+    return (ESP_LOG_ERROR == level) || (ESP_LOG_WARN == level);
+}
+
+/**
+ * @brief Check if a send to this ring may wait for room, so it is to be done after the log buffers mutex is released.
+ */
+bool netlogging_ring_may_wait(const netlogging_ring_t *ring, bool lossless)
+{
+    if (ring->external) {
+        return false;
+    }
+    return (ring->required && lossless) || ((NETLOGGING_OVERFLOW_BLOCK == ring->overflow) && (ring->block_ticks > 0));
+}
+
+/**
+ * @brief Store a record if there is room right now, without the overflow policy. A failure is not counted as a drop.
+ */
+bool netlogging_ring_try_send(netlogging_ring_t *ring, netlogging_record_hdr_t *record, size_t text_len)
+{
+    const size_t len = sizeof(netlogging_record_hdr_t) + text_len;
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    record->dropped = ring->dropped;
+    bool sent = is_priority_level(record->level) && (NULL != ring->lanes[LANE_PRIORITY].handle) &&
+        lane_try_send(&ring->lanes[LANE_PRIORITY], record, len);
+    sent = sent || lane_try_send(&ring->lanes[LANE_BULK], record, len);
+    if (sent) {
+        ring->dropped = 0;
+    }
+    xSemaphoreGive(ring->lock);
+    if (sent) {
+        xSemaphoreGive(ring->data_ready);
+    }
+    return sent;
+}
+
+/**
+ * @brief Keep the ring from being deleted while a producer uses it without the log buffers mutex.
+ *        Called with the log buffers mutex held, so the ring is still registered.
+ */
+void netlogging_ring_hold(netlogging_ring_t *ring)
+{
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    ring->users++;
+    xSemaphoreGive(ring->lock);
+}
+
+void netlogging_ring_release(netlogging_ring_t *ring)
+{
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    ring->users--;
+    xSemaphoreGive(ring->lock);
+}
+
+/**
+ * @brief Called when the ring was unregistered: wakes the producers waiting for room and waits until they are done.
+ */
+void netlogging_ring_close(netlogging_ring_t *ring)
+{
+    if (NULL == ring->lock) {
+        return; // user's buffer, producers never wait for it
+    }
+    ring->closing = true;
+    while (1) {
+        xSemaphoreGive(ring->space_ready);
+        xSemaphoreTake(ring->lock, portMAX_DELAY);
+        uint32_t users = ring->users;
+        xSemaphoreGive(ring->lock);
+        if (0 == users) {
+            break;
+        }
+        vTaskDelay(1);
+    }
+}
+
+/**
+ * @brief Put one log record into the ring, applying the ring's overflow policy if it is full.
+ * Called by logging_vprintf. A send that may wait (see netlogging_ring_may_wait()) is made without the
+ * log buffers mutex, between netlogging_ring_hold() and netlogging_ring_release(), so other tasks can log meanwhile.
+ *
+ * Errors and warnings go to the priority lane. If that is full, they go to the bulk lane and evict older lines
+ * there instead of being dropped, whatever the overflow policy.
+ *
+ * @param record Header of the record, immediately followed by text_len bytes of text. The dropped field is filled in here.
+ * @param lossless_wait Ticks to wait for room if this is a required ring in lossless mode, 0 otherwise
+ * @param may_block false if the calling task must not wait, regardless of the overflow policy
+ * @param[inout] stats Evictions and waits are added here
+ * @return true if the line was stored, false if it was dropped.
+ */
+bool netlogging_ring_send(netlogging_ring_t *ring, netlogging_record_hdr_t *record, size_t text_len,
+    TickType_t lossless_wait, bool may_block, netlogging_stats_t *stats)
+{
+    ring_lane_t *bulk = &ring->lanes[LANE_BULK];
+    if (ring->external) {
+        // User's buffer: plain null-terminated text as before, never blocks
+        const char *text = (const char *)(record + 1);
+        return lane_try_send(bulk, text, text_len + 1);
+    }
+
+    TickType_t wait = 0;
+    if (may_block) {
+        if (ring->required && (lossless_wait > 0)) {
+            wait = lossless_wait;
+        }
+        else if (NETLOGGING_OVERFLOW_BLOCK == ring->overflow) {
+            wait = ring->block_ticks;
+        }
+    }
+
+    const size_t len = sizeof(netlogging_record_hdr_t) + text_len;
+    const bool fits = (len + RECORD_OVERHEAD <= bulk->size);
+    ring_lane_t *priority = NULL;
+    if (is_priority_level(record->level) && (NULL != ring->lanes[LANE_PRIORITY].handle)) {
+        priority = &ring->lanes[LANE_PRIORITY];
+    }
+    const bool may_evict = (NETLOGGING_OVERFLOW_DROP_OLDEST == ring->overflow) || is_priority_level(record->level);
+    TickType_t start = xTaskGetTickCount();
+    int64_t blocked_since = 0;
+    bool sent = false;
+    while (1) {
+        xSemaphoreTake(ring->lock, portMAX_DELAY);
+        record->dropped = ring->dropped;
+        if (NULL != priority) {
+            sent = lane_try_send(priority, record, len);
+        }
+        if (!sent) {
+            sent = lane_try_send(bulk, record, len);
+        }
+        TickType_t waited = xTaskGetTickCount() - start;
+        bool keep_waiting = !sent && fits && (waited < wait) && !ring->closing;
+        if (!sent && !keep_waiting && fits && may_evict) {
+            while (!sent && lane_evict_oldest(ring, bulk)) {
+                stats->evicted++;
+                sent = lane_try_send(bulk, record, len);
+            }
+        }
+        if (sent) {
+            ring->dropped = 0;
+        }
+        else if (!keep_waiting) {
+            ring->dropped++;
+        }
+        xSemaphoreGive(ring->lock);
+
+        if (!keep_waiting) {
+            break;
+        }
+        // Wait for the reader to make room
+        if (0 == blocked_since) {
+            blocked_since = esp_timer_get_time();
+            stats->blocked++;
+        }
+        xSemaphoreTake(ring->space_ready, wait - waited);
+    }
+
+    if (0 != blocked_since) {
+        stats->blocked_us += esp_timer_get_time() - blocked_since;
+        if (!sent) {
+            stats->timeouts++;
+        }
+    }
+    if (sent) {
+        xSemaphoreGive(ring->data_ready);
+    }
+    return sent;
+}
+
+/**
+ * @brief Take one log record out of the ring. Records in the priority lane come first.
+ *
+ * @param[out] hdr Header of the record, may be NULL. hdr->dropped is the number of lines that were lost just before this one.
+ * @param[out] text Destination for the null-terminated text, lines longer than max_len - 1 are truncated
+ * @param[in] wait Ticks to wait for a line to become available
+ * @return Length of the text, 0 if no line was available within the wait time
+ */
+size_t netlogging_ring_receive(netlogging_ring_t *ring, netlogging_record_hdr_t *hdr, char *text, size_t max_len, TickType_t wait)
+{
+    ring->reader = xTaskGetCurrentTaskHandle();
+    TickType_t start = xTaskGetTickCount();
+    netlogging_record_hdr_t rec_hdr;
+    int text_len = -1;
+    while (1) {
+        xSemaphoreTake(ring->lock, portMAX_DELAY);
+        text_len = lane_take(ring, &ring->lanes[LANE_PRIORITY], &rec_hdr, text, max_len);
+        if (text_len < 0) {
+            text_len = lane_take(ring, &ring->lanes[LANE_BULK], &rec_hdr, text, max_len);
+        }
+        if (text_len >= 0) {
+            rec_hdr.dropped += ring->evicted;
+            ring->evicted = 0;
+        }
+        if (0 == text_len) {
+            // Nothing to send, the lines lost before it are reported with the next record
+            ring->evicted = rec_hdr.dropped;
+        }
+        xSemaphoreGive(ring->lock);
+
+        if (text_len >= 0) {
+            xSemaphoreGive(ring->space_ready);
+        }
+        if (text_len > 0) {
+            break;
+        }
+        if ((text_len < 0) && ring->wake) {
+            ring->wake = false;
+            return 0;
+        }
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= wait) {
+            return 0;
+        }
+        if (text_len < 0) {
+            xSemaphoreTake(ring->data_ready, wait - waited);
+        }
+    }
+    if (NULL != hdr) {
+        *hdr = rec_hdr;
+    }
+    return text_len;
+}
+
+/**
+ * @brief Make the reader return from netlogging_ring_receive() without waiting for the next line,
+ *        e.g. to stop it or to tell it that the network changed.
+ */
+void netlogging_ring_wake(netlogging_ring_t *ring)
+{
+    ring->wake = true;
+    xSemaphoreGive(ring->data_ready);
+}
+
+/**
+ * @brief Take as many log records out of the ring as fit into buf, for sinks that send a stream of text.
+ * Where lines were lost, a notice from netlogging_format_dropped() is put in their place.
+ *
+ * @param[out] buf Destination for the null-terminated text of the lines, one after the other
+ * @param[in] size Size of buf, at least CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH + NETLOGGING_DROPPED_NOTICE_MAX_LENGTH
+ * @param[in] wait Ticks to wait for the first line. Further lines are only taken if they are already there.
+ * @return Length of the text, 0 if no line was available within the wait time
+ */
+size_t netlogging_ring_receive_batch(netlogging_ring_t *ring, char *buf, size_t size, TickType_t wait)
+{
+    size_t len = 0;
+    // Stop when the longest possible line and its notice might not fit anymore
+    while (size - len >= CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH + NETLOGGING_DROPPED_NOTICE_MAX_LENGTH) {
+        netlogging_record_hdr_t hdr;
+        char *text = buf + len;
+        size_t text_len = netlogging_ring_receive(ring, &hdr, text, size - len - NETLOGGING_DROPPED_NOTICE_MAX_LENGTH, (0 == len) ? wait : 0);
+        if (0 == text_len) {
+            break;
+        }
+        if (hdr.dropped > 0) {
+            char notice[NETLOGGING_DROPPED_NOTICE_MAX_LENGTH];
+            int notice_len = netlogging_format_dropped(notice, sizeof(notice), hdr.dropped);
+            memmove(text + notice_len, text, text_len + 1);
+            memcpy(text, notice, notice_len);
+            text_len += notice_len;
+        }
+        len += text_len;
+    }
+    return len;
+}
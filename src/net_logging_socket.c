@@ -0,0 +1,145 @@
+/*
+    Socket helpers shared by the built-in clients that send to a server
+*/
+
+#include "net_logging_priv.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h" // for getaddrinfo
+
+#define CONNECT_TIMEOUT_S (5)
+#define SEND_TIMEOUT_S (5)
+
+#define TAG "net_logging_socket"
+
+static struct addrinfo *resolve(const char *host, unsigned long port, int socktype)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = socktype,
+    };
+    struct addrinfo *res = NULL;
+    char port_str[12];
+    snprintf(port_str, sizeof(port_str), "%lu", port);
+    if ((0 != getaddrinfo(host, port_str, &hints, &res)) || (NULL == res)) {
+        NETLOGGING_LOGE("Failed getaddrinfo");
+        return NULL;
+    }
+    return res;
+}
+
+/**
+ * @brief Connect to a TCP server, waiting at most CONNECT_TIMEOUT_S.
+ *        A send that makes no progress for SEND_TIMEOUT_S fails afterwards.
+ * @param sndbuf SO_SNDBUF in bytes, 0 keeps the default
+ * @return The socket, or -1
+ */
+int netlogging_tcp_connect(const char *host, unsigned long port, bool nodelay, int sndbuf)
+{
+    struct addrinfo *res = resolve(host, port, SOCK_STREAM);
+    if (NULL == res) {
+        return -1;
+    }
+    int sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (sock < 0) {
+        NETLOGGING_LOGE("Failed to create socket. Error %d", errno);
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    // Connect without blocking, so that an unreachable server doesn't hold up the task for long
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    int err = connect(sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if ((err < 0) && (errno != EINPROGRESS)) {
+        goto err;
+    }
+    if (err < 0) {
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(sock, &wfds);
+        struct timeval tv = { .tv_sec = CONNECT_TIMEOUT_S };
+        if (select(sock + 1, NULL, &wfds, NULL, &tv) <= 0) {
+            errno = ETIMEDOUT;
+            goto err;
+        }
+        int so_error = 0;
+        socklen_t len = sizeof(so_error);
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &so_error, &len);
+        if (0 != so_error) {
+            errno = so_error;
+            goto err;
+        }
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+
+    // A send that makes no progress for this long means the connection is dead
+    struct timeval snd_timeout = { .tv_sec = SEND_TIMEOUT_S };
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &snd_timeout, sizeof(snd_timeout));
+    int enable = 1;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    int nodelay_opt = nodelay ? 1 : 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay_opt, sizeof(nodelay_opt));
+    if ((sndbuf > 0) && (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0)) {
+        NETLOGGING_LOGW("setsockopt(SO_SNDBUF) failed, is LWIP_SO_SNDBUF enabled?");
+    }
+    return sock;
+
+err:
+    NETLOGGING_LOGE("Failed to connect to %s:%lu. Error %d", host, port, errno);
+    close(sock);
+    return -1;
+}
+
+/**
+ * @brief Create a UDP socket that sends to host:port with send()
+ * @return The socket, or -1
+ */
+int netlogging_udp_connect(const char *host, unsigned long port)
+{
+    struct addrinfo *res = resolve(host, port, SOCK_DGRAM);
+    if (NULL == res) {
+        return -1;
+    }
+    int sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (sock < 0) {
+        NETLOGGING_LOGE("Failed to create socket. Error %d", errno);
+        freeaddrinfo(res);
+        return -1;
+    }
+    int err = connect(sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (err < 0) {
+        NETLOGGING_LOGE("Failed to connect to %s:%lu. Error %d", host, port, errno);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Write all of data to a stream socket.
+ * @param[out] sent_len Bytes that the network stack took before a failure, may be NULL
+ * @return false if the connection failed. The server may have received part of the data.
+ */
+bool netlogging_send_all(int sock, const void *data, size_t len, size_t *sent_len)
+{
+    size_t sent = 0;
+    bool ok = true;
+    while (sent < len) {
+        int ret = send(sock, (const char *)data + sent, len - sent, 0);
+        if (ret < 0) {
+            NETLOGGING_LOGE("send failed. errno: %d", errno);
+            ok = false;
+            break;
+        }
+        sent += ret;
+    }
+    if (NULL != sent_len) {
+        *sent_len = sent;
+    }
+    return ok;
+}
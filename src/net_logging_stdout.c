@@ -0,0 +1,111 @@
+/*
+    Stdout (UART) sink: writes the log lines from a background task, so the logging task doesn't wait for the UART
+*/
+
+#include "net_logging_priv.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+#define STOPPED_BIT (1UL << 0) // bit to signal that task has stopped
+#define STOP_WAITTIME (8000 / portTICK_PERIOD_MS) // wait this long for task to stop
+#define BATCH_SIZE (2 * (CONFIG_NETLOGGING_MESSAGE_MAX_LENGTH + NETLOGGING_DROPPED_NOTICE_MAX_LENGTH))
+
+#define TAG "net_logging_stdout"
+
+struct stdout_handle_s
+{
+    netlogging_ring_t *ring;
+    volatile bool task_run;
+    netlogging_task_t task;
+    EventGroupHandle_t state_event;      /*!< Task's state event group */
+    char batch[BATCH_SIZE];
+};
+static struct stdout_handle_s *handle = NULL;
+
+static void stdout_log_sender(void *pvParameters)
+{
+    while (handle->task_run) {
+        size_t len = netlogging_ring_receive_batch(handle->ring, handle->batch, sizeof(handle->batch), pdMS_TO_TICKS(1000));
+        if (len > 0) {
+            fwrite(handle->batch, sizeof(char), len, stdout);
+        }
+        // Else timed out waiting for data from buffer, round the loop to check if task should keep running
+    }
+    // The ring is unregistered already. Write out what is left in it.
+    size_t len;
+    while ((len = netlogging_ring_receive_batch(handle->ring, handle->batch, sizeof(handle->batch), 0)) > 0) {
+        fwrite(handle->batch, sizeof(char), len, stdout);
+    }
+    fflush(stdout);
+    xEventGroupSetBits(handle->state_event, STOPPED_BIT);
+    netlogging_task_exit(&handle->task);
+}
+
+/**
+ * @brief Register a log ring for stdout and start the task that writes it out.
+ * The ring is registered before the task starts, so no line logged after netlogging_init() is missed.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if memory allocation failed.
+ */
+esp_err_t netlogging_stdout_sink_start(void)
+{
+    handle = calloc(1, sizeof(struct stdout_handle_s));
+    if (NULL == handle) {
+        NETLOGGING_LOGE("malloc fail");
+        return ESP_ERR_NO_MEM;
+    }
+    netlogging_buffer_config_t buffer = NETLOGGING_BUFFER_DEFAULT_CONFIG();
+    buffer.priority_size = 0; // the console has no sequence numbers to put errors back in order
+    handle->ring = netlogging_ring_create(&buffer);
+    handle->state_event = xEventGroupCreate();
+    if ((NULL == handle->ring) || (NULL == handle->state_event)) {
+        NETLOGGING_LOGE("netlogging_ring_create failed");
+        goto _init_failed;
+    }
+    if (netlogging_register_ring(handle->ring, NETLOGGING_SINK_STDOUT) != ESP_OK) {
+        NETLOGGING_LOGE("netlogging_register_ring failed");
+        goto _init_failed;
+    }
+    handle->task_run = true;
+    if (netlogging_task_create(&handle->task, stdout_log_sender, "LOG STDOUT", 1024 * 3, NULL, 2) != ESP_OK) {
+        NETLOGGING_LOGE("xTaskCreate failed");
+        netlogging_unregister_ring(handle->ring);
+        goto _init_failed;
+    }
+    return ESP_OK;
+
+_init_failed:
+    netlogging_ring_delete(handle->ring);
+    if (NULL != handle->state_event) {
+        vEventGroupDelete(handle->state_event);
+    }
+    free(handle);
+    handle = NULL;
+    return ESP_ERR_NO_MEM;
+}
+
+/**
+ * @brief Stop the stdout task after it has written out the lines that are still in its ring.
+ */
+void netlogging_stdout_sink_stop(void)
+{
+    if (NULL == handle) {
+        return;
+    }
+    netlogging_unregister_ring(handle->ring);
+    handle->task_run = false;
+    EventBits_t uxBits = xEventGroupWaitBits(handle->state_event, STOPPED_BIT, false, true, STOP_WAITTIME);
+    if (0 == (uxBits & STOPPED_BIT)) {
+        // Leak rather than free memory that the task might still use
+        NETLOGGING_LOGE("stdout task did not stop");
+        return;
+    }
+    netlogging_task_free(&handle->task);
+    netlogging_ring_delete(handle->ring);
+    vEventGroupDelete(handle->state_event);
+    free(handle);
+    handle = NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef NET_LOGGING_HOST_TEST_H_
+#define NET_LOGGING_HOST_TEST_H_
+
+/*
+ * Minimal checks for the host tests: a failed CHECK prints where and keeps going, TEST_RESULT() is the exit code.
+ */
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() (test_failures ? (printf("%d checks failed\n", test_failures), 1) : 0)
+
+#endif /* NET_LOGGING_HOST_TEST_H_ */
@@ -0,0 +1,111 @@
+/*
+    Host test of the gzip compressor: its output is decompressed with zlib, after each flush and at the end
+*/
+
+#include "net_logging_deflate.h"
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+} output_t;
+
+static bool output_append(void *ctx, const uint8_t *data, size_t len)
+{
+    output_t *out = ctx;
+    if (out->len + len > out->size) {
+        out->size = 2 * (out->len + len);
+        out->data = realloc(out->data, out->size);
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    return true;
+}
+
+// Log lines, which repeat a lot, and some bytes that don't
+static size_t make_input(uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+    uint32_t random = 12345;
+    for (int i = 0; len + 200 < size; i++) {
+        len += sprintf((char *)buf + len, "\033[0;32mI (%d) wifi: rssi %d, channel %d\033[0m\n", 1000 + 37 * i, -40 - i % 30, 1 + i % 13);
+        if (0 == i % 50) {
+            for (int j = 0; j < 100; j++) {
+                random = random * 1103515245 + 12345;
+                buf[len++] = random >> 24;
+            }
+        }
+    }
+    return len;
+}
+
+/**
+ * @brief Decompress what the stream has so far. A flushed stream decompresses up to the flush.
+ */
+static bool inflate_all(const output_t *in, uint8_t *out, size_t size, size_t *out_len, bool *end)
+{
+    z_stream z = {0};
+    if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) { // gzip header
+        return false;
+    }
+    z.next_in = in->data;
+    z.avail_in = in->len;
+    z.next_out = out;
+    z.avail_out = size;
+    int ret = inflate(&z, Z_SYNC_FLUSH);
+    *out_len = size - z.avail_out;
+    *end = (Z_STREAM_END == ret);
+    inflateEnd(&z);
+    return (Z_OK == ret) || (Z_STREAM_END == ret) || (Z_BUF_ERROR == ret);
+}
+
+static void test_round_trip(unsigned window_bits, const uint8_t *input, size_t len, size_t batch)
+{
+    output_t out = {0};
+    uint8_t *check = malloc(len + 1);
+    netlogging_deflate_t *d = netlogging_deflate_create(window_bits, output_append, &out);
+    CHECK(NULL != d);
+
+    // Twice, as the compressor is reused after finish
+    for (int round = 0; round < 2; round++) {
+        out.len = 0;
+        for (size_t done = 0; done < len; ) {
+            size_t n = (len - done < batch) ? len - done : batch;
+            CHECK(netlogging_deflate_write(d, input + done, n));
+            CHECK(netlogging_deflate_flush(d));
+            done += n;
+
+            size_t check_len;
+            bool end;
+            CHECK(inflate_all(&out, check, len + 1, &check_len, &end));
+            CHECK((done == check_len) && !end && (memcmp(check, input, done) == 0));
+        }
+        CHECK(netlogging_deflate_finish(d));
+
+        size_t check_len;
+        bool end;
+        CHECK(inflate_all(&out, check, len + 1, &check_len, &end));
+        CHECK((len == check_len) && end && (memcmp(check, input, len) == 0));
+    }
+
+    netlogging_deflate_delete(d);
+    free(check);
+    free(out.data);
+}
+
+int main(void)
+{
+    static uint8_t input[64 * 1024];
+    size_t len = make_input(input, sizeof(input));
+    for (unsigned bits = NETLOGGING_DEFLATE_MIN_WINDOW_BITS; bits <= NETLOGGING_DEFLATE_MAX_WINDOW_BITS; bits++) {
+        test_round_trip(bits, input, len, len);
+        test_round_trip(bits, input, len, 1000);
+        test_round_trip(bits, input, 100, 1);
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,149 @@
+/*
+    Host test of the SSE server's HTTP request parser: requests split across reads, pipelined requests, limits
+*/
+
+#include "http_parser.h"
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char request[] =
+    "GET /log-events?format=json&token=a%20b HTTP/1.1\r\n"
+    "Host: esp32.local\r\n"
+    "Accept-Encoding: deflate, gzip;q=0.5\r\n"
+    "Last-Event-ID: 4711\r\n"
+    "User-Agent: a header the server skips\r\n"
+    "\r\n";
+
+static void check_request(const netlogging_http_request_t *req)
+{
+    CHECK(strcmp(req->method, "GET") == 0);
+    CHECK(strcmp(req->path, "/log-events") == 0);
+    CHECK(strcmp(netlogging_http_query(req), "format=json&token=a%20b") == 0);
+    CHECK(1 == req->minor_version);
+    CHECK(req->keep_alive);
+    CHECK(req->accept_gzip);
+    CHECK(req->has_last_event_id && (4711 == req->last_event_id));
+    char value[16];
+    CHECK(netlogging_http_query_param(netlogging_http_query(req), "token", value, sizeof(value)));
+    CHECK(strcmp(value, "a b") == 0);
+    CHECK(!netlogging_http_query_param(netlogging_http_query(req), "level", value, sizeof(value)));
+}
+
+// Any split into two reads, and one byte per read
+static void test_split(void)
+{
+    const size_t len = strlen(request);
+    for (size_t split = 0; split <= len; split++) {
+        netlogging_http_request_t req;
+        netlogging_http_request_reset(&req);
+        netlogging_http_result_t result;
+        size_t used = netlogging_http_parse(&req, request, split, &result);
+        CHECK((split == used) && (NETLOGGING_HTTP_INCOMPLETE == result || split == len));
+        if (split < len) {
+            used = netlogging_http_parse(&req, request + split, len - split, &result);
+            CHECK(len - split == used);
+        }
+        CHECK(NETLOGGING_HTTP_COMPLETE == result);
+        check_request(&req);
+    }
+
+    netlogging_http_request_t req;
+    netlogging_http_request_reset(&req);
+    netlogging_http_result_t result = NETLOGGING_HTTP_INCOMPLETE;
+    for (size_t i = 0; i < len; i++) {
+        CHECK(NETLOGGING_HTTP_INCOMPLETE == result);
+        CHECK(1 == netlogging_http_parse(&req, request + i, 1, &result));
+    }
+    CHECK(NETLOGGING_HTTP_COMPLETE == result);
+    check_request(&req);
+}
+
+// Several requests in one read, the first with a body that must be skipped
+static void test_pipelined(void)
+{
+    const char data[] =
+        "POST /levels?tag=wifi&level=2 HTTP/1.1\r\nContent-Length: 5\r\nAuthorization: Bearer s3cret\r\n\r\nhello"
+        "GET /stats HTTP/1.1\nConnection: close\n\n"
+        "GET /chat HTTP/1.1\r\nConnection: keep-alive, Upgrade\r\nUpgrade: websocket\r\n"
+        "Sec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+    const char *p = data;
+    size_t left = strlen(data);
+    netlogging_http_request_t req;
+    netlogging_http_result_t result;
+
+    netlogging_http_request_reset(&req);
+    size_t used = netlogging_http_parse(&req, p, left, &result);
+    CHECK(NETLOGGING_HTTP_COMPLETE == result);
+    CHECK(used < left);
+    CHECK(strcmp(req.method, "POST") == 0 && strcmp(req.path, "/levels") == 0);
+    CHECK(5 == req.content_length);
+    CHECK(strcmp(req.authorization, "Bearer s3cret") == 0);
+    p += used;
+    left -= used;
+
+    netlogging_http_request_reset(&req);
+    used = netlogging_http_parse(&req, p, left, &result);
+    CHECK(NETLOGGING_HTTP_COMPLETE == result);
+    CHECK(strcmp(req.path, "/stats") == 0);
+    CHECK(!req.keep_alive);
+    p += used;
+    left -= used;
+
+    netlogging_http_request_reset(&req);
+    used = netlogging_http_parse(&req, p, left, &result);
+    CHECK(NETLOGGING_HTTP_COMPLETE == result);
+    CHECK(used == left);
+    CHECK(req.connection_upgrade && req.upgrade_websocket);
+    CHECK(13 == req.websocket_version);
+    CHECK(strcmp(req.websocket_key, "dGhlIHNhbXBsZSBub25jZQ==") == 0);
+}
+
+static netlogging_http_result_t parse_all(const char *data, size_t len)
+{
+    netlogging_http_request_t req;
+    netlogging_http_request_reset(&req);
+    netlogging_http_result_t result;
+    size_t used = netlogging_http_parse(&req, data, len, &result);
+    CHECK((used == len) || (result != NETLOGGING_HTTP_INCOMPLETE));
+    return result;
+}
+
+static void test_limits(void)
+{
+    char *data = malloc(2 * NETLOGGING_HTTP_HEADERS_MAX);
+
+    // A long header that the server doesn't use is skipped
+    int len = sprintf(data, "GET / HTTP/1.1\r\nCookie: ");
+    memset(data + len, 'x', 4000);
+    len += 4000;
+    len += sprintf(data + len, "\r\n\r\n");
+    CHECK(NETLOGGING_HTTP_COMPLETE == parse_all(data, len));
+
+    // All headers together are limited
+    len = sprintf(data, "GET / HTTP/1.1\r\n");
+    while (len < NETLOGGING_HTTP_HEADERS_MAX + 100) {
+        len += sprintf(data + len, "X-Filler: %0100d\r\n", 0);
+    }
+    len += sprintf(data + len, "\r\n");
+    CHECK(NETLOGGING_HTTP_HEADERS_TOO_LARGE == parse_all(data, len));
+
+    len = sprintf(data, "GET /");
+    memset(data + len, 'a', NETLOGGING_HTTP_TARGET_MAX);
+    len += NETLOGGING_HTTP_TARGET_MAX;
+    len += sprintf(data + len, " HTTP/1.1\r\n\r\n");
+    CHECK(NETLOGGING_HTTP_URI_TOO_LONG == parse_all(data, len));
+
+    const char folded[] = "GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n";
+    CHECK(NETLOGGING_HTTP_BAD_REQUEST == parse_all(folded, strlen(folded)));
+    free(data);
+}
+
+int main(void)
+{
+    test_split();
+    test_pipelined();
+    test_limits();
+    return TEST_RESULT();
+}
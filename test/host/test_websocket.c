@@ -0,0 +1,89 @@
+/*
+    Host test of the WebSocket pieces: the handshake key, frame headers and the reader of the client's frames
+*/
+
+#include "websocket.h"
+#include "test.h"
+
+#include <string.h>
+
+static void test_accept_key(void)
+{
+    // The example of RFC 6455, section 1.3
+    char accept[NETLOGGING_WS_ACCEPT_LENGTH + 1];
+    netlogging_ws_accept_key("dGhlIHNhbXBsZSBub25jZQ==", accept);
+    CHECK(strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+}
+
+static void test_frame_header(void)
+{
+    uint8_t header[NETLOGGING_WS_HEADER_MAX];
+    CHECK(2 == netlogging_ws_frame_header(header, NETLOGGING_WS_TEXT, 5));
+    CHECK((0x81 == header[0]) && (5 == header[1]));
+    CHECK(4 == netlogging_ws_frame_header(header, NETLOGGING_WS_BINARY, 256));
+    CHECK((0x82 == header[0]) && (126 == header[1]) && (1 == header[2]) && (0 == header[3]));
+    CHECK(10 == netlogging_ws_frame_header(header, NETLOGGING_WS_BINARY, 65536));
+    CHECK((127 == header[1]) && (1 == header[7]) && (0 == header[8]) && (0 == header[9]));
+}
+
+// A masked "Hello" and a masked ping, RFC 6455 section 5.7
+static const uint8_t frames[] = {
+    0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58,
+    0x89, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58,
+};
+
+// Both frames in one read, and one byte per read
+static void test_reader(void)
+{
+    netlogging_ws_reader_t reader;
+    netlogging_ws_frame_t frame;
+    netlogging_ws_result_t result;
+    netlogging_ws_reader_reset(&reader);
+    size_t used = netlogging_ws_read(&reader, frames, sizeof(frames), &frame, &result);
+    CHECK((NETLOGGING_WS_FRAME == result) && (11 == used));
+    CHECK((NETLOGGING_WS_TEXT == frame.opcode) && (5 == frame.len) && (memcmp(frame.payload, "Hello", 5) == 0));
+    used += netlogging_ws_read(&reader, frames + used, sizeof(frames) - used, &frame, &result);
+    CHECK((NETLOGGING_WS_FRAME == result) && (sizeof(frames) == used));
+    CHECK((NETLOGGING_WS_PING == frame.opcode) && (5 == frame.len) && (memcmp(frame.payload, "Hello", 5) == 0));
+
+    netlogging_ws_reader_reset(&reader);
+    int count = 0;
+    for (size_t i = 0; i < sizeof(frames); i++) {
+        CHECK(1 == netlogging_ws_read(&reader, frames + i, 1, &frame, &result));
+        if (NETLOGGING_WS_FRAME == result) {
+            CHECK(memcmp(frame.payload, "Hello", 5) == 0);
+            count++;
+        }
+        else {
+            CHECK(NETLOGGING_WS_INCOMPLETE == result);
+        }
+    }
+    CHECK(2 == count);
+}
+
+static void test_reader_errors(void)
+{
+    netlogging_ws_reader_t reader;
+    netlogging_ws_frame_t frame;
+    netlogging_ws_result_t result;
+
+    // Frames from a client must be masked
+    const uint8_t unmasked[] = { 0x81, 0x05, 'H', 'e', 'l', 'l', 'o' };
+    netlogging_ws_reader_reset(&reader);
+    netlogging_ws_read(&reader, unmasked, sizeof(unmasked), &frame, &result);
+    CHECK(NETLOGGING_WS_ERROR == result);
+
+    const uint8_t too_big[] = { 0x82, 0xFE, 0x01, 0x00 };
+    netlogging_ws_reader_reset(&reader);
+    netlogging_ws_read(&reader, too_big, sizeof(too_big), &frame, &result);
+    CHECK(NETLOGGING_WS_TOO_BIG == result);
+}
+
+int main(void)
+{
+    test_accept_key();
+    test_frame_header();
+    test_reader();
+    test_reader_errors();
+    return TEST_RESULT();
+}
@@ -0,0 +1,69 @@
+#include "capture.h"
+#include "pipeline.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace netlog {
+
+static const char capture_magic[8] = {'N', 'L', 'C', 'A', 'P', '0', '0', '1'};
+
+#pragma pack(push, 1)
+struct record_header {
+    int64_t time_us;
+    uint32_t addr;
+    uint16_t port;
+    uint16_t len;
+};
+#pragma pack(pop)
+
+capture_writer::capture_writer(const std::string &path)
+{
+    f_ = fopen(path.c_str(), "wb");
+    if (!f_) {
+        throw std::runtime_error("open " + path + ": " + strerror(errno));
+    }
+    fwrite(capture_magic, sizeof(capture_magic), 1, f_);
+}
+
+capture_writer::~capture_writer()
+{
+    fclose(f_);
+}
+
+void capture_writer::write(const batch &b)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &d : b.items) {
+        record_header hdr = {d.time_ms * 1000, d.addr, d.port, uint16_t(d.len)};
+        fwrite(&hdr, sizeof(hdr), 1, f_);
+        fwrite(b.bytes.data() + d.offset, d.len, 1, f_);
+    }
+}
+
+std::vector<captured_datagram> read_capture(const std::string &path)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        throw std::runtime_error("open " + path + ": " + strerror(errno));
+    }
+    char magic[sizeof(capture_magic)];
+    if ((1 != fread(magic, sizeof(magic), 1, f)) || (0 != memcmp(magic, capture_magic, sizeof(magic)))) {
+        fclose(f);
+        throw std::runtime_error(path + ": not a capture file");
+    }
+    std::vector<captured_datagram> out;
+    record_header hdr;
+    while (1 == fread(&hdr, sizeof(hdr), 1, f)) {
+        captured_datagram d{hdr.time_us, hdr.addr, hdr.port, std::string(hdr.len, '\0')};
+        if ((hdr.len > 0) && (1 != fread(&d.data[0], hdr.len, 1, f))) {
+            break; // cut off while capturing
+        }
+        out.push_back(std::move(d));
+    }
+    fclose(f);
+    return out;
+}
+
+} // namespace netlog
@@ -0,0 +1,45 @@
+/*
+    Captured traffic, for replay and benchmarks. Little-endian, as written by the host:
+        file:   "NLCAP001" record...
+        record: time_us:u64 addr:u32 port:u16 len:u16 data[len]
+    addr and port are in network byte order, as in struct sockaddr_in.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace netlog {
+
+struct batch;
+
+struct captured_datagram {
+    int64_t time_us;
+    uint32_t addr;
+    uint16_t port;
+    std::string data;
+};
+
+class capture_writer {
+public:
+    explicit capture_writer(const std::string &path);
+    ~capture_writer();
+    /**
+     * @brief Append a batch of received datagrams. Thread safe.
+     */
+    void write(const batch &b);
+
+private:
+    std::mutex mutex_;
+    FILE *f_;
+};
+
+/**
+ * @brief Read a whole capture file.
+ */
+std::vector<captured_datagram> read_capture(const std::string &path);
+
+} // namespace netlog
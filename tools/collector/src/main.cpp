@@ -0,0 +1,500 @@
+/*
+    netlog-collector: receives the logs of many devices over UDP multicast (multicast_log_sender.c),
+    unicast (udp_client.c) or from their SSE servers (sse_server.c), and writes one rotating log file per device and/or an indexed store
+    that the query mode searches.
+*/
+
+#include "capture.h"
+#include "net.h"
+#include "output.h"
+#include "pipeline.h"
+#include "sse.h"
+#include "store.h"
+
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace netlog;
+
+static std::atomic<bool> running{true};
+
+static void on_signal(int)
+{
+    running = false;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: netlog-collector [listen] [options]   receive and write <out>/<device>.log\n"
+        "       netlog-collector replay FILE --to HOST:PORT [--speed X]\n"
+        "       netlog-collector bench [FILE | --synthetic N] [--devices N] [--workers N] [--out DIR] [--store DIR]\n"
+        "       netlog-collector query DIR [--device ADDR] [--level L] [--tag TAG] [--from T] [--to T] [--grep RE]\n"
+        "\n"
+        "listen:\n"
+        "  --group ADDR       multicast group (239.2.1.2), \"\" for none\n"
+        "  --port N           multicast port (2054)\n"
+        "  --iface ADDR       interface to join the group on (0.0.0.0)\n"
+        "  --udp N            also receive unicast on port N, with one SO_REUSEPORT socket per worker\n"
+        "  --sse HOST[:PORT][/PATH]  also connect to a device's SSE server (port 8080, /log-events), may be repeated\n"
+        "  --sse-list FILE    connect to the SSE servers listed in FILE, one per line\n"
+        "  --sse-plain        don't ask the SSE servers for a gzip stream\n"
+        "  --workers N        worker threads (4)\n"
+        "  --out DIR          log directory (logs), not written when only --store is given\n"
+        "  --store DIR        also write the indexed store for query\n"
+        "  --partition N      a new store directory every N seconds (3600)\n"
+        "  --max-bytes N      rotate a file at this size (1000000)\n"
+        "  --backups N        keep this many rotated files per device (99)\n"
+        "  --per-port         a device is an address and a port, e.g. for traffic replayed from one host\n"
+        "  --no-nack          don't ask reliable mode senders to resend missing datagrams\n"
+        "  --capture FILE     also save everything received, for replay and bench\n"
+        "  --rcvbuf N         socket receive buffer in bytes (4194304)\n"
+        "  --stats N          print rates every N seconds (10), 0 for never\n"
+        "replay:\n"
+        "  --to HOST:PORT     where to send, a multicast group or a collector's --udp port\n"
+        "  --speed X          1 keeps the captured timing, 2 is twice as fast, 0 as fast as possible (1)\n"
+        "bench:\n"
+        "  --synthetic N      N generated datagrams of about 1 KB instead of a capture\n"
+        "  --devices N        the traffic of this many devices, each sending all of it (100)\n"
+        "  --out DIR          write files, otherwise lines are only parsed\n"
+        "  --store DIR        write the indexed store\n"
+        "query, prints the matching lines of a store in time order:\n"
+        "  --device ADDR      only this device, may be repeated\n"
+        "  --level L          E, W, I, D or V: this level and the more severe ones\n"
+        "  --tag TAG          only lines with this esp_log tag, may be repeated\n"
+        "  --from T, --to T   \"2024-01-31 12:34:56\", \"2024-01-31\", epoch seconds or relative, \"-15m\"\n"
+        "  --grep RE          only lines that match the extended regular expression\n"
+        "  --explain          print how much of the store was read\n");
+}
+
+struct options {
+    std::string mode = "listen";
+    std::string file;
+    udp_options mcast;
+    int udp_port = -1;
+    std::vector<sse_target> sse;
+    sse_options sse_opt;
+    pipeline::options pipe;
+    std::string out = "logs";
+    bool out_given = false;
+    uint64_t max_bytes = 1000000;
+    unsigned backups = 99;
+    std::string capture;
+    unsigned stats = 10;
+    std::string to;
+    double speed = 1.0;
+    size_t synthetic = 0;
+    unsigned devices = 100;
+    std::string store;
+    segment_store_sink::options store_opt;
+    query_options query;
+    std::string from;
+};
+
+static uint8_t levels_from(const char *level)
+{
+    // Each level includes the more severe ones; lines that aren't esp_log lines always match
+    static const char order[] = "EWIDV";
+    const char *p = (level[0] != '\0') ? strchr(order, toupper(level[0])) : nullptr;
+    if (!p || (level[1] != '\0')) {
+        fprintf(stderr, "--level: one of E, W, I, D, V\n");
+        exit(2);
+    }
+    uint8_t mask = level_other;
+    for (const char *l = order; l <= p; l++) {
+        mask |= level_mask(*l);
+    }
+    return mask;
+}
+
+static void read_sse_list(const char *path, std::vector<sse_target> &targets)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        throw std::runtime_error(std::string(path) + ": " + strerror(errno));
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        std::string s(line);
+        s.erase(0, s.find_first_not_of(" \t"));
+        s.erase(std::min(s.find_first_of(" \t\r\n#"), s.size()));
+        if (!s.empty()) {
+            targets.push_back(parse_sse_target(s));
+        }
+    }
+    fclose(f);
+}
+
+static options parse_options(int argc, char **argv)
+{
+    options o;
+    o.mcast.group = "239.2.1.2";
+    o.mcast.port = 2054;
+    int first = 1;
+    if ((argc > 1) && (argv[1][0] != '-')) {
+        o.mode = argv[1];
+        first = 2;
+        if ((o.mode != "listen") && (argc > 2) && (argv[2][0] != '-')) {
+            o.file = argv[2];
+            first = 3;
+        }
+    }
+    static const struct option longopts[] = {
+        {"group", required_argument, nullptr, 'g'},
+        {"port", required_argument, nullptr, 'p'},
+        {"iface", required_argument, nullptr, 'i'},
+        {"udp", required_argument, nullptr, 'u'},
+        {"sse", required_argument, nullptr, 'H'},
+        {"sse-list", required_argument, nullptr, 'l'},
+        {"sse-plain", no_argument, nullptr, 'z'},
+        {"workers", required_argument, nullptr, 'w'},
+        {"out", required_argument, nullptr, 'o'},
+        {"max-bytes", required_argument, nullptr, 'm'},
+        {"backups", required_argument, nullptr, 'b'},
+        {"per-port", no_argument, nullptr, 'P'},
+        {"no-nack", no_argument, nullptr, 'n'},
+        {"capture", required_argument, nullptr, 'c'},
+        {"rcvbuf", required_argument, nullptr, 'r'},
+        {"stats", required_argument, nullptr, 's'},
+        {"to", required_argument, nullptr, 't'},
+        {"speed", required_argument, nullptr, 'x'},
+        {"synthetic", required_argument, nullptr, 'S'},
+        {"devices", required_argument, nullptr, 'd'},
+        {"store", required_argument, nullptr, 'T'},
+        {"partition", required_argument, nullptr, 'A'},
+        {"device", required_argument, nullptr, 'D'},
+        {"level", required_argument, nullptr, 'L'},
+        {"tag", required_argument, nullptr, 'G'},
+        {"from", required_argument, nullptr, 'F'},
+        {"grep", required_argument, nullptr, 'R'},
+        {"explain", no_argument, nullptr, 'E'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    optind = first;
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longopts, nullptr)) != -1) {
+        switch (c) {
+        case 'g': o.mcast.group = optarg; break;
+        case 'p': o.mcast.port = uint16_t(atoi(optarg)); break;
+        case 'i': o.mcast.iface = optarg; break;
+        case 'u': o.udp_port = atoi(optarg); break;
+        case 'H': o.sse.push_back(parse_sse_target(optarg)); break;
+        case 'l': read_sse_list(optarg, o.sse); break;
+        case 'z': o.sse_opt.gzip = false; break;
+        case 'w': o.pipe.workers = unsigned(atoi(optarg)); break;
+        case 'o': o.out = optarg; o.out_given = true; break;
+        case 'm': o.max_bytes = strtoull(optarg, nullptr, 0); break;
+        case 'b': o.backups = unsigned(atoi(optarg)); break;
+        case 'P': o.pipe.per_port = true; break;
+        case 'n': o.pipe.nack = false; break;
+        case 'c': o.capture = optarg; break;
+        case 'r': o.mcast.rcvbuf = atoi(optarg); break;
+        case 's': o.stats = unsigned(atoi(optarg)); break;
+        case 't': o.to = optarg; break;
+        case 'x': o.speed = atof(optarg); break;
+        case 'S': o.synthetic = strtoull(optarg, nullptr, 0); break;
+        case 'd': o.devices = unsigned(atoi(optarg)); break;
+        case 'T': o.store = optarg; break;
+        case 'A': o.store_opt.partition_s = unsigned(atoi(optarg)); break;
+        case 'D': o.query.devices.push_back(optarg); break;
+        case 'L': o.query.levels = levels_from(optarg); break;
+        case 'G': o.query.tags.push_back(optarg); break;
+        case 'F': o.from = optarg; break;
+        case 'R': o.query.grep = optarg; break;
+        case 'E': o.query.stats = true; break;
+        default: usage(); exit(c == 'h' ? 0 : 2);
+        }
+    }
+    if (optind < argc) {
+        usage();
+        exit(2);
+    }
+    return o;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+static void print_rates(const pipeline_stats &s, double secs, uint64_t datagrams, uint64_t lines, uint64_t bytes)
+{
+    fprintf(stderr, "%.0f datagrams/s, %.0f lines/s, %.2f MB/s, %llu devices\n",
+        datagrams / secs, lines / secs, bytes / secs / 1e6, (unsigned long long)s.devices.load());
+}
+
+static void print_totals(const pipeline_stats &s, const receive_stats *r, const sse_stats *e = nullptr)
+{
+    fprintf(stderr, "total: %llu datagrams, %llu lines, %llu bytes, %llu devices\n",
+        (unsigned long long)s.datagrams.load(), (unsigned long long)s.lines.load(),
+        (unsigned long long)s.bytes.load(), (unsigned long long)s.devices.load());
+    fprintf(stderr, "reliable mode: %llu NACKs, %llu recovered, %llu lost, %llu duplicates\n",
+        (unsigned long long)s.nacks.load(), (unsigned long long)s.recovered.load(),
+        (unsigned long long)s.lost.load(), (unsigned long long)s.duplicates.load());
+    if (r) {
+        fprintf(stderr, "dropped: %llu by the kernel (socket buffer full), %llu by the workers, %llu truncated\n",
+            (unsigned long long)r->kernel_drops.load(), (unsigned long long)s.overflow.load(),
+            (unsigned long long)r->truncated.load());
+    }
+    if (e) {
+        fprintf(stderr, "sse: %llu connects, %llu failures, %llu events, %.1f MB received, %llu lines cut\n",
+            (unsigned long long)e->connects.load(), (unsigned long long)e->failures.load(),
+            (unsigned long long)e->events.load(), e->bytes.load() / 1e6, (unsigned long long)e->truncated.load());
+    }
+}
+
+/**
+ * @brief The log files and/or the store, as given. files says whether to write log files when neither is given.
+ */
+static std::unique_ptr<sink> make_sink(const options &o, bool files)
+{
+    std::vector<std::unique_ptr<sink>> sinks;
+    if (o.out_given || (files && o.store.empty())) {
+        sinks.push_back(std::make_unique<rotating_file_sink>(o.out, o.max_bytes, o.backups));
+    }
+    if (!o.store.empty()) {
+        sinks.push_back(std::make_unique<segment_store_sink>(o.store, o.store_opt));
+    }
+    if (sinks.empty()) {
+        return std::make_unique<null_sink>();
+    }
+    if (sinks.size() == 1) {
+        return std::move(sinks.front());
+    }
+    return std::make_unique<tee_sink>(std::move(sinks));
+}
+
+static int run_listen(const options &o)
+{
+    std::unique_ptr<sink> out = make_sink(o, true);
+    std::unique_ptr<capture_writer> capture;
+    if (!o.capture.empty()) {
+        capture = std::make_unique<capture_writer>(o.capture);
+    }
+
+    std::vector<int> fds;
+    int nack_fd = -1;
+    if (!o.mcast.group.empty()) {
+        fds.push_back(open_udp(o.mcast));
+        // NACKs go out from a unicast socket, the resent datagrams come back to it
+        udp_options nack_opt;
+        nack_opt.bind_addr = o.mcast.iface;
+        nack_fd = open_udp(nack_opt);
+        fds.push_back(nack_fd);
+    }
+    if (o.udp_port >= 0) {
+        // The kernel spreads the senders over the sockets, by address and port
+        udp_options udp_opt = o.mcast;
+        udp_opt.group.clear();
+        udp_opt.port = uint16_t(o.udp_port);
+        udp_opt.reuseport = true;
+        for (unsigned i = 0; i < std::max(o.pipe.workers, 1u); i++) {
+            fds.push_back(open_udp(udp_opt));
+        }
+    }
+    if (fds.empty() && o.sse.empty()) {
+        fprintf(stderr, "nothing to listen on, give --group, --udp or --sse\n");
+        return 2;
+    }
+
+    pipeline p(o.pipe, *out, nack_fd);
+    receive_stats rstats;
+    std::vector<std::thread> receivers;
+    for (int fd : fds) {
+        receivers.emplace_back([&, fd] { receive_loop(fd, p, capture.get(), running, rstats); });
+    }
+    sse_stats sstats;
+    if (!o.sse.empty()) {
+        receivers.emplace_back([&] { sse_loop(o.sse, o.sse_opt, p, running, sstats); });
+    }
+
+    auto last = std::chrono::steady_clock::now();
+    uint64_t datagrams = 0, lines = 0, bytes = 0;
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        if ((o.stats > 0) && (seconds_since(last) >= o.stats)) {
+            const auto &s = p.stats();
+            print_rates(s, seconds_since(last), s.datagrams - datagrams, s.lines - lines, s.bytes - bytes);
+            datagrams = s.datagrams;
+            lines = s.lines;
+            bytes = s.bytes;
+            last = std::chrono::steady_clock::now();
+        }
+    }
+    for (auto &t : receivers) {
+        t.join();
+    }
+    p.stop();
+    for (int fd : fds) {
+        close(fd);
+    }
+    print_totals(p.stats(), &rstats, o.sse.empty() ? nullptr : &sstats);
+    return 0;
+}
+
+static int run_replay(const options &o)
+{
+    if (o.file.empty() || o.to.empty()) {
+        usage();
+        return 2;
+    }
+    std::vector<captured_datagram> datagrams = read_capture(o.file);
+    struct sockaddr_in to = parse_endpoint(o.to);
+    bool multicast = IN_MULTICAST(ntohl(to.sin_addr.s_addr));
+
+    // One socket per captured sender, so the receiver still tells the devices apart by port
+    std::map<uint64_t, int> sockets;
+    auto start = std::chrono::steady_clock::now();
+    int64_t first_us = datagrams.empty() ? 0 : datagrams.front().time_us;
+    uint64_t sent = 0;
+    for (const auto &d : datagrams) {
+        if (!running) {
+            break;
+        }
+        int &fd = sockets[(uint64_t(d.addr) << 16) | d.port];
+        if (fd == 0) {
+            fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                perror("socket");
+                return 1;
+            }
+            if (multicast) {
+                unsigned char ttl = 1;
+                setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+            }
+        }
+        if (o.speed > 0) {
+            auto due = start + std::chrono::microseconds(int64_t((d.time_us - first_us) / o.speed));
+            std::this_thread::sleep_until(due);
+        }
+        if (sendto(fd, d.data.data(), d.data.size(), 0, reinterpret_cast<const struct sockaddr *>(&to), sizeof(to)) >= 0) {
+            sent++;
+        }
+    }
+    double secs = seconds_since(start);
+    fprintf(stderr, "sent %llu of %zu datagrams from %zu senders in %.2f s, %.0f datagrams/s\n",
+        (unsigned long long)sent, datagrams.size(), sockets.size(), secs, sent / secs);
+    for (auto &s : sockets) {
+        close(s.second);
+    }
+    return 0;
+}
+
+static std::vector<captured_datagram> synthesize(size_t count)
+{
+    static const char *const tags[] = {"wifi", "app_main", "sensor", "mqtt_client", "httpd"};
+    static const char *const colors[] = {"\x1b[0;31mE", "\x1b[0;33mW", "\x1b[0;32mI", "D"};
+    std::vector<captured_datagram> out;
+    uint32_t ms = 1000;
+    for (size_t i = 0; i < count; i++) {
+        std::string data;
+        while (data.size() < 900) {
+            unsigned r = unsigned(rand());
+            const char *color = colors[r % 4];
+            char line[200];
+            snprintf(line, sizeof(line), "%s (%u) %s: value %u of sample %zu, status ok%s\n",
+                color, ms, tags[(r >> 4) % 5], r % 100000, i, (color[0] == '\x1b') ? "\x1b[0m" : "");
+            data += line;
+            ms += r % 7;
+        }
+        out.push_back(captured_datagram{int64_t(i) * 1000, htonl(0x7f000001), htons(40000), std::move(data)});
+    }
+    return out;
+}
+
+static int run_bench(const options &o)
+{
+    std::vector<captured_datagram> datagrams = o.synthetic ? synthesize(o.synthetic) : read_capture(o.file);
+    if (datagrams.empty()) {
+        fprintf(stderr, "nothing to replay, give a capture file or --synthetic N\n");
+        return 2;
+    }
+    std::unique_ptr<sink> out = make_sink(o, false);
+    unsigned devices = std::max(o.devices, 1u);
+
+    // Each device sends all of the captured traffic, interleaved as if they ran at the same time
+    pipeline p(o.pipe, *out, -1);
+    auto start = std::chrono::steady_clock::now();
+    {
+        pipeline::feeder feeder(p);
+        int64_t time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        unsigned fed = 0;
+        for (const auto &d : datagrams) {
+            for (unsigned dev = 0; dev < devices; dev++) {
+                uint32_t addr = htonl(0x0a000000 + dev + 1); // 10.0.0.1 and up
+                feeder.add(addr, d.port, time_ms, d.data.data(), d.data.size());
+                if (++fed % 64 == 0) {
+                    feeder.flush(); // as one recvmmsg() would
+                }
+            }
+        }
+        feeder.flush();
+    }
+    p.stop();
+    double secs = seconds_since(start);
+    const auto &s = p.stats();
+    fprintf(stderr, "%u workers, %u devices, %.2f s: ", std::max(o.pipe.workers, 1u), devices, secs);
+    print_rates(s, secs, s.datagrams, s.lines, s.bytes);
+    print_totals(s, nullptr);
+    return 0;
+}
+
+static int run_query_mode(options &o)
+{
+    if (o.file.empty()) {
+        usage();
+        return 2;
+    }
+    o.query.dir = o.file;
+    if (!o.from.empty()) {
+        o.query.from_ms = parse_time(o.from);
+    }
+    if (!o.to.empty()) {
+        o.query.to_ms = parse_time(o.to);
+    }
+    run_query(o.query);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    try {
+        options o = parse_options(argc, argv);
+        if (o.mode == "listen") {
+            return run_listen(o);
+        }
+        if (o.mode == "replay") {
+            return run_replay(o);
+        }
+        if (o.mode == "bench") {
+            return run_bench(o);
+        }
+        if (o.mode == "query") {
+            return run_query_mode(o);
+        }
+        usage();
+        return 2;
+    } catch (const std::exception &e) {
+        fprintf(stderr, "netlog-collector: %s\n", e.what());
+        return 1;
+    }
+}
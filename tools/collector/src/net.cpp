@@ -0,0 +1,143 @@
+#include "net.h"
+#include "capture.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace netlog {
+
+static constexpr unsigned recv_batch = 64;
+static constexpr size_t recv_size = 4096; // reliable mode datagrams are up to datagram_size + 12 bytes
+
+static void check(int ret, const char *what)
+{
+    if (ret < 0) {
+        throw std::runtime_error(std::string(what) + ": " + strerror(errno));
+    }
+}
+
+static struct in_addr parse_addr(const std::string &s)
+{
+    struct in_addr a;
+    if (1 != inet_pton(AF_INET, s.c_str(), &a)) {
+        throw std::runtime_error("not an IPv4 address: " + s);
+    }
+    return a;
+}
+
+int open_udp(const udp_options &opt)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    check(fd, "socket");
+    int enable = 1;
+    check(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)), "SO_REUSEADDR");
+    if (opt.reuseport) {
+        check(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)), "SO_REUSEPORT");
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+    // SO_RCVBUFFORCE can go over net.core.rmem_max, if we may
+    if (0 != setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &opt.rcvbuf, sizeof(opt.rcvbuf))) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt.rcvbuf, sizeof(opt.rcvbuf));
+    }
+    struct timeval tv = {0, 200 * 1000};
+    check(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), "SO_RCVTIMEO");
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    // Bound to the group, the socket only gets the group's datagrams
+    addr.sin_addr = parse_addr(opt.group.empty() ? opt.bind_addr : opt.group);
+    check(bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)), "bind");
+
+    if (!opt.group.empty()) {
+        struct ip_mreq mreq = {};
+        mreq.imr_multiaddr = parse_addr(opt.group);
+        mreq.imr_interface = parse_addr(opt.iface);
+        check(setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)), "IP_ADD_MEMBERSHIP");
+    }
+    return fd;
+}
+
+void receive_loop(int fd, pipeline &p, capture_writer *capture, const std::atomic<bool> &running, receive_stats &stats)
+{
+    std::vector<char> bufs(recv_batch * recv_size);
+    struct mmsghdr msgs[recv_batch];
+    struct iovec iovs[recv_batch];
+    struct sockaddr_in addrs[recv_batch];
+    char controls[recv_batch][CMSG_SPACE(sizeof(uint32_t))];
+    pipeline::feeder feeder(p);
+    batch captured;
+    uint32_t last_drops = 0;
+
+    while (running) {
+        for (unsigned i = 0; i < recv_batch; i++) {
+            iovs[i] = {bufs.data() + i * recv_size, recv_size};
+            msgs[i].msg_hdr = {};
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = controls[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+        }
+        // Blocks until at least one datagram is there, then takes what else is waiting
+        int n = recvmmsg(fd, msgs, recv_batch, MSG_WAITFORONE, nullptr);
+        if (n <= 0) {
+            continue; // timed out, or interrupted
+        }
+        int64_t time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        for (int i = 0; i < n; i++) {
+            const struct msghdr &h = msgs[i].msg_hdr;
+            if (h.msg_flags & MSG_TRUNC) {
+                stats.truncated++;
+            }
+            feeder.add(addrs[i].sin_addr.s_addr, addrs[i].sin_port, time_ms, iovs[i].iov_base, msgs[i].msg_len);
+            if (capture) {
+                captured.add(addrs[i].sin_addr.s_addr, addrs[i].sin_port, time_ms, iovs[i].iov_base, msgs[i].msg_len);
+            }
+        }
+        feeder.flush();
+        if (capture) {
+            capture->write(captured);
+            captured.clear();
+        }
+        // The drop counter of the socket comes with every datagram, the last one is the latest
+        const struct msghdr &last = msgs[n - 1].msg_hdr;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&last); c; c = CMSG_NXTHDR(const_cast<struct msghdr *>(&last), c)) {
+            if ((c->cmsg_level == SOL_SOCKET) && (c->cmsg_type == SO_RXQ_OVFL)) {
+                uint32_t drops;
+                memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+                stats.kernel_drops += drops - last_drops;
+                last_drops = drops;
+            }
+        }
+    }
+}
+
+struct sockaddr_in parse_endpoint(const std::string &s)
+{
+    size_t colon = s.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::runtime_error("expected host:port, got " + s);
+    }
+    std::string host = s.substr(0, colon);
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *res = nullptr;
+    if ((0 != getaddrinfo(host.c_str(), s.c_str() + colon + 1, &hints, &res)) || !res) {
+        throw std::runtime_error("can't resolve " + s);
+    }
+    struct sockaddr_in addr = *reinterpret_cast<struct sockaddr_in *>(res->ai_addr);
+    freeaddrinfo(res);
+    return addr;
+}
+
+} // namespace netlog
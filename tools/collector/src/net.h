@@ -0,0 +1,47 @@
+/*
+    UDP sockets and the receiving loop
+*/
+#pragma once
+
+#include "pipeline.h"
+
+#include <atomic>
+#include <cstdint>
+#include <netinet/in.h>
+#include <string>
+
+namespace netlog {
+
+class capture_writer;
+
+struct udp_options {
+    std::string bind_addr = "0.0.0.0";
+    uint16_t port = 0;
+    std::string group;          // multicast group to join, empty for none
+    std::string iface = "0.0.0.0"; // interface address for the group
+    bool reuseport = false;     // SO_REUSEPORT, so several sockets share the port
+    int rcvbuf = 4 << 20;
+};
+
+/**
+ * @brief Open a UDP socket that times out after a short while, so the receiving thread can check if it should stop.
+ *        Throws std::runtime_error.
+ */
+int open_udp(const udp_options &opt);
+
+struct receive_stats {
+    std::atomic<uint64_t> kernel_drops{0}; // SO_RXQ_OVFL: dropped because the socket buffer was full
+    std::atomic<uint64_t> truncated{0};
+};
+
+/**
+ * @brief Receive with recvmmsg() and feed the pipeline until running is false.
+ */
+void receive_loop(int fd, pipeline &p, capture_writer *capture, const std::atomic<bool> &running, receive_stats &stats);
+
+/**
+ * @brief "host:port" to a sockaddr_in. Throws std::runtime_error.
+ */
+struct sockaddr_in parse_endpoint(const std::string &s);
+
+} // namespace netlog
@@ -0,0 +1,207 @@
+#include "output.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace netlog {
+
+void append_stripped(std::string &out, std::string_view s)
+{
+    if (!s.empty() && (s.back() == '\r')) {
+        s.remove_suffix(1);
+    }
+    size_t i = 0;
+    while (i < s.size()) {
+        const char *esc = static_cast<const char *>(memchr(s.data() + i, '\x1b', s.size() - i));
+        size_t end = esc ? size_t(esc - s.data()) : s.size();
+        out.append(s.data() + i, end - i);
+        if (!esc) {
+            break;
+        }
+        // ESC [ parameters intermediates final, or ESC and one more character
+        i = end + 1;
+        if ((i < s.size()) && (s[i] == '[')) {
+            i++;
+            while ((i < s.size()) && ((unsigned char)s[i] < 0x40 || (unsigned char)s[i] > 0x7E)) {
+                i++;
+            }
+        }
+        i++;
+    }
+}
+
+namespace {
+
+class null_writer : public device_writer {
+public:
+    void write(int64_t, std::string_view) override {}
+    void flush() override {}
+};
+
+class tee_writer : public device_writer {
+public:
+    explicit tee_writer(std::vector<std::unique_ptr<device_writer>> writers)
+        : writers_(std::move(writers))
+    {
+    }
+
+    void write(int64_t time_ms, std::string_view line) override
+    {
+        for (auto &w : writers_) {
+            w->write(time_ms, line);
+        }
+    }
+
+    void flush() override
+    {
+        for (auto &w : writers_) {
+            w->flush();
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<device_writer>> writers_;
+};
+
+class rotating_file : public device_writer {
+public:
+    static constexpr size_t buffer_size = 64 * 1024;
+
+    rotating_file(std::string path, uint64_t max_bytes, unsigned backups)
+        : path_(std::move(path)), max_bytes_(max_bytes), backups_(backups)
+    {
+        buf_.reserve(buffer_size + 4096);
+        open();
+    }
+
+    ~rotating_file() override
+    {
+        flush();
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    void write(int64_t time_ms, std::string_view line) override
+    {
+        int64_t sec = time_ms / 1000;
+        if (sec != stamp_sec_) {
+            // "2024-01-31 12:34:56", formatted once per second
+            time_t t = sec;
+            struct tm tm;
+            localtime_r(&t, &tm);
+            strftime(stamp_, sizeof(stamp_), "%Y-%m-%d %H:%M:%S", &tm);
+            stamp_sec_ = sec;
+        }
+        char ms[8];
+        snprintf(ms, sizeof(ms), ".%03u ", unsigned(time_ms % 1000));
+        buf_.append(stamp_);
+        buf_.append(ms);
+        buf_.append(line);
+        buf_.push_back('\n');
+        if (buf_.size() >= buffer_size) {
+            flush();
+        }
+    }
+
+    void flush() override
+    {
+        if (buf_.empty() || (fd_ < 0)) {
+            return;
+        }
+        size_t done = 0;
+        while (done < buf_.size()) {
+            ssize_t n = ::write(fd_, buf_.data() + done, buf_.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "write %s: %s\n", path_.c_str(), strerror(errno));
+                break;
+            }
+            done += n;
+        }
+        size_ += done;
+        buf_.clear();
+        if ((max_bytes_ > 0) && (size_ >= max_bytes_)) {
+            rotate();
+        }
+    }
+
+private:
+    void open()
+    {
+        fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            fprintf(stderr, "open %s: %s\n", path_.c_str(), strerror(errno));
+            return;
+        }
+        struct stat st;
+        size_ = (0 == fstat(fd_, &st)) ? st.st_size : 0;
+    }
+
+    void rotate()
+    {
+        close(fd_);
+        fd_ = -1;
+        if (backups_ == 0) {
+            unlink(path_.c_str());
+        }
+        for (unsigned i = backups_; i > 0; i--) {
+            std::string from = (i == 1) ? path_ : path_ + "." + std::to_string(i - 1);
+            rename(from.c_str(), (path_ + "." + std::to_string(i)).c_str());
+        }
+        open();
+    }
+
+    std::string path_;
+    uint64_t max_bytes_;
+    unsigned backups_;
+    int fd_ = -1;
+    uint64_t size_ = 0;
+    std::string buf_;
+    int64_t stamp_sec_ = -1;
+    char stamp_[32] = "";
+};
+
+} // namespace
+
+std::unique_ptr<device_writer> null_sink::open(const std::string &)
+{
+    return std::make_unique<null_writer>();
+}
+
+tee_sink::tee_sink(std::vector<std::unique_ptr<sink>> sinks)
+    : sinks_(std::move(sinks))
+{
+}
+
+std::unique_ptr<device_writer> tee_sink::open(const std::string &device)
+{
+    std::vector<std::unique_ptr<device_writer>> writers;
+    for (auto &s : sinks_) {
+        writers.push_back(s->open(device));
+    }
+    return std::make_unique<tee_writer>(std::move(writers));
+}
+
+rotating_file_sink::rotating_file_sink(std::string dir, uint64_t max_bytes, unsigned backups)
+    : dir_(std::move(dir)), max_bytes_(max_bytes), backups_(backups)
+{
+    if ((0 != mkdir(dir_.c_str(), 0755)) && (errno != EEXIST)) {
+        throw std::runtime_error("mkdir " + dir_ + ": " + strerror(errno));
+    }
+}
+
+std::unique_ptr<device_writer> rotating_file_sink::open(const std::string &device)
+{
+    return std::make_unique<rotating_file>(dir_ + "/" + device + ".log", max_bytes_, backups_);
+}
+
+} // namespace netlog
@@ -0,0 +1,75 @@
+/*
+    Where the collected lines go. Each worker thread owns the writers of its devices, so writers need no locks.
+*/
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace netlog {
+
+/**
+ * @brief Append s to out without ANSI escape sequences (colors) and without a trailing '\r'.
+ */
+void append_stripped(std::string &out, std::string_view s);
+
+class device_writer {
+public:
+    virtual ~device_writer() = default;
+    /**
+     * @brief One line of the device, without ANSI codes and newline.
+     * @param time_ms When it was received, in ms since the epoch
+     */
+    virtual void write(int64_t time_ms, std::string_view line) = 0;
+    virtual void flush() = 0;
+};
+
+class sink {
+public:
+    virtual ~sink() = default;
+    /**
+     * @brief The writer for one device. May be called from several worker threads, for different devices.
+     */
+    virtual std::unique_ptr<device_writer> open(const std::string &device) = 0;
+};
+
+/**
+ * @brief Discards everything, to measure the rest of the pipeline.
+ */
+class null_sink : public sink {
+public:
+    std::unique_ptr<device_writer> open(const std::string &device) override;
+};
+
+/**
+ * @brief One text file per device, <dir>/<device>.log, each line prefixed with the time it was received.
+ *        Output is buffered and written in blocks. A file that grows over max_bytes is renamed to .1, the .1 to .2,
+ *        and so on up to backups.
+ */
+class rotating_file_sink : public sink {
+public:
+    rotating_file_sink(std::string dir, uint64_t max_bytes, unsigned backups);
+    std::unique_ptr<device_writer> open(const std::string &device) override;
+
+private:
+    std::string dir_;
+    uint64_t max_bytes_;
+    unsigned backups_;
+};
+
+/**
+ * @brief Writes every line to all of the sinks, e.g. the log files and the indexed store.
+ */
+class tee_sink : public sink {
+public:
+    explicit tee_sink(std::vector<std::unique_ptr<sink>> sinks);
+    std::unique_ptr<device_writer> open(const std::string &device) override;
+
+private:
+    std::vector<std::unique_ptr<sink>> sinks_;
+};
+
+} // namespace netlog
@@ -0,0 +1,278 @@
+#include "pipeline.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace netlog {
+
+static constexpr auto tick_interval = std::chrono::milliseconds(20); // NACK timers
+static constexpr auto flush_interval = std::chrono::seconds(1);
+
+static uint64_t sender_key(uint32_t addr, uint16_t port)
+{
+    return (uint64_t(addr) << 16) | port;
+}
+
+static int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void batch::add(uint32_t addr, uint16_t port, int64_t time_ms, const void *data, size_t len)
+{
+    items.push_back(datagram_ref{addr, port, time_ms, uint32_t(bytes.size()), uint32_t(len)});
+    bytes.insert(bytes.end(), static_cast<const char *>(data), static_cast<const char *>(data) + len);
+}
+
+pipeline::pipeline(const options &opt, sink &out, int nack_fd)
+    : opt_(opt), out_(out), nack_fd_(nack_fd)
+{
+    if (opt_.workers == 0) {
+        opt_.workers = 1;
+    }
+    for (unsigned i = 0; i < opt_.workers; i++) {
+        workers_.push_back(std::make_unique<worker>());
+    }
+    for (auto &w : workers_) {
+        w->thread = std::thread([this, &w] { run(*w); });
+    }
+}
+
+pipeline::~pipeline()
+{
+    stop();
+}
+
+void pipeline::stop()
+{
+    for (auto &w : workers_) {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        w->stopping = true;
+        w->cv.notify_one();
+    }
+    for (auto &w : workers_) {
+        if (w->thread.joinable()) {
+            w->thread.join();
+        }
+    }
+}
+
+unsigned pipeline::worker_of(uint32_t addr, uint16_t port) const
+{
+    // All senders of one device share the device's writer, so they go to the same worker
+    uint64_t h = opt_.per_port ? sender_key(addr, port) : addr;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return unsigned((h >> 32) % workers_.size());
+}
+
+pipeline::feeder::feeder(pipeline &p)
+    : p_(p), batches_(p.workers_.size())
+{
+}
+
+void pipeline::feeder::add(uint32_t addr, uint16_t port, int64_t time_ms, const void *data, size_t len)
+{
+    batches_[p_.worker_of(addr, port)].add(addr, port, time_ms, data, len);
+}
+
+void pipeline::feeder::flush()
+{
+    for (size_t i = 0; i < batches_.size(); i++) {
+        batch &b = batches_[i];
+        if (b.items.empty()) {
+            continue;
+        }
+        worker &w = *p_.workers_[i];
+        {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (w.in.bytes.size() > p_.opt_.max_queued) {
+                p_.stats_.overflow += b.items.size();
+            } else if (w.in.items.empty()) {
+                std::swap(w.in, b); // the worker took the last batch, hand this one over without a copy
+            } else {
+                for (const auto &d : b.items) {
+                    w.in.add(d.addr, d.port, d.time_ms, b.bytes.data() + d.offset, d.len);
+                }
+            }
+        }
+        w.cv.notify_one();
+        b.clear();
+    }
+}
+
+void pipeline::run(worker &w)
+{
+    batch local;
+    auto last_tick = clock::now();
+    auto last_flush = last_tick;
+    for (;;) {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(w.mutex);
+            w.cv.wait_for(lock, tick_interval, [&w] { return !w.in.items.empty() || w.stopping; });
+            std::swap(w.in, local);
+            stopping = w.stopping;
+        }
+        uint64_t bytes = 0;
+        for (const auto &d : local.items) {
+            process(w, d, local.bytes.data() + d.offset);
+            bytes += d.len;
+        }
+        stats_.datagrams += local.items.size();
+        stats_.bytes += bytes;
+        stats_.lines += w.lines;
+        w.lines = 0;
+        local.clear();
+
+        auto now = clock::now();
+        if (now - last_tick >= tick_interval) {
+            tick(w, now);
+            last_tick = now;
+        }
+        if (stopping || (now - last_flush >= flush_interval)) {
+            for (auto &writer : w.writers) {
+                writer.second->flush();
+            }
+            last_flush = now;
+        }
+        if (stopping) {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (w.in.items.empty()) {
+                break;
+            }
+        }
+    }
+}
+
+pipeline::sender &pipeline::sender_of(worker &w, uint32_t addr, uint16_t port)
+{
+    auto it = w.senders.find(sender_key(addr, port));
+    if (it != w.senders.end()) {
+        return it->second;
+    }
+    sender &s = w.senders[sender_key(addr, port)];
+    char name[INET_ADDRSTRLEN + 8];
+    inet_ntop(AF_INET, &addr, name, INET_ADDRSTRLEN);
+    if (opt_.per_port) {
+        snprintf(name + strlen(name), 8, "_%u", ntohs(port));
+    }
+    s.name = name;
+    auto &writer = w.writers[s.name];
+    if (!writer) {
+        writer = out_.open(s.name);
+        stats_.devices++;
+    }
+    s.writer = writer.get();
+    return s;
+}
+
+void pipeline::write_lines(worker &w, sender &s, int64_t time_ms, const char *data, size_t len)
+{
+    // A datagram may hold several lines
+    const char *end = data + len;
+    while (data < end) {
+        const char *nl = static_cast<const char *>(memchr(data, '\n', end - data));
+        const char *line_end = nl ? nl : end;
+        w.line.clear();
+        append_stripped(w.line, std::string_view(data, line_end - data));
+        if (!w.line.empty()) {
+            s.writer->write(time_ms, w.line);
+            w.lines++;
+        }
+        data = line_end + 1;
+    }
+}
+
+void pipeline::process(worker &w, const datagram_ref &d, const char *data)
+{
+    sender &s = sender_of(w, d.addr, d.port);
+    header hdr;
+    if (!parse_header(reinterpret_cast<const uint8_t *>(data), d.len, hdr)) {
+        write_lines(w, s, d.time_ms, data, d.len); // sender without reliable mode
+        return;
+    }
+    process_reliable(w, s, d, hdr, data + header_len, d.len - header_len);
+}
+
+void pipeline::process_reliable(worker &w, sender &s, const datagram_ref &d, const header &hdr, const char *payload, size_t len)
+{
+    if (!s.stream || (s.stream->session() != hdr.session)) {
+        // Ask for the first datagrams of a sender that restarted or just started, but not for the past of one
+        // that ran before we did
+        uint32_t first = (hdr.type == pkt_heartbeat) ? hdr.seq + 1 : hdr.seq;
+        if (s.stream || (first < reliable_stream::startup_window)) {
+            first = 0;
+        }
+        s.stream = std::make_unique<reliable_stream>(hdr.session, first);
+    }
+    if (seq_diff(hdr.seq, s.stream->high()) > int32_t(reliable_stream::max_gap)) {
+        std::string note = "--- lost track, " + std::to_string(seq_diff(hdr.seq, s.stream->high())) + " datagrams skipped ---";
+        s.writer->write(d.time_ms, note);
+        s.stream = std::make_unique<reliable_stream>(hdr.session, hdr.seq);
+    }
+    auto before = s.stream->stats();
+    switch (hdr.type) {
+    case pkt_data:
+        if (s.stream->data(hdr.seq, std::string_view(payload, len), clock::now())) {
+            write_lines(w, s, d.time_ms, payload, len);
+        }
+        break;
+    case pkt_heartbeat:
+        s.stream->heartbeat(hdr.seq, clock::now());
+        break;
+    case pkt_gone:
+        s.stream->gone(hdr.seq);
+        break;
+    default:
+        break;
+    }
+    s.stream->deliver([&](const std::string *p) {
+        if (p) {
+            write_lines(w, s, d.time_ms, p->data(), p->size());
+        } else {
+            s.writer->write(d.time_ms, "--- datagram lost ---");
+        }
+    });
+    const auto &after = s.stream->stats();
+    stats_.duplicates += after.duplicates - before.duplicates;
+    stats_.recovered += after.recovered - before.recovered;
+    stats_.lost += after.lost - before.lost;
+}
+
+void pipeline::tick(worker &w, clock::time_point now)
+{
+    int64_t time_ms = now_ms();
+    for (auto &entry : w.senders) {
+        sender &s = entry.second;
+        if (!s.stream) {
+            continue;
+        }
+        uint64_t lost = s.stream->stats().lost;
+        std::vector<uint32_t> due = s.stream->due_nacks(now, opt_.nack && (nack_fd_ >= 0));
+        for (const auto &packet : build_nacks(s.stream->session(), due)) {
+            send_nack(entry.first, packet);
+        }
+        stats_.lost += s.stream->stats().lost - lost;
+        s.stream->deliver([&](const std::string *p) {
+            if (p) {
+                write_lines(w, s, time_ms, p->data(), p->size());
+            } else {
+                s.writer->write(time_ms, "--- datagram lost ---");
+            }
+        });
+    }
+}
+
+void pipeline::send_nack(uint64_t key, const std::string &packet)
+{
+    struct sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = uint32_t(key >> 16);
+    to.sin_port = uint16_t(key);
+    sendto(nack_fd_, packet.data(), packet.size(), 0, reinterpret_cast<struct sockaddr *>(&to), sizeof(to));
+    stats_.nacks++;
+}
+
+} // namespace netlog
@@ -0,0 +1,125 @@
+/*
+    Receiving threads hand datagrams to worker threads in batches. All datagrams of a device go to the same worker,
+    which puts reliable mode datagrams back in order, sends the NACKs, splits the lines and writes them.
+*/
+#pragma once
+
+#include "output.h"
+#include "protocol.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace netlog {
+
+struct datagram_ref {
+    uint32_t addr;      // IPv4 address of the sender, network byte order
+    uint16_t port;      // network byte order
+    int64_t time_ms;    // received, ms since the epoch
+    uint32_t offset;    // into batch::bytes
+    uint32_t len;
+};
+
+struct batch {
+    std::vector<char> bytes;
+    std::vector<datagram_ref> items;
+
+    void add(uint32_t addr, uint16_t port, int64_t time_ms, const void *data, size_t len);
+    void clear()
+    {
+        bytes.clear();
+        items.clear();
+    }
+};
+
+struct pipeline_stats {
+    std::atomic<uint64_t> datagrams{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> lines{0};
+    std::atomic<uint64_t> devices{0};
+    std::atomic<uint64_t> overflow{0};   // datagrams dropped because the workers fell behind
+    std::atomic<uint64_t> duplicates{0};
+    std::atomic<uint64_t> recovered{0};
+    std::atomic<uint64_t> lost{0};
+    std::atomic<uint64_t> nacks{0};
+};
+
+class pipeline {
+public:
+    struct options {
+        unsigned workers = 4;
+        bool nack = true;           // ask reliable mode senders for missing datagrams
+        bool per_port = false;      // a device is an address and port, not only an address
+        size_t max_queued = 64 << 20; // bytes waiting for a worker, more are dropped
+    };
+
+    /**
+     * @param nack_fd UDP socket to send NACKs from, -1 for none. Resent datagrams come back to it.
+     */
+    pipeline(const options &opt, sink &out, int nack_fd);
+    ~pipeline();
+
+    /**
+     * @brief Collects the datagrams of one receiving thread, and passes them on at flush()
+     */
+    class feeder {
+    public:
+        explicit feeder(pipeline &p);
+        void add(uint32_t addr, uint16_t port, int64_t time_ms, const void *data, size_t len);
+        void flush();
+
+    private:
+        pipeline &p_;
+        std::vector<batch> batches_;
+    };
+
+    /**
+     * @brief Process everything that was fed, and stop the workers.
+     */
+    void stop();
+
+    const pipeline_stats &stats() const { return stats_; }
+
+private:
+    struct sender {
+        std::string name;
+        device_writer *writer = nullptr;
+        std::unique_ptr<reliable_stream> stream;
+    };
+
+    struct worker {
+        std::mutex mutex;
+        std::condition_variable cv;
+        batch in;
+        bool stopping = false;
+        std::thread thread;
+        std::unordered_map<uint64_t, sender> senders; // by address and port
+        std::unordered_map<std::string, std::unique_ptr<device_writer>> writers; // by device name
+        std::string line;   // scratch
+        uint64_t lines = 0;
+    };
+
+    unsigned worker_of(uint32_t addr, uint16_t port) const;
+    void run(worker &w);
+    void process(worker &w, const datagram_ref &d, const char *data);
+    void process_reliable(worker &w, sender &s, const datagram_ref &d, const header &hdr, const char *payload, size_t len);
+    void tick(worker &w, clock::time_point now);
+    sender &sender_of(worker &w, uint32_t addr, uint16_t port);
+    void write_lines(worker &w, sender &s, int64_t time_ms, const char *data, size_t len);
+    void send_nack(uint64_t key, const std::string &packet);
+
+    options opt_;
+    sink &out_;
+    int nack_fd_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    pipeline_stats stats_;
+};
+
+} // namespace netlog
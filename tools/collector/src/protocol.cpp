@@ -0,0 +1,154 @@
+#include "protocol.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace netlog {
+
+static const char magic[3] = {'\0', 'N', 'L'};
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static void put_u32(std::string &out, uint32_t v)
+{
+    out.push_back(char(v >> 24));
+    out.push_back(char(v >> 16));
+    out.push_back(char(v >> 8));
+    out.push_back(char(v));
+}
+
+bool parse_header(const uint8_t *data, size_t len, header &hdr)
+{
+    if ((len < header_len) || (0 != memcmp(data, magic, sizeof(magic)))) {
+        return false;
+    }
+    hdr.type = data[3];
+    hdr.session = get_u32(data + 4);
+    hdr.seq = get_u32(data + 8);
+    return true;
+}
+
+std::vector<std::string> build_nacks(uint32_t session, const std::vector<uint32_t> &seqs)
+{
+    std::vector<std::pair<uint32_t, uint16_t>> ranges;
+    for (uint32_t seq : seqs) {
+        if (!ranges.empty() && (ranges.back().first + ranges.back().second == seq) && (ranges.back().second < 0xFFFF)) {
+            ranges.back().second++;
+        } else {
+            ranges.emplace_back(seq, 1);
+        }
+    }
+    std::vector<std::string> packets;
+    for (size_t i = 0; i < ranges.size(); i += nack_max_ranges) {
+        std::string packet(magic, sizeof(magic));
+        packet.push_back(char(pkt_nack));
+        put_u32(packet, session);
+        put_u32(packet, 0);
+        for (size_t j = i; j < std::min(ranges.size(), i + nack_max_ranges); j++) {
+            put_u32(packet, ranges[j].first);
+            packet.push_back(char(ranges[j].second >> 8));
+            packet.push_back(char(ranges[j].second));
+        }
+        packets.push_back(std::move(packet));
+    }
+    return packets;
+}
+
+reliable_stream::reliable_stream(uint32_t session, uint32_t next)
+    : session_(session), next_(next), high_(next - 1)
+{
+}
+
+void reliable_stream::note_sent(uint32_t seq, clock::time_point now)
+{
+    if (seq_diff(seq, high_) <= 0) {
+        return;
+    }
+    for (uint32_t s = high_ + 1; seq_diff(s, seq) <= 0; s++) {
+        missing_[s] = gap{now + reorder_wait, 0};
+    }
+    high_ = seq;
+}
+
+bool reliable_stream::data(uint32_t seq, std::string_view payload, clock::time_point now)
+{
+    if ((seq_diff(seq, next_) < 0) || pending_.count(seq)) {
+        stats_.duplicates++;
+        return false;
+    }
+    auto it = missing_.find(seq);
+    if (it != missing_.end()) {
+        if (it->second.tries > 0) {
+            stats_.recovered++;
+        }
+        missing_.erase(it);
+    }
+    if ((seq == next_) && pending_.empty()) {
+        // The usual case: in order, and nothing waiting behind a gap
+        next_++;
+        if (seq_diff(seq, high_) > 0) {
+            high_ = seq;
+        }
+        return true;
+    }
+    note_sent(seq - 1, now);
+    if (seq_diff(seq, high_) > 0) {
+        high_ = seq;
+    }
+    pending_[seq].payload.assign(payload);
+    return false;
+}
+
+void reliable_stream::heartbeat(uint32_t last_sent, clock::time_point now)
+{
+    note_sent(last_sent, now);
+}
+
+void reliable_stream::give_up(uint32_t seq)
+{
+    missing_.erase(seq);
+    pending_[seq].lost = true;
+    stats_.lost++;
+}
+
+void reliable_stream::gone(uint32_t oldest)
+{
+    std::vector<uint32_t> seqs;
+    for (const auto &m : missing_) {
+        if (seq_diff(m.first, oldest) < 0) {
+            seqs.push_back(m.first);
+        }
+    }
+    for (uint32_t seq : seqs) {
+        give_up(seq);
+    }
+}
+
+std::vector<uint32_t> reliable_stream::due_nacks(clock::time_point now, bool nack)
+{
+    std::vector<uint32_t> due;
+    std::vector<uint32_t> expired;
+    for (auto &m : missing_) {
+        if (m.second.due > now) {
+            continue;
+        }
+        if (!nack || (m.second.tries >= nack_tries)) {
+            expired.push_back(m.first);
+            continue;
+        }
+        m.second.due = now + nack_interval;
+        m.second.tries++;
+        due.push_back(m.first);
+    }
+    for (uint32_t seq : expired) {
+        give_up(seq);
+    }
+    // In order from next_, also where seq wrapped
+    std::sort(due.begin(), due.end(), [this](uint32_t a, uint32_t b) { return seq_diff(a, next_) < seq_diff(b, next_); });
+    return due;
+}
+
+} // namespace netlog
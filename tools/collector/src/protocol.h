@@ -0,0 +1,124 @@
+/*
+    Reliable multicast protocol of multicast_log_sender.c, receiving side.
+    See the comment at the top of multicast_log_sender.c for the packet format.
+*/
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace netlog {
+
+using clock = std::chrono::steady_clock;
+
+constexpr size_t header_len = 12;
+constexpr size_t nack_max_ranges = 16;
+
+enum packet_type : uint8_t {
+    pkt_data = 1,
+    pkt_heartbeat = 2,
+    pkt_nack = 3,
+    pkt_gone = 4,
+};
+
+struct header {
+    uint8_t type;
+    uint32_t session;
+    uint32_t seq;
+};
+
+/**
+ * @brief Parse the header of a reliable mode packet.
+ * @return false for a datagram of a sender without reliable mode
+ */
+bool parse_header(const uint8_t *data, size_t len, header &hdr);
+
+/**
+ * @brief NACK packets asking for the sorted seqs, as ranges.
+ */
+std::vector<std::string> build_nacks(uint32_t session, const std::vector<uint32_t> &seqs);
+
+/**
+ * @brief a - b for sequence numbers that wrap, negative if a is before b
+ */
+inline int32_t seq_diff(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b);
+}
+
+/**
+ * @brief Puts the datagrams of one session of one sender back in order.
+ *        Gaps are asked for with NACKs, and given up after nack_tries.
+ */
+class reliable_stream {
+public:
+    struct counters {
+        uint64_t duplicates = 0;
+        uint64_t recovered = 0; // arrived after a NACK
+        uint64_t lost = 0;      // given up, or gone from the sender's resend ring
+    };
+
+    static constexpr auto reorder_wait = std::chrono::milliseconds(20); // before the first NACK of a gap
+    static constexpr auto nack_interval = std::chrono::milliseconds(200);
+    static constexpr unsigned nack_tries = 5;
+    static constexpr uint32_t max_gap = 4096; // a larger jump starts over
+    static constexpr uint32_t startup_window = 16; // a new sender with a lower seq has just started
+
+    reliable_stream(uint32_t session, uint32_t next);
+
+    uint32_t session() const { return session_; }
+    uint32_t high() const { return high_; }
+    const counters &stats() const { return stats_; }
+
+    /**
+     * @brief A DATA packet arrived.
+     * @return true if it is the next one and nothing is waiting: the caller delivers it directly, without a copy
+     */
+    bool data(uint32_t seq, std::string_view payload, clock::time_point now);
+    void heartbeat(uint32_t last_sent, clock::time_point now);
+    void gone(uint32_t oldest);
+
+    /**
+     * @brief The seqs to ask for now. Without nack, gaps are given up after reorder_wait.
+     */
+    std::vector<uint32_t> due_nacks(clock::time_point now, bool nack);
+
+    /**
+     * @brief Hand the datagrams that are now in order to f(const std::string *payload), nullptr for a lost one.
+     */
+    template <class F> void deliver(F &&f)
+    {
+        for (auto it = pending_.find(next_); it != pending_.end(); it = pending_.find(next_)) {
+            f(it->second.lost ? nullptr : &it->second.payload);
+            pending_.erase(it);
+            next_++;
+        }
+    }
+
+private:
+    struct slot {
+        bool lost = false;
+        std::string payload;
+    };
+    struct gap {
+        clock::time_point due;
+        unsigned tries = 0;
+    };
+
+    void note_sent(uint32_t seq, clock::time_point now);
+    void give_up(uint32_t seq);
+
+    uint32_t session_;
+    uint32_t next_; // next seq to deliver
+    uint32_t high_; // highest seq known to be sent
+    std::map<uint32_t, slot> pending_; // received or given up, ahead of next_
+    std::map<uint32_t, gap> missing_;
+    counters stats_;
+};
+
+} // namespace netlog
@@ -0,0 +1,389 @@
+#include "store.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <queue>
+#include <regex.h>
+#include <set>
+#include <stdexcept>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace netlog {
+
+int64_t parse_time(const std::string &s)
+{
+    if (s.empty()) {
+        throw std::runtime_error("empty time");
+    }
+    char *end;
+    if (s[0] == '-') {
+        double n = strtod(s.c_str() + 1, &end);
+        int64_t unit = 0;
+        switch (*end) {
+        case 's': unit = 1; break;
+        case 'm': unit = 60; break;
+        case 'h': unit = 3600; break;
+        case 'd': unit = 86400; break;
+        }
+        if ((unit == 0) || (end[1] != '\0')) {
+            throw std::runtime_error("bad relative time: " + s);
+        }
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return now - int64_t(n * unit * 1000);
+    }
+    long long secs = strtoll(s.c_str(), &end, 10);
+    if (*end == '\0') {
+        return secs * 1000;
+    }
+    static const char *const formats[] = {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%dT%H:%M", "%Y-%m-%d"};
+    for (const char *format : formats) {
+        struct tm tm = {};
+        const char *rest = strptime(s.c_str(), format, &tm);
+        if (rest && (*rest == '\0')) {
+            tm.tm_isdst = -1;
+            return int64_t(mktime(&tm)) * 1000;
+        }
+    }
+    throw std::runtime_error("bad time: " + s);
+}
+
+namespace {
+
+struct block_ref {
+    int fd;
+    index_entry entry;
+    std::string device;
+};
+
+// The lines of one block, in the order they were written
+struct cursor {
+    const block_ref *block;
+    std::vector<char> data;
+    size_t pos;
+    int64_t time_ms;
+    char level;
+    std::string_view line;
+
+    bool next()
+    {
+        while (pos < data.size()) {
+            int64_t zigzag = int64_t(get_varint());
+            time_ms += (zigzag >> 1) ^ -(zigzag & 1);
+            if (pos >= data.size()) {
+                break;
+            }
+            level = data[pos++];
+            uint64_t len = get_varint();
+            if (pos + len > data.size()) {
+                break;
+            }
+            line = std::string_view(data.data() + pos, len);
+            pos += len;
+            return true;
+        }
+        return false;
+    }
+
+    uint64_t get_varint()
+    {
+        uint64_t v = 0;
+        for (unsigned shift = 0; (pos < data.size()) && (shift < 64); shift += 7) {
+            uint8_t b = uint8_t(data[pos++]);
+            v |= uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                break;
+            }
+        }
+        return v;
+    }
+};
+
+struct later {
+    bool operator()(const cursor *a, const cursor *b) const
+    {
+        // Lines of the same time come in the order of their blocks, so a device's lines keep their order
+        return (a->time_ms != b->time_ms) ? (a->time_ms > b->time_ms) : (a->block > b->block);
+    }
+};
+
+class query {
+public:
+    explicit query(const query_options &opt)
+        : opt_(opt), devices_(opt.devices.begin(), opt.devices.end())
+    {
+        for (const auto &tag : opt_.tags) {
+            tag_blooms_.push_back(tag_bloom(tag));
+        }
+        if (!opt_.grep.empty()) {
+            int err = regcomp(&regex_, opt_.grep.c_str(), REG_EXTENDED | REG_NOSUB);
+            if (err != 0) {
+                char msg[128];
+                regerror(err, &regex_, msg, sizeof(msg));
+                throw std::runtime_error("--grep: " + std::string(msg));
+            }
+            has_regex_ = true;
+        }
+    }
+
+    ~query()
+    {
+        if (has_regex_) {
+            regfree(&regex_);
+        }
+        for (int fd : fds_) {
+            close(fd);
+        }
+    }
+
+    void run()
+    {
+        auto start = std::chrono::steady_clock::now();
+        unsigned partition_s = 3600;
+        FILE *f = fopen((opt_.dir + "/partition").c_str(), "r");
+        if (!f) {
+            throw std::runtime_error(opt_.dir + " is not a log store");
+        }
+        if ((1 != fscanf(f, "%u", &partition_s)) || (partition_s == 0)) {
+            partition_s = 3600;
+        }
+        fclose(f);
+
+        for (const std::string &name : list(opt_.dir)) {
+            struct tm tm = {};
+            const char *rest = strptime(name.c_str(), "%Y-%m-%dT%H:%M", &tm);
+            if (!rest || (*rest != '\0')) {
+                continue;
+            }
+            int64_t begin_ms = int64_t(timegm(&tm)) * 1000;
+            if ((begin_ms > opt_.to_ms) || (begin_ms + int64_t(partition_s) * 1000 <= opt_.from_ms)) {
+                continue;
+            }
+            partitions_++;
+            std::string pdir = opt_.dir + "/" + name;
+            for (const std::string &file : list(pdir)) {
+                if ((file.size() > 4) && (file.compare(file.size() - 4, 4, ".idx") == 0)) {
+                    scan_index(pdir + "/" + file.substr(0, file.size() - 4));
+                }
+            }
+        }
+
+        merge();
+        if (opt_.stats) {
+            double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            fprintf(stderr, "%u partitions, %llu of %llu blocks read (%.1f MB compressed), %llu lines matched, %.3f s\n",
+                partitions_, (unsigned long long)blocks_.size(), (unsigned long long)entries_,
+                read_bytes_ / 1e6, (unsigned long long)matched_, secs);
+        }
+    }
+
+private:
+    static std::vector<std::string> list(const std::string &dir)
+    {
+        std::vector<std::string> names;
+        DIR *d = opendir(dir.c_str());
+        if (!d) {
+            return names;
+        }
+        while (struct dirent *e = readdir(d)) {
+            if (e->d_name[0] != '.') {
+                names.push_back(e->d_name);
+            }
+        }
+        closedir(d);
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    bool block_matches(const index_entry &e, std::string_view device) const
+    {
+        if ((e.t_max < opt_.from_ms) || (e.t_min > opt_.to_ms) || !(e.levels & opt_.levels)) {
+            return false;
+        }
+        if (!devices_.empty() && !devices_.count(std::string(device))) {
+            return false;
+        }
+        if (tag_blooms_.empty()) {
+            return true;
+        }
+        for (uint64_t bloom : tag_blooms_) {
+            if ((e.tag_bloom & bloom) == bloom) {
+                return true; // may contain the tag
+            }
+        }
+        return false;
+    }
+
+    bool line_matches(const cursor &c) const
+    {
+        if ((c.time_ms < opt_.from_ms) || (c.time_ms > opt_.to_ms) || !(level_mask(c.level) & opt_.levels)) {
+            return false;
+        }
+        if (!opt_.tags.empty()) {
+            char level;
+            std::string_view tag;
+            parse_esp_log(c.line, level, tag);
+            if (std::find(opt_.tags.begin(), opt_.tags.end(), tag) == opt_.tags.end()) {
+                return false;
+            }
+        }
+        if (has_regex_) {
+            std::string line(c.line);
+            if (0 != regexec(&regex_, line.c_str(), 0, nullptr, 0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void scan_index(const std::string &base)
+    {
+        // The whole index is read at once, it's small compared to the segment
+        FILE *f = fopen((base + ".idx").c_str(), "rb");
+        if (!f) {
+            return;
+        }
+        std::vector<char> idx;
+        char buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            idx.insert(idx.end(), buf, buf + n);
+        }
+        fclose(f);
+        int fd = -1;
+        // A torn entry at the end, from a collector that was killed while writing, is ignored
+        for (size_t pos = 8; pos + sizeof(index_entry) <= idx.size();) {
+            index_entry e;
+            memcpy(&e, idx.data() + pos, sizeof(e));
+            pos += sizeof(e);
+            if (pos + e.device_len > idx.size()) {
+                break;
+            }
+            std::string_view device(idx.data() + pos, e.device_len);
+            pos += e.device_len;
+            entries_++;
+            if (!block_matches(e, device)) {
+                continue;
+            }
+            if (fd < 0) {
+                fd = ::open((base + ".seg").c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    fprintf(stderr, "open %s.seg: %s\n", base.c_str(), strerror(errno));
+                    return;
+                }
+                fds_.push_back(fd);
+            }
+            blocks_.push_back(block_ref{fd, e, std::string(device)});
+        }
+    }
+
+    bool load(cursor &c)
+    {
+        const index_entry &e = c.block->entry;
+        std::vector<Bytef> z(e.csize);
+        if (pread(c.block->fd, z.data(), e.csize, off_t(e.offset)) != ssize_t(e.csize)) {
+            return false;
+        }
+        read_bytes_ += e.csize;
+        c.data.resize(e.usize);
+        uLongf usize = e.usize;
+        if ((Z_OK != uncompress(reinterpret_cast<Bytef *>(c.data.data()), &usize, z.data(), e.csize)) || (usize < sizeof(int64_t))) {
+            return false;
+        }
+        c.data.resize(usize);
+        memcpy(&c.time_ms, c.data.data(), sizeof(int64_t));
+        c.pos = sizeof(int64_t);
+        return true;
+    }
+
+    bool advance(cursor &c)
+    {
+        while (c.next()) {
+            if (line_matches(c)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void print(const cursor &c)
+    {
+        int64_t sec = c.time_ms / 1000;
+        if (sec != stamp_sec_) {
+            time_t t = sec;
+            struct tm tm;
+            localtime_r(&t, &tm);
+            strftime(stamp_, sizeof(stamp_), "%Y-%m-%d %H:%M:%S", &tm);
+            stamp_sec_ = sec;
+        }
+        printf("%s.%03u %s %.*s\n", stamp_, unsigned(c.time_ms % 1000), c.block->device.c_str(), int(c.line.size()), c.line.data());
+        matched_++;
+    }
+
+    /**
+     * @brief Print the lines of all selected blocks in time order. Only the blocks that overlap in time are open at once.
+     */
+    void merge()
+    {
+        std::stable_sort(blocks_.begin(), blocks_.end(), [](const block_ref &a, const block_ref &b) { return a.entry.t_min < b.entry.t_min; });
+        std::priority_queue<cursor *, std::vector<cursor *>, later> heap;
+        std::vector<std::unique_ptr<cursor>> open;
+        size_t i = 0;
+        while ((i < blocks_.size()) || !heap.empty()) {
+            while ((i < blocks_.size()) && (heap.empty() || (blocks_[i].entry.t_min <= heap.top()->time_ms))) {
+                auto c = std::make_unique<cursor>();
+                c->block = &blocks_[i++];
+                if (!load(*c)) {
+                    fprintf(stderr, "%s: a block is damaged, skipped\n", c->block->device.c_str());
+                    continue;
+                }
+                if (advance(*c)) {
+                    heap.push(c.get());
+                    open.push_back(std::move(c));
+                }
+            }
+            if (heap.empty()) {
+                continue;
+            }
+            cursor *c = heap.top();
+            heap.pop();
+            print(*c);
+            if (advance(*c)) {
+                heap.push(c);
+            } else {
+                // Done with this block, free its data
+                open.erase(std::find_if(open.begin(), open.end(), [c](const std::unique_ptr<cursor> &p) { return p.get() == c; }));
+            }
+        }
+    }
+
+    const query_options &opt_;
+    std::set<std::string> devices_;
+    std::vector<uint64_t> tag_blooms_;
+    regex_t regex_;
+    bool has_regex_ = false;
+    std::vector<int> fds_;
+    std::vector<block_ref> blocks_;
+    unsigned partitions_ = 0;
+    uint64_t entries_ = 0;
+    uint64_t read_bytes_ = 0;
+    uint64_t matched_ = 0;
+    int64_t stamp_sec_ = -1;
+    char stamp_[32] = "";
+};
+
+} // namespace
+
+void run_query(const query_options &opt)
+{
+    query q(opt);
+    q.run();
+}
+
+} // namespace netlog
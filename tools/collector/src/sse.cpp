@@ -0,0 +1,555 @@
+#include "sse.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace netlog {
+
+static constexpr size_t max_header_size = 16 * 1024;
+static constexpr size_t recv_size = 64 * 1024;
+
+sse_parser::sse_parser(size_t max_line, size_t max_data)
+    : max_line_(max_line), max_data_(max_data)
+{
+}
+
+void sse_parser::reset()
+{
+    line_.clear();
+    line_cut_ = false;
+    after_cr_ = false;
+    started_ = false;
+    type_.clear();
+    data_.clear();
+    id_ = last_id_;
+}
+
+void sse_parser::feed(const char *data, size_t len, const std::function<void(const sse_event &)> &on_event)
+{
+    const char *end = data + len;
+    if (!started_ && (data < end)) {
+        // A stream may start with a byte order mark, it's taken as a whole
+        static const char bom[] = "\xEF\xBB\xBF";
+        if ((len >= 3) && (0 == memcmp(data, bom, 3))) {
+            data += 3;
+        }
+        started_ = true;
+    }
+    while (data < end) {
+        if (after_cr_) {
+            // "\r\n" is one line end
+            after_cr_ = false;
+            if (*data == '\n') {
+                data++;
+                continue;
+            }
+        }
+        const char *p = data;
+        while ((p < end) && (*p != '\n') && (*p != '\r')) {
+            p++;
+        }
+        size_t room = max_line_ - line_.size();
+        size_t n = p - data;
+        if (n > room) {
+            n = room;
+            line_cut_ = true;
+        }
+        line_.append(data, n);
+        if (p == end) {
+            break;
+        }
+        after_cr_ = (*p == '\r');
+        data = p + 1;
+        if (line_cut_) {
+            truncated_++;
+            line_cut_ = false;
+        }
+        line(on_event);
+        line_.clear();
+    }
+}
+
+void sse_parser::line(const std::function<void(const sse_event &)> &on_event)
+{
+    if (line_.empty()) {
+        // A blank line dispatches the event
+        last_id_ = id_;
+        if (!data_.empty()) {
+            data_.pop_back(); // the '\n' after the last data line
+            sse_event e;
+            e.type = type_.empty() ? std::string_view("message") : std::string_view(type_);
+            e.data = data_;
+            e.id = last_id_;
+            on_event(e);
+        }
+        type_.clear();
+        data_.clear();
+        return;
+    }
+    if (line_[0] == ':') {
+        return; // comment
+    }
+    size_t colon = line_.find(':');
+    std::string_view field(line_.data(), std::min(colon, line_.size()));
+    std::string_view value;
+    if (colon != std::string::npos) {
+        value = std::string_view(line_).substr(colon + 1);
+        if (!value.empty() && (value[0] == ' ')) {
+            value.remove_prefix(1);
+        }
+    }
+    if (field == "data") {
+        size_t n = std::min(value.size(), max_data_ - std::min(max_data_, data_.size()));
+        if (n < value.size()) {
+            truncated_++;
+        }
+        data_.append(value.data(), n);
+        data_.push_back('\n');
+    } else if (field == "event") {
+        type_ = value;
+    } else if (field == "id") {
+        if (value.find('\0') == std::string_view::npos) {
+            id_ = value;
+        }
+    } else if (field == "retry") {
+        if (!value.empty() && (value.find_first_not_of("0123456789") == std::string_view::npos)) {
+            retry_ms_ = unsigned(std::min<unsigned long>(strtoul(std::string(value).c_str(), nullptr, 10), 3600000));
+        }
+    }
+}
+
+sse_target parse_sse_target(const std::string &s)
+{
+    sse_target t;
+    std::string rest = s;
+    if (rest.compare(0, 7, "http://") == 0) {
+        rest.erase(0, 7);
+    }
+    size_t slash = rest.find('/');
+    if (slash != std::string::npos) {
+        t.path = rest.substr(slash);
+        rest.erase(slash);
+    }
+    size_t colon = rest.rfind(':');
+    if (colon != std::string::npos) {
+        int port = atoi(rest.c_str() + colon + 1);
+        if ((port <= 0) || (port > 65535)) {
+            throw std::runtime_error("bad port in " + s);
+        }
+        t.port = uint16_t(port);
+        rest.erase(colon);
+    }
+    if (rest.empty()) {
+        throw std::runtime_error("no host in " + s);
+    }
+    t.host = rest;
+    return t;
+}
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief One device: connects, sends the request, checks the response headers, then undoes the chunked
+ *        transfer encoding and gzip, if the server used them, and parses the events.
+ */
+class connection {
+public:
+    enum class state { waiting, connecting, headers, body };
+
+    connection(const sse_target &target, const sse_options &opt, sse_stats &stats, int epoll_fd, uint32_t index)
+        : target_(target), opt_(opt), stats_(stats), epoll_fd_(epoll_fd), index_(index)
+    {
+    }
+
+    ~connection()
+    {
+        close_socket();
+    }
+
+    state get_state() const { return state_; }
+    clock::time_point retry_at() const { return retry_at_; }
+
+    void start(clock::time_point now)
+    {
+        last_rx_ = now;
+        struct addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *res = nullptr;
+        // Blocks on name lookups, give addresses for a large fleet
+        int err = getaddrinfo(target_.host.c_str(), std::to_string(target_.port).c_str(), &hints, &res);
+        if ((err != 0) || !res) {
+            fail(now, std::string("can't resolve: ") + gai_strerror(err));
+            return;
+        }
+        addr_ = *reinterpret_cast<struct sockaddr_in *>(res->ai_addr);
+        freeaddrinfo(res);
+        fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) {
+            fail(now, std::string("socket: ") + strerror(errno));
+            return;
+        }
+        if ((0 != connect(fd_, reinterpret_cast<struct sockaddr *>(&addr_), sizeof(addr_))) && (errno != EINPROGRESS)) {
+            fail(now, std::string("connect: ") + strerror(errno));
+            return;
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLOUT;
+        ev.data.u32 = index_;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd_, &ev);
+        state_ = state::connecting;
+    }
+
+    void on_writable(clock::time_point now)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            fail(now, std::string("connect: ") + strerror(err));
+            return;
+        }
+        std::string request = "GET " + target_.path + " HTTP/1.1\r\n"
+            "Host: " + target_.host + ":" + std::to_string(target_.port) + "\r\n"
+            "Accept: text/event-stream\r\n"
+            "Cache-Control: no-cache\r\n";
+        if (opt_.gzip) {
+            request += "Accept-Encoding: gzip\r\n";
+        }
+        if (!parser_.last_id().empty()) {
+            request += "Last-Event-ID: " + parser_.last_id() + "\r\n";
+        }
+        request += "\r\n";
+        // A new connection has room for the request in its send buffer
+        if (send(fd_, request.data(), request.size(), MSG_NOSIGNAL) != ssize_t(request.size())) {
+            fail(now, std::string("send: ") + strerror(errno));
+            return;
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u32 = index_;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd_, &ev);
+        state_ = state::headers;
+        header_.clear();
+    }
+
+    void on_readable(clock::time_point now, pipeline::feeder &feeder, char *buf)
+    {
+        for (;;) {
+            ssize_t n = recv(fd_, buf, recv_size, 0);
+            if (n < 0) {
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                    return;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail(now, std::string("recv: ") + strerror(errno));
+                return;
+            }
+            if (n == 0) {
+                fail(now, "closed by the device");
+                return;
+            }
+            last_rx_ = now;
+            stats_.bytes += n;
+            if (!received(buf, size_t(n), feeder)) {
+                return;
+            }
+            if (size_t(n) < recv_size) {
+                return;
+            }
+        }
+    }
+
+    void check_timeout(clock::time_point now)
+    {
+        if ((state_ != state::waiting) && (now - last_rx_ >= std::chrono::seconds(opt_.timeout_s))) {
+            fail(now, "timed out");
+        }
+    }
+
+    void stop()
+    {
+        close_socket();
+    }
+
+private:
+    bool received(const char *data, size_t len, pipeline::feeder &feeder)
+    {
+        feeder_ = &feeder;
+        if (state_ == state::headers) {
+            size_t old = header_.size();
+            header_.append(data, std::min(len, max_header_size - old));
+            size_t end = header_.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                if (header_.size() >= max_header_size) {
+                    fail(clock::now(), "response headers too long");
+                    return false;
+                }
+                return true;
+            }
+            if (!check_headers(header_.substr(0, end + 2))) {
+                return false;
+            }
+            size_t used = end + 4 - old;
+            data += used;
+            len -= used;
+            state_ = state::body;
+        }
+        return chunked_ ? dechunk(data, len) : decode(data, len);
+    }
+
+    bool check_headers(const std::string &h)
+    {
+        int status = 0;
+        if (1 != sscanf(h.c_str(), "HTTP/1.%*d %d", &status)) {
+            fail(clock::now(), "not an HTTP response");
+            return false;
+        }
+        if (status != 200) {
+            // 204 No Content is how a server says not to reconnect, we try again after the longest wait
+            failures_ = (status == 204) ? 32 : failures_;
+            fail(clock::now(), "HTTP status " + std::to_string(status));
+            return false;
+        }
+        std::string lower(h);
+        for (char &c : lower) {
+            c = char(tolower(uint8_t(c)));
+        }
+        if (lower.find("\ncontent-type: text/event-stream") == std::string::npos) {
+            fail(clock::now(), "not an event stream");
+            return false;
+        }
+        chunked_ = (lower.find("\ntransfer-encoding: chunked") != std::string::npos);
+        chunk_state_ = chunk_size;
+        chunk_line_.clear();
+        gzip_ = (lower.find("\ncontent-encoding: gzip") != std::string::npos);
+        if (gzip_) {
+            z_ = std::make_unique<z_stream>();
+            if (Z_OK != inflateInit2(z_.get(), 16 + MAX_WBITS)) {
+                z_.reset();
+                fail(clock::now(), "inflateInit2 failed");
+                return false;
+            }
+        }
+        parser_.reset();
+        stats_.connects++;
+        stats_.connected++;
+        connected_ = true;
+        fprintf(stderr, "%s: connected%s\n", target_.host.c_str(), gzip_ ? ", gzip" : "");
+        return true;
+    }
+
+    enum { chunk_size, chunk_data, chunk_end };
+
+    bool dechunk(const char *data, size_t len)
+    {
+        const char *end = data + len;
+        while (data < end) {
+            switch (chunk_state_) {
+            case chunk_size:
+                if (*data == '\n') {
+                    char *hex_end;
+                    chunk_left_ = strtoull(chunk_line_.c_str(), &hex_end, 16);
+                    if (hex_end == chunk_line_.c_str()) {
+                        fail(clock::now(), "bad chunk size");
+                        return false;
+                    }
+                    if (chunk_left_ == 0) {
+                        fail(clock::now(), "stream ended");
+                        return false;
+                    }
+                    chunk_line_.clear();
+                    chunk_state_ = chunk_data;
+                } else if (chunk_line_.size() < 64) {
+                    chunk_line_.push_back(*data);
+                }
+                data++;
+                break;
+            case chunk_data: {
+                size_t n = size_t(std::min<uint64_t>(chunk_left_, uint64_t(end - data)));
+                if (!decode(data, n)) {
+                    return false;
+                }
+                data += n;
+                chunk_left_ -= n;
+                if (chunk_left_ == 0) {
+                    chunk_state_ = chunk_end;
+                }
+                break;
+            }
+            case chunk_end:
+                if (*data++ == '\n') {
+                    chunk_state_ = chunk_size;
+                }
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool decode(const char *data, size_t len)
+    {
+        if (!gzip_) {
+            parse(data, len);
+            return true;
+        }
+        char out[16 * 1024];
+        z_->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        z_->avail_in = uInt(len);
+        do {
+            z_->next_out = reinterpret_cast<Bytef *>(out);
+            z_->avail_out = sizeof(out);
+            int ret = inflate(z_.get(), Z_SYNC_FLUSH);
+            if ((ret != Z_OK) && (ret != Z_BUF_ERROR) && (ret != Z_STREAM_END)) {
+                fail(clock::now(), "gzip stream damaged");
+                return false;
+            }
+            parse(out, sizeof(out) - z_->avail_out);
+            if (ret == Z_STREAM_END) {
+                break;
+            }
+        } while ((z_->avail_in > 0) || (z_->avail_out == 0));
+        return true;
+    }
+
+    void parse(const char *data, size_t len)
+    {
+        uint64_t truncated = parser_.truncated();
+        parser_.feed(data, len, [this](const sse_event &e) {
+            if ((e.type != "log-line") && (e.type != "message")) {
+                return; // keepalive
+            }
+            stats_.events++;
+            failures_ = 0; // the connection works, a new one won't have to wait long
+            feeder_->add(addr_.sin_addr.s_addr, addr_.sin_port, now_ms(), e.data.data(), e.data.size());
+        });
+        stats_.truncated += parser_.truncated() - truncated;
+    }
+
+    void fail(clock::time_point now, const std::string &why)
+    {
+        close_socket();
+        // Exponential backoff with jitter, so a fleet that lost its network doesn't come back all at once
+        unsigned base = std::max(opt_.min_backoff_ms, parser_.retry_ms());
+        uint64_t wait = std::min<uint64_t>(uint64_t(base) << std::min(failures_, 16u), opt_.max_backoff_ms);
+        std::uniform_int_distribution<uint64_t> jitter(wait * 3 / 4, wait);
+        wait = jitter(random_);
+        if (failures_ < 32) {
+            failures_++;
+        }
+        stats_.failures++;
+        fprintf(stderr, "%s: %s, reconnecting in %.1f s\n", target_.host.c_str(), why.c_str(), wait / 1000.0);
+        retry_at_ = now + std::chrono::milliseconds(wait);
+    }
+
+    void close_socket()
+    {
+        if (fd_ >= 0) {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd_, nullptr);
+            close(fd_);
+            fd_ = -1;
+        }
+        if (z_) {
+            inflateEnd(z_.get());
+            z_.reset();
+        }
+        if (connected_) {
+            stats_.connected--;
+            connected_ = false;
+        }
+        state_ = state::waiting;
+    }
+
+    const sse_target target_;
+    const sse_options &opt_;
+    sse_stats &stats_;
+    int epoll_fd_;
+    uint32_t index_;
+    int fd_ = -1;
+    struct sockaddr_in addr_ = {};
+    state state_ = state::waiting;
+    bool connected_ = false;
+    clock::time_point retry_at_;
+    clock::time_point last_rx_;
+    unsigned failures_ = 0;
+    std::minstd_rand random_{std::random_device{}()};
+    std::string header_;
+    bool chunked_ = false;
+    int chunk_state_ = chunk_size;
+    std::string chunk_line_;
+    uint64_t chunk_left_ = 0;
+    bool gzip_ = false;
+    std::unique_ptr<z_stream> z_;
+    sse_parser parser_;
+    pipeline::feeder *feeder_ = nullptr;
+};
+
+} // namespace
+
+void sse_loop(const std::vector<sse_target> &targets, const sse_options &opt, pipeline &p,
+    const std::atomic<bool> &running, sse_stats &stats)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        throw std::runtime_error(std::string("epoll_create1: ") + strerror(errno));
+    }
+    std::vector<std::unique_ptr<connection>> conns;
+    for (const auto &t : targets) {
+        conns.push_back(std::make_unique<connection>(t, opt, stats, epoll_fd, uint32_t(conns.size())));
+    }
+    pipeline::feeder feeder(p);
+    std::vector<char> buf(recv_size);
+    struct epoll_event events[64];
+    while (running) {
+        auto now = clock::now();
+        auto next = now + std::chrono::milliseconds(200); // check running at least this often
+        for (auto &c : conns) {
+            if ((c->get_state() == connection::state::waiting) && (c->retry_at() <= now)) {
+                c->start(now);
+            }
+            c->check_timeout(now);
+            if (c->get_state() == connection::state::waiting) {
+                next = std::min(next, c->retry_at());
+            }
+        }
+        int timeout = int(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count()));
+        int n = epoll_wait(epoll_fd, events, 64, timeout);
+        now = clock::now();
+        for (int i = 0; i < n; i++) {
+            connection &c = *conns[events[i].data.u32];
+            if (c.get_state() == connection::state::connecting) {
+                c.on_writable(now);
+            } else if (c.get_state() != connection::state::waiting) {
+                c.on_readable(now, feeder, buf.data());
+            }
+        }
+        feeder.flush();
+    }
+    for (auto &c : conns) {
+        c->stop();
+    }
+    close(epoll_fd);
+}
+
+} // namespace netlog
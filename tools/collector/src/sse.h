@@ -0,0 +1,92 @@
+/*
+    Server-Sent Events client for the devices' SSE servers (sse_server.c). One thread keeps the connections
+    to all devices, parses their event streams and feeds the lines to the pipeline, like a receiving thread.
+*/
+#pragma once
+
+#include "pipeline.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace netlog {
+
+struct sse_event {
+    std::string_view type;  // "message" if the event has no event field
+    std::string_view data;  // the data lines, joined with '\n'
+    std::string_view id;    // the last event ID
+};
+
+/**
+ * @brief Incremental event stream parser, as in the HTML spec. Takes the stream in pieces of any size.
+ *        Memory is bounded: longer lines and events are cut at max_line and max_data bytes.
+ */
+class sse_parser {
+public:
+    explicit sse_parser(size_t max_line = 16 * 1024, size_t max_data = 64 * 1024);
+
+    void feed(const char *data, size_t len, const std::function<void(const sse_event &)> &on_event);
+    /**
+     * @brief For a new connection: drops a partly received event, keeps the last event ID and retry time
+     */
+    void reset();
+    const std::string &last_id() const { return last_id_; }
+    unsigned retry_ms() const { return retry_ms_; }     // 0 if the server didn't set it
+    uint64_t truncated() const { return truncated_; }   // lines that were cut
+
+private:
+    void line(const std::function<void(const sse_event &)> &on_event);
+
+    size_t max_line_;
+    size_t max_data_;
+    std::string line_;
+    bool line_cut_ = false;
+    bool after_cr_ = false;
+    bool started_ = false;   // the byte order mark was checked
+    std::string type_;
+    std::string data_;
+    std::string id_;         // set by this event
+    std::string last_id_;
+    unsigned retry_ms_ = 0;
+    uint64_t truncated_ = 0;
+};
+
+struct sse_target {
+    std::string host;
+    uint16_t port = 8080;
+    std::string path = "/log-events";
+};
+
+/**
+ * @brief "host", "host:port", "host:port/path" or the same as an http:// URL. Throws std::runtime_error.
+ */
+sse_target parse_sse_target(const std::string &s);
+
+struct sse_options {
+    bool gzip = true;               // ask for a compressed stream, devices with sse_logging_param_t.gzip send one
+    unsigned timeout_s = 30;        // reconnect when nothing came this long, the devices send keep-alives every 10 s
+    unsigned min_backoff_ms = 1000; // or the server's retry time, if longer
+    unsigned max_backoff_ms = 60000;
+};
+
+struct sse_stats {
+    std::atomic<uint64_t> connected{0};   // connections now
+    std::atomic<uint64_t> connects{0};
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> bytes{0};       // as received, compressed or not
+    std::atomic<uint64_t> truncated{0};
+};
+
+/**
+ * @brief Keep connected to the targets and feed their log lines to the pipeline until running is false.
+ *        Failed connections are retried with exponential backoff, resuming after the last event ID.
+ */
+void sse_loop(const std::vector<sse_target> &targets, const sse_options &opt, pipeline &p,
+    const std::atomic<bool> &running, sse_stats &stats);
+
+} // namespace netlog
@@ -0,0 +1,319 @@
+#include "store.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace netlog {
+
+static const char seg_magic[8] = {'N', 'L', 'S', 'E', 'G', '0', '0', '1'};
+static const char idx_magic[8] = {'N', 'L', 'I', 'D', 'X', '0', '0', '1'};
+
+bool parse_esp_log(std::string_view line, char &level, std::string_view &tag)
+{
+    level = 0;
+    tag = {};
+    // "E (" ... ") " tag ": "
+    if ((line.size() < 7) || !strchr("EWIDV", line[0]) || (line[1] != ' ') || (line[2] != '(')) {
+        return false;
+    }
+    size_t close = line.find(") ", 3);
+    if (close == std::string_view::npos) {
+        return false;
+    }
+    size_t colon = line.find(": ", close + 2);
+    if (colon == std::string_view::npos) {
+        return false;
+    }
+    level = line[0];
+    tag = line.substr(close + 2, colon - close - 2);
+    return true;
+}
+
+uint8_t level_mask(char level)
+{
+    switch (level) {
+    case 'E': return level_error;
+    case 'W': return level_warn;
+    case 'I': return level_info;
+    case 'D': return level_debug;
+    case 'V': return level_verbose;
+    default: return level_other;
+    }
+}
+
+uint64_t tag_bloom(std::string_view tag)
+{
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    for (char c : tag) {
+        h = (h ^ uint8_t(c)) * 1099511628211ULL;
+    }
+    return (1ULL << (h & 63)) | (1ULL << ((h >> 6) & 63));
+}
+
+static void put_varint(std::string &out, uint64_t v)
+{
+    while (v >= 0x80) {
+        out.push_back(char(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(char(v));
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+    const char *p = static_cast<const char *>(data);
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief The .seg and .idx files of one worker thread, in the current partition
+ */
+class segment_file {
+public:
+    segment_file(std::string dir, unsigned worker, unsigned partition_s)
+        : dir_(std::move(dir)), worker_(worker), partition_s_(partition_s)
+    {
+    }
+
+    ~segment_file()
+    {
+        close_files();
+    }
+
+    int64_t partition_of(int64_t time_ms) const
+    {
+        int64_t s = time_ms / 1000;
+        return s - (((s % partition_s_) + partition_s_) % partition_s_);
+    }
+
+    void write_block(const std::string &device, index_entry entry, const std::string &raw)
+    {
+        int64_t partition = partition_of(entry.t_min);
+        if ((partition != partition_) && !open_files(partition)) {
+            return;
+        }
+        uLongf csize = compressBound(raw.size());
+        zbuf_.resize(csize);
+        if (Z_OK != compress2(zbuf_.data(), &csize, reinterpret_cast<const Bytef *>(raw.data()), raw.size(), Z_DEFAULT_COMPRESSION)) {
+            fprintf(stderr, "compress2 failed\n");
+            return;
+        }
+        entry.offset = seg_size_;
+        entry.csize = uint32_t(csize);
+        entry.usize = uint32_t(raw.size());
+        entry.device_len = uint8_t(std::min<size_t>(device.size(), 255));
+        // The block first, so an index entry never points past the end of the segment
+        if (!write_all(seg_fd_, zbuf_.data(), csize)) {
+            fprintf(stderr, "write %s: %s\n", seg_path_.c_str(), strerror(errno));
+            return;
+        }
+        seg_size_ += csize;
+        std::string rec(reinterpret_cast<const char *>(&entry), sizeof(entry));
+        rec.append(device, 0, entry.device_len);
+        if (!write_all(idx_fd_, rec.data(), rec.size())) {
+            fprintf(stderr, "write %s.idx: %s\n", seg_path_.c_str(), strerror(errno));
+        }
+    }
+
+private:
+    bool open_files(int64_t partition)
+    {
+        close_files();
+        time_t t = partition;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        char name[32];
+        strftime(name, sizeof(name), "%Y-%m-%dT%H:%M", &tm);
+        std::string pdir = dir_ + "/" + name;
+        if ((0 != mkdir(pdir.c_str(), 0755)) && (errno != EEXIST)) {
+            fprintf(stderr, "mkdir %s: %s\n", pdir.c_str(), strerror(errno));
+            return false;
+        }
+        std::string base = pdir + "/w" + std::to_string(worker_);
+        seg_path_ = base + ".seg";
+        seg_fd_ = open_with_magic(seg_path_, seg_magic, seg_size_);
+        uint64_t idx_size;
+        idx_fd_ = open_with_magic(base + ".idx", idx_magic, idx_size);
+        if ((seg_fd_ < 0) || (idx_fd_ < 0)) {
+            close_files();
+            return false;
+        }
+        partition_ = partition;
+        return true;
+    }
+
+    static int open_with_magic(const std::string &path, const char (&magic)[8], uint64_t &size)
+    {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "open %s: %s\n", path.c_str(), strerror(errno));
+            return -1;
+        }
+        struct stat st;
+        size = (0 == fstat(fd, &st)) ? st.st_size : 0;
+        if (size == 0) {
+            write_all(fd, magic, sizeof(magic));
+            size = sizeof(magic);
+        }
+        return fd;
+    }
+
+    void close_files()
+    {
+        if (seg_fd_ >= 0) {
+            close(seg_fd_);
+        }
+        if (idx_fd_ >= 0) {
+            close(idx_fd_);
+        }
+        seg_fd_ = idx_fd_ = -1;
+        partition_ = INT64_MIN;
+    }
+
+    std::string dir_;
+    unsigned worker_;
+    int64_t partition_s_;
+    int64_t partition_ = INT64_MIN;
+    std::string seg_path_;
+    int seg_fd_ = -1;
+    int idx_fd_ = -1;
+    uint64_t seg_size_ = 0;
+    std::vector<Bytef> zbuf_;
+};
+
+namespace {
+
+class store_writer : public device_writer {
+public:
+    store_writer(std::shared_ptr<segment_file> file, std::string device, const segment_store_sink::options &opt)
+        : file_(std::move(file)), device_(std::move(device)), opt_(opt)
+    {
+        block_.reserve(opt_.block_size + 1024);
+    }
+
+    ~store_writer() override
+    {
+        write_block();
+    }
+
+    void write(int64_t time_ms, std::string_view line) override
+    {
+        if (!block_.empty() && (file_->partition_of(time_ms) != file_->partition_of(entry_.t_min))) {
+            write_block(); // a block belongs to one partition
+        }
+        if (block_.empty()) {
+            entry_ = index_entry{};
+            entry_.t_min = entry_.t_max = last_ms_ = time_ms;
+            block_.append(reinterpret_cast<const char *>(&time_ms), sizeof(time_ms));
+            started_ = std::chrono::steady_clock::now();
+        }
+        char level;
+        std::string_view tag;
+        parse_esp_log(line, level, tag);
+        int64_t delta = time_ms - last_ms_;
+        put_varint(block_, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63)); // zigzag
+        block_.push_back(level);
+        put_varint(block_, line.size());
+        block_.append(line);
+        last_ms_ = time_ms;
+        entry_.t_min = std::min(entry_.t_min, time_ms);
+        entry_.t_max = std::max(entry_.t_max, time_ms);
+        entry_.count++;
+        entry_.levels |= level_mask(level);
+        if (!tag.empty()) {
+            entry_.tag_bloom |= tag_bloom(tag);
+        }
+        if (block_.size() >= opt_.block_size) {
+            write_block();
+        }
+    }
+
+    void flush() override
+    {
+        // Called every second: a block is kept open for a while, so blocks don't get small while it's quiet
+        if (!block_.empty() && (std::chrono::steady_clock::now() - started_ >= std::chrono::seconds(opt_.max_block_age_s))) {
+            write_block();
+        }
+    }
+
+private:
+    void write_block()
+    {
+        if (block_.empty()) {
+            return;
+        }
+        file_->write_block(device_, entry_, block_);
+        block_.clear();
+    }
+
+    std::shared_ptr<segment_file> file_;
+    std::string device_;
+    segment_store_sink::options opt_;
+    std::string block_;
+    index_entry entry_{};
+    int64_t last_ms_ = 0;
+    std::chrono::steady_clock::time_point started_;
+};
+
+} // namespace
+
+segment_store_sink::segment_store_sink(std::string dir, const options &opt)
+    : dir_(std::move(dir)), opt_(opt)
+{
+    if (opt_.partition_s == 0) {
+        opt_.partition_s = 3600;
+    }
+    if ((0 != mkdir(dir_.c_str(), 0755)) && (errno != EEXIST)) {
+        throw std::runtime_error("mkdir " + dir_ + ": " + strerror(errno));
+    }
+    // Queries need the partition length, a store keeps the one it was created with
+    std::string path = dir_ + "/partition";
+    FILE *f = fopen(path.c_str(), "r");
+    if (f) {
+        unsigned existing;
+        if (1 == fscanf(f, "%u", &existing) && (existing > 0)) {
+            opt_.partition_s = existing;
+        }
+        fclose(f);
+    } else if ((f = fopen(path.c_str(), "w"))) {
+        fprintf(f, "%u\n", opt_.partition_s);
+        fclose(f);
+    }
+}
+
+segment_store_sink::~segment_store_sink() = default;
+
+std::unique_ptr<device_writer> segment_store_sink::open(const std::string &device)
+{
+    std::shared_ptr<segment_file> file;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &f = files_[std::this_thread::get_id()];
+        if (!f) {
+            f = std::make_shared<segment_file>(dir_, unsigned(files_.size() - 1), opt_.partition_s);
+        }
+        file = f;
+    }
+    return std::make_unique<store_writer>(std::move(file), device, opt_);
+}
+
+} // namespace netlog
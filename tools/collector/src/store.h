@@ -0,0 +1,117 @@
+/*
+    Indexed log store: time-partitioned segment files of compressed blocks, each with a sidecar index.
+
+        <dir>/partition                      partition length in seconds, as text
+        <dir>/<YYYY-MM-DDTHH:MM>/w<N>.seg    "NLSEG001", then zlib-compressed blocks
+        <dir>/<YYYY-MM-DDTHH:MM>/w<N>.idx    "NLIDX001", then one index_entry and the device name per block
+
+    The partition directories are named by their start in UTC. Each worker thread writes its own pair of files.
+    A block holds up to block_size bytes of lines of one device. A query reads only the index and then
+    the blocks whose device, levels, tags and time range can match.
+    A block starts with the time of its first line, as an int64 in ms since the epoch. Each line follows as
+    the time since the line before (zigzag varint), the level character, the length (varint) and the line.
+    Numbers in the files are little-endian.
+*/
+#pragma once
+
+#include "output.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace netlog {
+
+enum level_bit : uint8_t {
+    level_error = 1 << 0,
+    level_warn = 1 << 1,
+    level_info = 1 << 2,
+    level_debug = 1 << 3,
+    level_verbose = 1 << 4,
+    level_other = 1 << 5,   // not an esp_log line
+};
+
+/**
+ * @brief The level and tag of an esp_log line, "E (1234) tag: message" or "E (12:34:56.789) tag: message".
+ * @return false if it isn't one, level is then 0 and tag empty
+ */
+bool parse_esp_log(std::string_view line, char &level, std::string_view &tag);
+
+/**
+ * @brief level_bit of a level character from parse_esp_log()
+ */
+uint8_t level_mask(char level);
+
+/**
+ * @brief The two bits that stand for tag in index_entry::tag_bloom
+ */
+uint64_t tag_bloom(std::string_view tag);
+
+#pragma pack(push, 1)
+struct index_entry {
+    uint64_t offset;        // of the block in the .seg file
+    uint32_t csize;         // compressed
+    uint32_t usize;
+    int64_t t_min;          // ms since the epoch
+    int64_t t_max;
+    uint32_t count;         // lines
+    uint8_t levels;         // level_bit of all lines
+    uint8_t device_len;     // the device name follows the entry
+    uint16_t reserved;
+    uint64_t tag_bloom;     // tag_bloom() of all tags
+};
+#pragma pack(pop)
+
+class segment_file;
+
+/**
+ * @brief Writes all devices into the store at dir.
+ */
+class segment_store_sink : public sink {
+public:
+    struct options {
+        unsigned partition_s = 3600;
+        size_t block_size = 64 * 1024;  // uncompressed
+        unsigned max_block_age_s = 10;  // a block is written at the latest this long after its first line
+    };
+
+    segment_store_sink(std::string dir, const options &opt);
+    ~segment_store_sink() override;
+    std::unique_ptr<device_writer> open(const std::string &device) override;
+
+private:
+    std::string dir_;
+    options opt_;
+    std::mutex mutex_;
+    std::map<std::thread::id, std::shared_ptr<segment_file>> files_; // one per worker thread
+};
+
+struct query_options {
+    std::string dir;
+    std::vector<std::string> devices;   // empty for all
+    uint8_t levels = 0xFF;              // level_bit mask
+    std::vector<std::string> tags;      // empty for all
+    int64_t from_ms = INT64_MIN;
+    int64_t to_ms = INT64_MAX;
+    std::string grep;                   // regular expression, empty for all
+    bool stats = false;
+};
+
+/**
+ * @brief Print the matching lines in time order. Throws std::runtime_error.
+ */
+void run_query(const query_options &opt);
+
+/**
+ * @brief "2024-01-31 12:34[:56]", "2024-01-31T12:34:56" or "2024-01-31" in local time, seconds since the epoch,
+ *        or relative to now: "-90s", "-15m", "-2h", "-7d". Throws std::runtime_error.
+ * @return ms since the epoch
+ */
+int64_t parse_time(const std::string &s);
+
+} // namespace netlog
@@ -1,25 +1,22 @@
 #!/usr/bin/env python
 
 import gzip
+import hashlib
+import mimetypes
 import os
 from argparse import ArgumentParser
 from collections import OrderedDict
 from fnmatch import fnmatch
 
-def compress_file(file_path, outdir = '.'):
-    """
-    Compress a file using gzip and print the compression stats.
-    """
-    # Read the file
-    with open(file_path, 'rb') as f:
-        data = f.read()
+CONTENT_TYPES = {
+    '.html': 'text/html; charset=utf-8',
+    '.js': 'text/javascript; charset=utf-8',
+    '.css': 'text/css; charset=utf-8',
+    '.svg': 'image/svg+xml',
+    '.json': 'application/json',
+}
 
-    initial_len = len(data)
-
-    # Compress the file
-    gzip_level = 9
-    data = gzip.compress(data, gzip_level)
-    data_len = len(data)
+def print_stats(file_path, initial_len, data_len):
 
     if initial_len < 1024:
         initial_len_str = '%d B' % (initial_len)
@@ -38,6 +35,22 @@ def compress_file(file_path, outdir = '.'):
     stats = '%-9s -> %-9s (%.1f%%)' % (initial_len_str, data_len_str, percent)
     print('%-34s file %s' % (file_path, stats))
 
+def compress_file(file_path, outdir = '.'):
+    """
+    Compress a file using gzip and print the compression stats.
+    """
+    # Read the file
+    with open(file_path, 'rb') as f:
+        data = f.read()
+
+    initial_len = len(data)
+
+    # Compress the file. Without a time stamp, the same input gives the same output.
+    gzip_level = 9
+    data = gzip.compress(data, gzip_level, mtime=0)
+    data_len = len(data)
+    print_stats(file_path, initial_len, data_len)
+
     # Write the compressed data to a new file in the target directory
     if not os.path.exists(outdir):
         os.makedirs(outdir)
@@ -50,6 +63,44 @@ def compress_file(file_path, outdir = '.'):
     with open(file_path + '.gz', 'wb') as f:
         f.write(data)
 
+def write_table(files, table_path):
+    """
+    Write a C source file with the files as an asset table for the built-in HTTP SSE server:
+    the URL path, content type, ETag and the content of each file, gzip-compressed if that makes it smaller.
+    The ETag is a hash of the content, so browsers can keep the files until the firmware brings new ones.
+    """
+    entries = []
+    arrays = []
+    for i, file_path in enumerate(files):
+        with open(file_path, 'rb') as f:
+            data = f.read()
+        etag = '"%s"' % hashlib.sha256(data).hexdigest()[:16]
+        compressed = gzip.compress(data, 9, mtime=0)
+        is_gzip = len(compressed) < len(data)
+        if is_gzip:
+            print_stats(file_path, len(data), len(compressed))
+            data = compressed
+        name = os.path.basename(file_path)
+        ext = os.path.splitext(name)[1].lower()
+        content_type = CONTENT_TYPES.get(ext) or mimetypes.guess_type(name)[0] or 'application/octet-stream'
+        rows = ['    ' + ', '.join('0x%02x' % b for b in data[j:j + 16]) + ',' for j in range(0, len(data), 16)]
+        arrays.append('static const uint8_t asset_%d[] = {\n%s\n};\n' % (i, '\n'.join(rows)))
+        entries.append('    { "/%s", "%s", "%s", asset_%d, sizeof(asset_%d), %s },' %
+            (name, content_type, etag.replace('"', '\\"'), i, i, 'true' if is_gzip else 'false'))
+
+    out_dir = os.path.dirname(table_path)
+    if out_dir and not os.path.exists(out_dir):
+        os.makedirs(out_dir)
+    with open(table_path, 'w') as f:
+        f.write('// Generated by tools/compress_assets.py, do not edit\n')
+        f.write('#include <stdbool.h>\n#include <stddef.h>\n#include <stdint.h>\n\n')
+        f.write('// Same as in sse_server.c\n')
+        f.write('struct netlogging_asset_s {\n    const char *path;\n    const char *content_type;\n'
+            '    const char *etag;\n    const uint8_t *data;\n    size_t size;\n    bool gzip;\n};\n\n')
+        f.write('\n'.join(arrays))
+        f.write('\nconst struct netlogging_asset_s netlogging_assets[] = {\n%s\n};\n' % '\n'.join(entries))
+        f.write('const size_t netlogging_assets_count = %d;\n' % len(entries))
+
 
 
 if __name__ == '__main__':
@@ -57,6 +108,7 @@ if __name__ == '__main__':
     parser.add_argument('files', nargs='+', help='File(s) to compress')
     parser.add_argument('-o', '--outdir', default='.', help='Directory to save compressed files')
     parser.add_argument('-e', '--exclude', action='append', help='Exclude files matching the pattern')
+    parser.add_argument('-t', '--table', help='Write a C asset table with all files to this file, instead of .gz files')
     args = parser.parse_args()
 
     # Exclude files matching the patterns
@@ -64,6 +116,9 @@ if __name__ == '__main__':
         exclude_patterns = args.exclude
         args.files = [f for f in args.files if not any(fnmatch(f, pattern) for pattern in exclude_patterns)]
 
-    # Compress each file
-    for file_path in args.files:
-        compress_file(file_path, args.outdir)
+    if args.table:
+        write_table(args.files, args.table)
+    else:
+        # Compress each file
+        for file_path in args.files:
+            compress_file(file_path, args.outdir)